@@ -79,6 +79,9 @@ workspace "Palette Tool"
       buildoptions {"--std=gnu99"}
 
       fatalwarnings {"shadow", "return-type", "implicit-function-declaration"}
+
+    filter "system:linux"
+      links {"pthread"}
       
     -- features: off by default, turn them on and regenerate
     -- if you need them
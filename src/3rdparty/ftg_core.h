@@ -72,6 +72,7 @@
 
 
    Version history
+   1.1              per-thread ftg_va buffer
    1.0              include compatible with -nostdint
    0.9              static array macros
    0.8              ftg_strto* wrappers
@@ -946,6 +947,8 @@ ftg_strsplit(const char *str, char split_ch, size_t index, size_t *out_len);
 FTGDEF void
 ftg_bzero(void *ptr, size_t num);
 
+/* format into a buffer that is reused by the calling thread's next
+   ftg_va call */
 FTGDEF char *
 ftg_va(const char *fmt, ...);
 
@@ -1439,10 +1442,16 @@ ftg_realloc(void *ptr, size_t size, size_t num)
     return alloc_ptr;
 }
 
+#if defined(_MSC_VER)
+#  define FTG__THREAD_LOCAL __declspec(thread)
+#else
+#  define FTG__THREAD_LOCAL __thread
+#endif
+
 char *
 ftg_va(const char *fmt, ...)
 {
-    static char buf[FTG_STRLEN_LONG];
+    static FTG__THREAD_LOCAL char buf[FTG_STRLEN_LONG];
     int len;
 
     va_list ap;
@@ -57,6 +57,22 @@
                      Breaking: Hex floats 
                      Breaking: Hints contain colors
                      Old:      Colors contained hints
+   0.4  (Oct 2026)   Key-extraction gradient sorting, color feature tables
+                     SIMD batch CIELAB conversion
+                     Table-driven batch transfer functions
+                     Streaming sink-based writers, table-driven emit formatting
+                     Compact and NDJSON output layouts
+                     Parallel multi-palette json emit
+                     Memory-mappable .palb binary palettes
+                     Deduplicating .pala palette archives
+                     Compact, contents-sized pal_compact_palette_t
+                     Interned name pools for compact palettes
+                     Structure-of-arrays color kernels
+                     Breaking: Palettes own growable storage, up to
+                               65535 colors. Use pal_reserve(), pal_free()
+                               pal_init() no longer keeps storage, see
+                               pal_clear()
+                     SIMD 64-bit incremental color hash
    LICENSE
 
    This software is in the public domain. Where that dedication is not
@@ -107,7 +123,8 @@
 extern "C"
 #endif
 
-#define PAL_MAX_COLORS 256
+// palettes grow to hold up to PAL_MAX_COLORS colors, see pal_reserve()
+#define PAL_MAX_COLORS 65535
 #define PAL_MAX_GRADIENT_INDICES (PAL_MAX_COLORS * 2)
 #define PAL_MAX_STRLEN 48
 typedef enum {
@@ -151,12 +168,13 @@ typedef enum {
 
 #define PAL_MAX_HINTS HINT_MAX
 #define PAL_MAX_GRADIENTS 32
-#define PAL_MAX_DITHER_PAIRS (PAL_MAX_COLORS * 2)
+#define PAL_MAX_DITHER_PAIRS 65535  // num_dither_pairs is 16-bit
 
     typedef char       pal_str_t[PAL_MAX_STRLEN];
 typedef unsigned char  pal_u8_t;
 typedef unsigned short pal_u16_t;
 typedef unsigned int   pal_u32_t;
+typedef unsigned long long pal_u64_t;
 
 typedef struct {
     float r;
@@ -181,9 +199,12 @@ typedef struct {
 
 typedef float (*pal_color_compare_func_t)(pal_color_t col0, pal_color_t col1, void* datum);
 
+// returns a scalar sort key for a single color
+typedef float (*pal_color_key_func_t)(pal_color_t col, void* datum);
+
 typedef struct {
-    int       num_indices;
-    pal_u16_t indices[PAL_MAX_GRADIENT_INDICES];
+    int        num_indices;
+    pal_u16_t* indices;  // [capacity * 2], in the palette's storage
 } pal_gradient_t;
 
 typedef struct {
@@ -197,33 +218,242 @@ typedef struct {
     int       is_linear;
 } pal_color_space_t;
 
+// The per-color arrays live in one block of storage from PAL_REALLOC,
+// sized by capacity: capacity colors and names, capacity entries per
+// hint, capacity * 2 indices per gradient and capacity * 2 dither pairs
+// (at most PAL_MAX_DITHER_PAIRS).  pal_reserve() grows it, keeping the
+// contents, and the parsers grow it as they go.  Start with pal_init()
+// or zero-initialize, then release with pal_free().
+//
+// Copying the struct copies the pointers, not the storage: the copy and
+// the original then share one block, growing either leaves the other
+// pointing at freed memory, and freeing both frees the block twice.
+// Copy a palette by reserving the destination and copying the arrays.
 typedef struct pal_palette_s {
     pal_str_t    title;
     pal_source_t source;
 
     pal_color_space_t color_space;
 
-    pal_u16_t   num_colors;
-    pal_str_t   color_names[PAL_MAX_COLORS];
-    pal_color_t colors[PAL_MAX_COLORS];
+    void*     storage;
+    pal_u32_t capacity;  // colors the storage holds
 
-    pal_u16_t num_hints[PAL_MAX_HINTS];
-    pal_u16_t hint_colors[PAL_MAX_HINTS][PAL_MAX_COLORS];
+    pal_u16_t    num_colors;
+    pal_str_t*   color_names;  // [capacity]
+    pal_color_t* colors;       // [capacity]
+
+    pal_u16_t  num_hints[PAL_MAX_HINTS];
+    pal_u16_t* hint_colors[PAL_MAX_HINTS];  // [capacity] each
 
     pal_u16_t      num_gradients;
     pal_str_t      gradient_names[PAL_MAX_GRADIENTS];
     pal_gradient_t gradients[PAL_MAX_GRADIENTS];
 
-    pal_u16_t         num_dither_pairs;
-    pal_str_t         dither_pair_names[PAL_MAX_DITHER_PAIRS];
-    pal_dither_pair_t dither_pairs[PAL_MAX_DITHER_PAIRS];
+    pal_u16_t          num_dither_pairs;
+    pal_str_t*         dither_pair_names;  // [capacity * 2]
+    pal_dither_pair_t* dither_pairs;       // [capacity * 2]
 } pal_palette_t;
 
+// Interned strings, each stored once and named by a 32-bit id, so two
+// interned names are equal exactly when their ids are.  Strings are
+// truncated to PAL_MAX_STRLEN-1 characters on the way in, as pal_str_t
+// truncates them.  Id 0 is always the empty string.  One pool can be
+// shared by every palette in a document.  Zero-initialize or call
+// pal_string_pool_init().
+typedef struct {
+    char*      chars;  // every string back to back, null terminated
+    pal_u32_t  chars_len;
+    pal_u32_t  chars_capacity;
+    pal_u32_t* offsets;  // [num_strings], offset of each id's string in chars
+    pal_u32_t  num_strings;
+    pal_u32_t  strings_capacity;
+    pal_u32_t* slots;      // open addressing hash of ids, 0 is empty
+    pal_u32_t  num_slots;  // power of two, kept at most half full
+} pal_string_pool_t;
+
+#define PAL_STRING_ID_EMPTY 0
+
+typedef struct {
+    pal_u32_t first;
+    pal_u32_t count;
+} pal_compact_span_t;
+
+// A pal_palette_t with its arrays sized to their contents, in a single
+// block of memory.  The arrays follow this struct in the same block and
+// the pointers point into it, so the block can be freed in one go but
+// not moved with memcpy.  Hints and gradients are spans of indices.
+//
+// Packed against a pal_string_pool_t, the names are ids into the pool
+// rather than inline strings: pool is set, the *_name_ids arrays are
+// used and the pal_str_t name arrays are NULL.  Otherwise it is the
+// other way around.  The title is always inline.
+typedef struct {
+    pal_u32_t size;  // bytes in the block, this struct included
+
+    pal_str_t         title;
+    pal_source_t      source;
+    pal_color_space_t color_space;
+
+    pal_u16_t num_colors;
+    pal_u16_t num_gradients;
+    pal_u16_t num_dither_pairs;
+    pal_u32_t num_indices;
+
+    pal_compact_span_t hints[PAL_MAX_HINTS];
+
+    const pal_string_pool_t* pool;  // names are interned here, or NULL
+
+    pal_color_t*        colors;                // [num_colors]
+    pal_str_t*          color_names;           // [num_colors]
+    pal_u32_t*          color_name_ids;        // [num_colors]
+    pal_str_t*          gradient_names;        // [num_gradients]
+    pal_u32_t*          gradient_name_ids;     // [num_gradients]
+    pal_compact_span_t* gradients;             // [num_gradients]
+    pal_str_t*          dither_pair_names;     // [num_dither_pairs]
+    pal_u32_t*          dither_pair_name_ids;  // [num_dither_pairs]
+    pal_dither_pair_t*  dither_pairs;          // [num_dither_pairs]
+    pal_u16_t*          indices;               // [num_indices], color indices
+} pal_compact_palette_t;
+
+// builtin gradient sorts
+typedef enum {
+    PAL_SORT_RED,
+    PAL_SORT_GREEN,
+    PAL_SORT_BLUE,
+    PAL_SORT_HUE,
+    PAL_SORT_SATURATION,
+    PAL_SORT_VALUE,
+    PAL_SORT_LIGHTNESS,
+    PAL_SORT_REDNESS,
+    PAL_SORT_YELLOWNESS,
+    PAL_SORT_GREENNESS,
+    PAL_SORT_CYANNESS,
+    PAL_SORT_BLUENESS,
+    PAL_SORT_MAGENTANESS,
+    PAL_SORT_MAX,  // always last
+} pal_sort_kind_t;
+
+// pure sRGB primaries and secondaries that the hue proximity sorts
+// measure distance to
+typedef enum {
+    PAL_PRIMARY_RED,
+    PAL_PRIMARY_YELLOW,
+    PAL_PRIMARY_GREEN,
+    PAL_PRIMARY_CYAN,
+    PAL_PRIMARY_BLUE,
+    PAL_PRIMARY_MAGENTA,
+    PAL_PRIMARY_MAX,  // always last
+} pal_primary_t;
+
+// every per-color value the builtin sorts are derived from, computed
+// once per palette and stored as structure-of-arrays.  The arrays share
+// one block from PAL_REALLOC, which is reused as long as it is big
+// enough.  Zero-initialize, then release with pal_color_features_free().
+typedef struct {
+    int num_colors;
+    int capacity;  // colors the block holds
+
+    float* r;
+    float* g;
+    float* b;
+
+    // HSV.  hue is in degrees, or 720 for achromatic colors
+    float* hue;
+    float* saturation;
+    float* value;
+
+    // HSL lightness
+    float* lightness;
+
+    // CIELAB (D65), treating the channels as sRGB
+    float* lab_l;
+    float* lab_a;
+    float* lab_b;
+
+    // squared CIELAB distance to each pal_primary_t
+    float* primary_dist_sq[PAL_PRIMARY_MAX];
+
+    void* block;
+} pal_color_features_t;
+
+#define PAL_SOA_LANES 8   // floats per avx2 register
+#define PAL_SOA_ALIGN 32  // bytes
+
+// one array per channel, see pal_color_soa_create()
+typedef struct {
+    int    num_colors;
+    int    num_padded;  // num_colors rounded up to PAL_SOA_LANES
+    float* r;
+    float* g;
+    float* b;
+    float* a;
+    void*  block;  // the allocation behind all four arrays
+} pal_color_soa_t;
+
 // API declaration starts here
 
-// zero-initialize a palette (optional)
+// initialize pal as an empty palette with no storage.  anything pal
+// held before is not freed.
 void pal_init(pal_palette_t* pal);
 
+// empty a palette, keeping its storage for reuse.  pal must have been
+// initialized.
+void pal_clear(pal_palette_t* pal);
+
+// grow pal's storage to hold at least num_colors colors, keeping its
+// contents.  new storage is zeroed.  returns 0 on success, 1 if
+// num_colors is over PAL_MAX_COLORS or out of memory, leaving pal as
+// it was.
+int pal_reserve(pal_palette_t* pal, int num_colors);
+
+// release pal's storage and empty it
+void pal_free(pal_palette_t* pal);
+
+// string pools allocate with PAL_REALLOC as they grow
+void pal_string_pool_init(pal_string_pool_t* pool);
+void pal_string_pool_free(pal_string_pool_t* pool);
+
+// set *out_id to str's id, adding str if it is new.  returns 0 on
+// success, 1 if out of memory or the pool would pass 4GB.
+int pal_string_pool_intern(pal_string_pool_t* pool, const char* str, pal_u32_t* out_id);
+
+// set *out_id to str's id without adding it.  returns 0 on success, 1
+// if str was never interned.
+int pal_string_pool_find(const pal_string_pool_t* pool, const char* str, pal_u32_t* out_id);
+
+// the string for id, which must come from this pool
+const char* pal_string_pool_get(const pal_string_pool_t* pool, pal_u32_t id);
+
+// bytes needed to hold pal as a pal_compact_palette_t, a multiple of 8.
+// pool is only tested for NULL here, and must match the pack call.
+pal_u32_t pal_compact_palette_size(const pal_palette_t* pal, const pal_string_pool_t* pool);
+
+// pack pal into mem, which must be 8-byte aligned and at least
+// pal_compact_palette_size(pal, pool) bytes.  many compact palettes can
+// be packed back to back into one allocation this way.  if pool is not
+// NULL the names are interned into it, and it must outlive the compact
+// palette.  returns NULL if mem is too small or pool runs out of memory.
+pal_compact_palette_t* pal_compact_palette_pack(const pal_palette_t* pal,
+                                                pal_string_pool_t*   pool,
+                                                void*                mem,
+                                                pal_u32_t            mem_len);
+
+// pack pal into a new block from PAL_REALLOC, or NULL if out of memory.
+// free it with pal_compact_palette_free().
+pal_compact_palette_t* pal_compact_palette_create(const pal_palette_t* pal, pal_string_pool_t* pool);
+void                   pal_compact_palette_free(pal_compact_palette_t* compact);
+
+// unpack a compact palette into out_pal, growing it to fit.  returns 0
+// on success, 1 if out of memory.
+int pal_compact_palette_expand(const pal_compact_palette_t* compact, pal_palette_t* out_pal);
+
+// name of color index, interned or not
+const char* pal_compact_palette_color_name(const pal_compact_palette_t* compact, int index);
+
+// index of the first color named name, or -1.  with a pool this is an
+// integer compare per color.
+int pal_compact_palette_find_color(const pal_compact_palette_t* compact, const char* name);
+
 // Convert a value in range 0-1 to an 8-bit channel between 0x0 and 0xFF
 pal_u8_t pal_convert_channel_to_8bit(float val);
 
@@ -303,8 +533,38 @@ void pal_color_to_hex(const pal_color_t* color, char out_str[9]);
 // provide a 32-bit value that is a hash of all colors in the palette
 // color names, gradients, stipples, etc. do not affect this value
 // color order affects the value
+// channels outside [0,1] are clamped; prefer pal_hash_color_values64
 pal_u32_t pal_hash_color_values(const pal_palette_t* pal);
 
+// 64-bit hash of the raw bits of every color channel, defined for any
+// float value including hdr channels, infinities and nans.  like
+// pal_hash_color_values, only colors and their order affect it.
+//
+// each color contributes an independent term to a running sum, so
+// changing one color only costs removing its old term and adding its
+// new one:
+//
+//   pal_color_hash64_t h;
+//   pal_color_hash64_init(&h, pal->colors, pal->num_colors);
+//   pal_color_hash64_update(&h, 5, &pal->colors[5], &new_color);
+//   pal->colors[5] = new_color;
+//   pal_color_hash64_value(&h) == pal_hash_color_values64(pal)
+typedef struct {
+    pal_u64_t sum;  // of every color's term, before finalizing
+    int       num_colors;
+} pal_color_hash64_t;
+
+PALDEF void      pal_color_hash64_init(pal_color_hash64_t* h,
+                                         const pal_color_t*  colors,
+                                         int                 num_colors);
+PALDEF void      pal_color_hash64_update(pal_color_hash64_t* h,
+                                         int                 index,
+                                         const pal_color_t*  old_color,
+                                         const pal_color_t*  new_color);
+PALDEF pal_u64_t pal_color_hash64_value(const pal_color_hash64_t* h);
+
+PALDEF pal_u64_t pal_hash_color_values64(const pal_palette_t* pal);
+
 // string names for hint enums
 const char* pal_string_for_hint(pal_hint_kind_t hint);
 
@@ -321,6 +581,300 @@ int pal_emit_palette_json(const pal_palette_t* pals, int num_pals, char* out_buf
 // emit a gimp gpl palette file
 int pal_emit_gimp_gpl(const pal_palette_t* pal, char* out_buf, int out_buf_len);
 
+//
+// Writers
+//
+// The pal_write_* emitters stream their output through a pal_writer_t,
+// which collects PAL_WRITER_BUF_LEN bytes at a time and hands each full
+// chunk to a write callback, so memory use stays flat regardless of how
+// much is emitted.  The pal_emit_* functions above are wrappers that
+// write into a caller's fixed buffer.
+//
+#ifndef PAL_WRITER_BUF_LEN
+#    define PAL_WRITER_BUF_LEN 4096
+#endif
+
+// consume num_bytes of output. return nonzero to fail the emit.
+typedef int (*pal_write_func_t)(void* write_data, const char* bytes, int num_bytes);
+
+typedef struct {
+    pal_write_func_t write_func;
+    void*            write_data;
+
+    char buf[PAL_WRITER_BUF_LEN];
+    int  buf_used;
+
+    int       error;          // nonzero once a write has failed; later output is dropped
+    pal_u64_t bytes_written;  // total bytes accepted, whether or not flushed yet
+} pal_writer_t;
+
+PALDEF void pal_writer_init(pal_writer_t* writer, pal_write_func_t write_func, void* write_data);
+
+// hand buffered bytes to the write callback. returns writer->error.
+PALDEF int pal_writer_flush(pal_writer_t* writer);
+
+// builtin write callbacks.  write_data is a FILE*, a pointer to an int
+// file descriptor and a pal_membuf_t* respectively.
+PALDEF int pal_write_to_file(void* write_data, const char* bytes, int num_bytes);
+PALDEF int pal_write_to_fd(void* write_data, const char* bytes, int num_bytes);
+PALDEF int pal_write_to_membuf(void* write_data, const char* bytes, int num_bytes);
+
+// growable memory sink.  zero-initialize, then release with
+// pal_membuf_free().  data is null terminated after every write.
+typedef struct {
+    char*     data;
+    pal_u64_t len;
+    pal_u64_t capacity;
+} pal_membuf_t;
+
+PALDEF void pal_membuf_free(pal_membuf_t* membuf);
+
+// json document layouts
+typedef enum {
+    PAL_JSON_LAYOUT_PRETTY,   // indented, one key per line
+    PAL_JSON_LAYOUT_COMPACT,  // minified; no insignificant whitespace
+    PAL_JSON_LAYOUT_NDJSON,   // one minified palette object per line, no
+                              // enclosing "palettes" document
+} pal_json_layout_t;
+
+// emit to writer, flushing it before returning.  returns 0 on success,
+// 1 if a write failed and 2 if a palette references an invalid color.
+// writer->bytes_written holds the exact output size.
+PALDEF int pal_write_palette_json(pal_writer_t*        writer,
+                                  const pal_palette_t* pals,
+                                  int                  num_pals,
+                                  pal_json_layout_t    layout);
+
+#ifndef PAL_MAX_EMIT_THREADS
+#    define PAL_MAX_EMIT_THREADS 64
+#endif
+
+// as pal_write_palette_json, with each palette's sub-document rendered
+// on one of num_threads threads (0 for one per cpu, up to
+// PAL_MAX_EMIT_THREADS) and the results joined in palette order.  the
+// output is byte-identical to pal_write_palette_json, and so are the
+// return values.  that holds on failure too, where the writer is left
+// holding the same partial document, except when the per-thread
+// buffers can't be allocated: then nothing is written and 1 returned.
+PALDEF int pal_write_palette_json_parallel(pal_writer_t*        writer,
+                                           const pal_palette_t* pals,
+                                           int                  num_pals,
+                                           pal_json_layout_t    layout,
+                                           int                  num_threads);
+PALDEF int pal_write_gimp_gpl(pal_writer_t* writer, const pal_palette_t* pal);
+
+//
+// .palb binary palettes
+//
+// A versioned, little-endian container holding everything in a
+// pal_palette_t, laid out so a file that has been read or mmap'ed into
+// memory is used in place: pal_palb_view() validates the bytes and
+// points into them, with no parsing or copying.
+//
+// The file is a pal_palb_header_t followed by sections at the header's
+// byte offsets, each 16-byte aligned:
+//
+//   strings            pal_str_t[PAL_PALB_STRING_MAX]
+//   colors             pal_color_t[num_colors], raw f32 rgba
+//   color_names        pal_str_t[num_colors]
+//   hint_spans         pal_palb_span_t[num_hint_kinds], into indices
+//   gradient_names     pal_str_t[num_gradients]
+//   gradient_spans     pal_palb_span_t[num_gradients], into indices
+//   dither_pair_names  pal_str_t[num_dither_pairs]
+//   dither_pairs       pal_dither_pair_t[num_dither_pairs]
+//   indices            pal_u16_t[num_indices], color indices
+//
+#define PAL_PALB_MAGIC 0x424c4150u  // "PALB"
+#define PAL_PALB_VERSION 1
+
+// the colors section is empty; the colors are a color block of the
+// .pala archive holding this palette.  never set in a standalone .palb.
+#define PAL_PALB_FLAG_SHARED_COLORS 0x1u
+
+typedef enum {
+    PAL_PALB_STRING_TITLE,
+    PAL_PALB_STRING_URL,
+    PAL_PALB_STRING_CONVERSION_TOOL,
+    PAL_PALB_STRING_COLOR_SPACE_NAME,
+    PAL_PALB_STRING_ICC_FILENAME,
+    PAL_PALB_STRING_MAX,  // always last
+} pal_palb_string_t;
+
+typedef struct {
+    pal_u32_t first;
+    pal_u32_t count;
+} pal_palb_span_t;
+
+typedef struct {
+    pal_u32_t magic;
+    pal_u16_t version;
+    pal_u16_t header_size;
+    pal_u32_t file_size;
+    pal_u32_t flags;  // PAL_PALB_FLAG_*
+
+    pal_u64_t conversion_timestamp;
+    pal_u32_t is_linear;
+
+    pal_u16_t num_colors;
+    pal_u16_t num_gradients;
+    pal_u16_t num_dither_pairs;
+    pal_u16_t num_hint_kinds;  // HINT_MAX when written
+    pal_u32_t num_indices;
+
+    pal_u32_t strings_offset;
+    pal_u32_t colors_offset;
+    pal_u32_t color_names_offset;
+    pal_u32_t hint_spans_offset;
+    pal_u32_t gradient_names_offset;
+    pal_u32_t gradient_spans_offset;
+    pal_u32_t dither_pair_names_offset;
+    pal_u32_t dither_pairs_offset;
+    pal_u32_t indices_offset;
+    pal_u32_t reserved;
+} pal_palb_header_t;
+
+// a validated .palb, pointing into the caller's bytes
+typedef struct {
+    const pal_palb_header_t* header;
+    const pal_str_t*         strings;  // indexed by pal_palb_string_t
+    const pal_color_t*       colors;
+    const pal_str_t*         color_names;
+    const pal_palb_span_t*   hint_spans;
+    const pal_str_t*         gradient_names;
+    const pal_palb_span_t*   gradient_spans;
+    const pal_str_t*         dither_pair_names;
+    const pal_dither_pair_t* dither_pairs;
+    const pal_u16_t*         indices;
+} pal_palb_view_t;
+
+// validate len bytes of .palb and point out_view into them.  bytes must
+// be 8-byte aligned (malloc and mmap both are) and outlive the view.
+// every count, offset, string and color index is checked, so a view
+// that validates can be read without further checks.  returns 0 on
+// success, 1 if the bytes are not a valid .palb, and 2 on a big-endian
+// host, where pal_parse_palb still works.
+PALDEF int pal_palb_view(const void* bytes, pal_u64_t len, pal_palb_view_t* out_view);
+
+// copy a view into a pal_palette_t.  returns 0 on success, 1 if it has
+// more of something than a pal_palette_t holds.
+PALDEF int pal_palb_to_palette(const pal_palb_view_t* view, pal_palette_t* out_pal);
+
+// validate and copy .palb bytes into a pal_palette_t on any host,
+// with no alignment requirement.  returns 0 on success.
+PALDEF int pal_parse_palb(const unsigned char* bytes, unsigned int len, pal_palette_t* out_pal);
+
+// emit pal as .palb.  returns as pal_write_palette_json does.
+PALDEF int pal_write_palb(pal_writer_t* writer, const pal_palette_t* pal);
+
+//
+// .pala palette archives
+//
+// Many palettes in one file, storing each distinct set of colors once.
+// Palettes with byte-identical colors (found by pal_hash_color_values,
+// confirmed by comparing the colors) share one color block, and each
+// palette's metadata is a .palb record with PAL_PALB_FLAG_SHARED_COLORS
+// that refers to it.  A table of contents gives the record for a
+// palette index, and a title hash table finds an index by title, both
+// without touching any other palette.
+//
+// The file is a pal_pala_header_t followed by, each 16-byte aligned:
+//
+//   color_blocks   pal_pala_block_t[num_color_blocks]
+//   entries        pal_pala_entry_t[num_palettes], the table of contents
+//   title_slots    pal_u32_t[num_title_slots], open addressing on the
+//                  title hash, PAL_PALA_EMPTY_SLOT or an entry index
+//   block colors   raw f32 rgba colors at each block's colors_offset
+//   records        .palb records at each entry's record_offset
+//
+// Every field is little-endian.
+//
+#define PAL_PALA_MAGIC 0x414c4150u  // "PALA"
+#define PAL_PALA_VERSION 1
+#define PAL_PALA_EMPTY_SLOT 0xffffffffu
+
+typedef struct {
+    pal_u32_t magic;
+    pal_u16_t version;
+    pal_u16_t header_size;
+    pal_u32_t file_size;
+    pal_u32_t flags;  // reserved, 0
+
+    pal_u32_t num_palettes;
+    pal_u32_t num_color_blocks;
+    pal_u32_t num_title_slots;  // a power of two, or 0 with no palettes
+
+    pal_u32_t color_blocks_offset;
+    pal_u32_t entries_offset;
+    pal_u32_t title_slots_offset;
+    pal_u32_t reserved[2];
+} pal_pala_header_t;
+
+typedef struct {
+    pal_u32_t color_hash;  // pal_hash_color_values()
+    pal_u32_t num_colors;
+    pal_u32_t colors_offset;
+    pal_u32_t reserved;
+} pal_pala_block_t;
+
+typedef struct {
+    pal_str_t title;  // copy of the record's title, for lookup
+    pal_u32_t record_offset;
+    pal_u32_t record_size;
+    pal_u32_t color_block;
+    pal_u32_t reserved;
+} pal_pala_entry_t;
+
+// an opened archive: the decoded header of caller-owned bytes
+typedef struct {
+    const unsigned char* bytes;
+    pal_u32_t            file_size;
+    pal_u32_t            num_palettes;
+    pal_u32_t            num_color_blocks;
+    pal_u32_t            num_title_slots;
+    pal_u32_t            color_blocks_offset;
+    pal_u32_t            entries_offset;
+    pal_u32_t            title_slots_offset;
+} pal_pala_t;
+
+// validate the header and tables of len .pala bytes, which must outlive
+// out_archive.  records are validated as they are loaded, so opening
+// costs one pass over the tables, not the palettes.  returns 0 on
+// success, 1 if the bytes are not a valid .pala.
+PALDEF int pal_pala_open(const unsigned char* bytes, pal_u64_t len, pal_pala_t* out_archive);
+
+// index of the first palette titled title, compared after truncation
+// to PAL_MAX_STRLEN-1 characters, or -1.
+PALDEF int pal_pala_find_title(const pal_pala_t* archive, const char* title);
+
+// copy palette index into out_pal.  returns 0 on success, 1 if the
+// index is out of range or its record is invalid.
+PALDEF int pal_pala_load(const pal_pala_t* archive, pal_u32_t index, pal_palette_t* out_pal);
+
+// emit num_pals palettes as one .pala.  returns as
+// pal_write_palette_json does; 2 also means the archive would be larger
+// than 4GB.
+PALDEF int pal_write_pala(pal_writer_t* writer, const pal_palette_t* pals, int num_pals);
+
+//
+// compact palette emitters
+//
+// The same output as the pal_palette_t emitters, for palettes held as
+// pal_compact_palette_t.  Each palette is expanded into a scratch
+// pal_palette_t from PAL_REALLOC as it is written, one per thread, so
+// these return 1 if that allocation fails.  num_threads is as for
+// pal_write_palette_json_parallel.
+//
+PALDEF int pal_write_compact_palette_json(pal_writer_t*                       writer,
+                                          const pal_compact_palette_t* const* pals,
+                                          int                                 num_pals,
+                                          pal_json_layout_t                   layout,
+                                          int                                 num_threads);
+PALDEF int pal_write_compact_gimp_gpl(pal_writer_t* writer, const pal_compact_palette_t* pal);
+PALDEF int pal_write_compact_palb(pal_writer_t* writer, const pal_compact_palette_t* pal);
+PALDEF int pal_write_compact_pala(pal_writer_t*                       writer,
+                                  const pal_compact_palette_t* const* pals,
+                                  int                                 num_pals);
+
 // add a new gradient to *pal that contains every color in
 // the palette, sorted by some criteria.
 //
@@ -337,6 +891,52 @@ int pal_create_sorted_gradient(pal_palette_t*           pal,
                                pal_color_compare_func_t cb,
                                void*                    datum);
 
+// as pal_create_sorted_gradient, but 'key_func' is called exactly
+// once per color, and colors are then stable sorted in O(n log n)
+// from the highest key to the lowest.
+//
+// each builtin key func produces the exact same ordering as its
+// callback counterpart, ties included:
+// pal_hue_key pal_saturation_key pal_value_key pal_lightness_key
+// pal_red_key pal_green_key pal_blue_key
+// pal_redness_key pal_yellowness_key pal_greenness_key
+// pal_cyanness_key pal_blueness_key pal_magentaness_key
+//
+// datum is passed through to key_func.
+int pal_create_key_sorted_gradient(pal_palette_t*       pal,
+                                   const char*          gradient_name,
+                                   pal_color_key_func_t key_func,
+                                   void*                datum);
+
+// fill *out_features from every color in *pal.  Do this once and pass
+// the result to pal_create_feature_sorted_gradient for each builtin
+// sort instead of converting every color again per sort.
+//
+// features are a snapshot: recompute them if the colors change.
+// returns 0 on success, 1 if out of memory.
+int pal_compute_color_features(const pal_palette_t*  pal,
+                               pal_color_features_t* out_features);
+
+// as pal_compute_color_features, reading the colors from soa
+int pal_compute_soa_color_features(const pal_color_soa_t* soa, pal_color_features_t* out_features);
+
+void pal_color_features_free(pal_color_features_t* features);
+
+// as pal_create_key_sorted_gradient with the builtin key func for
+// sort_kind, but reading precomputed features.  The ordering is
+// identical.
+int pal_create_feature_sorted_gradient(pal_palette_t*              pal,
+                                       const char*                 gradient_name,
+                                       const pal_color_features_t* features,
+                                       pal_sort_kind_t             sort_kind);
+
+// string names for sort kinds, eg: "hue", "magentaness"
+const char* pal_string_for_sort_kind(pal_sort_kind_t sort_kind);
+
+// given a case-sensitive string, set *out_sort_kind to the enum.  if
+// len is nonzero, str is not assumed to be null terminated
+int pal_sort_kind_for_string(const char* str, int len, pal_sort_kind_t* out_sort_kind);
+
 
 // in-place convert a color from sRGB to linear.
 //
@@ -350,12 +950,88 @@ PALDEF void pal_color_srgb_to_linear(pal_color_t* color);
 PALDEF void pal_color_linear_to_srgb(pal_color_t* color);
 
 // in-place converts a palette from "linear srgb" to srgb, calling
-// pal_color_linear_to_srgb on every color.
+// pal_color_linear_to_srgb on every color.  this is the exact powf
+// conversion; pal_colors_linear_to_srgb is faster but approximate.
 //
 // if the input palette isn't in "linear srgb", no action is performed.
 // this does not take into account any .icc file
 PALDEF void pal_palette_linear_to_srgb(pal_palette_t* pal);
 
+// in-place converts a palette from srgb to "linear srgb" with
+// pal_colors_srgb_to_linear, which gives the same results as calling
+// pal_color_srgb_to_linear on every color.
+//
+// if the input palette isn't in srgb, no action is performed.
+PALDEF void pal_palette_srgb_to_linear(pal_palette_t* pal);
+
+// in-place batch convert colors from sRGB to linear, as
+// pal_color_srgb_to_linear.  Channels that came from 8-bit values (via
+// pal_convert_channel_to_f32) are read from a precomputed table; all
+// others fall back to powf.  Results are identical either way.
+PALDEF void pal_colors_srgb_to_linear(pal_color_t* colors, int num_colors);
+
+// in-place batch convert colors from linear to sRGB, as
+// pal_color_linear_to_srgb, but interpolating a precomputed table
+// instead of calling powf.  Results are within 5e-7 of
+// pal_color_linear_to_srgb and are clamped to 0-1 the same way.
+PALDEF void pal_colors_linear_to_srgb(pal_color_t* colors, int num_colors);
+
+// convert num_colors sRGB colors to CIELAB (D65), writing one value per
+// color to each of out_L, out_a and out_b.  alpha is ignored.
+//
+// SSE2 and AVX2 kernels are selected at runtime.  Results are
+// approximate: within 2e-4 of the exact per-color conversion in each
+// of L, a and b for channels in 0-1.  The builtin sorts keep the exact
+// conversion so their orderings never change.
+PALDEF void pal_colors_to_lab(const pal_color_t* colors,
+                              int                num_colors,
+                              float*             out_L,
+                              float*             out_a,
+                              float*             out_b);
+
+// pal_colors_to_lab on every color in *pal.  Each out array must hold
+// pal->num_colors floats.
+PALDEF void pal_palette_to_lab(const pal_palette_t* pal, float* out_L, float* out_a, float* out_b);
+
+//
+// structure-of-arrays colors
+//
+// pal_color_t keeps each color's channels together.  A
+// pal_color_soa_t splits them into one array per channel so batch
+// kernels load PAL_SOA_LANES reds, greens or blues at a time.  Each
+// array is PAL_SOA_ALIGN-byte aligned and zero-padded to num_padded
+// floats, so kernels work in whole vectors with no scalar tail.
+//
+// Every kernel here gives the same results as its pal_color_t
+// counterpart.
+//
+PALDEF int  pal_color_soa_create(pal_color_soa_t* soa, const pal_color_t* colors, int num_colors);
+PALDEF void pal_color_soa_free(pal_color_soa_t* soa);
+
+// write soa->num_colors colors back out
+PALDEF void pal_color_soa_store(const pal_color_soa_t* soa, pal_color_t* out_colors);
+
+// as above, for every color in a palette.  pal_palette_from_color_soa
+// also sets pal->num_colors, growing the palette to fit.  both return 0
+// on success, 1 if out of memory.
+PALDEF int pal_palette_to_color_soa(const pal_palette_t* pal, pal_color_soa_t* soa);
+PALDEF int pal_palette_from_color_soa(const pal_color_soa_t* soa, pal_palette_t* pal);
+
+// in place, as pal_colors_srgb_to_linear and pal_colors_linear_to_srgb
+PALDEF void pal_color_soa_srgb_to_linear(pal_color_soa_t* soa);
+PALDEF void pal_color_soa_linear_to_srgb(pal_color_soa_t* soa);
+
+// as pal_colors_to_lab.  Each out array must hold soa->num_padded
+// floats; the padding lanes are written with the conversion of black.
+PALDEF void pal_color_soa_to_lab(const pal_color_soa_t* soa,
+                                 float*                 out_L,
+                                 float*                 out_a,
+                                 float*                 out_b);
+
+// pal_convert_channel_to_8bit on every channel, writing
+// soa->num_colors interleaved rgba colors, 4 bytes each
+PALDEF void pal_color_soa_to_8bit(const pal_color_soa_t* soa, pal_u8_t* out_rgba);
+
 /* callbacks for pal_create_sorted_gradient */
 float pal_red_cb(pal_color_t col0, pal_color_t col1, void* datum);
 float pal_green_cb(pal_color_t col0, pal_color_t col1, void* datum);
@@ -373,6 +1049,23 @@ float pal_cyanness_cb(pal_color_t col0, pal_color_t col1, void* datum);
 float pal_blueness_cb(pal_color_t col0, pal_color_t col1, void* datum);
 float pal_magentaness_cb(pal_color_t col0, pal_color_t col1, void* datum);
 
+/* key funcs for pal_create_key_sorted_gradient */
+float pal_red_key(pal_color_t col, void* datum);
+float pal_green_key(pal_color_t col, void* datum);
+float pal_blue_key(pal_color_t col, void* datum);
+float pal_hue_key(pal_color_t col, void* datum);
+float pal_saturation_key(pal_color_t col, void* datum);
+float pal_value_key(pal_color_t col, void* datum);
+float pal_lightness_key(pal_color_t col, void* datum);
+
+/* hue proximity keys -- negated distance, so the closest color sorts first */
+float pal_redness_key(pal_color_t col, void* datum);
+float pal_yellowness_key(pal_color_t col, void* datum);
+float pal_greenness_key(pal_color_t col, void* datum);
+float pal_cyanness_key(pal_color_t col, void* datum);
+float pal_blueness_key(pal_color_t col, void* datum);
+float pal_magentaness_key(pal_color_t col, void* datum);
+
 //
 // End of header file
 //
@@ -383,6 +1076,20 @@ float pal_magentaness_cb(pal_color_t col0, pal_color_t col1, void* datum);
 
 #define PAL__UNUSED(x) ((void)x)
 
+#ifndef PAL_REALLOC
+#    include <stdlib.h>
+#    define PAL_REALLOC(p, n) realloc((p), (n))
+#    define PAL_FREE(p) free(p)
+#endif
+
+#if defined(_WIN32)
+#    include <io.h>
+#    define PAL__WRITE_FD(fd, bytes, n) _write((fd), (bytes), (unsigned int)(n))
+#else
+#    include <unistd.h>
+#    define PAL__WRITE_FD(fd, bytes, n) write((fd), (bytes), (size_t)(n))
+#endif
+
 #ifndef PAL_TIME
 #    include <time.h>
 #    define PAL_TIME(n) time(n)
@@ -393,6 +1100,56 @@ float pal_magentaness_cb(pal_color_t col0, pal_color_t col1, void* datum);
 #    define PAL_POWF(n, m) powf((n), (m))
 #endif
 
+// define PAL_NO_SIMD to build only the scalar batch kernels
+#if !defined(PAL_NO_SIMD) &&                                                   \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#    define PAL__SSE2 1
+#    include <emmintrin.h>
+#    include <xmmintrin.h>
+#else
+#    define PAL__SSE2 0
+#endif
+
+// avx2 kernels are compiled on x64 regardless of compiler flags and only
+// run when the cpu reports support
+#if PAL__SSE2 && (defined(__x86_64__) || defined(_M_X64)) &&                   \
+    (defined(_MSC_VER) || defined(__clang__) ||                                \
+     (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#    define PAL__AVX2 1
+#    include <immintrin.h>
+#    if defined(_MSC_VER)
+#        include <intrin.h>
+#        define PAL__TARGET_AVX2
+#    else
+#        define PAL__TARGET_AVX2 __attribute__((target("avx2")))
+#    endif
+#else
+#    define PAL__AVX2 0
+#endif
+
+// kernels are selected on first use.  racing threads all select the
+// same one, so the cached pointer only has to be read and written
+// whole; msvc's aligned pointer accesses already are
+#if defined(__GNUC__) || defined(__clang__)
+#    define PAL__LOAD_RELAXED(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#    define PAL__STORE_RELAXED(var, val) __atomic_store_n(&(var), (val), __ATOMIC_RELAXED)
+#else
+#    define PAL__LOAD_RELAXED(var) (var)
+#    define PAL__STORE_RELAXED(var, val) ((var) = (val))
+#endif
+
+// define PAL_NO_THREADS to have pal_write_palette_json_parallel emit on
+// the calling thread only
+#if defined(PAL_NO_THREADS)
+#    define PAL__THREADS 0
+#elif defined(_WIN32)
+#    define PAL__THREADS 1
+#    include <windows.h>
+#else
+#    define PAL__THREADS 1
+#    include <pthread.h>
+#endif
+
 #define COLOR_SPACE_SRGB "sRGB"
 #define COLOR_SPACE_LINEAR_SRGB "linear-sRGB"
 #define ICC_SRGB "sRGB IEC61966-2.1.icc"
@@ -416,41 +1173,9 @@ pal__palette_set_linear(pal_palette_t* pal)
     pal->color_space.is_linear = true;
 }
 
-static int
-pal__append_buf(char** out_buf, int* out_buf_remaining, const char* str)
-{
-    while (*str) {
-        if (*out_buf_remaining == 0) {
-            printf("buf:\n%s", *out_buf);
-            PAL__ASSERT(!"Ran out of space appending buf");
-            return 1;
-        }
-
-        **out_buf = *str;
-        str++;
-        (*out_buf)++;
-        (*out_buf_remaining)--;
-    }
-
-    return 0;
-}
-
 #define PAL__TAB "    "
 #define PAL__3TAB PAL__TAB PAL__TAB PAL__TAB
 
-static int
-pal__append_buf_tabs(char** out_buf, int* out_buf_remaining, int num_tabs)
-{
-    int i;
-    for (i = 0; i < num_tabs; i++) {
-        int result = pal__append_buf(out_buf, out_buf_remaining, PAL__TAB);
-        if (result != 0)
-            return result;
-    }
-
-    return 0;
-}
-
 static char*
 pal__int_to_str(unsigned long long val, char* buf, int len, int base)
 {
@@ -505,1515 +1230,5166 @@ pal__strmatch(const char* s1, int s1_len, const char* s2, int s2_len)
     return *s1 == *s2;
 }
 
-#define PAL__APPEND(s)                                                         \
-    result |= pal__append_buf(&out_buf, &out_buf_remaining, (s))
+PALDEF void
+pal_writer_init(pal_writer_t* writer, pal_write_func_t write_func, void* write_data)
+{
+    writer->write_func = write_func;
+    writer->write_data = write_data;
+    writer->buf_used = 0;
+    writer->error = 0;
+    writer->bytes_written = 0;
+}
+
+PALDEF int
+pal_writer_flush(pal_writer_t* writer)
+{
+    if (writer->buf_used && !writer->error)
+        writer->error = writer->write_func(writer->write_data, writer->buf, writer->buf_used);
 
-#define PAL__APPEND_TABS(n)                                                    \
-    result |= pal__append_buf_tabs(&out_buf, &out_buf_remaining, (n));
+    writer->buf_used = 0;
+    return writer->error;
+}
 
-// append a single "foo": "bar" to the buf
-#define PAL__APPEND_JSON_KEYVALUE_STRING(key, value, trailing_comma)           \
-    pal__append_buf_tabs(&out_buf, &out_buf_remaining, tab);                   \
-    PAL__APPEND("\"" key "\": \"");                                            \
-    PAL__APPEND((char*)&value[0]);                                             \
-    PAL__APPEND(TRAILING_COMMA[trailing_comma]);                               \
-    if (result != 0) {                                                         \
-        PAL__ASSERT(!"buf overflow");                                          \
-        return 1;                                                              \
-    }
+// slow path for pal__write: the bytes straddle one or more flushes
+static void
+pal__write_spill(pal_writer_t* writer, const char* bytes, int num_bytes)
+{
+    if (writer->error)
+        return;
 
-#define PAL__APPEND_JSON_KEYVALUE_NOQUOTE(key, value, trailing_comma)          \
-    pal__append_buf_tabs(&out_buf, &out_buf_remaining, tab);                   \
-    PAL__APPEND("\"" key "\": ");                                              \
-    PAL__APPEND((char*)&value[0]);                                             \
-    PAL__APPEND(TRAILING_COMMA[trailing_comma]);                               \
-    if (result != 0) {                                                         \
-        PAL__ASSERT(!"buf overflow");                                          \
-        return 1;                                                              \
+    writer->bytes_written += (pal_u64_t)num_bytes;
+
+    // a write that would fill the buffer by itself skips it
+    if (num_bytes >= PAL_WRITER_BUF_LEN) {
+        if (pal_writer_flush(writer) == 0)
+            writer->error = writer->write_func(writer->write_data, bytes, num_bytes);
+        return;
     }
 
-#define PAL__WALK_BACK(n) out_buf -= (n), out_buf_remaining -= (n);
+    while (num_bytes > 0) {
+        if (writer->buf_used == PAL_WRITER_BUF_LEN && pal_writer_flush(writer) != 0)
+            return;
 
-static int 
-pal__f32_to_hex_string(float f, char* buf, int len)
-{
-    if (len < 8)
-        return 1;
-    
-    uint32_t bits;
-    memcpy(&bits, &f, sizeof(float));
-    sprintf(buf, "%08x", bits);
+        int n = PAL_WRITER_BUF_LEN - writer->buf_used;
+        if (n > num_bytes)
+            n = num_bytes;
 
-    return 0;
+        memcpy(writer->buf + writer->buf_used, bytes, (size_t)n);
+        writer->buf_used += n;
+        bytes += n;
+        num_bytes -= n;
+    }
 }
 
+// every append has a known length, so the common case is one bounds
+// check and a memcpy into the writer's buffer
+inline static void
+pal__write(pal_writer_t* writer, const char* bytes, int num_bytes)
+{
+    if (writer->buf_used + num_bytes <= PAL_WRITER_BUF_LEN && !writer->error) {
+        memcpy(writer->buf + writer->buf_used, bytes, (size_t)num_bytes);
+        writer->buf_used += num_bytes;
+        writer->bytes_written += (pal_u64_t)num_bytes;
+        return;
+    }
 
-PALDEF int
-pal_emit_palette_json(const pal_palette_t* pals, int num_pals, char* out_buf, int out_buf_len)
+    pal__write_spill(writer, bytes, num_bytes);
+}
+
+// pal_str_t fields are bounded, so never scan past PAL_MAX_STRLEN
+static void
+pal__write_pal_str(pal_writer_t* writer, const char* str)
 {
-    int         out_buf_remaining = out_buf_len;
-    int         tab = 0;
-    int         result = 0;
-    int         i, j, k;
-    const char* TRAILING_COMMA[] = {"\"\n", "\",\n", "\n", ",\n", "", ","};
+    int len = 0;
+    while (len < PAL_MAX_STRLEN && str[len]) len++;
 
-    PAL__APPEND("{\n" PAL__TAB "\"palettes\": [\n");
+    pal__write(writer, str, len);
+}
 
-    //
-    // for each palette
-    tab += 2;
+static void
+pal__write_tabs(pal_writer_t* writer, int num_tabs)
+{
+    static const char TABS[] = PAL__3TAB PAL__3TAB PAL__TAB PAL__TAB;
+    const int         TAB_LEN = sizeof(PAL__TAB) - 1;
 
-    for (i = 0; i < num_pals; i++) {
-        const pal_palette_t* pal = &pals[i];
-        char                 num_buf[64];
-        char*                p_num_buf;
+    PAL__ASSERT(num_tabs * TAB_LEN <= (int)sizeof(TABS) - 1);
+    pal__write(writer, TABS, num_tabs * TAB_LEN);
+}
 
-        // comma separation
-        if (i) {
-            PAL__APPEND(",\n");
-        }
+// digit-pair decimal formatting: two digits per division.  writes the
+// digits of val to the end of buf[PAL__U64_DEC_LEN] and returns the
+// offset of the first digit.
+#define PAL__U64_DEC_LEN 20
+
+static const char PAL__DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
 
-        // palette sub-document
-        PAL__APPEND_TABS(tab++);
-        PAL__APPEND("{\n");
+static int
+pal__u64_to_dec(unsigned long long val, char buf[PAL__U64_DEC_LEN])
+{
+    int i = PAL__U64_DEC_LEN;
 
+    while (val >= 100) {
+        unsigned pair = (unsigned)(val % 100) * 2;
+        val /= 100;
+        buf[--i] = PAL__DIGIT_PAIRS[pair + 1];
+        buf[--i] = PAL__DIGIT_PAIRS[pair];
+    }
 
+    if (val >= 10) {
+        buf[--i] = PAL__DIGIT_PAIRS[val * 2 + 1];
+        buf[--i] = PAL__DIGIT_PAIRS[val * 2];
+    } else {
+        buf[--i] = (char)('0' + val);
+    }
 
-        // title
-        PAL__APPEND_JSON_KEYVALUE_STRING("title", pal->title, 1);
+    return i;
+}
 
-        // color hash
-        p_num_buf = pal__int_to_str(pal_hash_color_values(pal), num_buf, 64, 10);
-        PAL__APPEND_JSON_KEYVALUE_STRING("color_hash", p_num_buf, 1);
+static void
+pal__write_u64(pal_writer_t* writer, unsigned long long val)
+{
+    char buf[PAL__U64_DEC_LEN];
+    int  first = pal__u64_to_dec(val, buf);
 
-        //
-        // source block
-        //
-        PAL__APPEND_TABS(tab++);
-        PAL__APPEND("\"source\": {\n");
-        if (pal->source.url[0]) {
-            PAL__APPEND_JSON_KEYVALUE_STRING("url", pal->source.url, 1);
-        }
-        if (pal->source.conversion_tool[0]) {
-            PAL__APPEND_JSON_KEYVALUE_STRING(
-                "conversion_tool", pal->source.conversion_tool, 1);
-        }
+    pal__write(writer, buf + first, PAL__U64_DEC_LEN - first);
+}
 
-        p_num_buf =
-            pal__int_to_str(pal->source.conversion_timestamp, num_buf, 64, 10);
-        PAL__APPEND_JSON_KEYVALUE_STRING("conversion_date", p_num_buf, 0);
-        tab--;
-        PAL__APPEND(PAL__3TAB "},\n\n");  // source
+// nibble-table hex encoding of the float's bits, equivalent to
+// sprintf("%08x") without the format parsing.  out is not terminated.
+static void
+pal__f32_to_hex(float f, char out[8])
+{
+    static const char NIBBLES[] = "0123456789abcdef";
+    pal_u32_t         bits;
+    int               i;
 
+    memcpy(&bits, &f, sizeof(float));
+    for (i = 7; i >= 0; i--, bits >>= 4) out[i] = NIBBLES[bits & 0xf];
+}
 
-        //
-        // colorspace
-        //
-        PAL__APPEND_TABS(tab++);
-        PAL__APPEND("\"color_space\": {\n");
-        if (pal->color_space.name[0]) {
-            PAL__APPEND_JSON_KEYVALUE_STRING("name", pal->color_space.name, 1);
-        }
+PALDEF int
+pal_write_to_file(void* write_data, const char* bytes, int num_bytes)
+{
+    return fwrite(bytes, 1, (size_t)num_bytes, (FILE*)write_data) != (size_t)num_bytes;
+}
 
-        if (pal->color_space.icc_filename[0]) {
-            PAL__APPEND_JSON_KEYVALUE_STRING(
-                "icc_filename", pal->color_space.icc_filename, 1);
-        }
+PALDEF int
+pal_write_to_fd(void* write_data, const char* bytes, int num_bytes)
+{
+    int fd = *(const int*)write_data;
 
-        PAL__APPEND_TABS(tab);
-        PAL__APPEND("\"is_linear\": ");
-        if (pal->color_space.is_linear)
-            PAL__APPEND("true\n");
-        else
-            PAL__APPEND("false\n");
-        tab--;
-        PAL__APPEND(PAL__3TAB "},\n\n");  // color_space
+    while (num_bytes > 0) {
+        int n = (int)PAL__WRITE_FD(fd, bytes, num_bytes);
+        if (n <= 0)
+            return 1;
 
+        bytes += n;
+        num_bytes -= n;
+    }
 
-        //
-        // colors block
-        //
-        PAL__APPEND_TABS(tab++);
-        PAL__APPEND("\"colors\": [\n");
-        for (j = 0; j < pal->num_colors; j++) {
-            result |= pal__append_buf_tabs(&out_buf, &out_buf_remaining, tab++);
-            PAL__APPEND("{\n");
-            PAL__APPEND_JSON_KEYVALUE_STRING("name", pal->color_names[j], 1);
-
-            result |= pal__f32_to_hex_string(pal->colors[j].rgba.r, num_buf, 64);
-            PAL__APPEND_JSON_KEYVALUE_STRING("red", num_buf, 1);
-
-            result |= pal__f32_to_hex_string(pal->colors[j].rgba.g, num_buf, 64);
-            PAL__APPEND_JSON_KEYVALUE_STRING("green", num_buf, 1);
-
-            result |= pal__f32_to_hex_string(pal->colors[j].rgba.b, num_buf, 64);
-            PAL__APPEND_JSON_KEYVALUE_STRING("blue", num_buf, 1);
-            
-            result |= pal__f32_to_hex_string(pal->colors[j].rgba.a, num_buf, 64);
-            PAL__APPEND_JSON_KEYVALUE_STRING("alpha", num_buf, 0);
-
-            tab--;
-            PAL__APPEND(PAL__3TAB PAL__TAB "}");
-            PAL__APPEND(j == pal->num_colors - 1 ? TRAILING_COMMA[2]
-                                                 : TRAILING_COMMA[3]);
-        }
+    return 0;
+}
 
-        // end colors array
-        tab--;
-        PAL__APPEND_TABS(tab);
-        PAL__APPEND("],\n\n");
+PALDEF int
+pal_write_to_membuf(void* write_data, const char* bytes, int num_bytes)
+{
+    pal_membuf_t* membuf = (pal_membuf_t*)write_data;
 
-        //
-        // hints (for this palette document)
-        //
-        PAL__APPEND_TABS(tab);
-        PAL__APPEND("\"hints\": {\n");
+    // keep room for the terminator
+    if (membuf->len + (pal_u64_t)num_bytes + 1 > membuf->capacity) {
+        pal_u64_t capacity = membuf->capacity ? membuf->capacity : PAL_WRITER_BUF_LEN;
+        while (membuf->len + (pal_u64_t)num_bytes + 1 > capacity) capacity *= 2;
 
+        char* data = (char*)PAL_REALLOC(membuf->data, (size_t)capacity);
+        if (!data)
+            return 1;
 
-        tab++;
-        int total_hints = 0;
-        for (j = 0; j < HINT_MAX; j++) {
-            if (pal->num_hints[j] == 0)
-                continue;
-            total_hints++;
-            // ex: "highlight": [
-            PAL__APPEND_TABS(tab);
-            PAL__APPEND("\"");
-            PAL__APPEND(pal_string_for_hint((pal_hint_kind_t)j));
-            PAL__APPEND("\": [");
-
-            // for each color in this hint
-            for (k = 0; k < pal->num_hints[j]; k++) {
-                PAL__APPEND("\"");
-                PAL__APPEND(pal->color_names[pal->hint_colors[j][k]]);
-                PAL__APPEND("\", ");
-            }
+        membuf->data = data;
+        membuf->capacity = capacity;
+    }
 
-            // walk back over the trailing comma
-            PAL__WALK_BACK(2);
-            PAL__APPEND("],\n");
-        }
+    memcpy(membuf->data + membuf->len, bytes, (size_t)num_bytes);
+    membuf->len += (pal_u64_t)num_bytes;
+    membuf->data[membuf->len] = 0;
 
-        // end hints
-        // walk back over the trailing comma, then add the newline back in
-        if (total_hints != 0)
-            out_buf -= 2, out_buf_remaining -= 2;
-        PAL__APPEND("\n");
+    return 0;
+}
 
-        tab--;
-        PAL__APPEND_TABS(tab);
-        PAL__APPEND("},\n\n");  // end hints array
+PALDEF void
+pal_membuf_free(pal_membuf_t* membuf)
+{
+    PAL_FREE(membuf->data);
+    membuf->data = NULL;
+    membuf->len = membuf->capacity = 0;
+}
 
-        //
-        // gradients
-        //
-        PAL__APPEND_TABS(tab++);
-        PAL__APPEND("\"gradients\": {\n");
+// string literal; length known at compile time
+#define PAL__APPEND(s) pal__write(writer, "" s, (int)sizeof(s) - 1)
 
-        // for each gradient
-        for (j = 0; j < pal->num_gradients; j++) {
-            // eg: "shadow": [
-            PAL__APPEND_TABS(tab);
-            PAL__APPEND("\"");
-            PAL__APPEND(pal->gradient_names[j]);
-            PAL__APPEND("\": [\n");
-            tab++;
-
-            // for each color in gradient
-            for (k = 0; k < pal->gradients[j].num_indices; k++) {
-                pal_u16_t index = pal->gradients[j].indices[k];
-
-                if (index >= pal->num_colors) {
-                    PAL__ASSERT(!"invalid color index in gradient");
-                    return 2;
-                }
-
-                if (pal->color_names[index][0] == 0) {
-                    PAL__ASSERT(
-                        !"Can't have a gradient with an empty color name");
-                    return 2;
-                }
-
-                // append the color name
-                PAL__APPEND_TABS(tab);
-                PAL__APPEND("\"");
-                PAL__APPEND(pal->color_names[index]);
-                PAL__APPEND(
-                    TRAILING_COMMA[k == pal->gradients[j].num_indices - 1 ? 0 : 1]);
-            }
+// pal_str_t or other bounded, null terminated string
+#define PAL__APPEND_STR(s) pal__write_pal_str(writer, (s))
 
-            tab--;
-            PAL__APPEND_TABS(tab);
-            PAL__APPEND("]");  // end gradient array
-            PAL__APPEND(TRAILING_COMMA[j == pal->num_gradients - 1 ? 2 : 3]);
-        }
+// json punctuation with its pretty-printed whitespace, or without it for
+// the compact layouts
+#define PAL__APPEND_JSON(pretty_s, compact_s)                                  \
+    if (pretty)                                                                \
+        PAL__APPEND(pretty_s);                                                 \
+    else                                                                       \
+        PAL__APPEND(compact_s);
+
+// indentation only exists in the pretty layout
+#define PAL__APPEND_TABS(n)                                                    \
+    if (pretty)                                                                \
+        pal__write_tabs(writer, (n));
+
+// closes a quoted value, with a comma unless it is the last in its object
+#define PAL__APPEND_JSON_VALUE_END(is_last)                                    \
+    if (is_last) {                                                             \
+        PAL__APPEND_JSON("\"\n", "\"");                                        \
+    } else {                                                                   \
+        PAL__APPEND_JSON("\",\n", "\",");                                      \
+    }
+
+// append a single "foo": "bar" to the writer
+#define PAL__APPEND_JSON_KEYVALUE_STRING(key, value, is_last)                  \
+    PAL__APPEND_TABS(tab);                                                     \
+    PAL__APPEND_JSON("\"" key "\": \"", "\"" key "\":\"");                     \
+    PAL__APPEND_STR(value);                                                    \
+    PAL__APPEND_JSON_VALUE_END(is_last);
+
+// as above, for a color channel written as 8 hex digits
+#define PAL__APPEND_JSON_KEYVALUE_HEX(key, value, is_last)                     \
+    PAL__APPEND_TABS(tab);                                                     \
+    PAL__APPEND_JSON("\"" key "\": \"", "\"" key "\":\"");                     \
+    pal__f32_to_hex((value), hex_buf);                                         \
+    pal__write(writer, hex_buf, 8);                                            \
+    PAL__APPEND_JSON_VALUE_END(is_last);
+
+// as above, for an unsigned decimal integer written as a string
+#define PAL__APPEND_JSON_KEYVALUE_U64(key, value, is_last)                     \
+    PAL__APPEND_TABS(tab);                                                     \
+    PAL__APPEND_JSON("\"" key "\": \"", "\"" key "\":\"");                     \
+    pal__write_u64(writer, (value));                                           \
+    PAL__APPEND_JSON_VALUE_END(is_last);
+
+
+// one palette sub-document, from its opening to its closing brace.
+// reads only *pal, so palettes can be rendered on separate threads.
+static int
+pal__write_palette_json_object(pal_writer_t*        writer,
+                               const pal_palette_t* pal,
+                               pal_json_layout_t    layout)
+{
+    int  tab = layout == PAL_JSON_LAYOUT_NDJSON ? 0 : 2;
+    int  j, k;
+    int  pretty = layout == PAL_JSON_LAYOUT_PRETTY;
+    char hex_buf[8];
+
+    // palette sub-document
+    PAL__APPEND_TABS(tab++);
+    PAL__APPEND_JSON("{\n", "{");
+
+
+
+    // title
+    PAL__APPEND_JSON_KEYVALUE_STRING("title", pal->title, 0);
+
+    // color hash
+    PAL__APPEND_JSON_KEYVALUE_U64("color_hash", pal_hash_color_values(pal), 0);
+    PAL__APPEND_JSON_KEYVALUE_U64("color_hash64", pal_hash_color_values64(pal), 0);
+
+    //
+    // source block
+    //
+    PAL__APPEND_TABS(tab++);
+    PAL__APPEND_JSON("\"source\": {\n", "\"source\":{");
+    if (pal->source.url[0]) {
+        PAL__APPEND_JSON_KEYVALUE_STRING("url", pal->source.url, 0);
+    }
+    if (pal->source.conversion_tool[0]) {
+        PAL__APPEND_JSON_KEYVALUE_STRING(
+            "conversion_tool", pal->source.conversion_tool, 0);
+    }
+
+    PAL__APPEND_JSON_KEYVALUE_U64(
+        "conversion_date", pal->source.conversion_timestamp, 1);
+    tab--;
+    PAL__APPEND_TABS(tab);
+    PAL__APPEND_JSON("},\n\n", "},");  // source
+
+
+    //
+    // colorspace
+    //
+    PAL__APPEND_TABS(tab++);
+    PAL__APPEND_JSON("\"color_space\": {\n", "\"color_space\":{");
+    if (pal->color_space.name[0]) {
+        PAL__APPEND_JSON_KEYVALUE_STRING("name", pal->color_space.name, 0);
+    }
+
+    if (pal->color_space.icc_filename[0]) {
+        PAL__APPEND_JSON_KEYVALUE_STRING(
+            "icc_filename", pal->color_space.icc_filename, 0);
+    }
+
+    PAL__APPEND_TABS(tab);
+    PAL__APPEND_JSON("\"is_linear\": ", "\"is_linear\":");
+    if (pal->color_space.is_linear) {
+        PAL__APPEND_JSON("true\n", "true");
+    } else {
+        PAL__APPEND_JSON("false\n", "false");
+    }
+    tab--;
+    PAL__APPEND_TABS(tab);
+    PAL__APPEND_JSON("},\n\n", "},");  // color_space
+
+
+    //
+    // colors block
+    //
+    PAL__APPEND_TABS(tab++);
+    PAL__APPEND_JSON("\"colors\": [\n", "\"colors\":[");
+    for (j = 0; j < pal->num_colors; j++) {
+        PAL__APPEND_TABS(tab++);
+        PAL__APPEND_JSON("{\n", "{");
+        PAL__APPEND_JSON_KEYVALUE_STRING("name", pal->color_names[j], 0);
+
+        PAL__APPEND_JSON_KEYVALUE_HEX("red", pal->colors[j].rgba.r, 0);
+        PAL__APPEND_JSON_KEYVALUE_HEX("green", pal->colors[j].rgba.g, 0);
+        PAL__APPEND_JSON_KEYVALUE_HEX("blue", pal->colors[j].rgba.b, 0);
+        PAL__APPEND_JSON_KEYVALUE_HEX("alpha", pal->colors[j].rgba.a, 1);
 
-        // end gradients
         tab--;
         PAL__APPEND_TABS(tab);
-        PAL__APPEND("},\n\n");  // end gradients dictionary
+        PAL__APPEND("}");
+        if (j == pal->num_colors - 1) {
+            PAL__APPEND_JSON("\n", "");
+        } else {
+            PAL__APPEND_JSON(",\n", ",");
+        }
+    }
 
-        //
-        // dither pairs
-        //
-        PAL__APPEND_TABS(tab);
-        PAL__APPEND("\"dither_pairs\": {\n");
-        tab++;
+    // end colors array
+    tab--;
+    PAL__APPEND_TABS(tab);
+    PAL__APPEND_JSON("],\n\n", "],");
+
+    //
+    // hints (for this palette document)
+    //
+    PAL__APPEND_TABS(tab);
+    PAL__APPEND_JSON("\"hints\": {\n", "\"hints\":{");
 
-        for (j = 0; j < pal->num_dither_pairs; j++) {
-            // for each dither pair
 
-            // eg: "purple":
-            PAL__APPEND_TABS(tab);
+    tab++;
+    int total_hints = 0;
+    for (j = 0; j < HINT_MAX; j++) {
+        if (pal->num_hints[j] == 0)
+            continue;
+
+        // separate from the previous hint
+        if (total_hints++) {
+            PAL__APPEND_JSON(",\n", ",");
+        }
+
+        // ex: "highlight": [
+        PAL__APPEND_TABS(tab);
+        PAL__APPEND("\"");
+        const char* hint_name = pal_string_for_hint((pal_hint_kind_t)j);
+        pal__write(writer, hint_name, pal__strlen(hint_name));
+        PAL__APPEND_JSON("\": [", "\":[");
+
+        // for each color in this hint
+        for (k = 0; k < pal->num_hints[j]; k++) {
+            if (k) {
+                PAL__APPEND_JSON(", ", ",");
+            }
+            PAL__APPEND("\"");
+            PAL__APPEND_STR(pal->color_names[pal->hint_colors[j][k]]);
             PAL__APPEND("\"");
-            PAL__APPEND(pal->dither_pair_names[j]);
-            PAL__APPEND("\": [");
+        }
+
+        PAL__APPEND("]");
+    }
+
+    // end hints
+    PAL__APPEND_JSON("\n", "");
+
+    tab--;
+    PAL__APPEND_TABS(tab);
+    PAL__APPEND_JSON("},\n\n", "},");  // end hints array
+
+    //
+    // gradients
+    //
+    PAL__APPEND_TABS(tab++);
+    PAL__APPEND_JSON("\"gradients\": {\n", "\"gradients\":{");
+
+    // for each gradient
+    for (j = 0; j < pal->num_gradients; j++) {
+        // eg: "shadow": [
+        PAL__APPEND_TABS(tab);
+        PAL__APPEND("\"");
+        PAL__APPEND_STR(pal->gradient_names[j]);
+        PAL__APPEND_JSON("\": [\n", "\":[");
+        tab++;
+
+        // for each color in gradient
+        for (k = 0; k < pal->gradients[j].num_indices; k++) {
+            pal_u16_t index = pal->gradients[j].indices[k];
 
-            if (pal->dither_pairs[j].index0 >= pal->num_colors ||
-                pal->dither_pairs[j].index1 >= pal->num_colors) {
-                PAL__ASSERT(!"dither pair index out of range");
+            if (index >= pal->num_colors) {
+                PAL__ASSERT(!"invalid color index in gradient");
                 return 2;
             }
 
-            PAL__APPEND("\"");
-            PAL__APPEND(pal->color_names[pal->dither_pairs[j].index0]);
-            PAL__APPEND("\", ");
+            if (pal->color_names[index][0] == 0) {
+                PAL__ASSERT(
+                    !"Can't have a gradient with an empty color name");
+                return 2;
+            }
 
+            // append the color name
+            PAL__APPEND_TABS(tab);
             PAL__APPEND("\"");
-            PAL__APPEND(pal->color_names[pal->dither_pairs[j].index1]);
-            PAL__APPEND("\"]");
-            PAL__APPEND(TRAILING_COMMA[j == (pal->num_dither_pairs - 1) ? 2 : 3]);
+            PAL__APPEND_STR(pal->color_names[index]);
+            PAL__APPEND_JSON_VALUE_END(k == pal->gradients[j].num_indices - 1);
         }
 
-
-        // end dither pairs
         tab--;
         PAL__APPEND_TABS(tab);
-        PAL__APPEND("}\n");  // end dither_pairs
+        PAL__APPEND("]");  // end gradient array
+        if (j == pal->num_gradients - 1) {
+            PAL__APPEND_JSON("\n", "");
+        } else {
+            PAL__APPEND_JSON(",\n", ",");
+        }
+    }
 
-        // end palette sub-document
-        tab--;
+    // end gradients
+    tab--;
+    PAL__APPEND_TABS(tab);
+    PAL__APPEND_JSON("},\n\n", "},");  // end gradients dictionary
+
+    //
+    // dither pairs
+    //
+    PAL__APPEND_TABS(tab);
+    PAL__APPEND_JSON("\"dither_pairs\": {\n", "\"dither_pairs\":{");
+    tab++;
+
+    for (j = 0; j < pal->num_dither_pairs; j++) {
+        // for each dither pair
+
+        // eg: "purple":
         PAL__APPEND_TABS(tab);
-        PAL__APPEND("}");
+        PAL__APPEND("\"");
+        PAL__APPEND_STR(pal->dither_pair_names[j]);
+        PAL__APPEND_JSON("\": [", "\":[");
+
+        if (pal->dither_pairs[j].index0 >= pal->num_colors ||
+            pal->dither_pairs[j].index1 >= pal->num_colors) {
+            PAL__ASSERT(!"dither pair index out of range");
+            return 2;
+        }
+
+        PAL__APPEND("\"");
+        PAL__APPEND_STR(pal->color_names[pal->dither_pairs[j].index0]);
+        PAL__APPEND_JSON("\", ", "\",");
+
+        PAL__APPEND("\"");
+        PAL__APPEND_STR(pal->color_names[pal->dither_pairs[j].index1]);
+        PAL__APPEND("\"]");
+        if (j == pal->num_dither_pairs - 1) {
+            PAL__APPEND_JSON("\n", "");
+        } else {
+            PAL__APPEND_JSON(",\n", ",");
+        }
     }
-    PAL__APPEND("\n");
 
-    // end palettes array
+
+    // end dither pairs
     tab--;
     PAL__APPEND_TABS(tab);
-    PAL__APPEND("]\n");  // end palettes array
+    PAL__APPEND_JSON("}\n", "}");  // end dither_pairs
 
-    // end main document array
+    // end palette sub-document
     tab--;
     PAL__APPEND_TABS(tab);
-    PAL__APPEND("}\n");
+    PAL__APPEND("}");
 
+    return 0;
+}
 
-    //
-    // terminate buf no matter what
-    if (out_buf_remaining == 0) {
-        (*out_buf)--;
-    }
-    *out_buf = 0;
-    if (out_buf_remaining == 0) {
-        PAL__ASSERT(!"Ran out of space appending buf");
-        return 1;
+static void
+pal__write_palette_json_open(pal_writer_t* writer, pal_json_layout_t layout)
+{
+    int pretty = layout == PAL_JSON_LAYOUT_PRETTY;
+
+    // ndjson is a bare palette object per line, with no enclosing document
+    if (layout != PAL_JSON_LAYOUT_NDJSON) {
+        PAL__APPEND_JSON("{\n" PAL__TAB "\"palettes\": [\n", "{\"palettes\":[");
     }
+}
 
-    return 0;
+// between two palette sub-documents
+static void
+pal__write_palette_json_separator(pal_writer_t* writer, pal_json_layout_t layout)
+{
+    int pretty = layout == PAL_JSON_LAYOUT_PRETTY;
+
+    if (layout == PAL_JSON_LAYOUT_NDJSON) {
+        PAL__APPEND("\n");
+    } else {
+        PAL__APPEND_JSON(",\n", ",");
+    }
 }
 
-PALDEF int
-pal_emit_gimp_gpl(const pal_palette_t* pal, char* out_buf, int out_buf_len)
+static void
+pal__write_palette_json_close(pal_writer_t* writer, pal_json_layout_t layout)
 {
-    int out_buf_remaining = out_buf_len;
-    int result = 0;
-    int i;
+    int pretty = layout == PAL_JSON_LAYOUT_PRETTY;
 
-    PAL__APPEND("GIMP Palette\n");
-    PAL__APPEND("Name: ");
-    if (pal->title[0])
-        PAL__APPEND(pal->title);
-    else
-        PAL__APPEND("(untitled)");
+    // end palettes array and main document
+    if (layout != PAL_JSON_LAYOUT_NDJSON) {
+        PAL__APPEND_JSON("\n" PAL__TAB "]\n}", "]}");
+    }
+
+    // every layout ends in a newline
     PAL__APPEND("\n");
+}
+
+// the palettes a bulk emitter writes: an array of pal_palette_t, or of
+// pointers to compact palettes
+typedef struct {
+    const pal_palette_t*                pals;
+    const pal_compact_palette_t* const* compact;
+    int                                 num_pals;
+} pal__palette_set_t;
+
+// palette i of set.  compact palettes are expanded into scratch, which
+// is then only needed if set->compact is non-NULL.  NULL if out of
+// memory.
+static const pal_palette_t*
+pal__palette_set_get(const pal__palette_set_t* set, int i, pal_palette_t* scratch)
+{
+    if (!set->compact)
+        return &set->pals[i];
 
+    if (pal_compact_palette_expand(set->compact[i], scratch) != 0)
+        return NULL;
+    return scratch;
+}
 
-    PAL__APPEND("# generated by ftg_palette.h\n");
+static pal_palette_t*
+pal__alloc_scratch_palette(void)
+{
+    pal_palette_t* scratch = (pal_palette_t*)PAL_REALLOC(NULL, sizeof(pal_palette_t));
 
-    // for each color
-    for (i = 0; i < pal->num_colors; i++) {
-        // for each channel (no alpha)
-        int j;
+    if (scratch)
+        memset(scratch, 0, sizeof(*scratch));
+    return scratch;
+}
 
-        for (j = 0; j < 3; j++) {
-            char  num_buf[64];
-            char* p_num_buf;
+static void
+pal__free_scratch_palette(pal_palette_t* scratch)
+{
+    if (!scratch)
+        return;
 
-            pal_u8_t chan8 = pal_convert_channel_to_8bit(pal->colors[i].c[j]);
-            p_num_buf = pal__int_to_str(chan8, num_buf, 64, 10);
-            PAL__APPEND(p_num_buf);
-            PAL__APPEND(" ");
-        }
+    pal_free(scratch);
+    PAL_FREE(scratch);
+}
 
-        if (pal->color_names[i][0])
-            PAL__APPEND(pal->color_names[i]);
-        else
-            PAL__APPEND("(unnamed)");
+static pal_palette_t*
+pal__palette_set_alloc_scratch(const pal__palette_set_t* set)
+{
+    return set->compact ? pal__alloc_scratch_palette() : NULL;
+}
 
-        PAL__APPEND("\n");
+// colors and title of palette i, without expanding it
+static const pal_color_t*
+pal__palette_set_colors(const pal__palette_set_t* set, int i, int* out_num_colors)
+{
+    if (set->compact) {
+        *out_num_colors = set->compact[i]->num_colors;
+        return set->compact[i]->colors;
     }
 
-    //
-    // terminate buf no matter what
-    if (out_buf_remaining == 0) {
-        (*out_buf)--;
-    }
-    *out_buf = 0;
-    if (out_buf_remaining == 0) {
-        PAL__ASSERT(!"Ran out of space appending buf");
+    *out_num_colors = set->pals[i].num_colors;
+    return set->pals[i].colors;
+}
+
+static const char*
+pal__palette_set_title(const pal__palette_set_t* set, int i)
+{
+    return set->compact ? set->compact[i]->title : set->pals[i].title;
+}
+
+static int
+pal__write_palette_set_json(pal_writer_t*             writer,
+                            const pal__palette_set_t* set,
+                            pal_json_layout_t         layout)
+{
+    pal_palette_t* scratch = pal__palette_set_alloc_scratch(set);
+    int            result = 0;
+    int            i;
+
+    if (set->compact && !scratch)
         return 1;
+
+    pal__write_palette_json_open(writer, layout);
+
+    for (i = 0; i < set->num_pals && result == 0; i++) {
+        if (i)
+            pal__write_palette_json_separator(writer, layout);
+
+        const pal_palette_t* pal = pal__palette_set_get(set, i, scratch);
+
+        result = pal ? pal__write_palette_json_object(writer, pal, layout) : 1;
     }
 
+    if (result == 0)
+        pal__write_palette_json_close(writer, layout);
+
+    // flushed even after a failure, so the writer has seen all of the
+    // partial document
+    if (pal_writer_flush(writer) != 0 && result == 0)
+        result = 1;
+
+    pal__free_scratch_palette(scratch);
     return result;
 }
 
+PALDEF int
+pal_write_palette_json(pal_writer_t*        writer,
+                       const pal_palette_t* pals,
+                       int                  num_pals,
+                       pal_json_layout_t    layout)
+{
+    pal__palette_set_t set = {pals, NULL, num_pals};
+    return pal__write_palette_set_json(writer, &set, layout);
+}
 
-#undef PAL__APPEND
-#undef PAL__APPEND_TABS
-#undef PAL__APPEND_JSON_KEYVALUE_STRING
-#undef PAL__APPEND_JSON_KEYVALUE_NOQUOTE
-#undef PAL__WALK_BACK
+// a worker's share of pal_write_palette_json_parallel: palettes first,
+// first + stride, ... rendered back to back into its own membuf
+typedef struct {
+    const pal__palette_set_t* set;
+    int                       first;
+    int                       stride;
+    pal_json_layout_t         layout;
+
+    pal_membuf_t out;
+    pal_u64_t*   ends;        // shared; ends[i] is where palette i ends in its worker's out
+    int          result;      // of the palette at failed_at
+    int          failed_at;   // first of its palettes to fail; its partial output ends out
+    int          out_failed;  // out or the scratch palette could not be allocated
+} pal__json_job_t;
 
-/* Fill up to max_copy characters in dst, including null.  Unlike strncpy(), a
-   null terminating character is guaranteed to be appended, EVEN if it
-   overwrites the last character in the string.
+static void
+pal__run_json_job(pal__json_job_t* job)
+{
+    pal_writer_t   writer;
+    pal_palette_t* scratch = pal__palette_set_alloc_scratch(job->set);
+    int            i;
+
+    job->result = 0;
+    job->failed_at = job->set->num_pals;
+    job->out_failed = job->set->compact && !scratch;
+    if (job->out_failed)
+        return;
 
-   Only appends a single NULL character instead of NULL filling the string.  The
-   trailing bytes are left uninitialized.
+    pal_writer_init(&writer, pal_write_to_membuf, &job->out);
 
-   No bytes are written if max_copy is 0, and FTG_ASSERT is thrown.
+    for (i = job->first; i < job->set->num_pals; i += job->stride) {
+        const pal_palette_t* pal = pal__palette_set_get(job->set, i, scratch);
 
-   return 1 on truncation or max_copy==0, zero otherwise.
-                                                                                   */
-static int
-pal__strncpy(char* dst, const char* src, int max_copy)
-{
-    size_t n;
-    char*  d;
+        job->result = pal ? pal__write_palette_json_object(&writer, pal, job->layout) : 1;
+        if (job->result != 0) {
+            job->failed_at = i;
+            break;
+        }
 
-    PAL__ASSERT(dst);
-    PAL__ASSERT(src);
-    PAL__ASSERT(max_copy > 0);
+        job->ends[i] = writer.bytes_written;
+    }
 
-    if (max_copy == 0)
-        return 1;
+    // a failed palette's partial output is kept, to be written where
+    // the serial emitter would have written it
+    job->out_failed = pal_writer_flush(&writer) != 0;
 
-    n = max_copy;
-    d = dst;
-    while (n > 0 && *src != '\0') {
-        *d++ = *src++;
-        --n;
-    }
+    pal__free_scratch_palette(scratch);
+}
 
-    /* Truncation case -
-       terminate string and return true */
-    if (n == 0) {
-        dst[max_copy - 1] = '\0';
-        return 1;
-    }
+#if PAL__THREADS
+#    if defined(_WIN32)
+typedef HANDLE pal__thread_t;
 
-    /* No truncation.  Append a single NULL and return. */
-    *d = '\0';
+static DWORD WINAPI
+pal__json_job_thread(LPVOID job)
+{
+    pal__run_json_job((pal__json_job_t*)job);
     return 0;
 }
 
+static int
+pal__thread_start(pal__thread_t* thread, pal__json_job_t* job)
+{
+    *thread = CreateThread(NULL, 0, pal__json_job_thread, job, 0, NULL);
+    return *thread == NULL;
+}
 
-static pal_u16_t
-pal__read_beu16(const unsigned char** p_bytes)
+static void
+pal__thread_join(pal__thread_t thread)
 {
-    pal_u16_t val = (*p_bytes)[0] << 8 | (*p_bytes)[1];
-    *p_bytes += 2;
-    return val;
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
 }
 
+static int
+pal__num_cpus(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+}
+#    else
+typedef pthread_t pal__thread_t;
+
+static void*
+pal__json_job_thread(void* job)
+{
+    pal__run_json_job((pal__json_job_t*)job);
+    return NULL;
+}
 
 static int
-pal__get_rgb(float h, float s, float v, float* r, float* g, float* b)
+pal__thread_start(pal__thread_t* thread, pal__json_job_t* job)
 {
-    if (h == FTG_UNDEFINED_HUE || (h >= 0.0f && h <= 360.0f)) {
-        PAL__ASSERT(!"hue out of range");
+    return pthread_create(thread, NULL, pal__json_job_thread, job) != 0;
+}
+
+static void
+pal__thread_join(pal__thread_t thread)
+{
+    pthread_join(thread, NULL);
+}
+
+static int
+pal__num_cpus(void)
+{
+    return (int)sysconf(_SC_NPROCESSORS_ONLN);
+}
+#    endif
+#endif
+
+static int
+pal__write_palette_set_json_parallel(pal_writer_t*             writer,
+                                     const pal__palette_set_t* set,
+                                     pal_json_layout_t         layout,
+                                     int                       num_threads)
+{
+#if PAL__THREADS
+    pal__json_job_t jobs[PAL_MAX_EMIT_THREADS];
+    pal__thread_t   threads[PAL_MAX_EMIT_THREADS];
+    int             started[PAL_MAX_EMIT_THREADS];
+    int             result = 0;
+    int             i;
+
+    if (num_threads <= 0)
+        num_threads = pal__num_cpus();
+    if (num_threads > PAL_MAX_EMIT_THREADS)
+        num_threads = PAL_MAX_EMIT_THREADS;
+    if (num_threads > set->num_pals)
+        num_threads = set->num_pals;
+
+    if (num_threads <= 1)
+        return pal__write_palette_set_json(writer, set, layout);
+
+    int        num_pals = set->num_pals;
+    pal_u64_t* ends = (pal_u64_t*)PAL_REALLOC(NULL, sizeof(pal_u64_t) * (size_t)num_pals);
+    if (!ends)
         return 1;
+
+    for (i = 0; i < num_threads; i++) {
+        pal__json_job_t* job = &jobs[i];
+        job->set = set;
+        job->first = i;
+        job->stride = num_threads;
+        job->layout = layout;
+        job->out.data = NULL;
+        job->out.len = job->out.capacity = 0;
+        job->ends = ends;
     }
 
-    if (s >= 0.0f && s <= 1.0f) {
-        PAL__ASSERT(!"saturation out of range");
-        return 1;
+    // the calling thread takes the first share, and any share whose
+    // thread could not be started
+    for (i = 1; i < num_threads; i++)
+        started[i] = pal__thread_start(&threads[i], &jobs[i]) == 0;
+
+    pal__run_json_job(&jobs[0]);
+    for (i = 1; i < num_threads; i++) {
+        if (started[i])
+            pal__thread_join(threads[i]);
+        else
+            pal__run_json_job(&jobs[i]);
     }
 
-    if (v >= 0.0f && v <= 1.0f) {
-        PAL__ASSERT("!value out of range");
-        return 1;
+    // the serial emitter stops at the first palette to fail, and every
+    // palette before it was rendered, whichever job it fell to
+    int failed_at = num_pals, out_failed = 0;
+    for (i = 0; i < num_threads; i++) {
+        out_failed |= jobs[i].out_failed;
+        if (jobs[i].failed_at < failed_at) {
+            failed_at = jobs[i].failed_at;
+            result = jobs[i].result;
+        }
     }
 
-    if (s == 0.0f) {
-        /* Achromatic color */
-        if (h == FTG_UNDEFINED_HUE) {
-            *r = *g = *b = v;
-        } else {
-            PAL__ASSERT(
-                !"If s == 0 and hue has value, this is an invalid HSV set");
-            return 1;
-        }
+    // stitch the sub-documents together in palette order.  after a
+    // failed palette's partial output the document is left unclosed, as
+    // the serial emitter leaves it
+    if (out_failed) {
+        result = 1;
     } else {
-        // Chromatic case: s != 0 so there is a hue.
-        float f, p, q, t;
-        int   i;
+        pal__write_palette_json_open(writer, layout);
 
-        if (h == 360.0f)
-            h = 0.0f;
-        h /= 60.0f;
+        for (i = 0; i < num_pals && i <= failed_at; i++) {
+            const pal__json_job_t* job = &jobs[i % num_threads];
+            pal_u64_t              start = i >= num_threads ? ends[i - num_threads] : 0;
+            pal_u64_t              end = i == failed_at ? job->out.len : ends[i];
 
-        i = (int)h;
-        f = h - i;
+            if (i)
+                pal__write_palette_json_separator(writer, layout);
+            if (end > start)
+                pal__write(writer, job->out.data + start, (int)(end - start));
+        }
 
-        p = v * (1.0f - s);
-        q = v * (1.0f - (s * f));
-        t = v * (1.0f - (s * (1.0f - f)));
+        if (result == 0)
+            pal__write_palette_json_close(writer, layout);
+        if (pal_writer_flush(writer) != 0 && result == 0)
+            result = 1;
+    }
 
-        switch (i) {
-        case 0:
-            *r = v;
-            *g = t;
-            *b = p;
-            break;
-        case 1:
-            *r = q;
-            *g = v;
-            *b = p;
-            break;
-        case 2:
-            *r = p;
-            *g = v;
-            *b = t;
-            break;
-        case 3:
-            *r = p;
-            *g = q;
-            *b = v;
-            break;
-        case 4:
-            *r = t;
-            *g = p;
-            *b = v;
-            break;
-        case 5:
-            *r = v;
-            *g = p;
-            *b = q;
-            break;
+    for (i = 0; i < num_threads; i++) pal_membuf_free(&jobs[i].out);
+    PAL_FREE(ends);
+
+    return result;
+#else
+    PAL__UNUSED(num_threads);
+    return pal__write_palette_set_json(writer, set, layout);
+#endif
+}
+
+PALDEF int
+pal_write_palette_json_parallel(pal_writer_t*        writer,
+                                const pal_palette_t* pals,
+                                int                  num_pals,
+                                pal_json_layout_t    layout,
+                                int                  num_threads)
+{
+    pal__palette_set_t set = {pals, NULL, num_pals};
+    return pal__write_palette_set_json_parallel(writer, &set, layout, num_threads);
+}
+
+PALDEF int
+pal_write_compact_palette_json(pal_writer_t*                       writer,
+                               const pal_compact_palette_t* const* pals,
+                               int                                 num_pals,
+                               pal_json_layout_t                   layout,
+                               int                                 num_threads)
+{
+    pal__palette_set_t set = {NULL, pals, num_pals};
+    return pal__write_palette_set_json_parallel(writer, &set, layout, num_threads);
+}
+
+// gpl only needs the title and colors, so both palette types write
+// straight from their own arrays
+static int
+pal__write_gimp_gpl(pal_writer_t*            writer,
+                    const char*              title,
+                    const pal_color_t*       colors,
+                    const pal_str_t*         color_names,
+                    const pal_string_pool_t* pool,
+                    const pal_u32_t*         color_name_ids,
+                    int                      num_colors)
+{
+    int i;
+
+    PAL__APPEND("GIMP Palette\n");
+    PAL__APPEND("Name: ");
+    if (title[0])
+        PAL__APPEND_STR(title);
+    else
+        PAL__APPEND("(untitled)");
+    PAL__APPEND("\n");
+
+
+    PAL__APPEND("# generated by ftg_palette.h\n");
+
+    // for each color
+    for (i = 0; i < num_colors; i++) {
+        // for each channel (no alpha)
+        int         j;
+        const char* name;
+
+        for (j = 0; j < 3; j++) {
+            pal_u8_t chan8 = pal_convert_channel_to_8bit(colors[i].c[j]);
+            pal__write_u64(writer, chan8);
+            PAL__APPEND(" ");
         }
+
+        name = pool ? pal_string_pool_get(pool, color_name_ids[i]) : color_names[i];
+        if (name[0])
+            PAL__APPEND_STR(name);
+        else
+            PAL__APPEND("(unnamed)");
+
+        PAL__APPEND("\n");
     }
 
-    return 0;
+    return pal_writer_flush(writer) != 0;
 }
 
-static pal_u8_t
-pal__clamp8(int val, int clamp_min, int clamp_max)
+PALDEF int
+pal_write_gimp_gpl(pal_writer_t* writer, const pal_palette_t* pal)
 {
-    if (val < clamp_min)
-        return (pal_u8_t)clamp_min;
-    if (val > clamp_max)
-        return (pal_u8_t)clamp_max;
-    return (pal_u8_t)val;
+    return pal__write_gimp_gpl(
+        writer, pal->title, pal->colors, pal->color_names, NULL, NULL, pal->num_colors);
 }
 
-inline static float
-pal__clampf32(float val, float min, float max)
+PALDEF int
+pal_write_compact_gimp_gpl(pal_writer_t* writer, const pal_compact_palette_t* pal)
 {
-    return val < min ? min : (val > max ? max : val);
+    return pal__write_gimp_gpl(writer,
+                               pal->title,
+                               pal->colors,
+                               pal->color_names,
+                               pal->pool,
+                               pal->color_name_ids,
+                               pal->num_colors);
 }
 
-inline static float
-pal__srgb_to_linear(float c)
+#undef PAL__APPEND
+#undef PAL__APPEND_STR
+#undef PAL__APPEND_JSON
+#undef PAL__APPEND_TABS
+#undef PAL__APPEND_JSON_VALUE_END
+#undef PAL__APPEND_JSON_KEYVALUE_STRING
+#undef PAL__APPEND_JSON_KEYVALUE_HEX
+#undef PAL__APPEND_JSON_KEYVALUE_U64
+
+// write callback for the fixed-buffer pal_emit_* wrappers.  keeps room
+// for a terminator and fills what it can before failing.
+typedef struct {
+    char* buf;
+    int   buf_len;
+    int   used;
+} pal__fixed_buf_t;
+
+static int
+pal__write_to_fixed_buf(void* write_data, const char* bytes, int num_bytes)
 {
-    return (c <= 0.04045f) ? c / 12.92f : PAL_POWF((c + 0.055f) / 1.055f, 2.4f);
+    pal__fixed_buf_t* fixed = (pal__fixed_buf_t*)write_data;
+    int               remaining = fixed->buf_len - 1 - fixed->used;
+    int               n = num_bytes < remaining ? num_bytes : remaining;
+
+    memcpy(fixed->buf + fixed->used, bytes, (size_t)n);
+    fixed->used += n;
+
+    if (n < num_bytes) {
+        PAL__ASSERT(!"Ran out of space appending buf");
+        return 1;
+    }
+
+    return 0;
 }
 
-inline static float
-pal__linear_to_srgb(float c)
+PALDEF int
+pal_emit_palette_json(const pal_palette_t* pals, int num_pals, char* out_buf, int out_buf_len)
 {
-    float out = (c <= 0.0031308f) ? 12.92f * c
-                                  : 1.055f * PAL_POWF(c, 1.0f / 2.4f) - 0.055f;
+    pal__fixed_buf_t fixed = {out_buf, out_buf_len, 0};
+    pal_writer_t     writer;
 
-    return pal__clampf32(out, 0.0f, 1.0f);
+    if (out_buf_len < 1)
+        return 1;
+
+    pal_writer_init(&writer, pal__write_to_fixed_buf, &fixed);
+    int result = pal_write_palette_json(&writer, pals, num_pals, PAL_JSON_LAYOUT_PRETTY);
+
+    // terminate buf no matter what
+    out_buf[fixed.used] = 0;
+
+    return result;
 }
 
-PALDEF void
-pal_color_srgb_to_linear(pal_color_t* color)
+PALDEF int
+pal_emit_gimp_gpl(const pal_palette_t* pal, char* out_buf, int out_buf_len)
 {
-    color->rgba.r = pal__srgb_to_linear(color->rgba.r);
-    color->rgba.g = pal__srgb_to_linear(color->rgba.g);
-    color->rgba.b = pal__srgb_to_linear(color->rgba.b);
+    pal__fixed_buf_t fixed = {out_buf, out_buf_len, 0};
+    pal_writer_t     writer;
+
+    if (out_buf_len < 1)
+        return 1;
+
+    pal_writer_init(&writer, pal__write_to_fixed_buf, &fixed);
+    int result = pal_write_gimp_gpl(&writer, pal);
+
+    // terminate buf no matter what
+    out_buf[fixed.used] = 0;
+
+    return result;
 }
 
-PALDEF void
-pal_color_linear_to_srgb(pal_color_t* color)
+//
+// .palb
+//
+// everything below reads and writes through explicit little-endian
+// helpers, so validation and copying work on any host.  only
+// pal_palb_view() relies on the host matching the file layout.
+//
+
+#define PAL__PALB_ALIGN 16
+
+// 'does sizeof(pal_palb_header_t) match the documented 80 bytes'
+typedef char pal__palb_header_size_check[sizeof(pal_palb_header_t) == 80 ? 1 : -1];
+
+static pal_u16_t
+pal__le16(const unsigned char* p)
 {
-    color->rgba.r = pal__linear_to_srgb(color->rgba.r);
-    color->rgba.g = pal__linear_to_srgb(color->rgba.g);
-    color->rgba.b = pal__linear_to_srgb(color->rgba.b);
+    return (pal_u16_t)(p[0] | p[1] << 8);
 }
 
-static float
-pal__max3(float a, float b, float c)
+static pal_u32_t
+pal__le32(const unsigned char* p)
 {
-    float r = a;
-    if (r < b)
-        r = b;
-    if (r < c)
-        r = c;
-    return r;
+    return (pal_u32_t)p[0] | (pal_u32_t)p[1] << 8 | (pal_u32_t)p[2] << 16 |
+           (pal_u32_t)p[3] << 24;
 }
 
-static float
-pal__min3(float a, float b, float c)
+static pal_u64_t
+pal__le64(const unsigned char* p)
 {
-    float r = a;
-    if (r > b)
-        r = b;
-    if (r > c)
-        r = c;
-    return r;
+    return (pal_u64_t)pal__le32(p) | (pal_u64_t)pal__le32(p + 4) << 32;
 }
 
-static void
-pal__get_hsv(float r, float g, float b, float* h, float* s, float* v)
+static float
+pal__lef32(const unsigned char* p)
 {
-    float max_chan = pal__max3(r, g, b);
-    float min_chan = pal__min3(r, g, b);
-    float delta;
+    pal_u32_t bits = pal__le32(p);
+    float     f;
+    memcpy(&f, &bits, sizeof(float));
+    return f;
+}
 
-    *v = max_chan;
+static int
+pal__host_is_little_endian(void)
+{
+    pal_u16_t probe = 1;
+    return *(const unsigned char*)&probe == 1;
+}
 
-    *s = (max_chan != 0.0f) ? ((max_chan - min_chan) / max_chan) : 0.0f;
+// header fields by byte offset, matching pal_palb_header_t
+#define PAL__PALB_MAGIC_AT 0
+#define PAL__PALB_VERSION_AT 4
+#define PAL__PALB_HEADER_SIZE_AT 6
+#define PAL__PALB_FILE_SIZE_AT 8
+#define PAL__PALB_FLAGS_AT 12
+#define PAL__PALB_TIMESTAMP_AT 16
+#define PAL__PALB_IS_LINEAR_AT 24
+#define PAL__PALB_NUM_COLORS_AT 28
+#define PAL__PALB_NUM_GRADIENTS_AT 30
+#define PAL__PALB_NUM_DITHER_PAIRS_AT 32
+#define PAL__PALB_NUM_HINT_KINDS_AT 34
+#define PAL__PALB_NUM_INDICES_AT 36
+#define PAL__PALB_OFFSETS_AT 40
+
+enum {
+    PAL__PALB_STRINGS,
+    PAL__PALB_COLORS,
+    PAL__PALB_COLOR_NAMES,
+    PAL__PALB_HINT_SPANS,
+    PAL__PALB_GRADIENT_NAMES,
+    PAL__PALB_GRADIENT_SPANS,
+    PAL__PALB_DITHER_PAIR_NAMES,
+    PAL__PALB_DITHER_PAIRS,
+    PAL__PALB_INDICES,
+    PAL__PALB_SECTION_MAX,
+};
 
-    if (*s == 0.0f) {
-        *h = 360.f * 2; /* undefined */
-    } else {
-        delta = max_chan - min_chan;
+// decoded header; everything validation and copying need
+typedef struct {
+    pal_u32_t file_size;
+    pal_u32_t flags;
+    pal_u32_t num_colors;
+    pal_u32_t num_gradients;
+    pal_u32_t num_dither_pairs;
+    pal_u32_t num_hint_kinds;
+    pal_u32_t num_indices;
+    pal_u32_t offset[PAL__PALB_SECTION_MAX];
+} pal__palb_layout_t;
 
-        if (r == max_chan)
-            *h = (g - b) / delta; /* Color between yellow and magenta */
-        else if (g == max_chan)
-            *h = 2.0f + (b - r) / delta; /* Color between cyan and yellow */
-        else if (b == max_chan)
-            *h = 4.0f + (r - g) / delta; /* Color between magenta and cyan */
+static void
+pal__palb_section_counts(const pal__palb_layout_t* layout,
+                         pal_u32_t                 counts[PAL__PALB_SECTION_MAX],
+                         pal_u32_t                 sizes[PAL__PALB_SECTION_MAX])
+{
+    counts[PAL__PALB_STRINGS] = PAL_PALB_STRING_MAX;
+    counts[PAL__PALB_COLORS] =
+        (layout->flags & PAL_PALB_FLAG_SHARED_COLORS) ? 0 : layout->num_colors;
+    counts[PAL__PALB_COLOR_NAMES] = layout->num_colors;
+    counts[PAL__PALB_HINT_SPANS] = layout->num_hint_kinds;
+    counts[PAL__PALB_GRADIENT_NAMES] = layout->num_gradients;
+    counts[PAL__PALB_GRADIENT_SPANS] = layout->num_gradients;
+    counts[PAL__PALB_DITHER_PAIR_NAMES] = layout->num_dither_pairs;
+    counts[PAL__PALB_DITHER_PAIRS] = layout->num_dither_pairs;
+    counts[PAL__PALB_INDICES] = layout->num_indices;
+
+    sizes[PAL__PALB_STRINGS] = PAL_MAX_STRLEN;
+    sizes[PAL__PALB_COLORS] = 16;
+    sizes[PAL__PALB_COLOR_NAMES] = PAL_MAX_STRLEN;
+    sizes[PAL__PALB_HINT_SPANS] = 8;
+    sizes[PAL__PALB_GRADIENT_NAMES] = PAL_MAX_STRLEN;
+    sizes[PAL__PALB_GRADIENT_SPANS] = 8;
+    sizes[PAL__PALB_DITHER_PAIR_NAMES] = PAL_MAX_STRLEN;
+    sizes[PAL__PALB_DITHER_PAIRS] = 4;
+    sizes[PAL__PALB_INDICES] = 2;
+}
 
-        *h *= 60.0f; /* Convert hue to degrees */
-        if (*h < 0.0f)
-            *h += 360.0f;
+// every pal_str_t in a section must be terminated within PAL_MAX_STRLEN
+static int
+pal__palb_strings_valid(const unsigned char* s, pal_u32_t count)
+{
+    pal_u32_t i;
+    for (i = 0; i < count; i++, s += PAL_MAX_STRLEN) {
+        if (!memchr(s, 0, PAL_MAX_STRLEN))
+            return 0;
     }
+
+    return 1;
 }
 
+static int
+pal__palb_spans_valid(const unsigned char* spans, pal_u32_t count, pal_u32_t num_indices)
+{
+    pal_u32_t i;
+    for (i = 0; i < count; i++, spans += 8) {
+        pal_u64_t first = pal__le32(spans);
+        pal_u64_t span_count = pal__le32(spans + 4);
+        if (first + span_count > num_indices)
+            return 0;
+    }
 
+    return 1;
+}
 
+// validate a whole .palb with the given flags and decode its header.
+// returns 0 if valid.
 static int
-pal__utf16be_to_utf8(const unsigned char** p_bytes,
-                     int                   num_utf16_codepoints,
-                     char*                 dst_utf8_str,
-                     int                   dst_max_bytes)
+pal__palb_validate(const unsigned char* b,
+                   pal_u64_t            len,
+                   pal_u32_t            flags,
+                   pal__palb_layout_t*  out_layout)
 {
-    char*       p_dst = dst_utf8_str;
-    char* const p_end = dst_utf8_str + dst_max_bytes;
-
-    PAL__ASSERT(dst_max_bytes > 0);
-    PAL__ASSERT(p_bytes);
-    PAL__ASSERT(dst_utf8_str);
+    pal__palb_layout_t layout;
+    pal_u32_t          counts[PAL__PALB_SECTION_MAX];
+    pal_u32_t          sizes[PAL__PALB_SECTION_MAX];
+    pal_u32_t          i;
 
-    int i;
-    for (i = 0; i < num_utf16_codepoints; ++i) {
-        pal_u16_t codepoint = pal__read_beu16(p_bytes);
+    if (len < sizeof(pal_palb_header_t))
+        return 1;
 
-        if (codepoint < 0x80) {
-            // single byte
-            if (p_end <= p_dst + 1)
-                break;
+    if (pal__le32(b + PAL__PALB_MAGIC_AT) != PAL_PALB_MAGIC ||
+        pal__le16(b + PAL__PALB_VERSION_AT) != PAL_PALB_VERSION ||
+        pal__le16(b + PAL__PALB_HEADER_SIZE_AT) != sizeof(pal_palb_header_t))
+        return 1;
 
-            *p_dst++ = (char)codepoint;
-        } else if (codepoint < 0x800) {
-            // two byte
-            if (p_end <= p_dst + 2)
-                break;
+    layout.file_size = pal__le32(b + PAL__PALB_FILE_SIZE_AT);
+    layout.flags = pal__le32(b + PAL__PALB_FLAGS_AT);
+    layout.num_colors = pal__le16(b + PAL__PALB_NUM_COLORS_AT);
+    layout.num_gradients = pal__le16(b + PAL__PALB_NUM_GRADIENTS_AT);
+    layout.num_dither_pairs = pal__le16(b + PAL__PALB_NUM_DITHER_PAIRS_AT);
+    layout.num_hint_kinds = pal__le16(b + PAL__PALB_NUM_HINT_KINDS_AT);
+    layout.num_indices = pal__le32(b + PAL__PALB_NUM_INDICES_AT);
+    for (i = 0; i < PAL__PALB_SECTION_MAX; i++)
+        layout.offset[i] = pal__le32(b + PAL__PALB_OFFSETS_AT + i * 4);
+
+    if (layout.file_size > len || layout.file_size < sizeof(pal_palb_header_t) ||
+        layout.flags != flags)
+        return 1;
 
-            *p_dst++ = (char)(0xC0 | (codepoint >> 6));
-            *p_dst++ = (char)(0x80 | (codepoint & 0x3F));
-        } else {
-            // three byte
-            if (p_end <= p_dst + 3)
-                break;
+    // every section is aligned and lies between the header and file end
+    pal__palb_section_counts(&layout, counts, sizes);
+    for (i = 0; i < PAL__PALB_SECTION_MAX; i++) {
+        pal_u64_t end = (pal_u64_t)layout.offset[i] + (pal_u64_t)counts[i] * sizes[i];
 
-            *p_dst++ = (char)(0xE0 | (codepoint >> 12));
-            *p_dst++ = (char)(0x80 | ((codepoint >> 6) & 0x3F));
-            *p_dst++ = (char)(0x80 | (codepoint & 0x3F));
-        }
+        if (layout.offset[i] % PAL__PALB_ALIGN != 0 ||
+            layout.offset[i] < sizeof(pal_palb_header_t) || end > layout.file_size)
+            return 1;
     }
 
-    // silently truncate if needed, adding a null terminator in any case
-    if (p_dst == p_end - 1)
-        p_dst--;
-    *p_dst = 0;
-
-    return 0;
-}
-
-#define PAL__AT_END_OF_DATA bytes + len <= p_bytes
-#define PAL__DOES_NOT_HAVE_BYTES(n) bytes + len < p_bytes + (n)
-
-PALDEF int
-pal_parse_aco(const unsigned char* bytes,
-              unsigned int         len,
-              pal_palette_t*       out_pal,
-              const char*          aco_url)
-{
-    int                  i;
-    const unsigned char* p_bytes = bytes;
-    //
-    //  parse header
-    pal_u16_t version = pal__read_beu16(&p_bytes);
-    if (PAL__AT_END_OF_DATA) {
-        PAL__ASSERT(!"end of bytes reading header");
+    if (!pal__palb_strings_valid(b + layout.offset[PAL__PALB_STRINGS], PAL_PALB_STRING_MAX) ||
+        !pal__palb_strings_valid(b + layout.offset[PAL__PALB_COLOR_NAMES], layout.num_colors) ||
+        !pal__palb_strings_valid(b + layout.offset[PAL__PALB_GRADIENT_NAMES],
+                                 layout.num_gradients) ||
+        !pal__palb_strings_valid(b + layout.offset[PAL__PALB_DITHER_PAIR_NAMES],
+                                 layout.num_dither_pairs))
         return 1;
-    }
 
-    if (version != 1 && version != 2) {
-        PAL__ASSERT(!"aco file version must be 1 or 2");
+    if (!pal__palb_spans_valid(
+            b + layout.offset[PAL__PALB_HINT_SPANS], layout.num_hint_kinds, layout.num_indices) ||
+        !pal__palb_spans_valid(b + layout.offset[PAL__PALB_GRADIENT_SPANS],
+                               layout.num_gradients,
+                               layout.num_indices))
         return 1;
-    }
 
-    out_pal->num_colors = pal__read_beu16(&p_bytes);
-    if (PAL__AT_END_OF_DATA) {
-        PAL__ASSERT(!"end of bytes after header");
-        return 1;
+    // every color reference is in range
+    for (i = 0; i < layout.num_indices; i++) {
+        if (pal__le16(b + layout.offset[PAL__PALB_INDICES] + i * 2) >= layout.num_colors)
+            return 1;
     }
 
-    //
-    // set source fields
-    if (aco_url != NULL) {
-        pal__strncpy(out_pal->source.url, aco_url, PAL_MAX_STRLEN);
+    for (i = 0; i < layout.num_dither_pairs * 2; i++) {
+        if (pal__le16(b + layout.offset[PAL__PALB_DITHER_PAIRS] + i * 2) >= layout.num_colors)
+            return 1;
     }
-    pal__strncpy(
-        out_pal->source.conversion_tool,
-        "ftg_palette.h - https://github.com/frogtoss/ftg_toolbox_public",
-        PAL_MAX_STRLEN);
-    out_pal->source.conversion_timestamp = PAL_TIME(NULL);
-
-    struct {
-        pal_u16_t color_space;
-        pal_u16_t w;
-        pal_u16_t x;
-        pal_u16_t y;
-        pal_u16_t z;
 
-        // v2-specific
-        pal_u16_t zero;
-        pal_u16_t string_len;
-        // also, a null terminated big endian string that is len 16-bit chars
-        // long plus an additional byte for the null terminator
-    } aco_color;
+    *out_layout = layout;
+    return 0;
+}
 
-    enum color_space {
-        CS_RGB = 0,
-        CS_HSB = 1,
-        CS_CMYK = 2,
-        CS_LAB = 3,
-        CS_GRAYSCALE = 4,
-        CS_WIDE_CMYK = 5,
-    };
+PALDEF int
+pal_palb_view(const void* bytes, pal_u64_t len, pal_palb_view_t* out_view)
+{
+    const unsigned char* b = (const unsigned char*)bytes;
+    pal__palb_layout_t   layout;
 
-    for (i = 0; i < out_pal->num_colors; i++) {
-        // confirm enough space for u16 values before reading through
-        if (PAL__DOES_NOT_HAVE_BYTES(7 * 2)) {
-            PAL__ASSERT(!"end of bytes parsing color");
-            return 1;
-        }
-        aco_color.color_space = pal__read_beu16(&p_bytes);
-        aco_color.w = pal__read_beu16(&p_bytes);
-        aco_color.x = pal__read_beu16(&p_bytes);
-        aco_color.y = pal__read_beu16(&p_bytes);
-        aco_color.z = pal__read_beu16(&p_bytes);
+    if (!pal__host_is_little_endian())
+        return 2;
 
-        switch (aco_color.color_space) {
-        case CS_RGB:
-            out_pal->colors[i].rgba.r = (float)aco_color.w / 65535.0f;
-            out_pal->colors[i].rgba.g = (float)aco_color.x / 65535.0f;
-            out_pal->colors[i].rgba.b = (float)aco_color.y / 65535.0f;
-            out_pal->colors[i].rgba.a = 1.0f;
-            PAL__ASSERT(aco_color.z == 0);
-            break;
+    if (((size_t)b & 7) != 0 || pal__palb_validate(b, len, 0, &layout) != 0)
+        return 1;
 
-        case CS_HSB: {
-            float hue = aco_color.w / 182.04f;
-            float sat = aco_color.x / 655.35f;
-            float val = aco_color.y / 655.35f;
-            int   result = pal__get_rgb(hue,
-                                      sat,
-                                      val,
-                                      &out_pal->colors[i].rgba.r,
-                                      &out_pal->colors[i].rgba.g,
-                                      &out_pal->colors[i].rgba.b);
-            out_pal->colors[i].rgba.a = 1.0f;
+    out_view->header = (const pal_palb_header_t*)b;
+    out_view->strings = (const pal_str_t*)(b + layout.offset[PAL__PALB_STRINGS]);
+    out_view->colors = (const pal_color_t*)(b + layout.offset[PAL__PALB_COLORS]);
+    out_view->color_names = (const pal_str_t*)(b + layout.offset[PAL__PALB_COLOR_NAMES]);
+    out_view->hint_spans = (const pal_palb_span_t*)(b + layout.offset[PAL__PALB_HINT_SPANS]);
+    out_view->gradient_names = (const pal_str_t*)(b + layout.offset[PAL__PALB_GRADIENT_NAMES]);
+    out_view->gradient_spans =
+        (const pal_palb_span_t*)(b + layout.offset[PAL__PALB_GRADIENT_SPANS]);
+    out_view->dither_pair_names =
+        (const pal_str_t*)(b + layout.offset[PAL__PALB_DITHER_PAIR_NAMES]);
+    out_view->dither_pairs =
+        (const pal_dither_pair_t*)(b + layout.offset[PAL__PALB_DITHER_PAIRS]);
+    out_view->indices = (const pal_u16_t*)(b + layout.offset[PAL__PALB_INDICES]);
 
-            // stop all processing as soon as there is one invalid color
-            if (result != 0)
-                return result;
-        } break;
+    return 0;
+}
 
-        default:
-            PAL__ASSERT(!"unsupported colorspace for color");
-            return 1;
-        }
+// copy the indices of a span into out, returning the count
+static pal_u32_t
+pal__palb_copy_span(const unsigned char*      b,
+                    const pal__palb_layout_t* layout,
+                    const unsigned char*      span,
+                    pal_u16_t*                out)
+{
+    const unsigned char* indices = b + layout->offset[PAL__PALB_INDICES];
+    pal_u32_t            first = pal__le32(span);
+    pal_u32_t            count = pal__le32(span + 4);
+    pal_u32_t            i;
 
-        if (version == 2) {
-            aco_color.zero = pal__read_beu16(&p_bytes);
-            aco_color.string_len = pal__read_beu16(&p_bytes);
+    for (i = 0; i < count; i++) out[i] = pal__le16(indices + (first + i) * 2);
 
-            // confirm enough bytes for string
-            if (PAL__DOES_NOT_HAVE_BYTES(aco_color.string_len)) {
-                PAL__ASSERT(!"end of bytes parsing color's string name");
-                return 1;
-            }
-            if (aco_color.string_len > 0)
-                pal__utf16be_to_utf8(&p_bytes,
-                                     (int)aco_color.string_len,
-                                     out_pal->color_names[i],
-                                     PAL_MAX_STRLEN);
-            else
-                out_pal->color_names[i][0] = 0;
-        } else {
-            /* version 1 does not have color names */
-            out_pal->color_names[i][0] = 0;
-        }
-    }
+    return count;
+}
 
-    // fill out the remaining fields
-    out_pal->title[0] = 0;
-    out_pal->num_gradients = 0;
-    out_pal->num_dither_pairs = 0;
-    for (i = 0; i < PAL_MAX_HINTS; i++) out_pal->num_hints[i] = 0;
-    pal__strncpy(out_pal->color_space.name, COLOR_SPACE_SRGB, PAL_MAX_STRLEN);
-    pal__strncpy(out_pal->color_space.icc_filename, ICC_SRGB, PAL_MAX_STRLEN);
-    out_pal->color_space.is_linear = false;
+// grow pal to hold num_colors colors, hint lists of up to max_hints
+// colors, gradients of up to max_indices colors and num_dither_pairs
+// dither pairs.  returns 1 if any is over its limit.
+static int
+pal__reserve_contents(pal_palette_t* pal,
+                      pal_u32_t      num_colors,
+                      pal_u32_t      max_hints,
+                      pal_u32_t      max_indices,
+                      pal_u32_t      num_dither_pairs)
+{
+    pal_u32_t capacity = num_colors;
 
-    return 0;
-}
+    if (max_hints > PAL_MAX_COLORS || max_indices > PAL_MAX_GRADIENT_INDICES ||
+        num_dither_pairs > PAL_MAX_DITHER_PAIRS)
+        return 1;
 
-#undef PAL__AT_END_OF_DATA
-#undef PAL__DOES_NOT_HAVE_BYTES
+    if (max_hints > capacity)
+        capacity = max_hints;
+    if ((max_indices + 1) / 2 > capacity)
+        capacity = (max_indices + 1) / 2;
+    if ((num_dither_pairs + 1) / 2 > capacity)
+        capacity = (num_dither_pairs + 1) / 2;
 
+    return capacity > PAL_MAX_COLORS || pal_reserve(pal, (int)capacity) != 0;
+}
 
-int
-pal_parse_bytes(const unsigned char* bytes,
-                unsigned int         len,
-                int                  num_channels,
-                pal_palette_t*       out_pal,
-                const char*          data_url)
+// copy validated .palb bytes into a pal_palette_t, taking the raw
+// colors from colors: the colors section, or a shared color block
+static int
+pal__palb_copy(const unsigned char*      b,
+               const pal__palb_layout_t* layout,
+               const unsigned char*      colors,
+               pal_palette_t*            out_pal)
 {
-    if (num_channels != 3 && num_channels != 4) {
-        PAL__ASSERT(!"num_channels must be 3 or 4");
+    const unsigned char* strings = b + layout->offset[PAL__PALB_STRINGS];
+    pal_u32_t            max_hints = 0, max_indices = 0;
+    pal_u32_t            i, j;
+
+    if (layout->num_colors > PAL_MAX_COLORS || layout->num_gradients > PAL_MAX_GRADIENTS ||
+        layout->num_dither_pairs > PAL_MAX_DITHER_PAIRS)
         return 1;
+
+    for (i = 0; i < layout->num_gradients; i++) {
+        const unsigned char* span = b + layout->offset[PAL__PALB_GRADIENT_SPANS] + i * 8;
+        if (pal__le32(span + 4) > max_indices)
+            max_indices = pal__le32(span + 4);
     }
 
-    if ((len % num_channels) != 0) {
-        PAL__ASSERT(!"more input bytes than expected for number of channels");
-        return 1;
+    // hint kinds this build doesn't know are dropped
+    for (i = 0; i < layout->num_hint_kinds && i < PAL_MAX_HINTS; i++) {
+        const unsigned char* span = b + layout->offset[PAL__PALB_HINT_SPANS] + i * 8;
+        if (pal__le32(span + 4) > max_hints)
+            max_hints = pal__le32(span + 4);
     }
 
-    if (len / num_channels > PAL_MAX_COLORS) {
-        PAL__ASSERT(!"PAL_MAX_COLORS exceeded");
+    pal_clear(out_pal);
+    if (pal__reserve_contents(
+            out_pal, layout->num_colors, max_hints, max_indices, layout->num_dither_pairs) != 0)
         return 1;
-    }
 
-    if (data_url != NULL) {
-        pal__strncpy(out_pal->source.url, data_url, PAL_MAX_STRLEN);
+    memcpy(out_pal->title, strings + PAL_PALB_STRING_TITLE * PAL_MAX_STRLEN, PAL_MAX_STRLEN);
+    memcpy(out_pal->source.url, strings + PAL_PALB_STRING_URL * PAL_MAX_STRLEN, PAL_MAX_STRLEN);
+    memcpy(out_pal->source.conversion_tool,
+           strings + PAL_PALB_STRING_CONVERSION_TOOL * PAL_MAX_STRLEN,
+           PAL_MAX_STRLEN);
+    memcpy(out_pal->color_space.name,
+           strings + PAL_PALB_STRING_COLOR_SPACE_NAME * PAL_MAX_STRLEN,
+           PAL_MAX_STRLEN);
+    memcpy(out_pal->color_space.icc_filename,
+           strings + PAL_PALB_STRING_ICC_FILENAME * PAL_MAX_STRLEN,
+           PAL_MAX_STRLEN);
+    out_pal->source.conversion_timestamp = pal__le64(b + PAL__PALB_TIMESTAMP_AT);
+    out_pal->color_space.is_linear = pal__le32(b + PAL__PALB_IS_LINEAR_AT) != 0;
+
+    out_pal->num_colors = (pal_u16_t)layout->num_colors;
+    for (i = 0; i < layout->num_colors; i++) {
+        const unsigned char* color = colors + i * 16;
+        for (j = 0; j < 4; j++) out_pal->colors[i].c[j] = pal__lef32(color + j * 4);
     }
-    pal__strncpy(
-        out_pal->source.conversion_tool,
-        "ftg_palette.h - https://github.com/frogtoss/ftg_toolbox_public",
-        PAL_MAX_STRLEN);
-    out_pal->source.conversion_timestamp = PAL_TIME(NULL);
+    memcpy(out_pal->color_names,
+           b + layout->offset[PAL__PALB_COLOR_NAMES],
+           (size_t)layout->num_colors * PAL_MAX_STRLEN);
 
-    // one slow loop to rule them all
-    pal_u16_t       i = 0;
-    const pal_u8_t* p;
-    for (p = bytes; p < bytes + len; p += num_channels, i++) {
-        out_pal->colors[i].rgba.r = pal_convert_channel_to_f32(p[0]);
-        out_pal->colors[i].rgba.g = pal_convert_channel_to_f32(p[1]);
-        out_pal->colors[i].rgba.b = pal_convert_channel_to_f32(p[2]);
-        out_pal->colors[i].rgba.a =
-            num_channels == 4 ? pal_convert_channel_to_f32(p[3]) : 1.0f;
+    for (i = 0; i < layout->num_hint_kinds && i < PAL_MAX_HINTS; i++) {
+        out_pal->num_hints[i] = (pal_u16_t)pal__palb_copy_span(
+            b, layout, b + layout->offset[PAL__PALB_HINT_SPANS] + i * 8, out_pal->hint_colors[i]);
     }
-    out_pal->num_colors = i;
 
-
-    for (i = 0; i < out_pal->num_colors; i++) {
-        char num_buf[64];
-
-        char* p_num_buf = pal__int_to_str(i, num_buf, 64, 10);
-        int   num_len = pal__strlen(p_num_buf);
-
-        pal__strncpy(out_pal->color_names[i], p_num_buf, PAL_MAX_STRLEN);
-        pal__strncpy(out_pal->color_names[i] + num_len,
-                     " from bytes",
-                     PAL_MAX_STRLEN - num_len);
+    out_pal->num_gradients = (pal_u16_t)layout->num_gradients;
+    memcpy(out_pal->gradient_names,
+           b + layout->offset[PAL__PALB_GRADIENT_NAMES],
+           (size_t)layout->num_gradients * PAL_MAX_STRLEN);
+    for (i = 0; i < layout->num_gradients; i++) {
+        out_pal->gradients[i].num_indices =
+            (int)pal__palb_copy_span(b,
+                                     layout,
+                                     b + layout->offset[PAL__PALB_GRADIENT_SPANS] + i * 8,
+                                     out_pal->gradients[i].indices);
     }
 
-    // fill out the remaining fields
-    out_pal->title[0] = 0;
-    out_pal->num_gradients = 0;
-    out_pal->num_dither_pairs = 0;
-    for (i = 0; i < PAL_MAX_HINTS; i++) out_pal->num_hints[i] = 0;
-    pal__palette_set_linear(out_pal);
+    out_pal->num_dither_pairs = (pal_u16_t)layout->num_dither_pairs;
+    memcpy(out_pal->dither_pair_names,
+           b + layout->offset[PAL__PALB_DITHER_PAIR_NAMES],
+           (size_t)layout->num_dither_pairs * PAL_MAX_STRLEN);
+    for (i = 0; i < layout->num_dither_pairs; i++) {
+        const unsigned char* pair = b + layout->offset[PAL__PALB_DITHER_PAIRS] + i * 4;
+        out_pal->dither_pairs[i].index0 = pal__le16(pair);
+        out_pal->dither_pairs[i].index1 = pal__le16(pair + 2);
+    }
 
     return 0;
 }
 
-PALDEF void
-pal_palette_linear_to_srgb(pal_palette_t* pal)
+PALDEF int
+pal_palb_to_palette(const pal_palb_view_t* view, pal_palette_t* out_pal)
 {
-    // this function is really basic by design, and does not do
-    // anything if the palette is not explicitly linear by string
-    // compare on name
-    if (!pal__strmatch(COLOR_SPACE_LINEAR_SRGB,
-                       sizeof(COLOR_SPACE_LINEAR_SRGB),
-                       pal->color_space.name,
-                       pal__strlen(pal->color_space.name)))
-        return;
+    const unsigned char* b = (const unsigned char*)view->header;
+    pal__palb_layout_t   layout;
 
-    int i;
-    for (i = 0; i < pal->num_colors; i++) {
-        pal_color_t* color = &pal->colors[i];
-        pal_color_linear_to_srgb(color);
-    }
+    // already validated; this only decodes the header again
+    if (pal__palb_validate(b, view->header->file_size, 0, &layout) != 0)
+        return 1;
 
-    pal__palette_set_srgb(pal);
+    return pal__palb_copy(b, &layout, b + layout.offset[PAL__PALB_COLORS], out_pal);
 }
 
-PALDEF void
-pal_palette_srgb_to_linear(pal_palette_t* pal)
+PALDEF int
+pal_parse_palb(const unsigned char* bytes, unsigned int len, pal_palette_t* out_pal)
 {
-    if (!pal__strmatch(COLOR_SPACE_SRGB,
-                       sizeof(COLOR_SPACE_SRGB),
-                       pal->color_space.name,
-                       pal__strlen(pal->color_space.name)))
-        return;
-
-    int i;
-    for (i = 0; i < pal->num_colors; i++) {
-        pal_color_t* color = &pal->colors[i];
-        pal_color_srgb_to_linear(color);
-    }
+    pal__palb_layout_t layout;
 
+    if (pal__palb_validate(bytes, len, 0, &layout) != 0)
+        return 1;
 
-    pal__palette_set_linear(pal);
+    return pal__palb_copy(bytes, &layout, bytes + layout.offset[PAL__PALB_COLORS], out_pal);
 }
 
-static int
-pal__is_base_10_digit(char c)
+static void
+pal__write_le16(pal_writer_t* writer, pal_u32_t v)
 {
-    return c >= '0' && c <= '9';
+    unsigned char b[2] = {(unsigned char)v, (unsigned char)(v >> 8)};
+    pal__write(writer, (const char*)b, 2);
 }
 
-
-static int
-pal__is_space(char c)
+static void
+pal__write_le32(pal_writer_t* writer, pal_u32_t v)
 {
-    return c == ' ' || c == '\t';
+    unsigned char b[4] = {
+        (unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24)};
+    pal__write(writer, (const char*)b, 4);
 }
 
-static int
-pal__parse_base10_int(const char** pp, const char* end)
+// zero fill up to the next section
+static void
+pal__write_palb_pad(pal_writer_t* writer, pal_u32_t offset)
 {
-    int         val = 0;
-    const char* p = *pp;
-    while (p < end && pal__is_space(*p)) ++p;
-    while (p < end && pal__is_base_10_digit(*p)) {
-        val = val * 10 + (*p - '0');
-        ++p;
-    }
-    *pp = p;
-    return val;
+    static const char ZEROS[PAL__PALB_ALIGN] = {0};
+    pal__write(writer, ZEROS, (int)(offset - (pal_u32_t)writer->bytes_written));
 }
 
 static void
-pal__parse_name(const char* p, const char* end, char* out)
+pal__write_palb_str(pal_writer_t* writer, const char* str)
 {
-    unsigned int i = 0;
+    char buf[PAL_MAX_STRLEN] = {0};
+    int  len = 0;
 
-    while (p < end && (*p == ' ')) p++;
+    // everything after the terminator is zeroed, so equal palettes give
+    // equal files
+    while (len < PAL_MAX_STRLEN - 1 && str[len]) len++;
+    memcpy(buf, str, (size_t)len);
 
-    while (p < end && *p != '\n' && *p != '\r' && i < PAL_MAX_STRLEN - 1) {
-        out[i++] = *p++;
-    }
-    out[i] = 0;
+    pal__write(writer, buf, PAL_MAX_STRLEN);
+}
+
+// check pal's color references and lay out its .palb.  returns 0, or 2
+// on an invalid reference.
+static int
+pal__palb_plan(const pal_palette_t* pal, pal_u32_t flags, pal__palb_layout_t* out_layout)
+{
+    pal__palb_layout_t layout;
+    pal_u32_t          counts[PAL__PALB_SECTION_MAX];
+    pal_u32_t          sizes[PAL__PALB_SECTION_MAX];
+    pal_u32_t          offset = sizeof(pal_palb_header_t);
+    int                i, j;
+
+    layout.flags = flags;
+    layout.num_colors = pal->num_colors;
+    layout.num_gradients = pal->num_gradients;
+    layout.num_dither_pairs = pal->num_dither_pairs;
+    layout.num_hint_kinds = HINT_MAX;
+    layout.num_indices = 0;
+
+    // hints and gradients share one pool of color indices
+    for (i = 0; i < HINT_MAX; i++) {
+        for (j = 0; j < pal->num_hints[i]; j++) {
+            if (pal->hint_colors[i][j] >= pal->num_colors) {
+                PAL__ASSERT(!"invalid color index in hint");
+                return 2;
+            }
+        }
+        layout.num_indices += pal->num_hints[i];
+    }
+
+    for (i = 0; i < pal->num_gradients; i++) {
+        for (j = 0; j < pal->gradients[i].num_indices; j++) {
+            if (pal->gradients[i].indices[j] >= pal->num_colors) {
+                PAL__ASSERT(!"invalid color index in gradient");
+                return 2;
+            }
+        }
+        layout.num_indices += (pal_u32_t)pal->gradients[i].num_indices;
+    }
+
+    for (i = 0; i < pal->num_dither_pairs; i++) {
+        if (pal->dither_pairs[i].index0 >= pal->num_colors ||
+            pal->dither_pairs[i].index1 >= pal->num_colors) {
+            PAL__ASSERT(!"dither pair index out of range");
+            return 2;
+        }
+    }
+
+    pal__palb_section_counts(&layout, counts, sizes);
+    for (i = 0; i < PAL__PALB_SECTION_MAX; i++) {
+        offset = (offset + PAL__PALB_ALIGN - 1) & ~(pal_u32_t)(PAL__PALB_ALIGN - 1);
+        layout.offset[i] = offset;
+        offset += counts[i] * sizes[i];
+    }
+    layout.file_size = offset;
+
+    *out_layout = layout;
+    return 0;
+}
+
+// write pal as laid out by pal__palb_plan
+static void
+pal__write_palb_record(pal_writer_t*             writer,
+                       const pal_palette_t*      pal,
+                       const pal__palb_layout_t* layout)
+{
+    int i, j;
+
+    // bytes_written is the record offset from here on
+    pal_u64_t base = writer->bytes_written;
+    writer->bytes_written = 0;
+
+    //
+    // header
+    pal__write_le32(writer, PAL_PALB_MAGIC);
+    pal__write_le16(writer, PAL_PALB_VERSION);
+    pal__write_le16(writer, sizeof(pal_palb_header_t));
+    pal__write_le32(writer, layout->file_size);
+    pal__write_le32(writer, layout->flags);
+    pal__write_le32(writer, (pal_u32_t)pal->source.conversion_timestamp);
+    pal__write_le32(writer, (pal_u32_t)(pal->source.conversion_timestamp >> 32));
+    pal__write_le32(writer, pal->color_space.is_linear ? 1 : 0);
+    pal__write_le16(writer, layout->num_colors);
+    pal__write_le16(writer, layout->num_gradients);
+    pal__write_le16(writer, layout->num_dither_pairs);
+    pal__write_le16(writer, layout->num_hint_kinds);
+    pal__write_le32(writer, layout->num_indices);
+    for (i = 0; i < PAL__PALB_SECTION_MAX; i++) pal__write_le32(writer, layout->offset[i]);
+    pal__write_le32(writer, 0);
+
+    //
+    // sections, in offset order
+    pal__write_palb_pad(writer, layout->offset[PAL__PALB_STRINGS]);
+    pal__write_palb_str(writer, pal->title);
+    pal__write_palb_str(writer, pal->source.url);
+    pal__write_palb_str(writer, pal->source.conversion_tool);
+    pal__write_palb_str(writer, pal->color_space.name);
+    pal__write_palb_str(writer, pal->color_space.icc_filename);
+
+    pal__write_palb_pad(writer, layout->offset[PAL__PALB_COLORS]);
+    for (i = 0; i < pal->num_colors && !(layout->flags & PAL_PALB_FLAG_SHARED_COLORS); i++) {
+        for (j = 0; j < 4; j++) {
+            pal_u32_t bits;
+            memcpy(&bits, &pal->colors[i].c[j], sizeof(float));
+            pal__write_le32(writer, bits);
+        }
+    }
+
+    pal__write_palb_pad(writer, layout->offset[PAL__PALB_COLOR_NAMES]);
+    for (i = 0; i < pal->num_colors; i++) pal__write_palb_str(writer, pal->color_names[i]);
+
+    pal_u32_t first = 0;
+
+    pal__write_palb_pad(writer, layout->offset[PAL__PALB_HINT_SPANS]);
+    for (i = 0; i < HINT_MAX; i++) {
+        pal__write_le32(writer, first);
+        pal__write_le32(writer, pal->num_hints[i]);
+        first += pal->num_hints[i];
+    }
+
+    pal__write_palb_pad(writer, layout->offset[PAL__PALB_GRADIENT_NAMES]);
+    for (i = 0; i < pal->num_gradients; i++) pal__write_palb_str(writer, pal->gradient_names[i]);
+
+    pal__write_palb_pad(writer, layout->offset[PAL__PALB_GRADIENT_SPANS]);
+    for (i = 0; i < pal->num_gradients; i++) {
+        pal__write_le32(writer, first);
+        pal__write_le32(writer, (pal_u32_t)pal->gradients[i].num_indices);
+        first += (pal_u32_t)pal->gradients[i].num_indices;
+    }
+
+    pal__write_palb_pad(writer, layout->offset[PAL__PALB_DITHER_PAIR_NAMES]);
+    for (i = 0; i < pal->num_dither_pairs; i++)
+        pal__write_palb_str(writer, pal->dither_pair_names[i]);
+
+    pal__write_palb_pad(writer, layout->offset[PAL__PALB_DITHER_PAIRS]);
+    for (i = 0; i < pal->num_dither_pairs; i++) {
+        pal__write_le16(writer, pal->dither_pairs[i].index0);
+        pal__write_le16(writer, pal->dither_pairs[i].index1);
+    }
+
+    pal__write_palb_pad(writer, layout->offset[PAL__PALB_INDICES]);
+    for (i = 0; i < HINT_MAX; i++) {
+        for (j = 0; j < pal->num_hints[i]; j++) pal__write_le16(writer, pal->hint_colors[i][j]);
+    }
+    for (i = 0; i < pal->num_gradients; i++) {
+        for (j = 0; j < pal->gradients[i].num_indices; j++)
+            pal__write_le16(writer, pal->gradients[i].indices[j]);
+    }
+
+    PAL__ASSERT(writer->error || writer->bytes_written == layout->file_size);
+    writer->bytes_written += base;
 }
 
-
-
-
 PALDEF int
-pal_parse_gpl(const unsigned char* bytes,
-              unsigned int         len,
-              pal_palette_t*       out_pal,
-              const char*          gpl_source_url)
+pal_write_palb(pal_writer_t* writer, const pal_palette_t* pal)
 {
-    const char* p = (const char*)bytes;
-    const char* end = p + (len > 1 ? len - 1 : 0);
+    pal__palb_layout_t layout;
 
-    const char MAGIC[] = "GIMP Palette\n";
+    if (pal__palb_plan(pal, 0, &layout) != 0)
+        return 2;
 
-    // validate magic
-    {
-        unsigned int i;
-        for (i = 0; i < sizeof(MAGIC) - 1; ++i) {
-            if (p >= end || *p != (unsigned char)MAGIC[i]) {
-                PAL__ASSERT(!"\"GIMP Palette\" magic string not found");
-                return 1;
+    pal__write_palb_record(writer, pal, &layout);
+    return pal_writer_flush(writer) != 0;
+}
+
+PALDEF int
+pal_write_compact_palb(pal_writer_t* writer, const pal_compact_palette_t* pal)
+{
+    pal_palette_t* scratch = pal__alloc_scratch_palette();
+    int            result = 1;
+
+    if (scratch && pal_compact_palette_expand(pal, scratch) == 0)
+        result = pal_write_palb(writer, scratch);
+
+    pal__free_scratch_palette(scratch);
+    return result;
+}
+
+//
+// .pala archives
+//
+
+// 'does sizeof(pal_pala_header_t) match the documented 48 bytes'
+typedef char pal__pala_header_size_check[sizeof(pal_pala_header_t) == 48 ? 1 : -1];
+
+#define PAL__PALA_MAGIC_AT 0
+#define PAL__PALA_VERSION_AT 4
+#define PAL__PALA_HEADER_SIZE_AT 6
+#define PAL__PALA_FILE_SIZE_AT 8
+#define PAL__PALA_FLAGS_AT 12
+#define PAL__PALA_NUM_PALETTES_AT 16
+#define PAL__PALA_NUM_COLOR_BLOCKS_AT 20
+#define PAL__PALA_NUM_TITLE_SLOTS_AT 24
+#define PAL__PALA_OFFSETS_AT 28
+
+#define PAL__PALA_BLOCK_SIZE 16
+#define PAL__PALA_ENTRY_SIZE (PAL_MAX_STRLEN + 16)
+
+// fnv-1a of a title or name as stored: at most PAL_MAX_STRLEN-1
+// characters
+static pal_u32_t
+pal__str_hash(const char* str)
+{
+    pal_u32_t hash = 2166136261u;
+    int       i;
+
+    for (i = 0; i < PAL_MAX_STRLEN - 1 && str[i]; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static pal_u32_t
+pal__pala_align(pal_u64_t offset)
+{
+    return (pal_u32_t)((offset + PAL__PALB_ALIGN - 1) & ~(pal_u64_t)(PAL__PALB_ALIGN - 1));
+}
+
+// section [offset, offset + size) is aligned and inside a file of file_size
+static int
+pal__pala_section_valid(pal_u32_t offset, pal_u64_t size, pal_u32_t file_size)
+{
+    return offset % PAL__PALB_ALIGN == 0 && offset >= sizeof(pal_pala_header_t) &&
+           (pal_u64_t)offset + size <= file_size;
+}
+
+PALDEF int
+pal_pala_open(const unsigned char* bytes, pal_u64_t len, pal_pala_t* out_archive)
+{
+    pal_pala_t a;
+    pal_u32_t  i;
+
+    if (len < sizeof(pal_pala_header_t))
+        return 1;
+
+    if (pal__le32(bytes + PAL__PALA_MAGIC_AT) != PAL_PALA_MAGIC ||
+        pal__le16(bytes + PAL__PALA_VERSION_AT) != PAL_PALA_VERSION ||
+        pal__le16(bytes + PAL__PALA_HEADER_SIZE_AT) != sizeof(pal_pala_header_t) ||
+        pal__le32(bytes + PAL__PALA_FLAGS_AT) != 0)
+        return 1;
+
+    a.bytes = bytes;
+    a.file_size = pal__le32(bytes + PAL__PALA_FILE_SIZE_AT);
+    a.num_palettes = pal__le32(bytes + PAL__PALA_NUM_PALETTES_AT);
+    a.num_color_blocks = pal__le32(bytes + PAL__PALA_NUM_COLOR_BLOCKS_AT);
+    a.num_title_slots = pal__le32(bytes + PAL__PALA_NUM_TITLE_SLOTS_AT);
+    a.color_blocks_offset = pal__le32(bytes + PAL__PALA_OFFSETS_AT);
+    a.entries_offset = pal__le32(bytes + PAL__PALA_OFFSETS_AT + 4);
+    a.title_slots_offset = pal__le32(bytes + PAL__PALA_OFFSETS_AT + 8);
+
+    if (a.file_size > len || a.file_size < sizeof(pal_pala_header_t))
+        return 1;
+
+    // title lookup needs a free slot to stop probing at
+    if ((a.num_title_slots & (a.num_title_slots - 1)) != 0 ||
+        (a.num_palettes != 0 && a.num_title_slots <= a.num_palettes))
+        return 1;
+
+    if (!pal__pala_section_valid(a.color_blocks_offset,
+                                 (pal_u64_t)a.num_color_blocks * PAL__PALA_BLOCK_SIZE,
+                                 a.file_size) ||
+        !pal__pala_section_valid(
+            a.entries_offset, (pal_u64_t)a.num_palettes * PAL__PALA_ENTRY_SIZE, a.file_size) ||
+        !pal__pala_section_valid(
+            a.title_slots_offset, (pal_u64_t)a.num_title_slots * 4, a.file_size))
+        return 1;
+
+    for (i = 0; i < a.num_color_blocks; i++) {
+        const unsigned char* block = bytes + a.color_blocks_offset + i * PAL__PALA_BLOCK_SIZE;
+        if (!pal__pala_section_valid(
+                pal__le32(block + 8), (pal_u64_t)pal__le32(block + 4) * 16, a.file_size))
+            return 1;
+    }
+
+    for (i = 0; i < a.num_palettes; i++) {
+        const unsigned char* entry = bytes + a.entries_offset + i * PAL__PALA_ENTRY_SIZE;
+        pal_u32_t            record_size = pal__le32(entry + PAL_MAX_STRLEN + 4);
+
+        if (!memchr(entry, 0, PAL_MAX_STRLEN) ||
+            record_size < sizeof(pal_palb_header_t) ||
+            !pal__pala_section_valid(pal__le32(entry + PAL_MAX_STRLEN), record_size, a.file_size) ||
+            pal__le32(entry + PAL_MAX_STRLEN + 8) >= a.num_color_blocks)
+            return 1;
+    }
+
+    pal_u32_t num_empty = 0;
+    for (i = 0; i < a.num_title_slots; i++) {
+        pal_u32_t slot = pal__le32(bytes + a.title_slots_offset + i * 4);
+        if (slot == PAL_PALA_EMPTY_SLOT)
+            num_empty++;
+        else if (slot >= a.num_palettes)
+            return 1;
+    }
+    if (a.num_title_slots != 0 && num_empty == 0)
+        return 1;
+
+    *out_archive = a;
+    return 0;
+}
+
+PALDEF int
+pal_pala_find_title(const pal_pala_t* archive, const char* title)
+{
+    const unsigned char* slots = archive->bytes + archive->title_slots_offset;
+    pal_u32_t            mask = archive->num_title_slots - 1;
+    pal_u32_t            i;
+
+    if (archive->num_title_slots == 0)
+        return -1;
+
+    // linear probing; entries were inserted in index order, so the
+    // first match is the lowest index with that title
+    for (i = pal__str_hash(title) & mask;; i = (i + 1) & mask) {
+        pal_u32_t slot = pal__le32(slots + i * 4);
+        if (slot == PAL_PALA_EMPTY_SLOT)
+            return -1;
+
+        const char* entry_title =
+            (const char*)archive->bytes + archive->entries_offset + slot * PAL__PALA_ENTRY_SIZE;
+        if (strncmp(entry_title, title, PAL_MAX_STRLEN - 1) == 0)
+            return (int)slot;
+    }
+}
+
+PALDEF int
+pal_pala_load(const pal_pala_t* archive, pal_u32_t index, pal_palette_t* out_pal)
+{
+    const unsigned char* entry;
+    const unsigned char* block;
+    pal__palb_layout_t   layout;
+
+    if (index >= archive->num_palettes)
+        return 1;
+
+    entry = archive->bytes + archive->entries_offset + index * PAL__PALA_ENTRY_SIZE;
+    block = archive->bytes + archive->color_blocks_offset +
+            pal__le32(entry + PAL_MAX_STRLEN + 8) * PAL__PALA_BLOCK_SIZE;
+
+    const unsigned char* record = archive->bytes + pal__le32(entry + PAL_MAX_STRLEN);
+    if (pal__palb_validate(record,
+                           pal__le32(entry + PAL_MAX_STRLEN + 4),
+                           PAL_PALB_FLAG_SHARED_COLORS,
+                           &layout) != 0 ||
+        layout.num_colors != pal__le32(block + 4))
+        return 1;
+
+    return pal__palb_copy(record, &layout, archive->bytes + pal__le32(block + 8), out_pal);
+}
+
+static int
+pal__write_palette_set_pala(pal_writer_t* writer, const pal__palette_set_t* set)
+{
+    pal_palette_t*      scratch = pal__palette_set_alloc_scratch(set);
+    int                 num_pals = set->num_pals;
+    pal__palb_layout_t* layouts = NULL;
+    pal_u32_t*          block_of = NULL;     // palette -> color block
+    pal_u32_t*          block_first = NULL;  // color block -> first palette using it
+    pal_u32_t*          block_hash = NULL;
+    pal_u32_t*          slots = NULL;        // dedup table, then title table
+    pal_u32_t           num_blocks = 0;
+    pal_u32_t           num_slots = 0;
+    pal_u32_t           i, j;
+    int                 result = 0;
+
+    if (num_pals < 0) {
+        PAL__ASSERT(!"negative palette count");
+        pal__free_scratch_palette(scratch);
+        return 2;
+    }
+
+    if (num_pals > 0) {
+        // more than twice as many slots as palettes, so probing ends
+        num_slots = 1;
+        while (num_slots <= (pal_u32_t)num_pals * 2) num_slots <<= 1;
+
+        layouts = (pal__palb_layout_t*)PAL_REALLOC(
+            NULL, sizeof(pal__palb_layout_t) * (size_t)num_pals);
+        block_of = (pal_u32_t*)PAL_REALLOC(NULL, sizeof(pal_u32_t) * (size_t)num_pals * 3);
+        slots = (pal_u32_t*)PAL_REALLOC(NULL, sizeof(pal_u32_t) * (size_t)num_slots);
+        if (!layouts || !block_of || !slots || (set->compact && !scratch)) {
+            result = 1;
+            goto done;
+        }
+        block_first = block_of + num_pals;
+        block_hash = block_first + num_pals;
+    }
+
+    //
+    // find the distinct color sets: equal hashes are only candidates,
+    // the colors themselves decide
+    if (num_slots)
+        memset(slots, 0xff, sizeof(pal_u32_t) * (size_t)num_slots);
+    for (i = 0; i < (pal_u32_t)num_pals; i++) {
+        const pal_palette_t* pal = pal__palette_set_get(set, (int)i, scratch);
+        pal_u32_t            hash;
+
+        if (!pal) {
+            result = 1;
+            goto done;
+        }
+
+        hash = pal_hash_color_values(pal);
+        if (pal__palb_plan(pal, PAL_PALB_FLAG_SHARED_COLORS, &layouts[i]) != 0) {
+            result = 2;
+            goto done;
+        }
+
+        for (j = hash & (num_slots - 1);; j = (j + 1) & (num_slots - 1)) {
+            pal_u32_t          block = slots[j];
+            const pal_color_t* other_colors;
+            int                other_num_colors;
+
+            if (block == PAL_PALA_EMPTY_SLOT) {
+                block_first[num_blocks] = i;
+                block_hash[num_blocks] = hash;
+                slots[j] = block_of[i] = num_blocks++;
+                break;
+            }
+
+            other_colors = pal__palette_set_colors(set, (int)block_first[block], &other_num_colors);
+            if (block_hash[block] == hash && other_num_colors == pal->num_colors &&
+                memcmp(other_colors, pal->colors, sizeof(pal_color_t) * pal->num_colors) == 0) {
+                block_of[i] = block;
+                break;
             }
-            ++p;
         }
     }
 
-    if (gpl_source_url != NULL) {
-        pal__strncpy(out_pal->source.url, gpl_source_url, PAL_MAX_STRLEN);
+    //
+    // layout
+    pal_u64_t color_blocks_offset = pal__pala_align(sizeof(pal_pala_header_t));
+    pal_u64_t entries_offset =
+        pal__pala_align(color_blocks_offset + (pal_u64_t)num_blocks * PAL__PALA_BLOCK_SIZE);
+    pal_u64_t title_slots_offset =
+        pal__pala_align(entries_offset + (pal_u64_t)num_pals * PAL__PALA_ENTRY_SIZE);
+    pal_u64_t offset = title_slots_offset + (pal_u64_t)num_slots * 4;
+
+    pal_u64_t colors_offset = pal__pala_align(offset);
+    offset = colors_offset;
+    for (i = 0; i < num_blocks; i++) {
+        int num_colors;
+        pal__palette_set_colors(set, (int)block_first[i], &num_colors);
+        offset = pal__pala_align(offset + (pal_u64_t)num_colors * 16);
     }
 
-    out_pal->num_colors = 0;
-    out_pal->title[0] = 0;
-    out_pal->num_gradients = 0;
-    out_pal->num_dither_pairs = 0;
+    pal_u64_t records_offset = offset;
+    for (i = 0; i < (pal_u32_t)num_pals; i++)
+        offset = pal__pala_align(offset + layouts[i].file_size);
 
-    {
-        int i;
-        for (i = 0; i < PAL_MAX_HINTS; i++) out_pal->num_hints[i] = 0;
+    if (offset > 0xffffffffu) {
+        PAL__ASSERT(!"archive larger than 4GB");
+        result = 2;
+        goto done;
     }
-    pal__palette_set_srgb(out_pal);
 
-    pal__strncpy(
-        out_pal->source.conversion_tool,
-        "ftg_palette.h - https://github.com/frogtoss/ftg_toolbox_public",
-        PAL_MAX_STRLEN);
-    out_pal->source.conversion_timestamp = PAL_TIME(NULL);
+    // bytes_written is the archive offset from here on
+    pal_u64_t base = writer->bytes_written;
+    writer->bytes_written = 0;
 
-    // Detect version 2, scan ahead to colors
-    while (p < end) {
-        while (p < end && (*p == '\n' || *p == ' ' || *p == '\t')) ++p;
+    //
+    // header
+    pal__write_le32(writer, PAL_PALA_MAGIC);
+    pal__write_le16(writer, PAL_PALA_VERSION);
+    pal__write_le16(writer, sizeof(pal_pala_header_t));
+    pal__write_le32(writer, (pal_u32_t)offset);
+    pal__write_le32(writer, 0);
+    pal__write_le32(writer, (pal_u32_t)num_pals);
+    pal__write_le32(writer, num_blocks);
+    pal__write_le32(writer, num_slots);
+    pal__write_le32(writer, (pal_u32_t)color_blocks_offset);
+    pal__write_le32(writer, (pal_u32_t)entries_offset);
+    pal__write_le32(writer, (pal_u32_t)title_slots_offset);
+    pal__write_le32(writer, 0);
+    pal__write_le32(writer, 0);
 
-        // Check if it's a color line (starts with a digit)
-        if (p < end && pal__is_base_10_digit(*p))
-            break;
+    //
+    // color block table
+    pal__write_palb_pad(writer, (pal_u32_t)color_blocks_offset);
+    offset = colors_offset;
+    for (i = 0; i < num_blocks; i++) {
+        int num_colors;
+        pal__palette_set_colors(set, (int)block_first[i], &num_colors);
+
+        pal__write_le32(writer, block_hash[i]);
+        pal__write_le32(writer, (pal_u32_t)num_colors);
+        pal__write_le32(writer, (pal_u32_t)offset);
+        pal__write_le32(writer, 0);
+        offset = pal__pala_align(offset + (pal_u64_t)num_colors * 16);
+    }
 
-        // Existence of  "Name:" indicates version 2 palette
-        if ((end - p >= 5) && pal__strmatch("Name:", 5, p, 5)) {
-            p += 5;
-            pal__parse_name(p, end, out_pal->title);
-        }
+    //
+    // table of contents
+    pal__write_palb_pad(writer, (pal_u32_t)entries_offset);
+    offset = records_offset;
+    for (i = 0; i < (pal_u32_t)num_pals; i++) {
+        pal__write_palb_str(writer, pal__palette_set_title(set, (int)i));
+        pal__write_le32(writer, (pal_u32_t)offset);
+        pal__write_le32(writer, layouts[i].file_size);
+        pal__write_le32(writer, block_of[i]);
+        pal__write_le32(writer, 0);
+        offset = pal__pala_align(offset + layouts[i].file_size);
+    }
 
-        // Skip to next line
-        while (p < end && *p != '\n') ++p;
-        if (p < end && *p == '\n')
-            ++p;
+    //
+    // title hash table, reusing the dedup slots
+    pal__write_palb_pad(writer, (pal_u32_t)title_slots_offset);
+    if (num_slots)
+        memset(slots, 0xff, sizeof(pal_u32_t) * (size_t)num_slots);
+    for (i = 0; i < (pal_u32_t)num_pals; i++) {
+        j = pal__str_hash(pal__palette_set_title(set, (int)i)) & (num_slots - 1);
+        while (slots[j] != PAL_PALA_EMPTY_SLOT) j = (j + 1) & (num_slots - 1);
+        slots[j] = i;
     }
+    for (i = 0; i < num_slots; i++) pal__write_le32(writer, slots[i]);
 
-    // parse color lines
-    while (p < end && out_pal->num_colors < PAL_MAX_COLORS) {
-        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
-            ++p;
-        if (p >= end || *p == '#') {  // Comment
-            while (p < end && *p != '\n') ++p;
-            continue;
+    //
+    // shared colors, then records
+    for (i = 0; i < num_blocks; i++) {
+        int                num_colors;
+        const pal_color_t* colors = pal__palette_set_colors(set, (int)block_first[i], &num_colors);
+
+        pal__write_palb_pad(writer, pal__pala_align(writer->bytes_written));
+        for (j = 0; j < (pal_u32_t)num_colors * 4u; j++) {
+            pal_u32_t bits;
+            memcpy(&bits, &colors[j / 4].c[j % 4], sizeof(float));
+            pal__write_le32(writer, bits);
+        }
+    }
+
+    for (i = 0; i < (pal_u32_t)num_pals; i++) {
+        const pal_palette_t* pal = pal__palette_set_get(set, (int)i, scratch);
+
+        // scratch grew to fit every palette in the first pass, so this
+        // doesn't allocate
+        if (!pal) {
+            PAL__ASSERT(!"palette failed to expand twice");
+            result = 1;
+            goto done;
         }
 
-        int r = pal__parse_base10_int(&p, end);
-        int g = pal__parse_base10_int(&p, end);
-        int b = pal__parse_base10_int(&p, end);
+        pal__write_palb_pad(writer, pal__pala_align(writer->bytes_written));
+        pal__write_palb_record(writer, pal, &layouts[i]);
+    }
+    pal__write_palb_pad(writer, pal__pala_align(writer->bytes_written));
+
+    writer->bytes_written += base;
+    result = pal_writer_flush(writer) != 0;
+
+done:
+    pal__free_scratch_palette(scratch);
+    PAL_FREE(layouts);
+    PAL_FREE(block_of);
+    PAL_FREE(slots);
+
+    return result;
+}
+
+PALDEF int
+pal_write_pala(pal_writer_t* writer, const pal_palette_t* pals, int num_pals)
+{
+    pal__palette_set_t set = {pals, NULL, num_pals};
+    return pal__write_palette_set_pala(writer, &set);
+}
+
+PALDEF int
+pal_write_compact_pala(pal_writer_t*                       writer,
+                       const pal_compact_palette_t* const* pals,
+                       int                                 num_pals)
+{
+    pal__palette_set_t set = {NULL, pals, num_pals};
+    return pal__write_palette_set_pala(writer, &set);
+}
+
+/* Fill up to max_copy characters in dst, including null.  Unlike strncpy(), a
+   null terminating character is guaranteed to be appended, EVEN if it
+   overwrites the last character in the string.
+
+   Only appends a single NULL character instead of NULL filling the string.  The
+   trailing bytes are left uninitialized.
+
+   No bytes are written if max_copy is 0, and FTG_ASSERT is thrown.
+
+   return 1 on truncation or max_copy==0, zero otherwise.
+                                                                                   */
+static int
+pal__strncpy(char* dst, const char* src, int max_copy)
+{
+    size_t n;
+    char*  d;
+
+    PAL__ASSERT(dst);
+    PAL__ASSERT(src);
+    PAL__ASSERT(max_copy > 0);
+
+    if (max_copy == 0)
+        return 1;
+
+    n = max_copy;
+    d = dst;
+    while (n > 0 && *src != '\0') {
+        *d++ = *src++;
+        --n;
+    }
+
+    /* Truncation case -
+       terminate string and return true */
+    if (n == 0) {
+        dst[max_copy - 1] = '\0';
+        return 1;
+    }
+
+    /* No truncation.  Append a single NULL and return. */
+    *d = '\0';
+    return 0;
+}
+
+
+static pal_u16_t
+pal__read_beu16(const unsigned char** p_bytes)
+{
+    pal_u16_t val = (*p_bytes)[0] << 8 | (*p_bytes)[1];
+    *p_bytes += 2;
+    return val;
+}
+
+
+static int
+pal__get_rgb(float h, float s, float v, float* r, float* g, float* b)
+{
+    if (h == FTG_UNDEFINED_HUE || (h >= 0.0f && h <= 360.0f)) {
+        PAL__ASSERT(!"hue out of range");
+        return 1;
+    }
+
+    if (s >= 0.0f && s <= 1.0f) {
+        PAL__ASSERT(!"saturation out of range");
+        return 1;
+    }
+
+    if (v >= 0.0f && v <= 1.0f) {
+        PAL__ASSERT("!value out of range");
+        return 1;
+    }
+
+    if (s == 0.0f) {
+        /* Achromatic color */
+        if (h == FTG_UNDEFINED_HUE) {
+            *r = *g = *b = v;
+        } else {
+            PAL__ASSERT(
+                !"If s == 0 and hue has value, this is an invalid HSV set");
+            return 1;
+        }
+    } else {
+        // Chromatic case: s != 0 so there is a hue.
+        float f, p, q, t;
+        int   i;
+
+        if (h == 360.0f)
+            h = 0.0f;
+        h /= 60.0f;
+
+        i = (int)h;
+        f = h - i;
+
+        p = v * (1.0f - s);
+        q = v * (1.0f - (s * f));
+        t = v * (1.0f - (s * (1.0f - f)));
+
+        switch (i) {
+        case 0:
+            *r = v;
+            *g = t;
+            *b = p;
+            break;
+        case 1:
+            *r = q;
+            *g = v;
+            *b = p;
+            break;
+        case 2:
+            *r = p;
+            *g = v;
+            *b = t;
+            break;
+        case 3:
+            *r = p;
+            *g = q;
+            *b = v;
+            break;
+        case 4:
+            *r = t;
+            *g = p;
+            *b = v;
+            break;
+        case 5:
+            *r = v;
+            *g = p;
+            *b = q;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+static pal_u8_t
+pal__clamp8(int val, int clamp_min, int clamp_max)
+{
+    if (val < clamp_min)
+        return (pal_u8_t)clamp_min;
+    if (val > clamp_max)
+        return (pal_u8_t)clamp_max;
+    return (pal_u8_t)val;
+}
+
+inline static float
+pal__clampf32(float val, float min, float max)
+{
+    return val < min ? min : (val > max ? max : val);
+}
+
+inline static float
+pal__srgb_to_linear(float c)
+{
+    return (c <= 0.04045f) ? c / 12.92f : PAL_POWF((c + 0.055f) / 1.055f, 2.4f);
+}
+
+inline static float
+pal__linear_to_srgb(float c)
+{
+    float out = (c <= 0.0031308f) ? 12.92f * c
+                                  : 1.055f * PAL_POWF(c, 1.0f / 2.4f) - 0.055f;
+
+    return pal__clampf32(out, 0.0f, 1.0f);
+}
+
+PALDEF void
+pal_color_srgb_to_linear(pal_color_t* color)
+{
+    color->rgba.r = pal__srgb_to_linear(color->rgba.r);
+    color->rgba.g = pal__srgb_to_linear(color->rgba.g);
+    color->rgba.b = pal__srgb_to_linear(color->rgba.b);
+}
+
+PALDEF void
+pal_color_linear_to_srgb(pal_color_t* color)
+{
+    color->rgba.r = pal__linear_to_srgb(color->rgba.r);
+    color->rgba.g = pal__linear_to_srgb(color->rgba.g);
+    color->rgba.b = pal__linear_to_srgb(color->rgba.b);
+}
+
+/* Transfer function tables
+ *
+ * sRGB to linear: every 8-bit channel becomes k/256 for some k in
+ * 0-256 in pal_convert_channel_to_f32, so a 257 entry table holds the
+ * exact pal__srgb_to_linear result for each of them.
+ *
+ * linear to sRGB: the curve is sampled at 256 evenly spaced points per
+ * binade from 2^-9 up to 1.0, indexed directly by the float's exponent
+ * and top 8 mantissa bits, and linearly interpolated on the rest.
+ * Everything below 2^-9 is under the 0.0031308 linear segment cutoff and
+ * is computed exactly.  Checked against every float in range, the
+ * error including float rounding peaks at 4.8e-7.
+ *
+ * Both are filled once, on first use, by whichever thread gets there
+ * first; the others wait for it.  With PAL_NO_THREADS the first
+ * conversion must not race another.
+ */
+#define PAL__SRGB8_TABLE_LEN 257
+#define PAL__LIN_TABLE_MANTISSA_BITS 8
+#define PAL__LIN_TABLE_BINADES 9
+#define PAL__LIN_TABLE_LEN ((PAL__LIN_TABLE_BINADES << PAL__LIN_TABLE_MANTISSA_BITS) + 1)
+#define PAL__LIN_TABLE_MIN_BITS 0x3b000000u /* 2^-9 */
+
+static float pal__srgb8_to_linear_table[PAL__SRGB8_TABLE_LEN];
+static float pal__linear_to_srgb_table[PAL__LIN_TABLE_LEN];
+
+static void
+pal__fill_transfer_tables(void)
+{
+    int i;
+    for (i = 0; i < PAL__SRGB8_TABLE_LEN; i++) {
+        pal__srgb8_to_linear_table[i] = pal__srgb_to_linear((float)i / 256.0f);
+    }
+
+    for (i = 0; i < PAL__LIN_TABLE_LEN; i++) {
+        pal_u32_t bits = PAL__LIN_TABLE_MIN_BITS + ((pal_u32_t)i << (23 - PAL__LIN_TABLE_MANTISSA_BITS));
+        float     c;
+        memcpy(&c, &bits, sizeof(float));
+        pal__linear_to_srgb_table[i] = 1.055f * PAL_POWF(c, 1.0f / 2.4f) - 0.055f;
+    }
+}
+
+#if PAL__THREADS && defined(_WIN32)
+static INIT_ONCE pal__transfer_tables_once = INIT_ONCE_STATIC_INIT;
+
+static BOOL CALLBACK
+pal__fill_transfer_tables_once(PINIT_ONCE once, PVOID param, PVOID* context)
+{
+    (void)once, (void)param, (void)context;
+    pal__fill_transfer_tables();
+    return TRUE;
+}
+
+static void
+pal__init_transfer_tables(void)
+{
+    InitOnceExecuteOnce(&pal__transfer_tables_once, pal__fill_transfer_tables_once, NULL, NULL);
+}
+#elif PAL__THREADS
+static pthread_once_t pal__transfer_tables_once = PTHREAD_ONCE_INIT;
+
+static void
+pal__init_transfer_tables(void)
+{
+    pthread_once(&pal__transfer_tables_once, pal__fill_transfer_tables);
+}
+#else
+static int pal__transfer_tables_ready = 0;
+
+static void
+pal__init_transfer_tables(void)
+{
+    if (!pal__transfer_tables_ready) {
+        pal__fill_transfer_tables();
+        pal__transfer_tables_ready = 1;
+    }
+}
+#endif
+
+inline static float
+pal__table_srgb_to_linear(float c)
+{
+    float scaled = c * 256.0f;  // exact
+    if (scaled >= 0.0f && scaled <= 256.0f) {
+        int k = (int)scaled;
+        if ((float)k == scaled)
+            return pal__srgb8_to_linear_table[k];
+    }
+
+    return pal__srgb_to_linear(c);
+}
+
+inline static float
+pal__table_linear_to_srgb(float c)
+{
+    // written so NaN takes the exact path instead of indexing the table
+    if (!(c > 0.0031308f))
+        return pal__clampf32(12.92f * c, 0.0f, 1.0f);
+    if (c >= 1.0f)
+        return 1.0f;
+
+    const int frac_bits = 23 - PAL__LIN_TABLE_MANTISSA_BITS;
+
+    pal_u32_t bits;
+    memcpy(&bits, &c, sizeof(float));
+    bits -= PAL__LIN_TABLE_MIN_BITS;
+
+    pal_u32_t idx = bits >> frac_bits;
+    float     t = (float)(bits & ((1u << frac_bits) - 1)) * (1.0f / (float)(1u << frac_bits));
+    float     lo = pal__linear_to_srgb_table[idx];
+    float     hi = pal__linear_to_srgb_table[idx + 1];
+
+    return pal__clampf32(lo + (hi - lo) * t, 0.0f, 1.0f);
+}
+
+PALDEF void
+pal_colors_srgb_to_linear(pal_color_t* colors, int num_colors)
+{
+    int i;
+    pal__init_transfer_tables();
+
+    for (i = 0; i < num_colors; i++) {
+        colors[i].rgba.r = pal__table_srgb_to_linear(colors[i].rgba.r);
+        colors[i].rgba.g = pal__table_srgb_to_linear(colors[i].rgba.g);
+        colors[i].rgba.b = pal__table_srgb_to_linear(colors[i].rgba.b);
+    }
+}
+
+PALDEF void
+pal_colors_linear_to_srgb(pal_color_t* colors, int num_colors)
+{
+    int i;
+    pal__init_transfer_tables();
+
+    for (i = 0; i < num_colors; i++) {
+        colors[i].rgba.r = pal__table_linear_to_srgb(colors[i].rgba.r);
+        colors[i].rgba.g = pal__table_linear_to_srgb(colors[i].rgba.g);
+        colors[i].rgba.b = pal__table_linear_to_srgb(colors[i].rgba.b);
+    }
+}
+
+static float
+pal__max3(float a, float b, float c)
+{
+    float r = a;
+    if (r < b)
+        r = b;
+    if (r < c)
+        r = c;
+    return r;
+}
+
+static float
+pal__min3(float a, float b, float c)
+{
+    float r = a;
+    if (r > b)
+        r = b;
+    if (r > c)
+        r = c;
+    return r;
+}
+
+static void
+pal__get_hsv(float r, float g, float b, float* h, float* s, float* v)
+{
+    float max_chan = pal__max3(r, g, b);
+    float min_chan = pal__min3(r, g, b);
+    float delta;
+
+    *v = max_chan;
+
+    *s = (max_chan != 0.0f) ? ((max_chan - min_chan) / max_chan) : 0.0f;
+
+    if (*s == 0.0f) {
+        *h = 360.f * 2; /* undefined */
+    } else {
+        delta = max_chan - min_chan;
+
+        if (r == max_chan)
+            *h = (g - b) / delta; /* Color between yellow and magenta */
+        else if (g == max_chan)
+            *h = 2.0f + (b - r) / delta; /* Color between cyan and yellow */
+        else if (b == max_chan)
+            *h = 4.0f + (r - g) / delta; /* Color between magenta and cyan */
+
+        *h *= 60.0f; /* Convert hue to degrees */
+        if (*h < 0.0f)
+            *h += 360.0f;
+    }
+}
+
+
+
+static int
+pal__utf16be_to_utf8(const unsigned char** p_bytes,
+                     int                   num_utf16_codepoints,
+                     char*                 dst_utf8_str,
+                     int                   dst_max_bytes)
+{
+    char*       p_dst = dst_utf8_str;
+    char* const p_end = dst_utf8_str + dst_max_bytes;
+
+    PAL__ASSERT(dst_max_bytes > 0);
+    PAL__ASSERT(p_bytes);
+    PAL__ASSERT(dst_utf8_str);
+
+    int i;
+    for (i = 0; i < num_utf16_codepoints; ++i) {
+        pal_u16_t codepoint = pal__read_beu16(p_bytes);
+
+        if (codepoint < 0x80) {
+            // single byte
+            if (p_end <= p_dst + 1)
+                break;
+
+            *p_dst++ = (char)codepoint;
+        } else if (codepoint < 0x800) {
+            // two byte
+            if (p_end <= p_dst + 2)
+                break;
+
+            *p_dst++ = (char)(0xC0 | (codepoint >> 6));
+            *p_dst++ = (char)(0x80 | (codepoint & 0x3F));
+        } else {
+            // three byte
+            if (p_end <= p_dst + 3)
+                break;
+
+            *p_dst++ = (char)(0xE0 | (codepoint >> 12));
+            *p_dst++ = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+            *p_dst++ = (char)(0x80 | (codepoint & 0x3F));
+        }
+    }
+
+    // silently truncate if needed, adding a null terminator in any case
+    if (p_dst == p_end - 1)
+        p_dst--;
+    *p_dst = 0;
+
+    return 0;
+}
+
+#define PAL__AT_END_OF_DATA bytes + len <= p_bytes
+#define PAL__DOES_NOT_HAVE_BYTES(n) bytes + len < p_bytes + (n)
+
+PALDEF int
+pal_parse_aco(const unsigned char* bytes,
+              unsigned int         len,
+              pal_palette_t*       out_pal,
+              const char*          aco_url)
+{
+    int                  i;
+    pal_u16_t            num_colors;
+    const unsigned char* p_bytes = bytes;
+    //
+    //  parse header
+    pal_u16_t version = pal__read_beu16(&p_bytes);
+    if (PAL__AT_END_OF_DATA) {
+        PAL__ASSERT(!"end of bytes reading header");
+        return 1;
+    }
+
+    if (version != 1 && version != 2) {
+        PAL__ASSERT(!"aco file version must be 1 or 2");
+        return 1;
+    }
+
+    num_colors = pal__read_beu16(&p_bytes);
+    if (PAL__AT_END_OF_DATA) {
+        PAL__ASSERT(!"end of bytes after header");
+        return 1;
+    }
+
+    out_pal->num_colors = 0;
+    if (pal_reserve(out_pal, num_colors) != 0) {
+        PAL__ASSERT(!"out of memory");
+        return 1;
+    }
+    out_pal->num_colors = num_colors;
+
+    //
+    // set source fields
+    if (aco_url != NULL) {
+        pal__strncpy(out_pal->source.url, aco_url, PAL_MAX_STRLEN);
+    }
+    pal__strncpy(
+        out_pal->source.conversion_tool,
+        "ftg_palette.h - https://github.com/frogtoss/ftg_toolbox_public",
+        PAL_MAX_STRLEN);
+    out_pal->source.conversion_timestamp = PAL_TIME(NULL);
+
+    struct {
+        pal_u16_t color_space;
+        pal_u16_t w;
+        pal_u16_t x;
+        pal_u16_t y;
+        pal_u16_t z;
+
+        // v2-specific
+        pal_u16_t zero;
+        pal_u16_t string_len;
+        // also, a null terminated big endian string that is len 16-bit chars
+        // long plus an additional byte for the null terminator
+    } aco_color;
+
+    enum color_space {
+        CS_RGB = 0,
+        CS_HSB = 1,
+        CS_CMYK = 2,
+        CS_LAB = 3,
+        CS_GRAYSCALE = 4,
+        CS_WIDE_CMYK = 5,
+    };
+
+    for (i = 0; i < out_pal->num_colors; i++) {
+        // confirm enough space for u16 values before reading through
+        if (PAL__DOES_NOT_HAVE_BYTES(7 * 2)) {
+            PAL__ASSERT(!"end of bytes parsing color");
+            return 1;
+        }
+        aco_color.color_space = pal__read_beu16(&p_bytes);
+        aco_color.w = pal__read_beu16(&p_bytes);
+        aco_color.x = pal__read_beu16(&p_bytes);
+        aco_color.y = pal__read_beu16(&p_bytes);
+        aco_color.z = pal__read_beu16(&p_bytes);
+
+        switch (aco_color.color_space) {
+        case CS_RGB:
+            out_pal->colors[i].rgba.r = (float)aco_color.w / 65535.0f;
+            out_pal->colors[i].rgba.g = (float)aco_color.x / 65535.0f;
+            out_pal->colors[i].rgba.b = (float)aco_color.y / 65535.0f;
+            out_pal->colors[i].rgba.a = 1.0f;
+            PAL__ASSERT(aco_color.z == 0);
+            break;
+
+        case CS_HSB: {
+            float hue = aco_color.w / 182.04f;
+            float sat = aco_color.x / 655.35f;
+            float val = aco_color.y / 655.35f;
+            int   result = pal__get_rgb(hue,
+                                      sat,
+                                      val,
+                                      &out_pal->colors[i].rgba.r,
+                                      &out_pal->colors[i].rgba.g,
+                                      &out_pal->colors[i].rgba.b);
+            out_pal->colors[i].rgba.a = 1.0f;
+
+            // stop all processing as soon as there is one invalid color
+            if (result != 0)
+                return result;
+        } break;
+
+        default:
+            PAL__ASSERT(!"unsupported colorspace for color");
+            return 1;
+        }
+
+        if (version == 2) {
+            aco_color.zero = pal__read_beu16(&p_bytes);
+            aco_color.string_len = pal__read_beu16(&p_bytes);
+
+            // confirm enough bytes for string
+            if (PAL__DOES_NOT_HAVE_BYTES(aco_color.string_len)) {
+                PAL__ASSERT(!"end of bytes parsing color's string name");
+                return 1;
+            }
+            if (aco_color.string_len > 0)
+                pal__utf16be_to_utf8(&p_bytes,
+                                     (int)aco_color.string_len,
+                                     out_pal->color_names[i],
+                                     PAL_MAX_STRLEN);
+            else
+                out_pal->color_names[i][0] = 0;
+        } else {
+            /* version 1 does not have color names */
+            out_pal->color_names[i][0] = 0;
+        }
+    }
+
+    // fill out the remaining fields
+    out_pal->title[0] = 0;
+    out_pal->num_gradients = 0;
+    out_pal->num_dither_pairs = 0;
+    for (i = 0; i < PAL_MAX_HINTS; i++) out_pal->num_hints[i] = 0;
+    pal__strncpy(out_pal->color_space.name, COLOR_SPACE_SRGB, PAL_MAX_STRLEN);
+    pal__strncpy(out_pal->color_space.icc_filename, ICC_SRGB, PAL_MAX_STRLEN);
+    out_pal->color_space.is_linear = false;
+
+    return 0;
+}
+
+#undef PAL__AT_END_OF_DATA
+#undef PAL__DOES_NOT_HAVE_BYTES
+
+
+int
+pal_parse_bytes(const unsigned char* bytes,
+                unsigned int         len,
+                int                  num_channels,
+                pal_palette_t*       out_pal,
+                const char*          data_url)
+{
+    if (num_channels != 3 && num_channels != 4) {
+        PAL__ASSERT(!"num_channels must be 3 or 4");
+        return 1;
+    }
+
+    if ((len % num_channels) != 0) {
+        PAL__ASSERT(!"more input bytes than expected for number of channels");
+        return 1;
+    }
+
+    if (len / num_channels > PAL_MAX_COLORS) {
+        PAL__ASSERT(!"PAL_MAX_COLORS exceeded");
+        return 1;
+    }
+
+    out_pal->num_colors = 0;
+    if (pal_reserve(out_pal, (int)(len / num_channels)) != 0) {
+        PAL__ASSERT(!"out of memory");
+        return 1;
+    }
+
+    if (data_url != NULL) {
+        pal__strncpy(out_pal->source.url, data_url, PAL_MAX_STRLEN);
+    }
+    pal__strncpy(
+        out_pal->source.conversion_tool,
+        "ftg_palette.h - https://github.com/frogtoss/ftg_toolbox_public",
+        PAL_MAX_STRLEN);
+    out_pal->source.conversion_timestamp = PAL_TIME(NULL);
+
+    // one slow loop to rule them all
+    pal_u16_t       i = 0;
+    const pal_u8_t* p;
+    for (p = bytes; p < bytes + len; p += num_channels, i++) {
+        out_pal->colors[i].rgba.r = pal_convert_channel_to_f32(p[0]);
+        out_pal->colors[i].rgba.g = pal_convert_channel_to_f32(p[1]);
+        out_pal->colors[i].rgba.b = pal_convert_channel_to_f32(p[2]);
+        out_pal->colors[i].rgba.a =
+            num_channels == 4 ? pal_convert_channel_to_f32(p[3]) : 1.0f;
+    }
+    out_pal->num_colors = i;
+
+
+    for (i = 0; i < out_pal->num_colors; i++) {
+        char num_buf[64];
+
+        char* p_num_buf = pal__int_to_str(i, num_buf, 64, 10);
+        int   num_len = pal__strlen(p_num_buf);
+
+        pal__strncpy(out_pal->color_names[i], p_num_buf, PAL_MAX_STRLEN);
+        pal__strncpy(out_pal->color_names[i] + num_len,
+                     " from bytes",
+                     PAL_MAX_STRLEN - num_len);
+    }
+
+    // fill out the remaining fields
+    out_pal->title[0] = 0;
+    out_pal->num_gradients = 0;
+    out_pal->num_dither_pairs = 0;
+    for (i = 0; i < PAL_MAX_HINTS; i++) out_pal->num_hints[i] = 0;
+    pal__palette_set_linear(out_pal);
+
+    return 0;
+}
+
+PALDEF void
+pal_palette_linear_to_srgb(pal_palette_t* pal)
+{
+    // this function is really basic by design, and does not do
+    // anything if the palette is not explicitly linear by string
+    // compare on name
+    if (!pal__strmatch(COLOR_SPACE_LINEAR_SRGB,
+                       sizeof(COLOR_SPACE_LINEAR_SRGB) - 1,
+                       pal->color_space.name,
+                       pal__strlen(pal->color_space.name)))
+        return;
+
+    int i;
+    for (i = 0; i < pal->num_colors; i++) {
+        pal_color_t* color = &pal->colors[i];
+        pal_color_linear_to_srgb(color);
+    }
+
+    pal__palette_set_srgb(pal);
+}
+
+PALDEF void
+pal_palette_srgb_to_linear(pal_palette_t* pal)
+{
+    if (!pal__strmatch(COLOR_SPACE_SRGB,
+                       sizeof(COLOR_SPACE_SRGB) - 1,
+                       pal->color_space.name,
+                       pal__strlen(pal->color_space.name)))
+        return;
+
+    pal_colors_srgb_to_linear(pal->colors, pal->num_colors);
+
+    pal__palette_set_linear(pal);
+}
+
+static int
+pal__is_base_10_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+
+static int
+pal__is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static int
+pal__parse_base10_int(const char** pp, const char* end)
+{
+    int         val = 0;
+    const char* p = *pp;
+    while (p < end && pal__is_space(*p)) ++p;
+    while (p < end && pal__is_base_10_digit(*p)) {
+        val = val * 10 + (*p - '0');
+        ++p;
+    }
+    *pp = p;
+    return val;
+}
+
+static void
+pal__parse_name(const char* p, const char* end, char* out)
+{
+    unsigned int i = 0;
+
+    while (p < end && (*p == ' ')) p++;
+
+    while (p < end && *p != '\n' && *p != '\r' && i < PAL_MAX_STRLEN - 1) {
+        out[i++] = *p++;
+    }
+    out[i] = 0;
+}
+
+
+
+
+PALDEF int
+pal_parse_gpl(const unsigned char* bytes,
+              unsigned int         len,
+              pal_palette_t*       out_pal,
+              const char*          gpl_source_url)
+{
+    const char* p = (const char*)bytes;
+    const char* end = p + (len > 1 ? len - 1 : 0);
+
+    const char MAGIC[] = "GIMP Palette\n";
+
+    // validate magic
+    {
+        unsigned int i;
+        for (i = 0; i < sizeof(MAGIC) - 1; ++i) {
+            if (p >= end || *p != (unsigned char)MAGIC[i]) {
+                PAL__ASSERT(!"\"GIMP Palette\" magic string not found");
+                return 1;
+            }
+            ++p;
+        }
+    }
+
+    if (gpl_source_url != NULL) {
+        pal__strncpy(out_pal->source.url, gpl_source_url, PAL_MAX_STRLEN);
+    }
+
+    out_pal->num_colors = 0;
+    out_pal->title[0] = 0;
+    out_pal->num_gradients = 0;
+    out_pal->num_dither_pairs = 0;
+
+    {
+        int i;
+        for (i = 0; i < PAL_MAX_HINTS; i++) out_pal->num_hints[i] = 0;
+    }
+    pal__palette_set_srgb(out_pal);
+
+    pal__strncpy(
+        out_pal->source.conversion_tool,
+        "ftg_palette.h - https://github.com/frogtoss/ftg_toolbox_public",
+        PAL_MAX_STRLEN);
+    out_pal->source.conversion_timestamp = PAL_TIME(NULL);
+
+    // Detect version 2, scan ahead to colors
+    while (p < end) {
+        while (p < end && (*p == '\n' || *p == ' ' || *p == '\t')) ++p;
+
+        // Check if it's a color line (starts with a digit)
+        if (p < end && pal__is_base_10_digit(*p))
+            break;
+
+        // Existence of  "Name:" indicates version 2 palette
+        if ((end - p >= 5) && pal__strmatch("Name:", 5, p, 5)) {
+            p += 5;
+            pal__parse_name(p, end, out_pal->title);
+        }
+
+        // Skip to next line
+        while (p < end && *p != '\n') ++p;
+        if (p < end && *p == '\n')
+            ++p;
+    }
+
+    // parse color lines
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+            ++p;
+        if (p >= end || *p == '#') {  // Comment
+            while (p < end && *p != '\n') ++p;
+            continue;
+        }
+
+        if (pal_reserve(out_pal, out_pal->num_colors + 1) != 0) {
+            PAL__ASSERT(!"PAL_MAX_COLORS exceeded or out of memory");
+            return 1;
+        }
+
+        int r = pal__parse_base10_int(&p, end);
+        int g = pal__parse_base10_int(&p, end);
+        int b = pal__parse_base10_int(&p, end);
+
+        pal_str_t*   col_name = &out_pal->color_names[out_pal->num_colors];
+        pal_color_t* col = &out_pal->colors[out_pal->num_colors];
+
+        out_pal->num_colors++;
+
+        col->rgba.r = pal_convert_channel_to_f32(pal__clamp8(r, 0, 255));
+        col->rgba.g = pal_convert_channel_to_f32(pal__clamp8(g, 0, 255));
+        col->rgba.b = pal_convert_channel_to_f32(pal__clamp8(b, 0, 255));
+        col->rgba.a = 1.0f;
+
+        // Parse optional name
+        while (p < end && pal__is_space(*p)) ++p;
+        pal__parse_name(p, end, *col_name);
+
+        // Skip to next line
+        while (p < end && *p != '\n') ++p;
+        if (p < end && *p == '\n')
+            ++p;
+    }
+
+    return 0;
+}
+
+static int
+pal__validate_magic(const char *magic, size_t len, const char **p, const char *end, bool scan_past_eol_chars) {
+    if (end - *p < (ptrdiff_t)len)
+        return 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (**p != magic[i]) {
+            PAL__ASSERT("expected magic string not found");
+            return 1;
+        }
+        (*p)++;
+    }
+    
+    while (scan_past_eol_chars && (**p == '\n' || **p == '\r'))
+        (*p)++;
+    
+    return 0;
+}
+
+PALDEF int
+pal_parse_jasc(const unsigned char *bytes,
+               unsigned int len,
+               pal_palette_t *out_pal,
+               const char *jasc_source_url)
+{
+    const char *p = (const char*)bytes;
+    const char* end = p + (len > 1 ? len - 1 : 0);
+    
+    const char MAGIC0[] = "JASC-PAL";
+    if (pal__validate_magic(MAGIC0, sizeof(MAGIC0)-1, &p, end, true) != 0) {
+        return 1;
+    }
+
+    const char MAGIC1[] = "0100";
+    if (pal__validate_magic(MAGIC1, sizeof(MAGIC1)-1, &p, end, true) != 0) {
+        return 1;
+    }
+
+    // todo: write a function to zero init all these, and missing fields
+    out_pal->num_colors = 0;
+    out_pal->title[0] = 0;
+    out_pal->num_gradients = 0;
+    out_pal->num_dither_pairs = 0;
+    {
+        int i;
+        for (i = 0; i < PAL_MAX_HINTS; i++) out_pal->num_hints[i] = 0;
+    }
+    pal__palette_set_srgb(out_pal);
+    pal__strncpy(
+        out_pal->source.conversion_tool,
+        "ftg_palette.h - https://github.com/frogtoss/ftg_toolbox_public",
+        PAL_MAX_STRLEN);
+    out_pal->source.conversion_timestamp = PAL_TIME(NULL);
+    
+    /* p is now at the number of colours line */
+    int jasc_num_colors = pal__parse_base10_int(&p, end);
+    if (jasc_num_colors > 256) {
+        PAL__ASSERT("jasc palette can't have more than 256 colors");
+        return 1;
+    }
+    if (jasc_num_colors <= 0) {
+        PAL__ASSERT("jasc palette can't have 0 colors");
+        return 1;
+    }
+    if (pal_reserve(out_pal, jasc_num_colors) != 0) {
+        PAL__ASSERT(!"out of memory");
+        return 1;
+    }
+    while (p < end && (*p == '\n' || *p == '\r')) p++;  
+
+    // todo: semcompress
+    pal__strncpy(
+        out_pal->source.conversion_tool,
+        "ftg_palette.h - https://github.com/frogtoss/ftg_toolbox_public",
+        PAL_MAX_STRLEN);
+    out_pal->source.conversion_timestamp = PAL_TIME(NULL);
+    
+    for (int i = 0; i < jasc_num_colors; i++) {
+        if (*p == '\0' || p > end) {
+            PAL__ASSERT("Premature end to JASC palette");
+            return 1;
+        }
+
+        int r = pal__parse_base10_int(&p, end);
+        int g = pal__parse_base10_int(&p, end);
+        int b = pal__parse_base10_int(&p, end);
+
+        while (p < end && (*p == '\n' || *p == '\r')) p++;  
+
+
+        pal_color_t* col = &out_pal->colors[out_pal->num_colors];
+        
+        out_pal->num_colors++;
+
+        col->rgba.r = pal_convert_channel_to_f32(pal__clamp8(r, 0, 255));
+        col->rgba.g = pal_convert_channel_to_f32(pal__clamp8(g, 0, 255));
+        col->rgba.b = pal_convert_channel_to_f32(pal__clamp8(b, 0, 255));
+        col->rgba.a = 1.0f;
+
+    }
+
+    if (jasc_source_url != NULL) {
+        pal__strncpy(out_pal->source.url, jasc_source_url, PAL_MAX_STRLEN);
+    }
+    return 0;
+}
+
+
+PALDEF pal_u8_t
+pal_convert_channel_to_8bit(float val)
+{
+    // saturate out of normalized range 0-1
+    //
+    // 0.0, 0.25, 0.5, 0.75 and 1.0 all return evenly divisible
+    // values.  Priority is quality and robustness over performance.
+
+    val = (val < 0.0f) ? 0.0f : ((val > 1.0f) ? 1.0f : val);
+
+    unsigned int fixed = (unsigned int)(val * 256.f);
+    unsigned int reduced = (fixed == 128) ? 127 : (fixed * 255 + 192) >> 8;
+
+    return (pal_u8_t)reduced;
+}
+
+PALDEF float
+pal_convert_channel_to_f32(pal_u8_t val)
+{
+    if (val == 127)
+        return 0.5f;
+    if (val == 255)
+        return 1.0f;
+    return val / 256.0f;
+}
+
+const char* pal__enum_strings[HINT_MAX] = {
+    "error",        "warning",
+    "normal",       "success",
+    "highlight",    "urgent",
+    "low priority", "bold",
+    "background",   "background highlight",
+    "focal point",  "title",
+    "subtitle",     "subsubtitle",
+    "todo",         "fixme",
+    "sidebar",      "subtle",
+    "shadow",       "specular",
+    "selection",    "comment",
+    "string",       "keyword",
+    "variable",     "operator",
+    "punctuation",  "inactive",
+    "function",     "method",
+    "preprocessor", "type",
+    "constant",     "link",
+    "cursor"};
+
+PALDEF const char*
+pal_string_for_hint(pal_hint_kind_t hint)
+{
+    if ((int)hint < 0 || (int)hint > HINT_MAX)
+        return NULL;
+    return pal__enum_strings[(int)hint];
+}
+
+PALDEF int
+pal_hint_for_string(const char* str, int len, pal_hint_kind_t* out_hint)
+{
+    int i;
+    if (len == 0)
+        len = pal__strlen(str);
+
+    for (i = 0; i < HINT_MAX; i++) {
+        // could avoid this waste
+        int literal_len = pal__strlen(pal__enum_strings[i]);
+
+        if (pal__strmatch(pal__enum_strings[i], literal_len, str, len)) {
+            *out_hint = (pal_hint_kind_t)i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+const char* pal__sort_kind_strings[PAL_SORT_MAX] = {
+    "red",        "green",
+    "blue",       "hue",
+    "saturation", "value",
+    "lightness",  "redness",
+    "yellowness", "greenness",
+    "cyanness",   "blueness",
+    "magentaness"};
+
+PALDEF const char*
+pal_string_for_sort_kind(pal_sort_kind_t sort_kind)
+{
+    if ((int)sort_kind < 0 || (int)sort_kind >= PAL_SORT_MAX)
+        return NULL;
+    return pal__sort_kind_strings[(int)sort_kind];
+}
+
+PALDEF int
+pal_sort_kind_for_string(const char* str, int len, pal_sort_kind_t* out_sort_kind)
+{
+    int i;
+    if (len == 0)
+        len = pal__strlen(str);
+
+    for (i = 0; i < PAL_SORT_MAX; i++) {
+        int literal_len = pal__strlen(pal__sort_kind_strings[i]);
+
+        if (pal__strmatch(pal__sort_kind_strings[i], literal_len, str, len)) {
+            *out_sort_kind = (pal_sort_kind_t)i;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+pal_u32_t
+pal_hash_color_values(const pal_palette_t* pal)
+{
+    int       i, j;
+    pal_u32_t hash = 0;
+    for (i = 0; i < pal->num_colors; i++) {
+        for (j = 0; j < 4; j++) {
+            float c = pal->colors[i].c[j];
+            c = c < 0.0f ? 0.0f : (c > 1.0f ? 1.0f : c);
+
+            // c * -2^31 wrapped to 32 bits, without the overflow
+            hash ^= j + (pal_u32_t)(pal_u64_t)(c * 2147483648.0f);
+            hash ^= hash << 3;
+            hash += hash >> 5;
+            hash ^= hash << 4;
+            hash += hash >> 17;
+            hash ^= hash << 25;
+            hash += hash >> 6;
+        }
+    }
+
+    return hash;
+}
+
+
+int
+pal_create_sorted_gradient(pal_palette_t*           pal,
+                           const char*              gradient_name,
+                           pal_color_compare_func_t compare_callback,
+                           void*                    datum)
+{
+    PAL__UNUSED(datum);
+    int i, j;
+    if (pal->num_gradients >= PAL_MAX_GRADIENTS) {
+        PAL__ASSERT(!"no space for more gradients");
+        return 1;
+    }
+
+    // work in the unused gradient slot; the palette doesn't change
+    // until num_gradients does
+    pal_gradient_t gradient = pal->gradients[pal->num_gradients];
+    int            len = pal->num_colors;
+    gradient.num_indices = len;
+    for (i = 0; i < len; i++) {
+        gradient.indices[i] = (pal_u16_t)i;
+    }
+
+    // lame bubble sort
+    for (i = 0; i < len - 1; i++) {
+        for (j = 0; j < len - i - 1; j++) {
+            if (compare_callback(pal->colors[gradient.indices[j]],
+                                 pal->colors[gradient.indices[j + 1]],
+                                 NULL) > 0.0f) {
+                pal_u16_t temp = gradient.indices[j];
+                gradient.indices[j] = gradient.indices[j + 1];
+                gradient.indices[j + 1] = temp;
+            }
+        }
+    }
+
+#if 0
+    for (i = 0; i < len; i++) {
+        pal_color_t col = pal->colors[gradient.indices[i]];
+        float       h, s, v;
+        pal__get_hsv(col.rgba.r, col.rgba.g, col.rgba.b, &h, &s, &v);
+        printf("Color %s   r%.4f g%.4f b%.4f a%.4f: hue %f\n",
+               pal->color_names[gradient.indices[i]],
+               col.rgba.r,
+               col.rgba.g,
+               col.rgba.b,
+               col.rgba.a,
+               h);
+    }
+#endif
+
+    // success
+    pal->gradients[pal->num_gradients] = gradient;
+    pal__strncpy(pal->gradient_names[pal->num_gradients], gradient_name, PAL_MAX_STRLEN);
+    pal->num_gradients++;
+    return 0;
+}
+
+// stable bottom-up merge sort of color indices, highest key first
+// unless ascending is set.  keys is indexed by color index, not by
+// position in indices.  indices must have room for len * 2, the second
+// half being scratch space; a gradient's indices always do.
+static void
+pal__sort_indices_by_key(const float* keys, pal_u16_t* indices, int len, int ascending)
+{
+    pal_u16_t* src = indices;
+    pal_u16_t* dst = indices + len;
+    int        width;
+
+    for (width = 1; width < len; width *= 2) {
+        int lo;
+        for (lo = 0; lo < len; lo += width * 2) {
+            int mid = lo + width < len ? lo + width : len;
+            int hi = lo + width * 2 < len ? lo + width * 2 : len;
+            int a = lo, b = mid, k = lo;
+
+            // only take from the right run on a strictly greater
+            // (or lesser) key so ties keep their palette order, matching
+            // the bubble sort
+            while (a < mid && b < hi) {
+                int take_right = ascending ? keys[src[b]] < keys[src[a]]
+                                           : keys[src[b]] > keys[src[a]];
+                if (take_right)
+                    dst[k++] = src[b++];
+                else
+                    dst[k++] = src[a++];
+            }
+            while (a < mid) dst[k++] = src[a++];
+            while (b < hi) dst[k++] = src[b++];
+        }
+
+        {
+            pal_u16_t* temp = src;
+            src = dst;
+            dst = temp;
+        }
+    }
+
+    if (src != indices)
+        memcpy(indices, src, sizeof(pal_u16_t) * len);
+}
+
+int
+pal_create_key_sorted_gradient(pal_palette_t*       pal,
+                               const char*          gradient_name,
+                               pal_color_key_func_t key_func,
+                               void*                datum)
+{
+    int i;
+    if (pal->num_gradients >= PAL_MAX_GRADIENTS) {
+        PAL__ASSERT(!"no space for more gradients");
+        return 1;
+    }
+
+    int    len = pal->num_colors;
+    float* keys = (float*)PAL_REALLOC(NULL, sizeof(float) * (len ? len : 1));
+    if (!keys)
+        return 1;
+
+    for (i = 0; i < len; i++) {
+        keys[i] = key_func(pal->colors[i], datum);
+    }
+
+    pal_gradient_t* gradient = &pal->gradients[pal->num_gradients];
+    gradient->num_indices = len;
+    for (i = 0; i < len; i++) {
+        gradient->indices[i] = (pal_u16_t)i;
+    }
+    pal__sort_indices_by_key(keys, gradient->indices, len, 0);
+    PAL_FREE(keys);
+
+    pal__strncpy(pal->gradient_names[pal->num_gradients], gradient_name, PAL_MAX_STRLEN);
+    pal->num_gradients++;
+    return 0;
+}
+
+float
+pal_red_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+    return col1.rgba.r - col0.rgba.r;
+}
+
+float
+pal_green_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+    return col1.rgba.g - col0.rgba.g;
+}
+
+float
+pal_blue_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+    return col1.rgba.b - col0.rgba.b;
+}
+
+float
+pal_hue_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+
+    float hue0, sat0, val0;
+    float hue1, sat1, val1;
+    pal__get_hsv(col0.c[0], col0.c[1], col0.c[2], &hue0, &sat0, &val0);
+    pal__get_hsv(col1.c[0], col1.c[1], col1.c[2], &hue1, &sat1, &val1);
+
+    return hue1 - hue0;
+}
+
+float
+pal_saturation_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+
+    float hue0, sat0, val0;
+    float hue1, sat1, val1;
+    pal__get_hsv(col0.c[0], col0.c[1], col0.c[2], &hue0, &sat0, &val0);
+    pal__get_hsv(col1.c[0], col1.c[1], col1.c[2], &hue1, &sat1, &val1);
+
+    return sat1 - sat0;
+}
+
+float
+pal_value_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+
+    float hue0, sat0, val0;
+    float hue1, sat1, val1;
+    pal__get_hsv(col0.c[0], col0.c[1], col0.c[2], &hue0, &sat0, &val0);
+    pal__get_hsv(col1.c[0], col1.c[1], col1.c[2], &hue1, &sat1, &val1);
+
+    return val1 - val0;
+}
+
+float
+pal_lightness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+    float col0_lightness, col1_lightness;
+
+    {
+        float val_max = pal__max3(col0.c[0], col0.c[1], col0.c[2]);
+        float val_min = pal__min3(col0.c[0], col0.c[1], col0.c[2]);
+        col0_lightness = (val_max + val_min) / 2.0f;
+    }
+
+    {
+        float val_max = pal__max3(col1.c[0], col1.c[1], col1.c[2]);
+        float val_min = pal__min3(col1.c[0], col1.c[1], col1.c[2]);
+        col1_lightness = (val_max + val_min) / 2.0f;
+    }
+
+    return col1_lightness - col0_lightness;
+}
+
+
+/* XYZ to LAB conversion */
+static float pal__lab_f(float t)
+{
+    /* 6/29 = 0.20689655; (6/29)^3 = 0.00885645 */
+    if (t > 0.0088564516f) {
+        return cbrtf(t);
+    }
+    /* 1/3 * (29/6)^2 = 7.787037; 4/29 = 0.137931 */
+    return (7.787037f * t) + 0.137931034f;
+}
+
+/* Convert sRGB to CIELAB (D65 Illuminant) */
+static void pal__get_lab(float r, float g, float b, float* out_L, float* out_a, float* out_b)
+{
+    float lr = pal__srgb_to_linear(r);
+    float lg = pal__srgb_to_linear(g);
+    float lb = pal__srgb_to_linear(b);
+
+    /* Linear sRGB to CIE XYZ */
+    float x = (lr * 0.4124564f + lg * 0.3575761f + lb * 0.1804375f) / 0.95047f;
+    float y = (lr * 0.2126729f + lg * 0.7151522f + lb * 0.0721750f) / 1.00000f;
+    float z = (lr * 0.0193339f + lg * 0.1191920f + lb * 0.9503041f) / 1.08883f;
+
+    /* CIE XYZ to CIELAB */
+    float fx = pal__lab_f(x);
+    float fy = pal__lab_f(y);
+    float fz = pal__lab_f(z);
+
+    *out_L = (116.0f * fy) - 16.0f;
+    *out_a = 500.0f * (fx - fy);
+    *out_b = 200.0f * (fy - fz);
+}
+
+/* Batch sRGB to CIELAB
+ *
+ * pal_colors_to_lab() replaces the powf() and cbrtf() calls in
+ * pal__get_lab() with log2/exp2 approximations built from plain
+ * arithmetic, so four (SSE2) or eight (AVX2) colors convert at once.
+ * The widest kernel the cpu supports is picked on first use; the
+ * scalar kernel runs the same approximation one color at a time.
+ *
+ *   log2: exponent split, mantissa in [sqrt(1/2), sqrt(2)), atanh
+ *         series through t^7.  |t| <= 0.1716, so the truncation
+ *         error is below 4.2e-8.
+ *
+ *   exp2: n = floor(y + 0.5), 2^f for f in [-0.5, 0.5] by taylor
+ *         series through f^7.  relative truncation error is below
+ *         7.3e-9.  y is clamped to [-126, 127].
+ *
+ *   x^2.4 and cbrt(x) are exp2(2.4 * log2(x)) and exp2(log2(x) / 3).
+ *
+ * After float rounding, sRGB channels in [0, 1] land within 2e-4 of
+ * pal__get_lab() in each of L, a and b (measured: under 1e-4), which is
+ * well below the 1.0 just noticeable difference.  Every kernel performs
+ * the same float operations in the same order, so they agree bit for
+ * bit unless the compiler contracts the scalar kernel into fused
+ * multiply-adds.  Infinities and NaNs are not handled.
+ */
+
+static float
+pal__approx_log2(float x)
+{
+    pal_u32_t bits, mbits;
+    float     m;
+    memcpy(&bits, &x, sizeof(float));
+
+    int e = (int)((bits >> 23) & 0xff) - 127;
+    mbits = (bits & 0x007fffff) | 0x3f800000;
+    memcpy(&m, &mbits, sizeof(float));
+
+    if (m > 1.41421356f) {
+        m *= 0.5f;
+        e += 1;
+    }
+
+    float t = (m - 1.0f) / (m + 1.0f);
+    float t2 = t * t;
+    float p = 0.41219858f;
+    p = p * t2 + 0.57707802f;
+    p = p * t2 + 0.96179669f;
+    p = p * t2 + 2.88539008f;
+
+    return (float)e + p * t;
+}
+
+static float
+pal__approx_exp2(float y)
+{
+    y = pal__clampf32(y, -126.0f, 127.0f);
+
+    // floor(y + 0.5) without libm
+    float fl = y + 0.5f;
+    float tr = (float)(int)fl;
+    fl = tr > fl ? tr - 1.0f : tr;
+    float f = y - fl;
+
+    float p = 1.52527338e-5f;
+    p = p * f + 1.54035304e-4f;
+    p = p * f + 1.33335581e-3f;
+    p = p * f + 9.61812911e-3f;
+    p = p * f + 5.55041087e-2f;
+    p = p * f + 2.40226507e-1f;
+    p = p * f + 6.93147181e-1f;
+    p = p * f + 1.0f;
+
+    pal_u32_t scale_bits = (pal_u32_t)((int)fl + 127) << 23;
+    float     scale;
+    memcpy(&scale, &scale_bits, sizeof(float));
+
+    return p * scale;
+}
+
+static float
+pal__approx_srgb_to_linear(float c)
+{
+    if (c <= 0.04045f)
+        return c / 12.92f;
+    return pal__approx_exp2(2.4f * pal__approx_log2((c + 0.055f) / 1.055f));
+}
+
+static float
+pal__approx_lab_f(float t)
+{
+    if (t > 0.0088564516f)
+        return pal__approx_exp2(pal__approx_log2(t) / 3.0f);
+    return (7.787037f * t) + 0.137931034f;
+}
+
+static void
+pal__approx_lab(float r, float g, float b, float* out_L, float* out_a, float* out_b)
+{
+    float lr = pal__approx_srgb_to_linear(r);
+    float lg = pal__approx_srgb_to_linear(g);
+    float lb = pal__approx_srgb_to_linear(b);
+
+    float x = (lr * 0.4124564f + lg * 0.3575761f + lb * 0.1804375f) / 0.95047f;
+    float y = (lr * 0.2126729f + lg * 0.7151522f + lb * 0.0721750f) / 1.00000f;
+    float z = (lr * 0.0193339f + lg * 0.1191920f + lb * 0.9503041f) / 1.08883f;
+
+    float fx = pal__approx_lab_f(x);
+    float fy = pal__approx_lab_f(y);
+    float fz = pal__approx_lab_f(z);
+
+    *out_L = (116.0f * fy) - 16.0f;
+    *out_a = 500.0f * (fx - fy);
+    *out_b = 200.0f * (fy - fz);
+}
+
+static void
+pal__lab_kernel_scalar(const pal_color_t* colors, int num_colors, float* out_L, float* out_a, float* out_b)
+{
+    int i;
+    for (i = 0; i < num_colors; i++) {
+        pal__approx_lab(
+            colors[i].rgba.r, colors[i].rgba.g, colors[i].rgba.b, &out_L[i], &out_a[i], &out_b[i]);
+    }
+}
+
+#if !PAL__SSE2
+static void
+pal__soa_lab_kernel_scalar(const pal_color_soa_t* soa, float* out_L, float* out_a, float* out_b)
+{
+    int i;
+    for (i = 0; i < soa->num_padded; i++)
+        pal__approx_lab(soa->r[i], soa->g[i], soa->b[i], &out_L[i], &out_a[i], &out_b[i]);
+}
+#endif
+
+#if PAL__SSE2
+
+static __m128
+pal__log2_ps(__m128 x)
+{
+    __m128i bits = _mm_castps_si128(x);
+    __m128i e = _mm_sub_epi32(_mm_and_si128(_mm_srli_epi32(bits, 23), _mm_set1_epi32(0xff)),
+                              _mm_set1_epi32(127));
+    __m128  m = _mm_castsi128_ps(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007fffff)),
+                                             _mm_set1_epi32(0x3f800000)));
+
+    __m128 big = _mm_cmpgt_ps(m, _mm_set1_ps(1.41421356f));
+    m = _mm_or_ps(_mm_and_ps(big, _mm_mul_ps(m, _mm_set1_ps(0.5f))), _mm_andnot_ps(big, m));
+    e = _mm_sub_epi32(e, _mm_castps_si128(big));  // all bits set is -1
+
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 t = _mm_div_ps(_mm_sub_ps(m, one), _mm_add_ps(m, one));
+    __m128 t2 = _mm_mul_ps(t, t);
+    __m128 p = _mm_set1_ps(0.41219858f);
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(0.57707802f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(0.96179669f));
+    p = _mm_add_ps(_mm_mul_ps(p, t2), _mm_set1_ps(2.88539008f));
+
+    return _mm_add_ps(_mm_cvtepi32_ps(e), _mm_mul_ps(p, t));
+}
+
+static __m128
+pal__exp2_ps(__m128 y)
+{
+    y = _mm_min_ps(_mm_max_ps(y, _mm_set1_ps(-126.0f)), _mm_set1_ps(127.0f));
+
+    __m128 fl = _mm_add_ps(y, _mm_set1_ps(0.5f));
+    __m128 tr = _mm_cvtepi32_ps(_mm_cvttps_epi32(fl));
+    fl = _mm_sub_ps(tr, _mm_and_ps(_mm_cmpgt_ps(tr, fl), _mm_set1_ps(1.0f)));
+    __m128 f = _mm_sub_ps(y, fl);
+
+    __m128 p = _mm_set1_ps(1.52527338e-5f);
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.54035304e-4f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.33335581e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.61812911e-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.55041087e-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.40226507e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.93147181e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.0f));
+
+    __m128i n = _mm_add_epi32(_mm_cvttps_epi32(fl), _mm_set1_epi32(127));
+    return _mm_mul_ps(p, _mm_castsi128_ps(_mm_slli_epi32(n, 23)));
+}
+
+static __m128
+pal__srgb_to_linear_ps(__m128 c)
+{
+    __m128 lo = _mm_div_ps(c, _mm_set1_ps(12.92f));
+    __m128 x = _mm_div_ps(_mm_add_ps(c, _mm_set1_ps(0.055f)), _mm_set1_ps(1.055f));
+    __m128 hi = pal__exp2_ps(_mm_mul_ps(_mm_set1_ps(2.4f), pal__log2_ps(x)));
+
+    __m128 is_lo = _mm_cmple_ps(c, _mm_set1_ps(0.04045f));
+    return _mm_or_ps(_mm_and_ps(is_lo, lo), _mm_andnot_ps(is_lo, hi));
+}
+
+static __m128
+pal__lab_f_ps(__m128 t)
+{
+    __m128 cube = pal__exp2_ps(_mm_div_ps(pal__log2_ps(t), _mm_set1_ps(3.0f)));
+    __m128 lin = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(7.787037f), t), _mm_set1_ps(0.137931034f));
+
+    __m128 is_cube = _mm_cmpgt_ps(t, _mm_set1_ps(0.0088564516f));
+    return _mm_or_ps(_mm_and_ps(is_cube, cube), _mm_andnot_ps(is_cube, lin));
+}
+
+// dot product of linear rgb and one row of the sRGB to XYZ matrix
+#    define PAL__XYZ_ROW_PS(m0, m1, m2, white)                                           \
+        _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(lr, _mm_set1_ps(m0)),               \
+                                         _mm_mul_ps(lg, _mm_set1_ps(m1))),              \
+                              _mm_mul_ps(lb, _mm_set1_ps(m2))),                         \
+                   _mm_set1_ps(white))
+
+// four colors already split into channels
+static void
+pal__lab_ps(__m128 r, __m128 g, __m128 b, float* out_L, float* out_a, float* out_b)
+{
+    __m128 lr = pal__srgb_to_linear_ps(r);
+    __m128 lg = pal__srgb_to_linear_ps(g);
+    __m128 lb = pal__srgb_to_linear_ps(b);
+
+    __m128 fx = pal__lab_f_ps(PAL__XYZ_ROW_PS(0.4124564f, 0.3575761f, 0.1804375f, 0.95047f));
+    __m128 fy = pal__lab_f_ps(PAL__XYZ_ROW_PS(0.2126729f, 0.7151522f, 0.0721750f, 1.00000f));
+    __m128 fz = pal__lab_f_ps(PAL__XYZ_ROW_PS(0.0193339f, 0.1191920f, 0.9503041f, 1.08883f));
+
+    _mm_storeu_ps(out_L, _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(116.0f), fy), _mm_set1_ps(16.0f)));
+    _mm_storeu_ps(out_a, _mm_mul_ps(_mm_set1_ps(500.0f), _mm_sub_ps(fx, fy)));
+    _mm_storeu_ps(out_b, _mm_mul_ps(_mm_set1_ps(200.0f), _mm_sub_ps(fy, fz)));
+}
+
+static void
+pal__lab_kernel_sse2(const pal_color_t* colors, int num_colors, float* out_L, float* out_a, float* out_b)
+{
+    int i;
+    for (i = 0; i + 4 <= num_colors; i += 4) {
+        __m128 r = _mm_loadu_ps(colors[i + 0].c);
+        __m128 g = _mm_loadu_ps(colors[i + 1].c);
+        __m128 b = _mm_loadu_ps(colors[i + 2].c);
+        __m128 a = _mm_loadu_ps(colors[i + 3].c);
+        _MM_TRANSPOSE4_PS(r, g, b, a);
+
+        pal__lab_ps(r, g, b, out_L + i, out_a + i, out_b + i);
+    }
+
+    pal__lab_kernel_scalar(colors + i, num_colors - i, out_L + i, out_a + i, out_b + i);
+}
+
+static void
+pal__soa_lab_kernel_sse2(const pal_color_soa_t* soa, float* out_L, float* out_a, float* out_b)
+{
+    int i;
+    for (i = 0; i < soa->num_padded; i += 4) {
+        pal__lab_ps(_mm_load_ps(soa->r + i),
+                    _mm_load_ps(soa->g + i),
+                    _mm_load_ps(soa->b + i),
+                    out_L + i,
+                    out_a + i,
+                    out_b + i);
+    }
+}
+
+#    undef PAL__XYZ_ROW_PS
+#endif /* PAL__SSE2 */
+
+#if PAL__AVX2
+
+PAL__TARGET_AVX2 static __m256
+pal__log2_ps256(__m256 x)
+{
+    __m256i bits = _mm256_castps_si256(x);
+    __m256i e = _mm256_sub_epi32(
+        _mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0xff)),
+        _mm256_set1_epi32(127));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+        _mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)), _mm256_set1_epi32(0x3f800000)));
+
+    __m256 big = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+    m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), big);
+    e = _mm256_sub_epi32(e, _mm256_castps_si256(big));
+
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 p = _mm256_set1_ps(0.41219858f);
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(0.57707802f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(0.96179669f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, t2), _mm256_set1_ps(2.88539008f));
+
+    return _mm256_add_ps(_mm256_cvtepi32_ps(e), _mm256_mul_ps(p, t));
+}
+
+PAL__TARGET_AVX2 static __m256
+pal__exp2_ps256(__m256 y)
+{
+    y = _mm256_min_ps(_mm256_max_ps(y, _mm256_set1_ps(-126.0f)), _mm256_set1_ps(127.0f));
+
+    __m256 fl = _mm256_add_ps(y, _mm256_set1_ps(0.5f));
+    __m256 tr = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(fl));
+    fl = _mm256_sub_ps(
+        tr, _mm256_and_ps(_mm256_cmp_ps(tr, fl, _CMP_GT_OQ), _mm256_set1_ps(1.0f)));
+    __m256 f = _mm256_sub_ps(y, fl);
+
+    __m256 p = _mm256_set1_ps(1.52527338e-5f);
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.54035304e-4f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.33335581e-3f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(9.61812911e-3f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(5.55041087e-2f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(2.40226507e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(6.93147181e-1f));
+    p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.0f));
+
+    __m256i n = _mm256_add_epi32(_mm256_cvttps_epi32(fl), _mm256_set1_epi32(127));
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(_mm256_slli_epi32(n, 23)));
+}
+
+PAL__TARGET_AVX2 static __m256
+pal__srgb_to_linear_ps256(__m256 c)
+{
+    __m256 lo = _mm256_div_ps(c, _mm256_set1_ps(12.92f));
+    __m256 x = _mm256_div_ps(_mm256_add_ps(c, _mm256_set1_ps(0.055f)), _mm256_set1_ps(1.055f));
+    __m256 hi = pal__exp2_ps256(_mm256_mul_ps(_mm256_set1_ps(2.4f), pal__log2_ps256(x)));
+
+    return _mm256_blendv_ps(hi, lo, _mm256_cmp_ps(c, _mm256_set1_ps(0.04045f), _CMP_LE_OQ));
+}
+
+PAL__TARGET_AVX2 static __m256
+pal__lab_f_ps256(__m256 t)
+{
+    __m256 cube = pal__exp2_ps256(_mm256_div_ps(pal__log2_ps256(t), _mm256_set1_ps(3.0f)));
+    __m256 lin =
+        _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(7.787037f), t), _mm256_set1_ps(0.137931034f));
+
+    return _mm256_blendv_ps(
+        lin, cube, _mm256_cmp_ps(t, _mm256_set1_ps(0.0088564516f), _CMP_GT_OQ));
+}
+
+#    define PAL__XYZ_ROW_PS256(m0, m1, m2, white)                                        \
+        _mm256_div_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(lr, _mm256_set1_ps(m0)), \
+                                                  _mm256_mul_ps(lg, _mm256_set1_ps(m1))), \
+                                    _mm256_mul_ps(lb, _mm256_set1_ps(m2))),              \
+                      _mm256_set1_ps(white))
+
+// eight colors already split into channels
+PAL__TARGET_AVX2 static void
+pal__lab_ps256(__m256 r, __m256 g, __m256 b, float* out_L, float* out_a, float* out_b)
+{
+    __m256 lr = pal__srgb_to_linear_ps256(r);
+    __m256 lg = pal__srgb_to_linear_ps256(g);
+    __m256 lb = pal__srgb_to_linear_ps256(b);
+
+    __m256 fx = pal__lab_f_ps256(PAL__XYZ_ROW_PS256(0.4124564f, 0.3575761f, 0.1804375f, 0.95047f));
+    __m256 fy = pal__lab_f_ps256(PAL__XYZ_ROW_PS256(0.2126729f, 0.7151522f, 0.0721750f, 1.00000f));
+    __m256 fz = pal__lab_f_ps256(PAL__XYZ_ROW_PS256(0.0193339f, 0.1191920f, 0.9503041f, 1.08883f));
+
+    _mm256_storeu_ps(
+        out_L, _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(116.0f), fy), _mm256_set1_ps(16.0f)));
+    _mm256_storeu_ps(out_a, _mm256_mul_ps(_mm256_set1_ps(500.0f), _mm256_sub_ps(fx, fy)));
+    _mm256_storeu_ps(out_b, _mm256_mul_ps(_mm256_set1_ps(200.0f), _mm256_sub_ps(fy, fz)));
+}
+
+PAL__TARGET_AVX2 static void
+pal__lab_kernel_avx2(const pal_color_t* colors, int num_colors, float* out_L, float* out_a, float* out_b)
+{
+    int i;
+    for (i = 0; i + 8 <= num_colors; i += 8) {
+        // transpose two groups of four rgba colors, then join the halves
+        __m128 r0 = _mm_loadu_ps(colors[i + 0].c);
+        __m128 g0 = _mm_loadu_ps(colors[i + 1].c);
+        __m128 b0 = _mm_loadu_ps(colors[i + 2].c);
+        __m128 a0 = _mm_loadu_ps(colors[i + 3].c);
+        __m128 r1 = _mm_loadu_ps(colors[i + 4].c);
+        __m128 g1 = _mm_loadu_ps(colors[i + 5].c);
+        __m128 b1 = _mm_loadu_ps(colors[i + 6].c);
+        __m128 a1 = _mm_loadu_ps(colors[i + 7].c);
+        _MM_TRANSPOSE4_PS(r0, g0, b0, a0);
+        _MM_TRANSPOSE4_PS(r1, g1, b1, a1);
+
+        __m256 r = _mm256_insertf128_ps(_mm256_castps128_ps256(r0), r1, 1);
+        __m256 g = _mm256_insertf128_ps(_mm256_castps128_ps256(g0), g1, 1);
+        __m256 b = _mm256_insertf128_ps(_mm256_castps128_ps256(b0), b1, 1);
+
+        pal__lab_ps256(r, g, b, out_L + i, out_a + i, out_b + i);
+    }
+
+    pal__lab_kernel_scalar(colors + i, num_colors - i, out_L + i, out_a + i, out_b + i);
+}
+
+PAL__TARGET_AVX2 static void
+pal__soa_lab_kernel_avx2(const pal_color_soa_t* soa, float* out_L, float* out_a, float* out_b)
+{
+    int i;
+    for (i = 0; i < soa->num_padded; i += 8) {
+        pal__lab_ps256(_mm256_load_ps(soa->r + i),
+                       _mm256_load_ps(soa->g + i),
+                       _mm256_load_ps(soa->b + i),
+                       out_L + i,
+                       out_a + i,
+                       out_b + i);
+    }
+}
+
+#    undef PAL__XYZ_ROW_PS256
+
+static int
+pal__cpu_has_avx2(void)
+{
+#    if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return 0;
+
+    // the os must also save ymm registers: OSXSAVE, AVX and XCR0 bits
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+        return 0;
+    if ((_xgetbv(0) & 6) != 6)
+        return 0;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#    else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#    endif
+}
+#endif /* PAL__AVX2 */
+
+typedef void (*pal__lab_kernel_t)(const pal_color_t* colors,
+                                  int                num_colors,
+                                  float*             out_L,
+                                  float*             out_a,
+                                  float*             out_b);
+
+static pal__lab_kernel_t
+pal__select_lab_kernel(void)
+{
+#if PAL__AVX2
+    if (pal__cpu_has_avx2())
+        return pal__lab_kernel_avx2;
+#endif
+#if PAL__SSE2
+    return pal__lab_kernel_sse2;
+#else
+    return pal__lab_kernel_scalar;
+#endif
+}
+
+PALDEF void
+pal_colors_to_lab(const pal_color_t* colors, int num_colors, float* out_L, float* out_a, float* out_b)
+{
+    // selecting twice from racing threads is harmless
+    static pal__lab_kernel_t selected = NULL;
+    pal__lab_kernel_t        kernel = PAL__LOAD_RELAXED(selected);
+    if (!kernel) {
+        kernel = pal__select_lab_kernel();
+        PAL__STORE_RELAXED(selected, kernel);
+    }
+
+    kernel(colors, num_colors, out_L, out_a, out_b);
+}
+
+PALDEF void
+pal_palette_to_lab(const pal_palette_t* pal, float* out_L, float* out_a, float* out_b)
+{
+    pal_colors_to_lab(pal->colors, pal->num_colors, out_L, out_a, out_b);
+}
+
+typedef void (*pal__soa_lab_kernel_t)(const pal_color_soa_t* soa,
+                                      float*                 out_L,
+                                      float*                 out_a,
+                                      float*                 out_b);
+
+static pal__soa_lab_kernel_t
+pal__select_soa_lab_kernel(void)
+{
+#if PAL__AVX2
+    if (pal__cpu_has_avx2())
+        return pal__soa_lab_kernel_avx2;
+#endif
+#if PAL__SSE2
+    return pal__soa_lab_kernel_sse2;
+#else
+    return pal__soa_lab_kernel_scalar;
+#endif
+}
+
+PALDEF void
+pal_color_soa_to_lab(const pal_color_soa_t* soa, float* out_L, float* out_a, float* out_b)
+{
+    // selecting twice from racing threads is harmless
+    static pal__soa_lab_kernel_t selected = NULL;
+    pal__soa_lab_kernel_t        kernel = PAL__LOAD_RELAXED(selected);
+    if (!kernel) {
+        kernel = pal__select_soa_lab_kernel();
+        PAL__STORE_RELAXED(selected, kernel);
+    }
+
+    kernel(soa, out_L, out_a, out_b);
+}
+
+PALDEF int
+pal_color_soa_create(pal_color_soa_t* soa, const pal_color_t* colors, int num_colors)
+{
+    size_t num_padded = ((size_t)num_colors + PAL_SOA_LANES - 1) & ~(size_t)(PAL_SOA_LANES - 1);
+    char*  block = (char*)PAL_REALLOC(NULL, sizeof(float) * 4 * num_padded + PAL_SOA_ALIGN - 1);
+    float* base;
+    int    i;
+
+    PAL__ASSERT(num_colors >= 0);
+    if (!block)
+        return 1;
+
+    base = (float*)(((size_t)block + PAL_SOA_ALIGN - 1) & ~(size_t)(PAL_SOA_ALIGN - 1));
+
+    soa->num_colors = num_colors;
+    soa->num_padded = (int)num_padded;
+    soa->r = base;
+    soa->g = base + num_padded;
+    soa->b = base + num_padded * 2;
+    soa->a = base + num_padded * 3;
+    soa->block = block;
+
+    i = 0;
+#if PAL__SSE2
+    for (; i + 4 <= num_colors; i += 4) {
+        __m128 r = _mm_loadu_ps(colors[i + 0].c);
+        __m128 g = _mm_loadu_ps(colors[i + 1].c);
+        __m128 b = _mm_loadu_ps(colors[i + 2].c);
+        __m128 a = _mm_loadu_ps(colors[i + 3].c);
+        _MM_TRANSPOSE4_PS(r, g, b, a);
+
+        _mm_store_ps(soa->r + i, r);
+        _mm_store_ps(soa->g + i, g);
+        _mm_store_ps(soa->b + i, b);
+        _mm_store_ps(soa->a + i, a);
+    }
+#endif
+    for (; i < num_colors; i++) {
+        soa->r[i] = colors[i].rgba.r;
+        soa->g[i] = colors[i].rgba.g;
+        soa->b[i] = colors[i].rgba.b;
+        soa->a[i] = colors[i].rgba.a;
+    }
+
+    for (; i < soa->num_padded; i++) soa->r[i] = soa->g[i] = soa->b[i] = soa->a[i] = 0.0f;
+
+    return 0;
+}
+
+PALDEF void
+pal_color_soa_free(pal_color_soa_t* soa)
+{
+    PAL_FREE(soa->block);
+    memset(soa, 0, sizeof(*soa));
+}
+
+PALDEF void
+pal_color_soa_store(const pal_color_soa_t* soa, pal_color_t* out_colors)
+{
+    int i = 0;
+
+#if PAL__SSE2
+    for (; i + 4 <= soa->num_colors; i += 4) {
+        __m128 c0 = _mm_load_ps(soa->r + i);
+        __m128 c1 = _mm_load_ps(soa->g + i);
+        __m128 c2 = _mm_load_ps(soa->b + i);
+        __m128 c3 = _mm_load_ps(soa->a + i);
+        _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+        _mm_storeu_ps(out_colors[i + 0].c, c0);
+        _mm_storeu_ps(out_colors[i + 1].c, c1);
+        _mm_storeu_ps(out_colors[i + 2].c, c2);
+        _mm_storeu_ps(out_colors[i + 3].c, c3);
+    }
+#endif
+    for (; i < soa->num_colors; i++) {
+        out_colors[i].rgba.r = soa->r[i];
+        out_colors[i].rgba.g = soa->g[i];
+        out_colors[i].rgba.b = soa->b[i];
+        out_colors[i].rgba.a = soa->a[i];
+    }
+}
+
+PALDEF int
+pal_palette_to_color_soa(const pal_palette_t* pal, pal_color_soa_t* soa)
+{
+    return pal_color_soa_create(soa, pal->colors, pal->num_colors);
+}
+
+PALDEF int
+pal_palette_from_color_soa(const pal_color_soa_t* soa, pal_palette_t* pal)
+{
+    if (pal_reserve(pal, soa->num_colors) != 0)
+        return 1;
+
+    pal_color_soa_store(soa, pal->colors);
+    pal->num_colors = (pal_u16_t)soa->num_colors;
+
+    return 0;
+}
+
+PALDEF void
+pal_color_soa_srgb_to_linear(pal_color_soa_t* soa)
+{
+    int i;
+    pal__init_transfer_tables();
+
+    for (i = 0; i < soa->num_padded; i++) soa->r[i] = pal__table_srgb_to_linear(soa->r[i]);
+    for (i = 0; i < soa->num_padded; i++) soa->g[i] = pal__table_srgb_to_linear(soa->g[i]);
+    for (i = 0; i < soa->num_padded; i++) soa->b[i] = pal__table_srgb_to_linear(soa->b[i]);
+}
+
+PALDEF void
+pal_color_soa_linear_to_srgb(pal_color_soa_t* soa)
+{
+    int i;
+    pal__init_transfer_tables();
+
+    for (i = 0; i < soa->num_padded; i++) soa->r[i] = pal__table_linear_to_srgb(soa->r[i]);
+    for (i = 0; i < soa->num_padded; i++) soa->g[i] = pal__table_linear_to_srgb(soa->g[i]);
+    for (i = 0; i < soa->num_padded; i++) soa->b[i] = pal__table_linear_to_srgb(soa->b[i]);
+}
+
+#if PAL__SSE2
+// pal_convert_channel_to_8bit on four channels, one per 32-bit lane
+static __m128i
+pal__channel_to_8bit_ps(__m128 val)
+{
+    __m128i fixed, reduced, is_half;
+
+    val = _mm_min_ps(_mm_max_ps(val, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    fixed = _mm_cvttps_epi32(_mm_mul_ps(val, _mm_set1_ps(256.0f)));
+
+    // fixed * 255 + 192 >> 8
+    reduced = _mm_sub_epi32(_mm_slli_epi32(fixed, 8), fixed);
+    reduced = _mm_srli_epi32(_mm_add_epi32(reduced, _mm_set1_epi32(192)), 8);
+
+    is_half = _mm_cmpeq_epi32(fixed, _mm_set1_epi32(128));
+    return _mm_or_si128(_mm_and_si128(is_half, _mm_set1_epi32(127)),
+                        _mm_andnot_si128(is_half, reduced));
+}
+#endif
+
+PALDEF void
+pal_color_soa_to_8bit(const pal_color_soa_t* soa, pal_u8_t* out_rgba)
+{
+    int i = 0;
+
+#if PAL__SSE2
+    for (; i + 4 <= soa->num_colors; i += 4) {
+        __m128i r = pal__channel_to_8bit_ps(_mm_load_ps(soa->r + i));
+        __m128i g = pal__channel_to_8bit_ps(_mm_load_ps(soa->g + i));
+        __m128i b = pal__channel_to_8bit_ps(_mm_load_ps(soa->b + i));
+        __m128i a = pal__channel_to_8bit_ps(_mm_load_ps(soa->a + i));
+
+        // little endian: r is the lowest byte of each color
+        __m128i rgba = _mm_or_si128(_mm_or_si128(r, _mm_slli_epi32(g, 8)),
+                                    _mm_or_si128(_mm_slli_epi32(b, 16), _mm_slli_epi32(a, 24)));
+        _mm_storeu_si128((__m128i*)(out_rgba + i * 4), rgba);
+    }
+#endif
+    for (; i < soa->num_colors; i++) {
+        out_rgba[i * 4 + 0] = pal_convert_channel_to_8bit(soa->r[i]);
+        out_rgba[i * 4 + 1] = pal_convert_channel_to_8bit(soa->g[i]);
+        out_rgba[i * 4 + 2] = pal_convert_channel_to_8bit(soa->b[i]);
+        out_rgba[i * 4 + 3] = pal_convert_channel_to_8bit(soa->a[i]);
+    }
+}
+
+// pal_color_hash64_t
+//
+// a color's 128 bits are two 64-bit lanes, r|g and b|a.  each lane is
+// xored with a key that depends on the lane and the color's index, and
+// its 32-bit halves are multiplied into a 64-bit product, nh style.
+// adding the half-swapped input keeps colors whose product is zero
+// apart.  keys step by a constant per color so the simd kernels can
+// carry them in registers.
+#define PAL__HASH64_KEY0 0x1cad21f72c81017cull
+#define PAL__HASH64_KEY1 0xbe4ba423396cfeb8ull
+#define PAL__HASH64_STEP0 0x9e3779b97f4a7c15ull
+#define PAL__HASH64_STEP1 0xc2b2ae3d27d4eb4full
+#define PAL__HASH64_LENGTH 0x165667b19e3779f9ull
+
+static pal_u64_t
+pal__hash64_lane(pal_u64_t lane, pal_u64_t key)
+{
+    pal_u64_t d = lane ^ key;
+    return (d & 0xffffffffull) * (d >> 32) + ((lane << 32) | (lane >> 32));
+}
+
+static pal_u64_t
+pal__hash64_color_term(const pal_color_t* color, pal_u64_t index)
+{
+    pal_u32_t bits[4];
+    memcpy(bits, color->c, sizeof(bits));
+
+    return pal__hash64_lane(bits[0] | (pal_u64_t)bits[1] << 32,
+                            PAL__HASH64_KEY0 + index * PAL__HASH64_STEP0) +
+           pal__hash64_lane(bits[2] | (pal_u64_t)bits[3] << 32,
+                            PAL__HASH64_KEY1 + index * PAL__HASH64_STEP1);
+}
+
+#if !PAL__SSE2
+static pal_u64_t
+pal__hash64_kernel_scalar(const pal_color_t* colors, int num_colors)
+{
+    pal_u64_t sum = 0;
+    int       i;
+
+    for (i = 0; i < num_colors; i++) sum += pal__hash64_color_term(&colors[i], (pal_u64_t)i);
+
+    return sum;
+}
+#endif
+
+#if PAL__SSE2
+// one color per register; x86 is little endian, so each 64-bit lane
+// holds r|g and b|a exactly as the scalar term builds them
+static pal_u64_t
+pal__hash64_kernel_sse2(const pal_color_t* colors, int num_colors)
+{
+    __m128i   acc = _mm_setzero_si128();
+    __m128i   key = _mm_set_epi64x((long long)PAL__HASH64_KEY1, (long long)PAL__HASH64_KEY0);
+    __m128i   step = _mm_set_epi64x((long long)PAL__HASH64_STEP1, (long long)PAL__HASH64_STEP0);
+    pal_u64_t lanes[2];
+    int       i;
+
+    for (i = 0; i < num_colors; i++) {
+        __m128i in = _mm_loadu_si128((const __m128i*)colors[i].c);
+        __m128i d = _mm_xor_si128(in, key);
+        __m128i product = _mm_mul_epu32(d, _mm_srli_epi64(d, 32));
+        __m128i swapped = _mm_shuffle_epi32(in, _MM_SHUFFLE(2, 3, 0, 1));
+
+        acc = _mm_add_epi64(acc, _mm_add_epi64(product, swapped));
+        key = _mm_add_epi64(key, step);
+    }
+
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    return lanes[0] + lanes[1];
+}
+#endif
+
+#if PAL__AVX2
+// two colors per register
+PAL__TARGET_AVX2 static pal_u64_t
+pal__hash64_kernel_avx2(const pal_color_t* colors, int num_colors)
+{
+    __m256i   acc = _mm256_setzero_si256();
+    __m256i   key = _mm256_set_epi64x((long long)(PAL__HASH64_KEY1 + PAL__HASH64_STEP1),
+                                    (long long)(PAL__HASH64_KEY0 + PAL__HASH64_STEP0),
+                                    (long long)PAL__HASH64_KEY1,
+                                    (long long)PAL__HASH64_KEY0);
+    __m256i   step = _mm256_set_epi64x((long long)(PAL__HASH64_STEP1 * 2),
+                                     (long long)(PAL__HASH64_STEP0 * 2),
+                                     (long long)(PAL__HASH64_STEP1 * 2),
+                                     (long long)(PAL__HASH64_STEP0 * 2));
+    pal_u64_t lanes[4];
+    pal_u64_t sum;
+    int       i;
+
+    for (i = 0; i + 2 <= num_colors; i += 2) {
+        __m256i in = _mm256_loadu_si256((const __m256i*)colors[i].c);
+        __m256i d = _mm256_xor_si256(in, key);
+        __m256i product = _mm256_mul_epu32(d, _mm256_srli_epi64(d, 32));
+        __m256i swapped = _mm256_shuffle_epi32(in, _MM_SHUFFLE(2, 3, 0, 1));
+
+        acc = _mm256_add_epi64(acc, _mm256_add_epi64(product, swapped));
+        key = _mm256_add_epi64(key, step);
+    }
+
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    for (; i < num_colors; i++) sum += pal__hash64_color_term(&colors[i], (pal_u64_t)i);
+
+    return sum;
+}
+#endif
+
+typedef pal_u64_t (*pal__hash64_kernel_t)(const pal_color_t* colors, int num_colors);
+
+static pal__hash64_kernel_t
+pal__select_hash64_kernel(void)
+{
+#if PAL__AVX2
+    if (pal__cpu_has_avx2())
+        return pal__hash64_kernel_avx2;
+#endif
+#if PAL__SSE2
+    return pal__hash64_kernel_sse2;
+#else
+    return pal__hash64_kernel_scalar;
+#endif
+}
+
+PALDEF void
+pal_color_hash64_init(pal_color_hash64_t* h, const pal_color_t* colors, int num_colors)
+{
+    // selecting twice from racing threads is harmless
+    static pal__hash64_kernel_t selected = NULL;
+    pal__hash64_kernel_t        kernel = PAL__LOAD_RELAXED(selected);
+    if (!kernel) {
+        kernel = pal__select_hash64_kernel();
+        PAL__STORE_RELAXED(selected, kernel);
+    }
+
+    h->sum = kernel(colors, num_colors);
+    h->num_colors = num_colors;
+}
+
+PALDEF void
+pal_color_hash64_update(pal_color_hash64_t* h,
+                        int                 index,
+                        const pal_color_t*  old_color,
+                        const pal_color_t*  new_color)
+{
+    PAL__ASSERT(index >= 0 && index < h->num_colors);
+
+    h->sum -= pal__hash64_color_term(old_color, (pal_u64_t)index);
+    h->sum += pal__hash64_color_term(new_color, (pal_u64_t)index);
+}
+
+PALDEF pal_u64_t
+pal_color_hash64_value(const pal_color_hash64_t* h)
+{
+    // murmur3 finalizer, so every bit of the sum reaches every output bit
+    pal_u64_t x = h->sum ^ ((pal_u64_t)h->num_colors * PAL__HASH64_LENGTH);
+
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+
+    return x;
+}
+
+PALDEF pal_u64_t
+pal_hash_color_values64(const pal_palette_t* pal)
+{
+    pal_color_hash64_t h;
+    pal_color_hash64_init(&h, pal->colors, pal->num_colors);
+    return pal_color_hash64_value(&h);
+}
+
+/* Returns the squared perceptual distance (Delta E^2) from a target LAB color. 
+   Smaller values mean the color is perceptually closer to the target. */
+static float pal__lab_distance_sq_from_target(pal_color_t col, float tL, float ta, float tb)
+{
+    float L, a, b;
+    pal__get_lab(col.rgba.r, col.rgba.g, col.rgba.b, &L, &a, &b);
+    
+    float dL = L - tL;
+    float da = a - ta;
+    float db = b - tb;
+    
+    return (dL * dL) + (da * da) + (db * db);
+}
+
+/* * Sorting Callbacks 
+ * Target LAB coordinates are pre-computed for pure sRGB primaries/secondaries.
+ */
+
+float pal_redness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+    /* Pure sRGB Red: L=53.24, a=80.09, b=67.20 */
+    return pal__lab_distance_sq_from_target(col0, 53.24f, 80.09f, 67.20f)
+         - pal__lab_distance_sq_from_target(col1, 53.24f, 80.09f, 67.20f);
+}
+
+float pal_yellowness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+    /* Pure sRGB Yellow: L=97.14, a=-21.55, b=94.48 */
+    return pal__lab_distance_sq_from_target(col0, 97.14f, -21.55f, 94.48f)
+         - pal__lab_distance_sq_from_target(col1, 97.14f, -21.55f, 94.48f);
+}
+
+float pal_greenness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+    /* Pure sRGB Green: L=87.73, a=-86.18, b=83.18 */
+    return pal__lab_distance_sq_from_target(col0, 87.73f, -86.18f, 83.18f)
+         - pal__lab_distance_sq_from_target(col1, 87.73f, -86.18f, 83.18f);
+}
+
+float pal_cyanness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+    /* Pure sRGB Cyan: L=91.11, a=-48.09, b=-14.13 */
+    return pal__lab_distance_sq_from_target(col0, 91.11f, -48.09f, -14.13f)
+         - pal__lab_distance_sq_from_target(col1, 91.11f, -48.09f, -14.13f);
+}
+
+float pal_blueness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+    /* Pure sRGB Blue: L=32.30, a=79.19, b=-107.86 */
+    return pal__lab_distance_sq_from_target(col0, 32.30f, 79.19f, -107.86f)
+         - pal__lab_distance_sq_from_target(col1, 32.30f, 79.19f, -107.86f);
+}
+
+float pal_magentaness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+{
+    PAL__UNUSED(datum);
+    /* Pure sRGB Magenta: L=60.32, a=98.23, b=-60.82 */
+    return pal__lab_distance_sq_from_target(col0, 60.32f, 98.23f, -60.82f)
+         - pal__lab_distance_sq_from_target(col1, 60.32f, 98.23f, -60.82f);
+}
+
+/* * Sort keys
+ * The callbacks above return a positive value when col1 belongs before
+ * col0, so channel keys are the value itself and proximity keys are the
+ * negated distance.
+ */
+
+float
+pal_red_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    return col.rgba.r;
+}
+
+float
+pal_green_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    return col.rgba.g;
+}
+
+float
+pal_blue_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    return col.rgba.b;
+}
+
+float
+pal_hue_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    float hue, sat, val;
+    pal__get_hsv(col.c[0], col.c[1], col.c[2], &hue, &sat, &val);
+    return hue;
+}
+
+float
+pal_saturation_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    float hue, sat, val;
+    pal__get_hsv(col.c[0], col.c[1], col.c[2], &hue, &sat, &val);
+    return sat;
+}
+
+float
+pal_value_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    float hue, sat, val;
+    pal__get_hsv(col.c[0], col.c[1], col.c[2], &hue, &sat, &val);
+    return val;
+}
+
+float
+pal_lightness_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    float val_max = pal__max3(col.c[0], col.c[1], col.c[2]);
+    float val_min = pal__min3(col.c[0], col.c[1], col.c[2]);
+    return (val_max + val_min) / 2.0f;
+}
+
+float pal_redness_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    return -pal__lab_distance_sq_from_target(col, 53.24f, 80.09f, 67.20f);
+}
+
+float pal_yellowness_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    return -pal__lab_distance_sq_from_target(col, 97.14f, -21.55f, 94.48f);
+}
+
+float pal_greenness_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    return -pal__lab_distance_sq_from_target(col, 87.73f, -86.18f, 83.18f);
+}
+
+float pal_cyanness_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    return -pal__lab_distance_sq_from_target(col, 91.11f, -48.09f, -14.13f);
+}
+
+float pal_blueness_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    return -pal__lab_distance_sq_from_target(col, 32.30f, 79.19f, -107.86f);
+}
 
-        pal_str_t*   col_name = &out_pal->color_names[out_pal->num_colors];
-        pal_color_t* col = &out_pal->colors[out_pal->num_colors];
+float pal_magentaness_key(pal_color_t col, void* datum)
+{
+    PAL__UNUSED(datum);
+    return -pal__lab_distance_sq_from_target(col, 60.32f, 98.23f, -60.82f);
+}
 
-        out_pal->num_colors++;
+/* CIELAB of each pal_primary_t, matching the constants in the callbacks */
+static const float pal__primary_lab[PAL_PRIMARY_MAX][3] = {
+    {53.24f, 80.09f, 67.20f},
+    {97.14f, -21.55f, 94.48f},
+    {87.73f, -86.18f, 83.18f},
+    {91.11f, -48.09f, -14.13f},
+    {32.30f, 79.19f, -107.86f},
+    {60.32f, 98.23f, -60.82f},
+};
 
-        col->rgba.r = pal_convert_channel_to_f32(pal__clamp8(r, 0, 255));
-        col->rgba.g = pal_convert_channel_to_f32(pal__clamp8(g, 0, 255));
-        col->rgba.b = pal_convert_channel_to_f32(pal__clamp8(b, 0, 255));
-        col->rgba.a = 1.0f;
+// everything but r, g and b, which are already filled in
+static void
+pal__compute_features_from_rgb(pal_color_features_t* f)
+{
+    int i, j;
 
-        // Parse optional name
-        while (p < end && pal__is_space(*p)) ++p;
-        pal__parse_name(p, end, *col_name);
+    for (i = 0; i < f->num_colors; i++) {
+        pal__get_hsv(f->r[i], f->g[i], f->b[i], &f->hue[i], &f->saturation[i], &f->value[i]);
 
-        // Skip to next line
-        while (p < end && *p != '\n') ++p;
-        if (p < end && *p == '\n')
-            ++p;
+        float val_max = pal__max3(f->r[i], f->g[i], f->b[i]);
+        float val_min = pal__min3(f->r[i], f->g[i], f->b[i]);
+        f->lightness[i] = (val_max + val_min) / 2.0f;
     }
 
-    return 0;
-}
+    for (i = 0; i < f->num_colors; i++) {
+        pal__get_lab(f->r[i], f->g[i], f->b[i], &f->lab_l[i], &f->lab_a[i], &f->lab_b[i]);
+    }
 
-static int
-pal__validate_magic(const char *magic, size_t len, const char **p, const char *end, bool scan_past_eol_chars) {
-    if (end - *p < (ptrdiff_t)len)
-        return 1;
+    for (j = 0; j < PAL_PRIMARY_MAX; j++) {
+        float tL = pal__primary_lab[j][0];
+        float ta = pal__primary_lab[j][1];
+        float tb = pal__primary_lab[j][2];
 
-    for (size_t i = 0; i < len; i++) {
-        if (**p != magic[i]) {
-            PAL__ASSERT("expected magic string not found");
-            return 1;
+        // same arithmetic as pal__lab_distance_sq_from_target so the
+        // orderings match the callbacks bit for bit
+        for (i = 0; i < f->num_colors; i++) {
+            float dL = f->lab_l[i] - tL;
+            float da = f->lab_a[i] - ta;
+            float db = f->lab_b[i] - tb;
+
+            f->primary_dist_sq[j][i] = (dL * dL) + (da * da) + (db * db);
         }
-        (*p)++;
     }
-    
-    while (scan_past_eol_chars && (**p == '\n' || **p == '\r'))
-        (*p)++;
-    
-    return 0;
 }
 
-PALDEF int
-pal_parse_jasc(const unsigned char *bytes,
-               unsigned int len,
-               pal_palette_t *out_pal,
-               const char *jasc_source_url)
+// size f for num_colors colors, discarding its contents
+static int
+pal__color_features_reserve(pal_color_features_t* f, int num_colors)
 {
-    const char *p = (const char*)bytes;
-    const char* end = p + (len > 1 ? len - 1 : 0);
-    
-    const char MAGIC0[] = "JASC-PAL";
-    if (pal__validate_magic(MAGIC0, sizeof(MAGIC0)-1, &p, end, true) != 0) {
-        return 1;
-    }
+    enum { NUM_ARRAYS = 10 + PAL_PRIMARY_MAX };
+    float* block;
+    int    i;
 
-    const char MAGIC1[] = "0100";
-    if (pal__validate_magic(MAGIC1, sizeof(MAGIC1)-1, &p, end, true) != 0) {
-        return 1;
-    }
+    if (num_colors <= f->capacity)
+        return 0;
 
-    // todo: write a function to zero init all these, and missing fields
-    out_pal->num_colors = 0;
-    out_pal->title[0] = 0;
-    out_pal->num_gradients = 0;
-    out_pal->num_dither_pairs = 0;
-    {
-        int i;
-        for (i = 0; i < PAL_MAX_HINTS; i++) out_pal->num_hints[i] = 0;
-    }
-    pal__palette_set_srgb(out_pal);
-    pal__strncpy(
-        out_pal->source.conversion_tool,
-        "ftg_palette.h - https://github.com/frogtoss/ftg_toolbox_public",
-        PAL_MAX_STRLEN);
-    out_pal->source.conversion_timestamp = PAL_TIME(NULL);
-    
-    /* p is now at the number of colours line */
-    int jasc_num_colors = pal__parse_base10_int(&p, end);
-    if (jasc_num_colors > 256) {
-        PAL__ASSERT("jasc palette can't have more than 256 colors");
-        return 1;
-    }
-    if (jasc_num_colors <= 0) {
-        PAL__ASSERT("jasc palette can't have 0 colors");
+    block = (float*)PAL_REALLOC(f->block, sizeof(float) * NUM_ARRAYS * (size_t)num_colors);
+    if (!block)
         return 1;
-    }
-    while (p < end && (*p == '\n' || *p == '\r')) p++;  
-
-    // todo: semcompress
-    pal__strncpy(
-        out_pal->source.conversion_tool,
-        "ftg_palette.h - https://github.com/frogtoss/ftg_toolbox_public",
-        PAL_MAX_STRLEN);
-    out_pal->source.conversion_timestamp = PAL_TIME(NULL);
-    
-    for (int i = 0; i < jasc_num_colors; i++) {
-        if (*p == '\0' || p > end) {
-            PAL__ASSERT("Premature end to JASC palette");
-            return 1;
-        }
-
-        int r = pal__parse_base10_int(&p, end);
-        int g = pal__parse_base10_int(&p, end);
-        int b = pal__parse_base10_int(&p, end);
 
-        while (p < end && (*p == '\n' || *p == '\r')) p++;  
+    f->block = block;
+    f->capacity = num_colors;
+
+    f->r = block;
+    f->g = f->r + num_colors;
+    f->b = f->g + num_colors;
+    f->hue = f->b + num_colors;
+    f->saturation = f->hue + num_colors;
+    f->value = f->saturation + num_colors;
+    f->lightness = f->value + num_colors;
+    f->lab_l = f->lightness + num_colors;
+    f->lab_a = f->lab_l + num_colors;
+    f->lab_b = f->lab_a + num_colors;
+    for (i = 0; i < PAL_PRIMARY_MAX; i++)
+        f->primary_dist_sq[i] = f->lab_b + num_colors * (i + 1);
 
+    return 0;
+}
 
-        pal_color_t* col = &out_pal->colors[out_pal->num_colors];
-        
-        out_pal->num_colors++;
+int
+pal_compute_color_features(const pal_palette_t* pal, pal_color_features_t* out_features)
+{
+    int i;
 
-        col->rgba.r = pal_convert_channel_to_f32(pal__clamp8(r, 0, 255));
-        col->rgba.g = pal_convert_channel_to_f32(pal__clamp8(g, 0, 255));
-        col->rgba.b = pal_convert_channel_to_f32(pal__clamp8(b, 0, 255));
-        col->rgba.a = 1.0f;
+    if (pal__color_features_reserve(out_features, pal->num_colors) != 0)
+        return 1;
 
+    out_features->num_colors = pal->num_colors;
+    for (i = 0; i < pal->num_colors; i++) {
+        const pal_color_t* col = &pal->colors[i];
+        out_features->r[i] = col->rgba.r;
+        out_features->g[i] = col->rgba.g;
+        out_features->b[i] = col->rgba.b;
     }
 
-    if (jasc_source_url != NULL) {
-        pal__strncpy(out_pal->source.url, jasc_source_url, PAL_MAX_STRLEN);
-    }
+    pal__compute_features_from_rgb(out_features);
+
     return 0;
 }
 
-
-PALDEF pal_u8_t
-pal_convert_channel_to_8bit(float val)
+int
+pal_compute_soa_color_features(const pal_color_soa_t* soa, pal_color_features_t* out_features)
 {
-    // saturate out of normalized range 0-1
-    //
-    // 0.0, 0.25, 0.5, 0.75 and 1.0 all return evenly divisible
-    // values.  Priority is quality and robustness over performance.
+    if (pal__color_features_reserve(out_features, soa->num_colors) != 0)
+        return 1;
 
-    val = (val < 0.0f) ? 0.0f : ((val > 1.0f) ? 1.0f : val);
+    out_features->num_colors = soa->num_colors;
+    memcpy(out_features->r, soa->r, sizeof(float) * soa->num_colors);
+    memcpy(out_features->g, soa->g, sizeof(float) * soa->num_colors);
+    memcpy(out_features->b, soa->b, sizeof(float) * soa->num_colors);
 
-    unsigned int fixed = (unsigned int)(val * 256.f);
-    unsigned int reduced = (fixed == 128) ? 127 : (fixed * 255 + 192) >> 8;
+    pal__compute_features_from_rgb(out_features);
 
-    return (pal_u8_t)reduced;
+    return 0;
 }
 
-PALDEF float
-pal_convert_channel_to_f32(pal_u8_t val)
+void
+pal_color_features_free(pal_color_features_t* features)
 {
-    if (val == 127)
-        return 0.5f;
-    if (val == 255)
-        return 1.0f;
-    return val / 256.0f;
+    PAL_FREE(features->block);
+    memset(features, 0, sizeof(*features));
 }
 
-const char* pal__enum_strings[HINT_MAX] = {
-    "error",        "warning",
-    "normal",       "success",
-    "highlight",    "urgent",
-    "low priority", "bold",
-    "background",   "background highlight",
-    "focal point",  "title",
-    "subtitle",     "subsubtitle",
-    "todo",         "fixme",
-    "sidebar",      "subtle",
-    "shadow",       "specular",
-    "selection",    "comment",
-    "string",       "keyword",
-    "variable",     "operator",
-    "punctuation",  "inactive",
-    "function",     "method",
-    "preprocessor", "type",
-    "constant",     "link",
-    "cursor"};
+int
+pal_create_feature_sorted_gradient(pal_palette_t*              pal,
+                                   const char*                 gradient_name,
+                                   const pal_color_features_t* features,
+                                   pal_sort_kind_t             sort_kind)
+{
+    const float* keys = NULL;
+    int          ascending = 0;
+    int          i;
 
-PALDEF const char*
-pal_string_for_hint(pal_hint_kind_t hint)
+    if (features->num_colors != pal->num_colors) {
+        PAL__ASSERT(!"color features are stale");
+        return 1;
+    }
+
+    switch (sort_kind) {
+    case PAL_SORT_RED:
+        keys = features->r;
+        break;
+    case PAL_SORT_GREEN:
+        keys = features->g;
+        break;
+    case PAL_SORT_BLUE:
+        keys = features->b;
+        break;
+    case PAL_SORT_HUE:
+        keys = features->hue;
+        break;
+    case PAL_SORT_SATURATION:
+        keys = features->saturation;
+        break;
+    case PAL_SORT_VALUE:
+        keys = features->value;
+        break;
+    case PAL_SORT_LIGHTNESS:
+        keys = features->lightness;
+        break;
+    case PAL_SORT_REDNESS:
+    case PAL_SORT_YELLOWNESS:
+    case PAL_SORT_GREENNESS:
+    case PAL_SORT_CYANNESS:
+    case PAL_SORT_BLUENESS:
+    case PAL_SORT_MAGENTANESS:
+        // closest first
+        keys = features->primary_dist_sq[sort_kind - PAL_SORT_REDNESS];
+        ascending = 1;
+        break;
+    default:
+        PAL__ASSERT(!"invalid sort kind");
+        return 1;
+    }
+
+    if (pal->num_gradients >= PAL_MAX_GRADIENTS) {
+        PAL__ASSERT(!"no space for more gradients");
+        return 1;
+    }
+
+    pal_gradient_t* gradient = &pal->gradients[pal->num_gradients];
+    gradient->num_indices = pal->num_colors;
+    for (i = 0; i < pal->num_colors; i++) {
+        gradient->indices[i] = (pal_u16_t)i;
+    }
+    pal__sort_indices_by_key(keys, gradient->indices, pal->num_colors, ascending);
+
+    pal__strncpy(pal->gradient_names[pal->num_gradients], gradient_name, PAL_MAX_STRLEN);
+    pal->num_gradients++;
+    return 0;
+}
+void
+pal_init(pal_palette_t* pal)
 {
-    if ((int)hint < 0 || (int)hint > HINT_MAX)
-        return NULL;
-    return pal__enum_strings[(int)hint];
+    memset(pal, 0, sizeof(*pal));
 }
 
-PALDEF int
-pal_hint_for_string(const char* str, int len, pal_hint_kind_t* out_hint)
+void
+pal_clear(pal_palette_t* pal)
 {
     int i;
-    if (len == 0)
-        len = pal__strlen(str);
+    pal->title[0] = 0;
+    pal->source.url[0] = 0;
+    pal->source.conversion_tool[0] = 0;
+    pal->source.conversion_timestamp = 0;
+    pal->color_space.name[0] = 0;
+    pal->color_space.icc_filename[0] = 0;
+    pal->color_space.is_linear = 0;
+    pal->num_colors = 0;
+    pal->num_gradients = 0;
+    pal->num_dither_pairs = 0;
 
-    for (i = 0; i < HINT_MAX; i++) {
-        // could avoid this waste
-        int literal_len = pal__strlen(pal__enum_strings[i]);
+    for (i = 0; i < PAL_MAX_HINTS; i++) pal->num_hints[i] = 0;
+}
 
-        if (pal__strmatch(pal__enum_strings[i], literal_len, str, len)) {
-            *out_hint = (pal_hint_kind_t)i;
-            return 0;
-        }
-    }
+#define PAL__MIN_CAPACITY 16
 
-    return 1;
+static pal_u32_t
+pal__dither_capacity(pal_u32_t capacity)
+{
+    return capacity * 2 < PAL_MAX_DITHER_PAIRS ? capacity * 2 : PAL_MAX_DITHER_PAIRS;
 }
 
-pal_u32_t
-pal_hash_color_values(const pal_palette_t* pal)
+// bytes of storage for capacity colors, laid out as
+// pal__palette_point_into() does
+static size_t
+pal__palette_storage_size(pal_u32_t capacity)
 {
-    int       i, j;
-    pal_u32_t hash = 0;
-    for (i = 0; i < pal->num_colors; i++) {
-        for (j = 0; j < 4; j++) {
-            PAL__ASSERT(pal->colors[i].c[j] >= 0.0f && pal->colors[i].c[j] <= 1.0f);
-            hash ^= j - (pal_u32_t)(pal->colors[i].c[j] * (1 << 31));
-            hash ^= hash << 3;
-            hash += hash >> 5;
-            hash ^= hash << 4;
-            hash += hash >> 17;
-            hash ^= hash << 25;
-            hash += hash >> 6;
-        }
-    }
+    size_t num_dither_pairs = pal__dither_capacity(capacity);
 
-    return hash;
+    return (sizeof(pal_color_t) + sizeof(pal_str_t)) * capacity +
+           (sizeof(pal_str_t) + sizeof(pal_dither_pair_t)) * num_dither_pairs +
+           sizeof(pal_u16_t) * capacity * PAL_MAX_HINTS +
+           sizeof(pal_u16_t) * capacity * 2 * PAL_MAX_GRADIENTS;
 }
 
-
-int
-pal_create_sorted_gradient(pal_palette_t*           pal,
-                           const char*              gradient_name,
-                           pal_color_compare_func_t compare_callback,
-                           void*                    datum)
+// point pal's arrays into storage, widest alignment first
+static void
+pal__palette_point_into(pal_palette_t* pal, unsigned char* storage, pal_u32_t capacity)
 {
-    PAL__UNUSED(datum);
-    int i, j;
-    if (pal->num_gradients >= PAL_MAX_GRADIENTS) {
-        PAL__ASSERT(!"no space for more gradients");
-        return 1;
+    pal_u32_t      num_dither_pairs = pal__dither_capacity(capacity);
+    unsigned char* p = storage;
+    int            i;
+
+    pal->storage = storage;
+    pal->capacity = capacity;
+
+    pal->colors = (pal_color_t*)p;
+    p += sizeof(pal_color_t) * capacity;
+    pal->color_names = (pal_str_t*)p;
+    p += sizeof(pal_str_t) * capacity;
+    pal->dither_pair_names = (pal_str_t*)p;
+    p += sizeof(pal_str_t) * num_dither_pairs;
+    pal->dither_pairs = (pal_dither_pair_t*)p;
+    p += sizeof(pal_dither_pair_t) * num_dither_pairs;
+
+    for (i = 0; i < PAL_MAX_HINTS; i++) {
+        pal->hint_colors[i] = (pal_u16_t*)p;
+        p += sizeof(pal_u16_t) * capacity;
     }
-
-    // work on the stack to avoid altering the palette until success
-    // is assured
-    pal_gradient_t gradient;
-    int            len = pal->num_colors;
-    gradient.num_indices = len;
-    for (i = 0; i < len; i++) {
-        gradient.indices[i] = (pal_u16_t)i;
+    for (i = 0; i < PAL_MAX_GRADIENTS; i++) {
+        pal->gradients[i].indices = (pal_u16_t*)p;
+        p += sizeof(pal_u16_t) * capacity * 2;
     }
+}
+
+int
+pal_reserve(pal_palette_t* pal, int num_colors)
+{
+    pal_palette_t  grown;
+    unsigned char* storage;
+    pal_u32_t      capacity, old_capacity = pal->capacity;
+    int            i;
 
-    // lame bubble sort
-    for (i = 0; i < len - 1; i++) {
-        for (j = 0; j < len - i - 1; j++) {
-            if (compare_callback(pal->colors[gradient.indices[j]],
-                                 pal->colors[gradient.indices[j + 1]],
-                                 NULL) > 0.0f) {
-                pal_u16_t temp = gradient.indices[j];
-                gradient.indices[j] = gradient.indices[j + 1];
-                gradient.indices[j + 1] = temp;
-            }
+    if (num_colors <= (int)old_capacity)
+        return 0;
+    if (num_colors > PAL_MAX_COLORS)
+        return 1;
+
+    // grow geometrically so palettes can be filled a color at a time
+    capacity = old_capacity * 2;
+    if (capacity < (pal_u32_t)num_colors)
+        capacity = (pal_u32_t)num_colors;
+    if (capacity < PAL__MIN_CAPACITY)
+        capacity = PAL__MIN_CAPACITY;
+    if (capacity > PAL_MAX_COLORS)
+        capacity = PAL_MAX_COLORS;
+
+    storage = (unsigned char*)PAL_REALLOC(NULL, pal__palette_storage_size(capacity));
+    if (!storage)
+        return 1;
+    memset(storage, 0, pal__palette_storage_size(capacity));
+
+    grown = *pal;
+    pal__palette_point_into(&grown, storage, capacity);
+
+    // copy whole arrays, not just the counted elements, so callers can
+    // fill an element before counting it
+    if (pal->storage) {
+        pal_u32_t old_dither_pairs = pal__dither_capacity(old_capacity);
+
+        memcpy(grown.colors, pal->colors, sizeof(pal_color_t) * old_capacity);
+        memcpy(grown.color_names, pal->color_names, sizeof(pal_str_t) * old_capacity);
+        memcpy(grown.dither_pair_names,
+               pal->dither_pair_names,
+               sizeof(pal_str_t) * old_dither_pairs);
+        memcpy(grown.dither_pairs,
+               pal->dither_pairs,
+               sizeof(pal_dither_pair_t) * old_dither_pairs);
+        for (i = 0; i < PAL_MAX_HINTS; i++)
+            memcpy(grown.hint_colors[i], pal->hint_colors[i], sizeof(pal_u16_t) * old_capacity);
+        for (i = 0; i < PAL_MAX_GRADIENTS; i++) {
+            memcpy(grown.gradients[i].indices,
+                   pal->gradients[i].indices,
+                   sizeof(pal_u16_t) * old_capacity * 2);
         }
-    }
 
-#if 0
-    for (i = 0; i < len; i++) {
-        pal_color_t col = pal->colors[gradient.indices[i]];
-        float       h, s, v;
-        pal__get_hsv(col.rgba.r, col.rgba.g, col.rgba.b, &h, &s, &v);
-        printf("Color %s   r%.4f g%.4f b%.4f a%.4f: hue %f\n",
-               pal->color_names[gradient.indices[i]],
-               col.rgba.r,
-               col.rgba.g,
-               col.rgba.b,
-               col.rgba.a,
-               h);
+        PAL_FREE(pal->storage);
     }
-#endif
 
-    // success
-    pal->gradients[pal->num_gradients] = gradient;
-    pal__strncpy(pal->gradient_names[pal->num_gradients], gradient_name, PAL_MAX_STRLEN);
-    pal->num_gradients++;
+    *pal = grown;
     return 0;
 }
 
-float
-pal_red_cb(pal_color_t col0, pal_color_t col1, void* datum)
+void
+pal_free(pal_palette_t* pal)
 {
-    PAL__UNUSED(datum);
-    return col1.rgba.r - col0.rgba.r;
+    PAL_FREE(pal->storage);
+    memset(pal, 0, sizeof(*pal));
 }
 
-float
-pal_green_cb(pal_color_t col0, pal_color_t col1, void* datum)
+// name length as stored: at most PAL_MAX_STRLEN-1 characters
+static pal_u32_t
+pal__str_len(const char* str)
 {
-    PAL__UNUSED(datum);
-    return col1.rgba.g - col0.rgba.g;
+    pal_u32_t len = 0;
+
+    while (len < PAL_MAX_STRLEN - 1 && str[len]) len++;
+
+    return len;
 }
 
-float
-pal_blue_cb(pal_color_t col0, pal_color_t col1, void* datum)
+void
+pal_string_pool_init(pal_string_pool_t* pool)
 {
-    PAL__UNUSED(datum);
-    return col1.rgba.b - col0.rgba.b;
+    memset(pool, 0, sizeof(*pool));
 }
 
-float
-pal_hue_cb(pal_color_t col0, pal_color_t col1, void* datum)
+void
+pal_string_pool_free(pal_string_pool_t* pool)
 {
-    PAL__UNUSED(datum);
-
-    float hue0, sat0, val0;
-    float hue1, sat1, val1;
-    pal__get_hsv(col0.c[0], col0.c[1], col0.c[2], &hue0, &sat0, &val0);
-    pal__get_hsv(col1.c[0], col1.c[1], col1.c[2], &hue1, &sat1, &val1);
-
-    return hue1 - hue0;
+    PAL_FREE(pool->chars);
+    PAL_FREE(pool->offsets);
+    PAL_FREE(pool->slots);
+    pal_string_pool_init(pool);
 }
 
-float
-pal_saturation_cb(pal_color_t col0, pal_color_t col1, void* datum)
+// the slot holding the len-character str, or the empty slot where it
+// belongs.  the pool must have slots.
+static pal_u32_t
+pal__string_pool_slot(const pal_string_pool_t* pool, const char* str, pal_u32_t len)
 {
-    PAL__UNUSED(datum);
+    pal_u32_t mask = pool->num_slots - 1;
+    pal_u32_t i;
 
-    float hue0, sat0, val0;
-    float hue1, sat1, val1;
-    pal__get_hsv(col0.c[0], col0.c[1], col0.c[2], &hue0, &sat0, &val0);
-    pal__get_hsv(col1.c[0], col1.c[1], col1.c[2], &hue1, &sat1, &val1);
+    for (i = pal__str_hash(str) & mask;; i = (i + 1) & mask) {
+        const char* stored;
 
-    return sat1 - sat0;
+        if (pool->slots[i] == 0)
+            return i;
+
+        stored = pool->chars + pool->offsets[pool->slots[i]];
+        if (memcmp(stored, str, len) == 0 && stored[len] == 0)
+            return i;
+    }
 }
 
-float
-pal_value_cb(pal_color_t col0, pal_color_t col1, void* datum)
+// make room for one more string of len characters.  the first call
+// also stores the empty string as id 0, which is never hashed, so a
+// slot of 0 is empty.
+static int
+pal__string_pool_reserve(pal_string_pool_t* pool, pal_u32_t len)
 {
-    PAL__UNUSED(datum);
+    int       first = pool->num_strings == 0;
+    pal_u64_t num_chars = (pal_u64_t)pool->chars_len + len + 1 + first;
+    pal_u32_t num_strings = pool->num_strings + 1 + first;
+    pal_u32_t i;
 
-    float hue0, sat0, val0;
-    float hue1, sat1, val1;
-    pal__get_hsv(col0.c[0], col0.c[1], col0.c[2], &hue0, &sat0, &val0);
-    pal__get_hsv(col1.c[0], col1.c[1], col1.c[2], &hue1, &sat1, &val1);
+    if (num_chars > 0xffffffffu)
+        return 1;
 
-    return val1 - val0;
-}
+    if (num_chars > pool->chars_capacity) {
+        pal_u64_t capacity = pool->chars_capacity ? pool->chars_capacity : 1024;
+        char*     chars;
 
-float
-pal_lightness_cb(pal_color_t col0, pal_color_t col1, void* datum)
-{
-    PAL__UNUSED(datum);
-    float col0_lightness, col1_lightness;
+        while (capacity < num_chars) capacity *= 2;
+        if (capacity > 0xffffffffu)
+            capacity = 0xffffffffu;
 
-    {
-        float val_max = pal__max3(col0.c[0], col0.c[1], col0.c[2]);
-        float val_min = pal__min3(col0.c[0], col0.c[1], col0.c[2]);
-        col0_lightness = (val_max + val_min) / 2.0f;
+        chars = (char*)PAL_REALLOC(pool->chars, (size_t)capacity);
+        if (!chars)
+            return 1;
+        pool->chars = chars;
+        pool->chars_capacity = (pal_u32_t)capacity;
     }
 
-    {
-        float val_max = pal__max3(col1.c[0], col1.c[1], col1.c[2]);
-        float val_min = pal__min3(col1.c[0], col1.c[1], col1.c[2]);
-        col1_lightness = (val_max + val_min) / 2.0f;
+    if (num_strings > pool->strings_capacity) {
+        pal_u32_t  capacity = pool->strings_capacity ? pool->strings_capacity * 2 : 64;
+        pal_u32_t* offsets = (pal_u32_t*)PAL_REALLOC(pool->offsets, sizeof(pal_u32_t) * capacity);
+
+        if (!offsets)
+            return 1;
+        pool->offsets = offsets;
+        pool->strings_capacity = capacity;
     }
 
-    return col1_lightness - col0_lightness;
-}
+    if (first) {
+        pool->chars[0] = 0;
+        pool->offsets[0] = 0;
+        pool->chars_len = 1;
+        pool->num_strings = 1;
+    }
 
+    // rehash into twice the slots when more than half full
+    if ((pal_u64_t)num_strings * 2 > pool->num_slots) {
+        pal_u32_t  num_slots = pool->num_slots ? pool->num_slots * 2 : 256;
+        pal_u32_t* slots = (pal_u32_t*)PAL_REALLOC(NULL, sizeof(pal_u32_t) * num_slots);
+        pal_u32_t* old_slots = pool->slots;
 
-/* XYZ to LAB conversion */
-static float pal__lab_f(float t)
-{
-    /* 6/29 = 0.20689655; (6/29)^3 = 0.00885645 */
-    if (t > 0.0088564516f) {
-        return cbrtf(t);
+        if (!slots)
+            return 1;
+        memset(slots, 0, sizeof(pal_u32_t) * num_slots);
+
+        pool->slots = slots;
+        pool->num_slots = num_slots;
+        for (i = 1; i < pool->num_strings; i++) {
+            const char* str = pool->chars + pool->offsets[i];
+            pool->slots[pal__string_pool_slot(pool, str, pal__str_len(str))] = i;
+        }
+
+        PAL_FREE(old_slots);
     }
-    /* 1/3 * (29/6)^2 = 7.787037; 4/29 = 0.137931 */
-    return (7.787037f * t) + 0.137931034f;
+
+    return 0;
 }
 
-/* Convert sRGB to CIELAB (D65 Illuminant) */
-static void pal__get_lab(float r, float g, float b, float* out_L, float* out_a, float* out_b)
+int
+pal_string_pool_intern(pal_string_pool_t* pool, const char* str, pal_u32_t* out_id)
 {
-    float lr = pal__srgb_to_linear(r);
-    float lg = pal__srgb_to_linear(g);
-    float lb = pal__srgb_to_linear(b);
+    pal_u32_t len = pal__str_len(str);
+    pal_u32_t slot;
 
-    /* Linear sRGB to CIE XYZ */
-    float x = (lr * 0.4124564f + lg * 0.3575761f + lb * 0.1804375f) / 0.95047f;
-    float y = (lr * 0.2126729f + lg * 0.7151522f + lb * 0.0721750f) / 1.00000f;
-    float z = (lr * 0.0193339f + lg * 0.1191920f + lb * 0.9503041f) / 1.08883f;
+    if (pal_string_pool_find(pool, str, out_id) == 0)
+        return 0;
 
-    /* CIE XYZ to CIELAB */
-    float fx = pal__lab_f(x);
-    float fy = pal__lab_f(y);
-    float fz = pal__lab_f(z);
+    if (pal__string_pool_reserve(pool, len) != 0)
+        return 1;
 
-    *out_L = (116.0f * fy) - 16.0f;
-    *out_a = 500.0f * (fx - fy);
-    *out_b = 200.0f * (fy - fz);
+    slot = pal__string_pool_slot(pool, str, len);
+    pool->offsets[pool->num_strings] = pool->chars_len;
+    memcpy(pool->chars + pool->chars_len, str, len);
+    pool->chars[pool->chars_len + len] = 0;
+    pool->chars_len += len + 1;
+
+    pool->slots[slot] = pool->num_strings;
+    *out_id = pool->num_strings++;
+
+    return 0;
 }
 
-/* Returns the squared perceptual distance (Delta E^2) from a target LAB color. 
-   Smaller values mean the color is perceptually closer to the target. */
-static float pal__lab_distance_sq_from_target(pal_color_t col, float tL, float ta, float tb)
+int
+pal_string_pool_find(const pal_string_pool_t* pool, const char* str, pal_u32_t* out_id)
 {
-    float L, a, b;
-    pal__get_lab(col.rgba.r, col.rgba.g, col.rgba.b, &L, &a, &b);
-    
-    float dL = L - tL;
-    float da = a - ta;
-    float db = b - tb;
-    
-    return (dL * dL) + (da * da) + (db * db);
-}
+    pal_u32_t len = pal__str_len(str);
+    pal_u32_t slot;
 
-/* * Sorting Callbacks 
- * Target LAB coordinates are pre-computed for pure sRGB primaries/secondaries.
- */
+    if (len == 0) {
+        *out_id = PAL_STRING_ID_EMPTY;
+        return 0;
+    }
 
-float pal_redness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+    if (pool->num_slots == 0)
+        return 1;
+
+    slot = pal__string_pool_slot(pool, str, len);
+    if (pool->slots[slot] == 0)
+        return 1;
+
+    *out_id = pool->slots[slot];
+    return 0;
+}
+
+const char*
+pal_string_pool_get(const pal_string_pool_t* pool, pal_u32_t id)
 {
-    PAL__UNUSED(datum);
-    /* Pure sRGB Red: L=53.24, a=80.09, b=67.20 */
-    return pal__lab_distance_sq_from_target(col0, 53.24f, 80.09f, 67.20f)
-         - pal__lab_distance_sq_from_target(col1, 53.24f, 80.09f, 67.20f);
+    if (id == PAL_STRING_ID_EMPTY)
+        return "";
+
+    PAL__ASSERT(id < pool->num_strings);
+    return pool->chars + pool->offsets[id];
 }
 
-float pal_yellowness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+// compact palettes lay their arrays out after the struct in order of
+// alignment, so nothing but the end needs padding.  interned names are
+// pal_u32_t ids in place of the pal_str_t arrays.
+typedef struct {
+    pal_u32_t num_indices;
+    pal_u32_t colors;
+    pal_u32_t color_names;
+    pal_u32_t gradient_names;
+    pal_u32_t dither_pair_names;
+    pal_u32_t gradients;
+    pal_u32_t dither_pairs;
+    pal_u32_t indices;
+    pal_u32_t size;
+} pal__compact_layout_t;
+
+static void
+pal__compact_layout(const pal_palette_t* pal, int interned, pal__compact_layout_t* out_layout)
 {
-    PAL__UNUSED(datum);
-    /* Pure sRGB Yellow: L=97.14, a=-21.55, b=94.48 */
-    return pal__lab_distance_sq_from_target(col0, 97.14f, -21.55f, 94.48f)
-         - pal__lab_distance_sq_from_target(col1, 97.14f, -21.55f, 94.48f);
+    pal_u32_t offset = (sizeof(pal_compact_palette_t) + 7) & ~7u;
+    pal_u32_t name_size = interned ? (pal_u32_t)sizeof(pal_u32_t) : (pal_u32_t)sizeof(pal_str_t);
+    int       i;
+
+    out_layout->num_indices = 0;
+    for (i = 0; i < PAL_MAX_HINTS; i++) out_layout->num_indices += pal->num_hints[i];
+    for (i = 0; i < pal->num_gradients; i++)
+        out_layout->num_indices += (pal_u32_t)pal->gradients[i].num_indices;
+
+    out_layout->colors = offset;
+    offset += (pal_u32_t)sizeof(pal_color_t) * pal->num_colors;
+    out_layout->color_names = offset;
+    offset += name_size * pal->num_colors;
+    out_layout->gradient_names = offset;
+    offset += name_size * pal->num_gradients;
+    out_layout->dither_pair_names = offset;
+    offset += name_size * pal->num_dither_pairs;
+    out_layout->gradients = offset;
+    offset += (pal_u32_t)sizeof(pal_compact_span_t) * pal->num_gradients;
+    out_layout->dither_pairs = offset;
+    offset += (pal_u32_t)sizeof(pal_dither_pair_t) * pal->num_dither_pairs;
+    out_layout->indices = offset;
+    offset += (pal_u32_t)sizeof(pal_u16_t) * out_layout->num_indices;
+
+    out_layout->size = (offset + 7) & ~7u;
 }
 
-float pal_greenness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+pal_u32_t
+pal_compact_palette_size(const pal_palette_t* pal, const pal_string_pool_t* pool)
 {
-    PAL__UNUSED(datum);
-    /* Pure sRGB Green: L=87.73, a=-86.18, b=83.18 */
-    return pal__lab_distance_sq_from_target(col0, 87.73f, -86.18f, 83.18f)
-         - pal__lab_distance_sq_from_target(col1, 87.73f, -86.18f, 83.18f);
+    pal__compact_layout_t layout;
+    pal__compact_layout(pal, pool != NULL, &layout);
+
+    return layout.size;
 }
 
-float pal_cyanness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+static int
+pal__intern_names(pal_string_pool_t* pool, const pal_str_t* names, int num_names, pal_u32_t* out_ids)
 {
-    PAL__UNUSED(datum);
-    /* Pure sRGB Cyan: L=91.11, a=-48.09, b=-14.13 */
-    return pal__lab_distance_sq_from_target(col0, 91.11f, -48.09f, -14.13f)
-         - pal__lab_distance_sq_from_target(col1, 91.11f, -48.09f, -14.13f);
+    int i;
+
+    for (i = 0; i < num_names; i++) {
+        if (pal_string_pool_intern(pool, names[i], &out_ids[i]) != 0)
+            return 1;
+    }
+
+    return 0;
 }
 
-float pal_blueness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+pal_compact_palette_t*
+pal_compact_palette_pack(const pal_palette_t* pal, pal_string_pool_t* pool, void* mem, pal_u32_t mem_len)
 {
-    PAL__UNUSED(datum);
-    /* Pure sRGB Blue: L=32.30, a=79.19, b=-107.86 */
-    return pal__lab_distance_sq_from_target(col0, 32.30f, 79.19f, -107.86f)
-         - pal__lab_distance_sq_from_target(col1, 32.30f, 79.19f, -107.86f);
+    pal__compact_layout_t  layout;
+    pal_compact_palette_t* compact = (pal_compact_palette_t*)mem;
+    char*                  base = (char*)mem;
+    pal_u32_t              first = 0;
+    int                    i;
+
+    PAL__ASSERT(((size_t)mem & 7) == 0);
+
+    pal__compact_layout(pal, pool != NULL, &layout);
+    if (mem_len < layout.size)
+        return NULL;
+
+    compact->size = layout.size;
+    memcpy(compact->title, pal->title, sizeof(pal_str_t));
+    compact->source = pal->source;
+    compact->color_space = pal->color_space;
+
+    compact->num_colors = pal->num_colors;
+    compact->num_gradients = pal->num_gradients;
+    compact->num_dither_pairs = pal->num_dither_pairs;
+    compact->num_indices = layout.num_indices;
+
+    compact->pool = pool;
+    compact->colors = (pal_color_t*)(base + layout.colors);
+    compact->gradients = (pal_compact_span_t*)(base + layout.gradients);
+    compact->dither_pairs = (pal_dither_pair_t*)(base + layout.dither_pairs);
+    compact->indices = (pal_u16_t*)(base + layout.indices);
+
+    if (pool) {
+        compact->color_names = NULL;
+        compact->gradient_names = NULL;
+        compact->dither_pair_names = NULL;
+        compact->color_name_ids = (pal_u32_t*)(base + layout.color_names);
+        compact->gradient_name_ids = (pal_u32_t*)(base + layout.gradient_names);
+        compact->dither_pair_name_ids = (pal_u32_t*)(base + layout.dither_pair_names);
+
+        if (pal__intern_names(pool, pal->color_names, pal->num_colors, compact->color_name_ids) ||
+            pal__intern_names(
+                pool, pal->gradient_names, pal->num_gradients, compact->gradient_name_ids) ||
+            pal__intern_names(
+                pool, pal->dither_pair_names, pal->num_dither_pairs, compact->dither_pair_name_ids))
+            return NULL;
+    } else {
+        compact->color_names = (pal_str_t*)(base + layout.color_names);
+        compact->gradient_names = (pal_str_t*)(base + layout.gradient_names);
+        compact->dither_pair_names = (pal_str_t*)(base + layout.dither_pair_names);
+        compact->color_name_ids = NULL;
+        compact->gradient_name_ids = NULL;
+        compact->dither_pair_name_ids = NULL;
+
+        memcpy(compact->color_names, pal->color_names, sizeof(pal_str_t) * pal->num_colors);
+        memcpy(
+            compact->gradient_names, pal->gradient_names, sizeof(pal_str_t) * pal->num_gradients);
+        memcpy(compact->dither_pair_names,
+               pal->dither_pair_names,
+               sizeof(pal_str_t) * pal->num_dither_pairs);
+    }
+
+    memcpy(compact->colors, pal->colors, sizeof(pal_color_t) * pal->num_colors);
+    memcpy(compact->dither_pairs,
+           pal->dither_pairs,
+           sizeof(pal_dither_pair_t) * pal->num_dither_pairs);
+
+    // hints, then gradients, share the index array
+    for (i = 0; i < PAL_MAX_HINTS; i++) {
+        compact->hints[i].first = first;
+        compact->hints[i].count = pal->num_hints[i];
+        memcpy(compact->indices + first, pal->hint_colors[i], sizeof(pal_u16_t) * pal->num_hints[i]);
+        first += pal->num_hints[i];
+    }
+
+    for (i = 0; i < pal->num_gradients; i++) {
+        pal_u32_t count = (pal_u32_t)pal->gradients[i].num_indices;
+
+        compact->gradients[i].first = first;
+        compact->gradients[i].count = count;
+        memcpy(compact->indices + first, pal->gradients[i].indices, sizeof(pal_u16_t) * count);
+        first += count;
+    }
+
+    return compact;
 }
 
-float pal_magentaness_cb(pal_color_t col0, pal_color_t col1, void* datum)
+pal_compact_palette_t*
+pal_compact_palette_create(const pal_palette_t* pal, pal_string_pool_t* pool)
 {
-    PAL__UNUSED(datum);
-    /* Pure sRGB Magenta: L=60.32, a=98.23, b=-60.82 */
-    return pal__lab_distance_sq_from_target(col0, 60.32f, 98.23f, -60.82f)
-         - pal__lab_distance_sq_from_target(col1, 60.32f, 98.23f, -60.82f);
+    pal_u32_t              size = pal_compact_palette_size(pal, pool);
+    void*                  mem = PAL_REALLOC(NULL, size);
+    pal_compact_palette_t* compact;
+
+    if (!mem)
+        return NULL;
+
+    compact = pal_compact_palette_pack(pal, pool, mem, size);
+    if (!compact)
+        PAL_FREE(mem);
+
+    return compact;
 }
+
 void
-pal_init(pal_palette_t* pal)
+pal_compact_palette_free(pal_compact_palette_t* compact)
+{
+    PAL_FREE(compact);
+}
+
+static void
+pal__expand_names(const pal_compact_palette_t* compact,
+                  const pal_str_t*             names,
+                  const pal_u32_t*             ids,
+                  int                          num_names,
+                  pal_str_t*                   out_names)
 {
     int i;
-    pal->title[0] = 0;
-    pal->source.url[0] = 0;
-    pal->source.conversion_tool[0] = 0;
-    pal->source.conversion_timestamp = 0;
-    pal->color_space.name[0] = 0;
-    pal->color_space.icc_filename[0] = 0;
-    pal->color_space.is_linear = 0;
-    pal->num_colors = 0;
-    pal->num_gradients = 0;
-    pal->num_dither_pairs = 0;
 
-    for (i = 0; i < PAL_MAX_HINTS; i++) pal->num_hints[i] = 0;
+    if (!compact->pool) {
+        memcpy(out_names, names, sizeof(pal_str_t) * num_names);
+        return;
+    }
+
+    for (i = 0; i < num_names; i++)
+        pal__strncpy(out_names[i], pal_string_pool_get(compact->pool, ids[i]), PAL_MAX_STRLEN);
+}
+
+int
+pal_compact_palette_expand(const pal_compact_palette_t* compact, pal_palette_t* out_pal)
+{
+    pal_u32_t max_hints = 0, max_indices = 0;
+    int       i;
+
+    for (i = 0; i < PAL_MAX_HINTS; i++) {
+        if (compact->hints[i].count > max_hints)
+            max_hints = compact->hints[i].count;
+    }
+    for (i = 0; i < compact->num_gradients; i++) {
+        if (compact->gradients[i].count > max_indices)
+            max_indices = compact->gradients[i].count;
+    }
+    if (pal__reserve_contents(
+            out_pal, compact->num_colors, max_hints, max_indices, compact->num_dither_pairs) != 0)
+        return 1;
+
+    // only what pal_clear() clears and the counted elements are written
+    memcpy(out_pal->title, compact->title, sizeof(pal_str_t));
+    out_pal->source = compact->source;
+    out_pal->color_space = compact->color_space;
+
+    out_pal->num_colors = compact->num_colors;
+    out_pal->num_gradients = compact->num_gradients;
+    out_pal->num_dither_pairs = compact->num_dither_pairs;
+
+    memcpy(out_pal->colors, compact->colors, sizeof(pal_color_t) * compact->num_colors);
+    pal__expand_names(compact,
+                      compact->color_names,
+                      compact->color_name_ids,
+                      compact->num_colors,
+                      out_pal->color_names);
+    pal__expand_names(compact,
+                      compact->gradient_names,
+                      compact->gradient_name_ids,
+                      compact->num_gradients,
+                      out_pal->gradient_names);
+    pal__expand_names(compact,
+                      compact->dither_pair_names,
+                      compact->dither_pair_name_ids,
+                      compact->num_dither_pairs,
+                      out_pal->dither_pair_names);
+    memcpy(out_pal->dither_pairs,
+           compact->dither_pairs,
+           sizeof(pal_dither_pair_t) * compact->num_dither_pairs);
+
+    for (i = 0; i < PAL_MAX_HINTS; i++) {
+        out_pal->num_hints[i] = (pal_u16_t)compact->hints[i].count;
+        memcpy(out_pal->hint_colors[i],
+               compact->indices + compact->hints[i].first,
+               sizeof(pal_u16_t) * compact->hints[i].count);
+    }
+
+    for (i = 0; i < compact->num_gradients; i++) {
+        out_pal->gradients[i].num_indices = (int)compact->gradients[i].count;
+        memcpy(out_pal->gradients[i].indices,
+               compact->indices + compact->gradients[i].first,
+               sizeof(pal_u16_t) * compact->gradients[i].count);
+    }
+
+    return 0;
+}
+
+const char*
+pal_compact_palette_color_name(const pal_compact_palette_t* compact, int index)
+{
+    PAL__ASSERT(index >= 0 && index < compact->num_colors);
+
+    if (compact->pool)
+        return pal_string_pool_get(compact->pool, compact->color_name_ids[index]);
+
+    return compact->color_names[index];
+}
+
+int
+pal_compact_palette_find_color(const pal_compact_palette_t* compact, const char* name)
+{
+    pal_u32_t id;
+    int       i;
+
+    if (!compact->pool) {
+        for (i = 0; i < compact->num_colors; i++) {
+            if (strncmp(compact->color_names[i], name, PAL_MAX_STRLEN - 1) == 0)
+                return i;
+        }
+        return -1;
+    }
+
+    // a name that was never interned can't be in the palette
+    if (pal_string_pool_find(compact->pool, name, &id) != 0)
+        return -1;
+
+    for (i = 0; i < compact->num_colors; i++) {
+        if (compact->color_name_ids[i] == id)
+            return i;
+    }
+
+    return -1;
 }
 
 static int
@@ -2141,6 +6517,9 @@ struct pal_testvars_s {
 
 static struct pal_testvars_s pal__tv;
 
+// palettes most tests fill, the most a palette held before it could grow
+#define PAL__TEST_NUM_COLORS 256
+
 static int
 pal__test_setup(void)
 {
@@ -2289,6 +6668,1122 @@ pal__test_parse_hexcolor(void)
     return ftgt_test_errorlevel();
 }
 
+static int
+pal__test_key_sort_matches_callback_sort(void)
+{
+    static pal_palette_t pal;
+    pal_color_compare_func_t cbs[] = {pal_red_cb,
+                                      pal_green_cb,
+                                      pal_blue_cb,
+                                      pal_hue_cb,
+                                      pal_saturation_cb,
+                                      pal_value_cb,
+                                      pal_lightness_cb,
+                                      pal_redness_cb,
+                                      pal_yellowness_cb,
+                                      pal_greenness_cb,
+                                      pal_cyanness_cb,
+                                      pal_blueness_cb,
+                                      pal_magentaness_cb};
+    pal_color_key_func_t keys[] = {pal_red_key,
+                                   pal_green_key,
+                                   pal_blue_key,
+                                   pal_hue_key,
+                                   pal_saturation_key,
+                                   pal_value_key,
+                                   pal_lightness_key,
+                                   pal_redness_key,
+                                   pal_yellowness_key,
+                                   pal_greenness_key,
+                                   pal_cyanness_key,
+                                   pal_blueness_key,
+                                   pal_magentaness_key};
+    int num_sorts = sizeof(cbs) / sizeof(cbs[0]);
+    int i, j;
+
+    // 8-bit sourced colors with plenty of repeats, so ties and
+    // achromatic (undefined hue) colors are both exercised
+    pal_init(&pal);
+    FTGT_ASSERT(pal_reserve(&pal, PAL__TEST_NUM_COLORS) == 0);
+    pal_u32_t seed = 12345;
+    for (i = 0; i < PAL__TEST_NUM_COLORS; i++) {
+        for (j = 0; j < 3; j++) {
+            seed = seed * 1664525u + 1013904223u;
+            pal.colors[i].c[j] = pal_convert_channel_to_f32((pal_u8_t)((seed >> 24) & 0xe0));
+        }
+        pal.colors[i].rgba.a = 1.0f;
+    }
+    pal.num_colors = PAL__TEST_NUM_COLORS;
+
+    for (i = 0; i < num_sorts; i++) {
+        pal.num_gradients = 0;
+        FTGT_ASSERT(pal_create_sorted_gradient(&pal, "cb", cbs[i], NULL) == 0);
+        FTGT_ASSERT(pal_create_key_sorted_gradient(&pal, "key", keys[i], NULL) == 0);
+
+        FTGT_ASSERT(pal.gradients[0].num_indices == pal.gradients[1].num_indices);
+        for (j = 0; j < pal.gradients[0].num_indices; j++) {
+            FTGT_ASSERT(pal.gradients[0].indices[j] == pal.gradients[1].indices[j]);
+        }
+    }
+
+    pal_free(&pal);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_feature_sort_matches_key_sort(void)
+{
+    static pal_palette_t        pal;
+    static pal_color_features_t features;
+    pal_color_key_func_t        keys[PAL_SORT_MAX] = {pal_red_key,
+                                                      pal_green_key,
+                                                      pal_blue_key,
+                                                      pal_hue_key,
+                                                      pal_saturation_key,
+                                                      pal_value_key,
+                                                      pal_lightness_key,
+                                                      pal_redness_key,
+                                                      pal_yellowness_key,
+                                                      pal_greenness_key,
+                                                      pal_cyanness_key,
+                                                      pal_blueness_key,
+                                                      pal_magentaness_key};
+    int i, j;
+
+    pal_init(&pal);
+    FTGT_ASSERT(pal_reserve(&pal, PAL__TEST_NUM_COLORS) == 0);
+    pal_u32_t seed = 777;
+    for (i = 0; i < PAL__TEST_NUM_COLORS; i++) {
+        for (j = 0; j < 3; j++) {
+            seed = seed * 1664525u + 1013904223u;
+            pal.colors[i].c[j] = pal_convert_channel_to_f32((pal_u8_t)((seed >> 24) & 0xf0));
+        }
+        pal.colors[i].rgba.a = 1.0f;
+    }
+    pal.num_colors = PAL__TEST_NUM_COLORS;
+
+    FTGT_ASSERT(pal_compute_color_features(&pal, &features) == 0);
+
+    for (i = 0; i < PAL_SORT_MAX; i++) {
+        pal_sort_kind_t kind;
+        FTGT_ASSERT(pal_sort_kind_for_string(
+                        pal_string_for_sort_kind((pal_sort_kind_t)i), 0, &kind) == 0);
+        FTGT_ASSERT(kind == (pal_sort_kind_t)i);
+
+        pal.num_gradients = 0;
+        FTGT_ASSERT(pal_create_key_sorted_gradient(&pal, "key", keys[i], NULL) == 0);
+        FTGT_ASSERT(pal_create_feature_sorted_gradient(&pal, "feature", &features, kind) == 0);
+
+        for (j = 0; j < pal.num_colors; j++) {
+            FTGT_ASSERT(pal.gradients[0].indices[j] == pal.gradients[1].indices[j]);
+        }
+    }
+
+    pal_color_features_free(&features);
+    pal_free(&pal);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_batch_lab_matches_scalar(void)
+{
+    static pal_palette_t pal;
+    static float         L[PAL__TEST_NUM_COLORS], a[PAL__TEST_NUM_COLORS], b[PAL__TEST_NUM_COLORS];
+    static float         kL[PAL__TEST_NUM_COLORS], ka[PAL__TEST_NUM_COLORS], kb[PAL__TEST_NUM_COLORS];
+    int                  i, j;
+
+    // a gray ramp, then random colors; 255 colors leaves a scalar tail
+    pal_init(&pal);
+    FTGT_ASSERT(pal_reserve(&pal, PAL__TEST_NUM_COLORS) == 0);
+    pal_u32_t seed = 4242;
+    for (i = 0; i < PAL__TEST_NUM_COLORS - 1; i++) {
+        for (j = 0; j < 3; j++) {
+            seed = seed * 1664525u + 1013904223u;
+            pal.colors[i].c[j] = i < 128 ? (float)i / 127.0f : (float)(seed >> 8) / 16777216.0f;
+        }
+        pal.colors[i].rgba.a = 1.0f;
+    }
+    pal.num_colors = PAL__TEST_NUM_COLORS - 1;
+
+    pal_palette_to_lab(&pal, L, a, b);
+
+    for (i = 0; i < pal.num_colors; i++) {
+        float eL, ea, eb;
+        pal__get_lab(pal.colors[i].rgba.r, pal.colors[i].rgba.g, pal.colors[i].rgba.b, &eL, &ea, &eb);
+
+        FTGT_ASSERT(fabsf(L[i] - eL) <= 2e-4f);
+        FTGT_ASSERT(fabsf(a[i] - ea) <= 2e-4f);
+        FTGT_ASSERT(fabsf(b[i] - eb) <= 2e-4f);
+    }
+
+    // every simd kernel against the scalar kernel
+    pal__lab_kernel_scalar(pal.colors, pal.num_colors, L, a, b);
+    for (j = 0; j < 2; j++) {
+        if (j == 0 && PAL__SSE2) {
+#if PAL__SSE2
+            pal__lab_kernel_sse2(pal.colors, pal.num_colors, kL, ka, kb);
+#endif
+        } else if (j == 1 && PAL__AVX2) {
+#if PAL__AVX2
+            if (!pal__cpu_has_avx2())
+                continue;
+            pal__lab_kernel_avx2(pal.colors, pal.num_colors, kL, ka, kb);
+#endif
+        } else {
+            continue;
+        }
+
+        for (i = 0; i < pal.num_colors; i++) {
+            FTGT_ASSERT(fabsf(kL[i] - L[i]) <= 1e-5f);
+            FTGT_ASSERT(fabsf(ka[i] - a[i]) <= 1e-5f);
+            FTGT_ASSERT(fabsf(kb[i] - b[i]) <= 1e-5f);
+        }
+    }
+
+    pal_free(&pal);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_transfer_tables(void)
+{
+    pal_color_t colors[256 + 64];
+    int         i;
+
+    // every 8-bit channel must convert exactly as the powf path does
+    for (i = 0; i < 256; i++) {
+        colors[i] = pal__test_color_zero();
+        colors[i].rgba.r = pal_convert_channel_to_f32((pal_u8_t)i);
+        colors[i].rgba.g = (float)i / 255.0f;  // not on the table grid
+    }
+    for (i = 256; i < 256 + 64; i++) {
+        colors[i] = pal__test_color_zero();
+        colors[i].rgba.r = (float)(i - 256) / 60.0f - 0.02f;  // crosses 0 and 1
+    }
+
+    pal_color_t linear[256 + 64];
+    memcpy(linear, colors, sizeof(colors));
+    pal_colors_srgb_to_linear(linear, 256 + 64);
+
+    for (i = 0; i < 256 + 64; i++) {
+        pal_color_t expected = colors[i];
+        pal_color_srgb_to_linear(&expected);
+        FTGT_ASSERT(linear[i].rgba.r == expected.rgba.r);
+        FTGT_ASSERT(linear[i].rgba.g == expected.rgba.g);
+    }
+
+    // and back, against the documented interpolation error
+    pal_color_t srgb[256 + 64];
+    memcpy(srgb, linear, sizeof(linear));
+    pal_colors_linear_to_srgb(srgb, 256 + 64);
+
+    for (i = 0; i < 256 + 64; i++) {
+        pal_color_t expected = linear[i];
+        pal_color_linear_to_srgb(&expected);
+        FTGT_ASSERT(fabsf(srgb[i].rgba.r - expected.rgba.r) <= 5e-7f);
+        FTGT_ASSERT(fabsf(srgb[i].rgba.g - expected.rgba.g) <= 5e-7f);
+        FTGT_ASSERT(srgb[i].rgba.r >= 0.0f && srgb[i].rgba.r <= 1.0f);
+    }
+
+    // whole palettes stay on the exact powf path
+    pal_palette_t pal;
+    pal_init(&pal);
+    FTGT_ASSERT(pal_reserve(&pal, 256 + 64) == 0);
+    memcpy(pal.colors, linear, sizeof(linear));
+    pal.num_colors = 256 + 64;
+    pal__palette_set_linear(&pal);
+    pal_palette_linear_to_srgb(&pal);
+
+    for (i = 0; i < 256 + 64; i++) {
+        pal_color_t expected = linear[i];
+        pal_color_linear_to_srgb(&expected);
+        FTGT_ASSERT(memcmp(&pal.colors[i], &expected, sizeof(expected)) == 0);
+    }
+    FTGT_ASSERT(!pal.color_space.is_linear);
+
+    memcpy(srgb, pal.colors, sizeof(srgb));
+    pal_palette_srgb_to_linear(&pal);
+    for (i = 0; i < 256 + 64; i++) {
+        pal_color_t expected = srgb[i];
+        pal_color_srgb_to_linear(&expected);
+        FTGT_ASSERT(memcmp(&pal.colors[i], &expected, sizeof(expected)) == 0);
+    }
+    FTGT_ASSERT(pal.color_space.is_linear);
+    pal_free(&pal);
+
+    // non-finite channels stay off the table, and match the powf path
+    pal_color_t special = pal__test_color_zero();
+    special.rgba.r = NAN;
+    special.rgba.g = INFINITY;
+    special.rgba.b = -INFINITY;
+    pal_colors_linear_to_srgb(&special, 1);
+
+    FTGT_ASSERT(special.rgba.r != special.rgba.r);
+    FTGT_ASSERT(special.rgba.g == 1.0f);
+    FTGT_ASSERT(special.rgba.b == 0.0f);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_color_soa_matches_aos(void)
+{
+    static pal_palette_t pal, stored;
+    static float         L[PAL__TEST_NUM_COLORS], a[PAL__TEST_NUM_COLORS], b[PAL__TEST_NUM_COLORS];
+    static float         sL[PAL__TEST_NUM_COLORS], sa[PAL__TEST_NUM_COLORS], sb[PAL__TEST_NUM_COLORS];
+    static pal_color_t   linear[PAL__TEST_NUM_COLORS];
+    pal_u8_t             rgba[PAL__TEST_NUM_COLORS * 4];
+    pal_color_soa_t      soa;
+    pal_u32_t            seed = 77;
+    int                  i, j;
+
+    // 8-bit values, exact halves, out of range and arbitrary channels.
+    // 203 colors leaves a partial vector of padding.
+    pal_init(&pal);
+    FTGT_ASSERT(pal_reserve(&pal, 203) == 0);
+    for (i = 0; i < 203; i++) {
+        for (j = 0; j < 4; j++) {
+            seed = seed * 1664525u + 1013904223u;
+            if (i < 64)
+                pal.colors[i].c[j] = pal_convert_channel_to_f32((pal_u8_t)(seed >> 24));
+            else if (i < 72)
+                pal.colors[i].c[j] = (float)(i - 64) / 4.0f - 0.5f;
+            else
+                pal.colors[i].c[j] = (float)(seed >> 8) / 16777216.0f;
+        }
+    }
+    pal.num_colors = 203;
+
+    FTGT_ASSERT(pal_palette_to_color_soa(&pal, &soa) == 0);
+    FTGT_ASSERT(soa.num_padded == 208 && soa.num_padded % PAL_SOA_LANES == 0);
+    FTGT_ASSERT(((size_t)soa.r & (PAL_SOA_ALIGN - 1)) == 0);
+    FTGT_ASSERT(((size_t)soa.a & (PAL_SOA_ALIGN - 1)) == 0);
+    FTGT_ASSERT(soa.g[17] == pal.colors[17].rgba.g && soa.a[202] == pal.colors[202].rgba.a);
+    for (i = soa.num_colors; i < soa.num_padded; i++)
+        FTGT_ASSERT(soa.r[i] == 0.0f && soa.a[i] == 0.0f);
+
+    pal_init(&stored);
+    FTGT_ASSERT(pal_palette_from_color_soa(&soa, &stored) == 0);
+    FTGT_ASSERT(stored.num_colors == pal.num_colors);
+    FTGT_ASSERT(memcmp(stored.colors, pal.colors, sizeof(pal_color_t) * pal.num_colors) == 0);
+
+    // 8-bit quantization is exact
+    pal_color_soa_to_8bit(&soa, rgba);
+    for (i = 0; i < pal.num_colors; i++) {
+        for (j = 0; j < 4; j++)
+            FTGT_ASSERT(rgba[i * 4 + j] == pal_convert_channel_to_8bit(pal.colors[i].c[j]));
+    }
+
+    // lab within the simd kernels' agreement, padding converts as black
+    pal_palette_to_lab(&pal, L, a, b);
+    pal_color_soa_to_lab(&soa, sL, sa, sb);
+    for (i = 0; i < pal.num_colors; i++) {
+        FTGT_ASSERT(fabsf(sL[i] - L[i]) <= 1e-5f);
+        FTGT_ASSERT(fabsf(sa[i] - a[i]) <= 1e-5f);
+        FTGT_ASSERT(fabsf(sb[i] - b[i]) <= 1e-5f);
+    }
+    FTGT_ASSERT(fabsf(sL[soa.num_padded - 1]) <= 1e-4f);
+
+    // transfer functions are exact both ways
+    memcpy(linear, pal.colors, sizeof(pal_color_t) * pal.num_colors);
+    pal_colors_srgb_to_linear(linear, pal.num_colors);
+    pal_color_soa_srgb_to_linear(&soa);
+    pal_color_soa_store(&soa, stored.colors);
+    FTGT_ASSERT(memcmp(stored.colors, linear, sizeof(pal_color_t) * pal.num_colors) == 0);
+
+    pal_colors_linear_to_srgb(linear, pal.num_colors);
+    pal_color_soa_linear_to_srgb(&soa);
+    pal_color_soa_store(&soa, stored.colors);
+    FTGT_ASSERT(memcmp(stored.colors, linear, sizeof(pal_color_t) * pal.num_colors) == 0);
+
+    pal_color_soa_free(&soa);
+    FTGT_ASSERT(soa.block == NULL);
+    pal_free(&pal);
+    pal_free(&stored);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_writer_matches_fixed_buffer_emit(void)
+{
+    static pal_palette_t pal;
+    static char          fixed[1 << 19];
+    pal_membuf_t         membuf = {0};
+    pal_writer_t         writer;
+    int                  i;
+
+    // enough colors that the writer has to flush several times
+    pal_init(&pal);
+    FTGT_ASSERT(pal_reserve(&pal, PAL__TEST_NUM_COLORS) == 0);
+    pal__strncpy(pal.title, "writer test", PAL_MAX_STRLEN);
+    for (i = 0; i < PAL__TEST_NUM_COLORS; i++) {
+        pal.colors[i].rgba.r = (float)i / 255.0f;
+        pal.colors[i].rgba.g = 1.0f - (float)i / 255.0f;
+        pal.colors[i].rgba.b = 0.5f;
+        pal.colors[i].rgba.a = 1.0f;
+        pal__strncpy(pal.color_names[i],
+                     pal__int_to_str((unsigned long long)i, fixed, 64, 10),
+                     PAL_MAX_STRLEN);
+    }
+    pal.num_colors = PAL__TEST_NUM_COLORS;
+
+    pal.num_hints[HINT_ERROR] = 2;
+    pal.hint_colors[HINT_ERROR][0] = 1;
+    pal.hint_colors[HINT_ERROR][1] = 2;
+    pal.num_hints[HINT_CURSOR] = 1;
+    pal.hint_colors[HINT_CURSOR][0] = 3;
+
+    pal.num_dither_pairs = 1;
+    pal__strncpy(pal.dither_pair_names[0], "pair", PAL_MAX_STRLEN);
+    pal.dither_pairs[0].index0 = 4;
+    pal.dither_pairs[0].index1 = 5;
+
+    FTGT_ASSERT(pal_create_key_sorted_gradient(&pal, "hue", pal_hue_key, NULL) == 0);
+
+    FTGT_ASSERT(pal_emit_palette_json(&pal, 1, fixed, (int)sizeof(fixed)) == 0);
+    pal_writer_init(&writer, pal_write_to_membuf, &membuf);
+    FTGT_ASSERT(pal_write_palette_json(&writer, &pal, 1, PAL_JSON_LAYOUT_PRETTY) == 0);
+    FTGT_ASSERT(membuf.len > PAL_WRITER_BUF_LEN);
+    FTGT_ASSERT(writer.bytes_written == membuf.len);
+    FTGT_ASSERT(membuf.len == (pal_u64_t)pal__strlen(fixed));
+    FTGT_ASSERT(memcmp(membuf.data, fixed, (size_t)membuf.len) == 0);
+
+    membuf.len = 0;
+    FTGT_ASSERT(pal_emit_gimp_gpl(&pal, fixed, (int)sizeof(fixed)) == 0);
+    pal_writer_init(&writer, pal_write_to_membuf, &membuf);
+    FTGT_ASSERT(pal_write_gimp_gpl(&writer, &pal) == 0);
+    FTGT_ASSERT(membuf.len == (pal_u64_t)pal__strlen(fixed));
+    FTGT_ASSERT(memcmp(membuf.data, fixed, (size_t)membuf.len) == 0);
+
+    pal_membuf_free(&membuf);
+    pal_free(&pal);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_format_kernels_match_libc(void)
+{
+    unsigned long long edges[] = {0ull, 9ull, 10ull, 99ull, 100ull, 101ull, 999ull,
+                                  4294967295ull, 18446744073709551615ull};
+    pal_u32_t          seed = 2463534242u;
+    char               expected[32];
+    char               dec[PAL__U64_DEC_LEN];
+    char               hex[8];
+    int                i, first;
+
+    for (i = 0; i < (int)(sizeof(edges) / sizeof(edges[0])) + 4096; i++) {
+        unsigned long long val;
+        if (i < (int)(sizeof(edges) / sizeof(edges[0]))) {
+            val = edges[i];
+        } else {
+            // xorshift, with the magnitude varied so every digit count is hit
+            seed ^= seed << 13, seed ^= seed >> 17, seed ^= seed << 5;
+            val = ((unsigned long long)seed << 32 | seed) >> (seed % 64);
+        }
+
+        sprintf(expected, "%llu", val);
+        first = pal__u64_to_dec(val, dec);
+        FTGT_ASSERT(PAL__U64_DEC_LEN - first == pal__strlen(expected));
+        FTGT_ASSERT(memcmp(dec + first, expected, (size_t)(PAL__U64_DEC_LEN - first)) == 0);
+
+        pal_u32_t bits = (pal_u32_t)val;
+        float     f;
+        memcpy(&f, &bits, sizeof(float));
+        sprintf(expected, "%08x", bits);
+        pal__f32_to_hex(f, hex);
+        FTGT_ASSERT(memcmp(hex, expected, 8) == 0);
+    }
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_compact_layouts_strip_only_whitespace(void)
+{
+    static pal_palette_t pals[2];
+    pal_membuf_t         pretty = {0};
+    pal_membuf_t         compact = {0};
+    pal_membuf_t         ndjson = {0};
+    pal_writer_t         writer;
+    pal_u64_t            i, j;
+    int                  in_string = 0, lines = 0;
+
+    for (i = 0; i < 2; i++) {
+        pal_init(&pals[i]);
+        FTGT_ASSERT(pal_reserve(&pals[i], 2) == 0);
+        pal__strncpy(pals[i].title, "layout test", PAL_MAX_STRLEN);
+        pals[i].num_colors = 2;
+        pal__strncpy(pals[i].color_names[0], "dark gray", PAL_MAX_STRLEN);
+        pal__strncpy(pals[i].color_names[1], "white", PAL_MAX_STRLEN);
+        pals[i].colors[1].rgba.r = pals[i].colors[1].rgba.a = 1.0f;
+        pals[i].num_hints[HINT_TITLE] = 2;
+        pals[i].hint_colors[HINT_TITLE][1] = 1;
+        pals[i].num_dither_pairs = 1;
+        pal__strncpy(pals[i].dither_pair_names[0], "mid gray", PAL_MAX_STRLEN);
+        pals[i].dither_pairs[0].index1 = 1;
+        FTGT_ASSERT(pal_create_key_sorted_gradient(&pals[i], "by red", pal_red_key, NULL) == 0);
+    }
+
+    pal_writer_init(&writer, pal_write_to_membuf, &pretty);
+    FTGT_ASSERT(pal_write_palette_json(&writer, pals, 2, PAL_JSON_LAYOUT_PRETTY) == 0);
+    pal_writer_init(&writer, pal_write_to_membuf, &compact);
+    FTGT_ASSERT(pal_write_palette_json(&writer, pals, 2, PAL_JSON_LAYOUT_COMPACT) == 0);
+    pal_writer_init(&writer, pal_write_to_membuf, &ndjson);
+    FTGT_ASSERT(pal_write_palette_json(&writer, pals, 2, PAL_JSON_LAYOUT_NDJSON) == 0);
+
+    // compact is pretty with whitespace outside of strings removed, and
+    // ends in a single newline
+    for (i = 0, j = 0; i < pretty.len; i++) {
+        char c = pretty.data[i];
+        if (c == '"')
+            in_string = !in_string;
+        if (!in_string && (c == ' ' || c == '\n') && i != pretty.len - 1)
+            continue;
+
+        FTGT_ASSERT(j < compact.len && compact.data[j] == c);
+        j++;
+    }
+    FTGT_ASSERT(j == compact.len);
+
+    // ndjson is the compact palette array, one palette object per line
+    for (i = 0; i < ndjson.len; i++) lines += ndjson.data[i] == '\n';
+    FTGT_ASSERT(lines == 2);
+    FTGT_ASSERT(ndjson.data[0] == '{' && ndjson.data[ndjson.len - 1] == '\n');
+    FTGT_ASSERT(compact.len == ndjson.len + sizeof("{\"palettes\":[]}") - 1);
+    for (i = 0; i < ndjson.len - 1; i++) {
+        char c = ndjson.data[i] == '\n' ? ',' : ndjson.data[i];
+        FTGT_ASSERT(compact.data[sizeof("{\"palettes\":[") - 1 + i] == c);
+    }
+
+    pal_membuf_free(&pretty);
+    pal_membuf_free(&compact);
+    pal_membuf_free(&ndjson);
+    for (i = 0; i < 2; i++) pal_free(&pals[i]);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_parallel_json_matches_serial(void)
+{
+    static pal_palette_t pals[37];
+    int                  num_pals = (int)(sizeof(pals) / sizeof(pals[0]));
+    int                  thread_counts[] = {0, 2, 3, 8, 64};
+    pal_json_layout_t    layouts[] = {
+        PAL_JSON_LAYOUT_PRETTY, PAL_JSON_LAYOUT_COMPACT, PAL_JSON_LAYOUT_NDJSON};
+    int i, j, t, l;
+
+    // palettes of varying size, so workers finish out of order
+    for (i = 0; i < num_pals; i++) {
+        pal_init(&pals[i]);
+        FTGT_ASSERT(pal_reserve(&pals[i], 1 + (i * 53) % PAL__TEST_NUM_COLORS) == 0);
+        pals[i].num_colors = (pal_u16_t)(1 + (i * 53) % PAL__TEST_NUM_COLORS);
+        for (j = 0; j < pals[i].num_colors; j++) {
+            pals[i].colors[j].rgba.r = (float)((i + j) % 256) / 255.0f;
+            pals[i].colors[j].rgba.a = 1.0f;
+            pal__strncpy(pals[i].color_names[j],
+                         pal__int_to_str((unsigned long long)j, pals[i].title, 32, 10),
+                         PAL_MAX_STRLEN);
+        }
+        pal__strncpy(pals[i].title, "parallel test", PAL_MAX_STRLEN);
+        FTGT_ASSERT(pal_create_key_sorted_gradient(&pals[i], "by hue", pal_hue_key, NULL) == 0);
+    }
+
+    for (l = 0; l < 3; l++) {
+        pal_membuf_t serial = {0};
+        pal_writer_t writer;
+
+        pal_writer_init(&writer, pal_write_to_membuf, &serial);
+        FTGT_ASSERT(pal_write_palette_json(&writer, pals, num_pals, layouts[l]) == 0);
+
+        for (t = 0; t < (int)(sizeof(thread_counts) / sizeof(thread_counts[0])); t++) {
+            pal_membuf_t parallel = {0};
+
+            pal_writer_init(&writer, pal_write_to_membuf, &parallel);
+            FTGT_ASSERT(pal_write_palette_json_parallel(
+                            &writer, pals, num_pals, layouts[l], thread_counts[t]) == 0);
+            FTGT_ASSERT(writer.bytes_written == serial.len);
+            FTGT_ASSERT(parallel.len == serial.len);
+            FTGT_ASSERT(memcmp(parallel.data, serial.data, (size_t)serial.len) == 0);
+
+            pal_membuf_free(&parallel);
+        }
+
+        pal_membuf_free(&serial);
+    }
+
+    for (i = 0; i < num_pals; i++) pal_free(&pals[i]);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_palb_roundtrip_and_validation(void)
+{
+    static pal_palette_t pal, loaded;
+    pal_membuf_t         membuf = {0};
+    pal_writer_t         writer;
+    pal_palb_view_t      view;
+    int                  i, j;
+
+    pal_init(&pal);
+    FTGT_ASSERT(pal_reserve(&pal, 20) == 0);
+    pal__strncpy(pal.title, "palb test", PAL_MAX_STRLEN);
+    pal__strncpy(pal.source.url, "https://example.com", PAL_MAX_STRLEN);
+    pal.source.conversion_timestamp = 0x123456789aull;
+    pal__palette_set_srgb(&pal);
+    pal.num_colors = 20;
+    for (i = 0; i < pal.num_colors; i++) {
+        for (j = 0; j < 4; j++) pal.colors[i].c[j] = (float)(i * 4 + j) / 80.0f;
+        pal__strncpy(pal.color_names[i],
+                     pal__int_to_str((unsigned long long)i, loaded.title, 32, 10),
+                     PAL_MAX_STRLEN);
+    }
+    pal.num_hints[HINT_BACKGROUND] = 2;
+    pal.hint_colors[HINT_BACKGROUND][0] = 19;
+    pal.hint_colors[HINT_BACKGROUND][1] = 3;
+    pal.num_hints[HINT_CURSOR] = 1;
+    pal.hint_colors[HINT_CURSOR][0] = 7;
+    pal.num_dither_pairs = 1;
+    pal__strncpy(pal.dither_pair_names[0], "pair", PAL_MAX_STRLEN);
+    pal.dither_pairs[0].index0 = 2;
+    pal.dither_pairs[0].index1 = 18;
+    FTGT_ASSERT(pal_create_key_sorted_gradient(&pal, "by value", pal_value_key, NULL) == 0);
+
+    pal_writer_init(&writer, pal_write_to_membuf, &membuf);
+    FTGT_ASSERT(pal_write_palb(&writer, &pal) == 0);
+    FTGT_ASSERT(writer.bytes_written == membuf.len);
+
+    // copying loader
+    FTGT_ASSERT(pal_parse_palb((const unsigned char*)membuf.data, (unsigned int)membuf.len, &loaded) == 0);
+    FTGT_ASSERT(strcmp(loaded.title, pal.title) == 0);
+    FTGT_ASSERT(strcmp(loaded.source.url, pal.source.url) == 0);
+    FTGT_ASSERT(strcmp(loaded.color_space.icc_filename, pal.color_space.icc_filename) == 0);
+    FTGT_ASSERT(loaded.source.conversion_timestamp == pal.source.conversion_timestamp);
+    FTGT_ASSERT(loaded.num_colors == pal.num_colors);
+    FTGT_ASSERT(memcmp(loaded.colors, pal.colors, sizeof(pal_color_t) * pal.num_colors) == 0);
+    FTGT_ASSERT(strcmp(loaded.color_names[19], "19") == 0);
+    for (i = 0; i < PAL_MAX_HINTS; i++) {
+        FTGT_ASSERT(loaded.num_hints[i] == pal.num_hints[i]);
+        for (j = 0; j < pal.num_hints[i]; j++)
+            FTGT_ASSERT(loaded.hint_colors[i][j] == pal.hint_colors[i][j]);
+    }
+    FTGT_ASSERT(loaded.num_gradients == 1);
+    FTGT_ASSERT(loaded.gradients[0].num_indices == pal.gradients[0].num_indices);
+    FTGT_ASSERT(memcmp(loaded.gradients[0].indices,
+                       pal.gradients[0].indices,
+                       sizeof(pal_u16_t) * pal.gradients[0].num_indices) == 0);
+    FTGT_ASSERT(loaded.num_dither_pairs == 1 && loaded.dither_pairs[0].index1 == 18);
+
+    // in place
+    if (pal__host_is_little_endian()) {
+        FTGT_ASSERT(pal_palb_view(membuf.data, membuf.len, &view) == 0);
+        FTGT_ASSERT(view.header->num_colors == pal.num_colors);
+        FTGT_ASSERT(strcmp(view.strings[PAL_PALB_STRING_TITLE], "palb test") == 0);
+        FTGT_ASSERT(view.colors[5].rgba.g == pal.colors[5].rgba.g);
+        FTGT_ASSERT(view.indices[view.hint_spans[HINT_BACKGROUND].first] == 19);
+        FTGT_ASSERT(view.dither_pairs[0].index0 == 2);
+    }
+
+    // truncation anywhere fails
+    for (i = 0; i < (int)membuf.len; i++)
+        FTGT_ASSERT(pal_parse_palb((const unsigned char*)membuf.data, (unsigned int)i, &loaded) != 0);
+
+    // out of range color reference
+    pal_u32_t indices_offset;
+    memcpy(&indices_offset, membuf.data + 72, 4);
+    if (pal__host_is_little_endian()) {
+        membuf.data[indices_offset] = 20;
+        FTGT_ASSERT(pal_parse_palb((const unsigned char*)membuf.data, (unsigned int)membuf.len, &loaded) != 0);
+        membuf.data[indices_offset] = 19;
+    }
+
+    // unterminated string
+    memset(membuf.data + sizeof(pal_palb_header_t), 'x', PAL_MAX_STRLEN);
+    FTGT_ASSERT(pal_parse_palb((const unsigned char*)membuf.data, (unsigned int)membuf.len, &loaded) != 0);
+
+    // bad magic
+    membuf.data[0] ^= 1;
+    FTGT_ASSERT(pal_parse_palb((const unsigned char*)membuf.data, (unsigned int)membuf.len, &loaded) != 0);
+
+    pal_membuf_free(&membuf);
+    pal_free(&pal);
+    pal_free(&loaded);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_pala_dedup_and_lookup(void)
+{
+    static pal_palette_t pals[3], loaded;
+    pal_membuf_t         membuf = {0};
+    pal_writer_t         writer;
+    pal_pala_t           archive;
+    int                  i, j;
+
+    for (i = 0; i < 3; i++) {
+        pal_init(&pals[i]);
+        FTGT_ASSERT(pal_reserve(&pals[i], 8) == 0);
+        pal__palette_set_srgb(&pals[i]);
+        pals[i].num_colors = 8;
+        for (j = 0; j < 8; j++) {
+            pals[i].colors[j].rgba.r = (float)j / 8.0f;
+            pals[i].colors[j].rgba.g = i == 1 ? 0.5f : 0.25f;
+            pals[i].colors[j].rgba.b = 1.0f;
+            pals[i].colors[j].rgba.a = 1.0f;
+        }
+    }
+    pal__strncpy(pals[0].title, "first", PAL_MAX_STRLEN);
+    pal__strncpy(pals[1].title, "second", PAL_MAX_STRLEN);
+    pal__strncpy(pals[2].title, "third", PAL_MAX_STRLEN);
+    pal__strncpy(pals[2].color_names[3], "named", PAL_MAX_STRLEN);
+    pals[2].num_hints[HINT_BACKGROUND] = 1;
+    pals[2].hint_colors[HINT_BACKGROUND][0] = 3;
+
+    pal_writer_init(&writer, pal_write_to_membuf, &membuf);
+    FTGT_ASSERT(pal_write_pala(&writer, pals, 3) == 0);
+    FTGT_ASSERT(writer.bytes_written == membuf.len);
+
+    FTGT_ASSERT(pal_pala_open((const unsigned char*)membuf.data, membuf.len, &archive) == 0);
+    FTGT_ASSERT(archive.num_palettes == 3);
+    // first and third share their colors
+    FTGT_ASSERT(archive.num_color_blocks == 2);
+
+    FTGT_ASSERT(pal_pala_find_title(&archive, "third") == 2);
+    FTGT_ASSERT(pal_pala_find_title(&archive, "first") == 0);
+    FTGT_ASSERT(pal_pala_find_title(&archive, "fourth") == -1);
+
+    for (i = 0; i < 3; i++) {
+        FTGT_ASSERT(pal_pala_load(&archive, (pal_u32_t)i, &loaded) == 0);
+        FTGT_ASSERT(strcmp(loaded.title, pals[i].title) == 0);
+        FTGT_ASSERT(loaded.num_colors == pals[i].num_colors);
+        FTGT_ASSERT(memcmp(loaded.colors, pals[i].colors, sizeof(pal_color_t) * 8) == 0);
+        FTGT_ASSERT(loaded.num_hints[HINT_BACKGROUND] == pals[i].num_hints[HINT_BACKGROUND]);
+    }
+    FTGT_ASSERT(strcmp(loaded.color_names[3], "named") == 0);
+    FTGT_ASSERT(loaded.hint_colors[HINT_BACKGROUND][0] == 3);
+    FTGT_ASSERT(pal_pala_load(&archive, 3, &loaded) != 0);
+
+    // a shared-colors record is not a standalone .palb
+    const unsigned char* bytes = (const unsigned char*)membuf.data;
+    const unsigned char* entry = bytes + archive.entries_offset;
+    FTGT_ASSERT(pal_parse_palb(bytes + pal__le32(entry + PAL_MAX_STRLEN),
+                               pal__le32(entry + PAL_MAX_STRLEN + 4),
+                               &loaded) != 0);
+
+    // truncation is caught by opening or loading
+    for (i = 0; i < (int)membuf.len; i++) {
+        int ok = pal_pala_open((const unsigned char*)membuf.data, (pal_u64_t)i, &archive) == 0;
+        for (j = 0; ok && j < 3; j++)
+            ok = pal_pala_load(&archive, (pal_u32_t)j, &loaded) == 0;
+        FTGT_ASSERT(!ok);
+    }
+
+    // an empty archive is valid
+    membuf.len = 0;
+    pal_writer_init(&writer, pal_write_to_membuf, &membuf);
+    FTGT_ASSERT(pal_write_pala(&writer, pals, 0) == 0);
+    FTGT_ASSERT(pal_pala_open((const unsigned char*)membuf.data, membuf.len, &archive) == 0);
+    FTGT_ASSERT(archive.num_palettes == 0);
+    FTGT_ASSERT(pal_pala_find_title(&archive, "first") == -1);
+
+    pal_membuf_free(&membuf);
+    for (i = 0; i < 3; i++) pal_free(&pals[i]);
+    pal_free(&loaded);
+
+    return ftgt_test_errorlevel();
+}
+
+// writes the same output for pal and compact through each emitter
+static int
+pal__compact_emits_match(const pal_palette_t*                pals,
+                         const pal_compact_palette_t* const* compact,
+                         int                                 num_pals)
+{
+    pal_membuf_t full = {0}, packed = {0};
+    pal_writer_t writer;
+    int          same = 1;
+    int          k;
+
+    for (k = 0; k < 4 && same; k++) {
+        full.len = packed.len = 0;
+
+        pal_writer_init(&writer, pal_write_to_membuf, &full);
+        if (k == 0)
+            pal_write_palette_json_parallel(&writer, pals, num_pals, PAL_JSON_LAYOUT_PRETTY, 2);
+        else if (k == 1)
+            pal_write_gimp_gpl(&writer, &pals[0]);
+        else if (k == 2)
+            pal_write_palb(&writer, &pals[0]);
+        else
+            pal_write_pala(&writer, pals, num_pals);
+
+        pal_writer_init(&writer, pal_write_to_membuf, &packed);
+        if (k == 0)
+            pal_write_compact_palette_json(&writer, compact, num_pals, PAL_JSON_LAYOUT_PRETTY, 2);
+        else if (k == 1)
+            pal_write_compact_gimp_gpl(&writer, compact[0]);
+        else if (k == 2)
+            pal_write_compact_palb(&writer, compact[0]);
+        else
+            pal_write_compact_pala(&writer, compact, num_pals);
+
+        same = full.len > 0 && full.len == packed.len &&
+               memcmp(full.data, packed.data, (size_t)full.len) == 0;
+    }
+
+    pal_membuf_free(&full);
+    pal_membuf_free(&packed);
+
+    return same;
+}
+
+static int
+pal__test_compact_palette_roundtrip(void)
+{
+    static pal_palette_t   pals[3], expanded;
+    static pal_u64_t       arena[1 << 13];
+    pal_compact_palette_t* compact[3];
+    pal_u32_t              used = 0;
+    int                    i, j;
+
+    for (i = 0; i < 3; i++) {
+        pal_init(&pals[i]);
+        pal__palette_set_srgb(&pals[i]);
+        pal__strncpy(pals[i].title, "compact", PAL_MAX_STRLEN);
+        FTGT_ASSERT(pal_reserve(&pals[i], 4 + i * 60) == 0);
+        pals[i].num_colors = (pal_u16_t)(4 + i * 60);
+        for (j = 0; j < pals[i].num_colors; j++) {
+            pals[i].colors[j].rgba.r = (float)j / 255.0f;
+            pals[i].colors[j].rgba.g = (float)i / 3.0f;
+            pals[i].colors[j].rgba.a = 1.0f;
+            pal__strncpy(pals[i].color_names[j],
+                         pal__int_to_str((unsigned long long)j, expanded.title, 32, 10),
+                         PAL_MAX_STRLEN);
+        }
+        pals[i].num_hints[HINT_TITLE] = 2;
+        pals[i].hint_colors[HINT_TITLE][0] = 3;
+        pals[i].hint_colors[HINT_TITLE][1] = 1;
+        pals[i].num_dither_pairs = 1;
+        pal__strncpy(pals[i].dither_pair_names[0], "pair", PAL_MAX_STRLEN);
+        pals[i].dither_pairs[0].index0 = 0;
+        pals[i].dither_pairs[0].index1 = 2;
+        FTGT_ASSERT(pal_create_key_sorted_gradient(&pals[i], "by red", pal_red_key, NULL) == 0);
+    }
+
+    // packed back to back into one arena
+    for (i = 0; i < 3; i++) {
+        pal_u32_t size = pal_compact_palette_size(&pals[i], NULL);
+        FTGT_ASSERT(size % 8 == 0 &&
+                    size < sizeof(pal_palette_t) + pal__palette_storage_size(pals[i].capacity));
+
+        FTGT_ASSERT(pal_compact_palette_pack(&pals[i], NULL, (char*)arena + used, size - 8) == NULL);
+        compact[i] = pal_compact_palette_pack(&pals[i], NULL, (char*)arena + used, size);
+        FTGT_ASSERT(compact[i] && compact[i]->size == size);
+        used += size;
+    }
+
+    for (i = 0; i < 3; i++) {
+        pal_clear(&expanded);
+        FTGT_ASSERT(pal_compact_palette_expand(compact[i], &expanded) == 0);
+
+        FTGT_ASSERT(strcmp(expanded.title, pals[i].title) == 0);
+        FTGT_ASSERT(expanded.num_colors == pals[i].num_colors);
+        FTGT_ASSERT(memcmp(expanded.colors,
+                           pals[i].colors,
+                           sizeof(pal_color_t) * pals[i].num_colors) == 0);
+        FTGT_ASSERT(strcmp(expanded.color_names[3], "3") == 0);
+        FTGT_ASSERT(expanded.num_hints[HINT_TITLE] == 2);
+        FTGT_ASSERT(expanded.hint_colors[HINT_TITLE][0] == 3);
+        FTGT_ASSERT(expanded.num_gradients == 1);
+        FTGT_ASSERT(memcmp(expanded.gradients[0].indices,
+                           pals[i].gradients[0].indices,
+                           sizeof(pal_u16_t) * pals[i].num_colors) == 0);
+        FTGT_ASSERT(expanded.num_dither_pairs == 1 && expanded.dither_pairs[0].index1 == 2);
+    }
+
+    FTGT_ASSERT(pal__compact_emits_match(pals, (const pal_compact_palette_t* const*)compact, 3));
+
+    pal_compact_palette_t* created = pal_compact_palette_create(&pals[2], NULL);
+    FTGT_ASSERT(created && created->size == compact[2]->size);
+    pal_compact_palette_free(created);
+
+    for (i = 0; i < 3; i++) pal_free(&pals[i]);
+    pal_free(&expanded);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_string_pool_interns_names(void)
+{
+    static pal_palette_t   pals[2], expanded;
+    pal_string_pool_t      pool;
+    pal_compact_palette_t* compact[2];
+    pal_u32_t              id, red_id, long_id;
+    char                   long_name[PAL_MAX_STRLEN + 8];
+    int                    i, j;
+
+    pal_string_pool_init(&pool);
+
+    // empty names are id 0 without touching the pool
+    FTGT_ASSERT(pal_string_pool_find(&pool, "", &id) == 0 && id == PAL_STRING_ID_EMPTY);
+    FTGT_ASSERT(pal_string_pool_find(&pool, "red", &id) == 1);
+    FTGT_ASSERT(strcmp(pal_string_pool_get(&pool, PAL_STRING_ID_EMPTY), "") == 0);
+
+    // enough names to rehash, each interned twice
+    FTGT_ASSERT(pal_string_pool_intern(&pool, "red", &red_id) == 0 && red_id != 0);
+    for (i = 0; i < 1000; i++) {
+        char      buf[32];
+        char*     num = pal__int_to_str((unsigned long long)i, buf, 32, 10);
+        pal_u32_t again;
+
+        FTGT_ASSERT(pal_string_pool_intern(&pool, num, &id) == 0);
+        FTGT_ASSERT(pal_string_pool_intern(&pool, num, &again) == 0 && again == id);
+        FTGT_ASSERT(strcmp(pal_string_pool_get(&pool, id), num) == 0);
+    }
+    FTGT_ASSERT(pal_string_pool_find(&pool, "red", &id) == 0 && id == red_id);
+    FTGT_ASSERT(pool.num_strings == 1002);
+
+    // names truncate as pal_str_t does
+    memset(long_name, 'x', sizeof(long_name) - 1);
+    long_name[sizeof(long_name) - 1] = 0;
+    FTGT_ASSERT(pal_string_pool_intern(&pool, long_name, &long_id) == 0);
+    long_name[PAL_MAX_STRLEN - 1] = 0;
+    FTGT_ASSERT(pal_string_pool_find(&pool, long_name, &id) == 0 && id == long_id);
+    FTGT_ASSERT(strlen(pal_string_pool_get(&pool, long_id)) == PAL_MAX_STRLEN - 1);
+
+    // two palettes sharing one pool share their names
+    for (i = 0; i < 2; i++) {
+        pal_init(&pals[i]);
+        pal__palette_set_srgb(&pals[i]);
+        pal__strncpy(pals[i].title, "interned", PAL_MAX_STRLEN);
+        FTGT_ASSERT(pal_reserve(&pals[i], 64) == 0);
+        pals[i].num_colors = 64;
+        for (j = 0; j < pals[i].num_colors; j++) {
+            pals[i].colors[j].rgba.r = (float)j / 255.0f;
+            pals[i].colors[j].rgba.a = 1.0f;
+            pal__strncpy(pals[i].color_names[j],
+                         pal__int_to_str((unsigned long long)(j + i), expanded.title, 32, 10),
+                         PAL_MAX_STRLEN);
+        }
+        pals[i].num_dither_pairs = 1;
+        pal__strncpy(pals[i].dither_pair_names[0], "pair", PAL_MAX_STRLEN);
+        pals[i].dither_pairs[0].index0 = 0;
+        pals[i].dither_pairs[0].index1 = 2;
+        FTGT_ASSERT(pal_create_key_sorted_gradient(&pals[i], "by red", pal_red_key, NULL) == 0);
+
+        FTGT_ASSERT(pal_compact_palette_size(&pals[i], &pool) <
+                    pal_compact_palette_size(&pals[i], NULL) / 2);
+        compact[i] = pal_compact_palette_create(&pals[i], &pool);
+        FTGT_ASSERT(compact[i] && compact[i]->pool == &pool && !compact[i]->color_names);
+    }
+
+    FTGT_ASSERT(compact[0]->color_name_ids[10] == compact[1]->color_name_ids[9]);
+    FTGT_ASSERT(compact[0]->dither_pair_name_ids[0] == compact[1]->dither_pair_name_ids[0]);
+    FTGT_ASSERT(strcmp(pal_compact_palette_color_name(compact[1], 9), "10") == 0);
+
+    FTGT_ASSERT(pal_compact_palette_find_color(compact[1], "10") == 9);
+    FTGT_ASSERT(pal_compact_palette_find_color(compact[1], "0") == -1);
+    FTGT_ASSERT(pal_compact_palette_find_color(compact[0], "not a name") == -1);
+
+    pal_clear(&expanded);
+    FTGT_ASSERT(pal_compact_palette_expand(compact[1], &expanded) == 0);
+    FTGT_ASSERT(memcmp(expanded.color_names,
+                       pals[1].color_names,
+                       sizeof(pal_str_t) * pals[1].num_colors) == 0);
+    FTGT_ASSERT(strcmp(expanded.gradient_names[0], "by red") == 0);
+
+    FTGT_ASSERT(pal__compact_emits_match(pals, (const pal_compact_palette_t* const*)compact, 2));
+
+    for (i = 0; i < 2; i++) pal_compact_palette_free(compact[i]);
+    for (i = 0; i < 2; i++) pal_free(&pals[i]);
+    pal_free(&expanded);
+    pal_string_pool_free(&pool);
+    FTGT_ASSERT(pool.num_strings == 0 && pool.chars == NULL);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_palette_grows_past_256_colors(void)
+{
+    static pal_palette_t pal, loaded;
+    pal_membuf_t         membuf = {0};
+    pal_writer_t         writer;
+    pal_u32_t            capacity;
+    int                  i, j;
+
+    // init doesn't trust what was in the struct
+    memset(&pal, 0xff, sizeof(pal));
+    pal_init(&pal);
+    FTGT_ASSERT(pal.storage == NULL && pal.capacity == 0 && pal.colors == NULL);
+    FTGT_ASSERT(pal.num_colors == 0 && pal.gradients[0].indices == NULL);
+
+    // growing keeps what was already there
+    FTGT_ASSERT(pal_reserve(&pal, 3) == 0 && pal.capacity >= 3);
+    pal.num_colors = 3;
+    for (i = 0; i < 3; i++) pal.colors[i].rgba.g = (float)i;
+    pal__strncpy(pal.color_names[2], "kept", PAL_MAX_STRLEN);
+    pal.num_hints[HINT_HIGHLIGHT] = 1;
+    pal.hint_colors[HINT_HIGHLIGHT][0] = 2;
+
+    FTGT_ASSERT(pal_reserve(&pal, 4096) == 0 && pal.capacity >= 4096);
+    FTGT_ASSERT(pal.colors[2].rgba.g == 2.0f);
+    FTGT_ASSERT(strcmp(pal.color_names[2], "kept") == 0);
+    FTGT_ASSERT(pal.hint_colors[HINT_HIGHLIGHT][0] == 2);
+
+    // reserving less never shrinks, and the limit is enforced
+    capacity = pal.capacity;
+    FTGT_ASSERT(pal_reserve(&pal, 10) == 0 && pal.capacity == capacity);
+    FTGT_ASSERT(pal_reserve(&pal, PAL_MAX_COLORS + 1) != 0 && pal.capacity == capacity);
+
+    pal__palette_set_srgb(&pal);
+    pal__strncpy(pal.title, "big", PAL_MAX_STRLEN);
+    pal.num_colors = 4096;
+    for (i = 0; i < pal.num_colors; i++) {
+        pal.colors[i].rgba.r = (float)(i & 255) / 255.0f;
+        pal.colors[i].rgba.g = (float)(i >> 4) / 255.0f;
+        pal.colors[i].rgba.b = (float)((i * 7) & 255) / 255.0f;
+        pal.colors[i].rgba.a = 1.0f;
+        pal__strncpy(pal.color_names[i],
+                     pal__int_to_str((unsigned long long)i, loaded.title, 32, 10),
+                     PAL_MAX_STRLEN);
+    }
+    FTGT_ASSERT(pal_create_key_sorted_gradient(&pal, "by value", pal_value_key, NULL) == 0);
+    FTGT_ASSERT(pal.gradients[0].num_indices == 4096);
+
+    // gpl grows the palette a color at a time
+    pal_writer_init(&writer, pal_write_to_membuf, &membuf);
+    FTGT_ASSERT(pal_write_gimp_gpl(&writer, &pal) == 0);
+    FTGT_ASSERT(pal_parse_gpl((const unsigned char*)membuf.data, (unsigned int)membuf.len, &loaded, NULL) == 0);
+    FTGT_ASSERT(loaded.num_colors == pal.num_colors);
+    for (i = 0; i < pal.num_colors; i++) {
+        for (j = 0; j < 3; j++) {
+            FTGT_ASSERT(loaded.colors[i].c[j] ==
+                        pal_convert_channel_to_f32(pal_convert_channel_to_8bit(pal.colors[i].c[j])));
+        }
+    }
+    FTGT_ASSERT(strcmp(loaded.color_names[4095], "4095") == 0);
+
+    // palb reserves up front, into a palette that already has storage
+    membuf.len = 0;
+    pal_writer_init(&writer, pal_write_to_membuf, &membuf);
+    FTGT_ASSERT(pal_write_palb(&writer, &pal) == 0);
+    FTGT_ASSERT(pal_parse_palb((const unsigned char*)membuf.data, (unsigned int)membuf.len, &loaded) == 0);
+    FTGT_ASSERT(loaded.num_colors == 4096);
+    FTGT_ASSERT(memcmp(loaded.colors, pal.colors, sizeof(pal_color_t) * pal.num_colors) == 0);
+    FTGT_ASSERT(loaded.num_gradients == 1);
+    FTGT_ASSERT(memcmp(loaded.gradients[0].indices,
+                       pal.gradients[0].indices,
+                       sizeof(pal_u16_t) * pal.gradients[0].num_indices) == 0);
+
+    // clear empties but keeps the storage for the next parse
+    capacity = loaded.capacity;
+    pal_clear(&loaded);
+    FTGT_ASSERT(loaded.storage != NULL && loaded.capacity == capacity);
+    FTGT_ASSERT(loaded.num_colors == 0 && loaded.num_gradients == 0 && loaded.title[0] == 0);
+
+    pal_membuf_free(&membuf);
+    pal_free(&pal);
+    pal_free(&loaded);
+    FTGT_ASSERT(pal.storage == NULL && pal.capacity == 0);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+pal__test_color_hash64(void)
+{
+    static pal_palette_t pal;
+    pal_color_hash64_t   h;
+    pal_color_t          changed;
+    pal_u64_t            expected, value, swapped;
+    pal_u32_t            seed = 777;
+    int                  i, j;
+
+    // hdr, negative, infinite and nan channels are all defined
+    pal_init(&pal);
+    FTGT_ASSERT(pal_reserve(&pal, PAL__TEST_NUM_COLORS) == 0);
+    for (i = 0; i < PAL__TEST_NUM_COLORS - 1; i++) {
+        for (j = 0; j < 4; j++) {
+            seed = seed * 1664525u + 1013904223u;
+            pal.colors[i].c[j] = ((float)(seed >> 8) / 16777216.0f - 0.25f) * 8.0f;
+        }
+    }
+    pal.colors[3].rgba.r = INFINITY;
+    pal.colors[4].rgba.g = NAN;
+    pal.num_colors = PAL__TEST_NUM_COLORS - 1;
+
+    // 255 colors leaves a tail for the two-color kernel
+    expected = 0;
+    for (i = 0; i < pal.num_colors; i++)
+        expected += pal__hash64_color_term(&pal.colors[i], (pal_u64_t)i);
+
+    pal_color_hash64_init(&h, pal.colors, pal.num_colors);
+    FTGT_ASSERT(h.sum == expected && h.num_colors == pal.num_colors);
+#if PAL__SSE2
+    FTGT_ASSERT(pal__hash64_kernel_sse2(pal.colors, pal.num_colors) == expected);
+#endif
+#if PAL__AVX2
+    if (pal__cpu_has_avx2())
+        FTGT_ASSERT(pal__hash64_kernel_avx2(pal.colors, pal.num_colors) == expected);
+#endif
+
+    // incremental updates match hashing from scratch
+    value = pal_hash_color_values64(&pal);
+    FTGT_ASSERT(pal_color_hash64_value(&h) == value);
+
+    changed = pal.colors[100];
+    changed.rgba.b = 1.5f;
+    pal_color_hash64_update(&h, 100, &pal.colors[100], &changed);
+    pal.colors[100] = changed;
+    FTGT_ASSERT(pal_color_hash64_value(&h) == pal_hash_color_values64(&pal));
+    FTGT_ASSERT(pal_color_hash64_value(&h) != value);
+
+    // -0 and 0 have different bits, so hash differently
+    {
+        pal_color_hash64_t neg = h, pos = h;
+        pal_color_t        neg_color = changed, pos_color = changed;
+
+        neg_color.rgba.b = -0.0f;
+        pos_color.rgba.b = 0.0f;
+        pal_color_hash64_update(&neg, 100, &pal.colors[100], &neg_color);
+        pal_color_hash64_update(&pos, 100, &pal.colors[100], &pos_color);
+        FTGT_ASSERT(pal_color_hash64_value(&neg) != pal_color_hash64_value(&pos));
+    }
+
+    // order and length matter, names don't
+    value = pal_hash_color_values64(&pal);
+    pal__strncpy(pal.color_names[0], "renamed", PAL_MAX_STRLEN);
+    FTGT_ASSERT(pal_hash_color_values64(&pal) == value);
+
+    changed = pal.colors[0];
+    pal.colors[0] = pal.colors[1];
+    pal.colors[1] = changed;
+    swapped = pal_hash_color_values64(&pal);
+    FTGT_ASSERT(swapped != value);
+
+    pal.num_colors--;
+    FTGT_ASSERT(pal_hash_color_values64(&pal) != swapped);
+
+    memset(pal.colors, 0, sizeof(pal_color_t) * 2);
+    pal.num_colors = 1;
+    value = pal_hash_color_values64(&pal);
+    pal.num_colors = 2;
+    FTGT_ASSERT(pal_hash_color_values64(&pal) != value);
+
+    pal_free(&pal);
+
+    return ftgt_test_errorlevel();
+}
+
 PALDEF
 void
 pal_decl_suite(void)
@@ -2297,6 +7792,21 @@ pal_decl_suite(void)
         ftgt_create_suite(NULL, "pal_core", pal__test_setup, pal__test_teardown);
     FTGT_ADD_TEST(suite, pal__test_roundtrip_srgb_to_linear_srgb);
     FTGT_ADD_TEST(suite, pal__test_parse_hexcolor);
+    FTGT_ADD_TEST(suite, pal__test_key_sort_matches_callback_sort);
+    FTGT_ADD_TEST(suite, pal__test_feature_sort_matches_key_sort);
+    FTGT_ADD_TEST(suite, pal__test_batch_lab_matches_scalar);
+    FTGT_ADD_TEST(suite, pal__test_transfer_tables);
+    FTGT_ADD_TEST(suite, pal__test_color_soa_matches_aos);
+    FTGT_ADD_TEST(suite, pal__test_writer_matches_fixed_buffer_emit);
+    FTGT_ADD_TEST(suite, pal__test_format_kernels_match_libc);
+    FTGT_ADD_TEST(suite, pal__test_compact_layouts_strip_only_whitespace);
+    FTGT_ADD_TEST(suite, pal__test_parallel_json_matches_serial);
+    FTGT_ADD_TEST(suite, pal__test_palb_roundtrip_and_validation);
+    FTGT_ADD_TEST(suite, pal__test_pala_dedup_and_lookup);
+    FTGT_ADD_TEST(suite, pal__test_compact_palette_roundtrip);
+    FTGT_ADD_TEST(suite, pal__test_string_pool_interns_names);
+    FTGT_ADD_TEST(suite, pal__test_palette_grows_past_256_colors);
+    FTGT_ADD_TEST(suite, pal__test_color_hash64);
 }
 
 #endif /* FTGT_TESTS_ENABLED */
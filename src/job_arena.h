@@ -0,0 +1,471 @@
+/* palettetool Copyright (C) 2024-2026 Frogtoss Games, Inc. */
+
+/*
+   Per-job scratch arena.
+
+   palettetool routes FTG_MALLOC, STBI_MALLOC, STBIW_MALLOC and
+   PAL_REALLOC, with their frees and reallocs, through job_malloc(),
+   job_realloc() and job_free().  On a thread with a current arena
+   these bump-allocate from it, so a conversion's file reads, image
+   buffers and palettes are carved out of one warm region.
+   job_arena_reset() drops everything a job allocated at once and
+   keeps the memory for the next job, up to
+   JOB_ARENA_MAX_RETAINED_SIZE so one huge job doesn't pin its memory
+   for the rest of the run.
+
+   Frees are only honored for the newest allocation, which makes the
+   common alloc/free pairs and grow-the-last-buffer reallocs free.
+   Anything else is reclaimed at reset.
+
+   Threads without a current arena, such as the json emitter's
+   workers, get the system allocator.  job_free() and job_realloc()
+   tell the two apart by address, so the job's thread can free what a
+   worker allocated.  Arena memory must only be freed on its own
+   thread.
+*/
+
+#pragma once
+
+// not every program uses every function
+#if defined(_MSC_VER)
+#    pragma warning(push)
+#    pragma warning(disable : 4505)  // unreferenced local function
+#elif defined(__GNUC__) || defined(__clang__)
+#    pragma GCC diagnostic push
+#    pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#    define JOB_THREAD_LOCAL __declspec(thread)
+#else
+#    define JOB_THREAD_LOCAL __thread
+#endif
+
+#define JOB_ARENA_ALIGN 16
+#define JOB_ARENA_INITIAL_SIZE (256 * 1024)
+#define JOB_ARENA_MAX_RETAINED_SIZE (16 * 1024 * 1024)
+
+typedef struct job_arena_block_s {
+    struct job_arena_block_s* prev;
+    size_t                    capacity;
+    size_t                    used;
+    size_t                    last;  // offset of the newest allocation's header
+} job_arena_block_t;
+
+typedef struct {
+    job_arena_block_t* block;  // newest; older blocks chain through prev
+} job_arena_t;
+
+// every allocation is preceded by its size, padded to keep alignment
+typedef struct {
+    size_t size;
+    char   pad[JOB_ARENA_ALIGN - sizeof(size_t)];
+} job_arena_header_t;
+
+#define JOB_ARENA_BLOCK_DATA_OFFSET \
+    ((sizeof(job_arena_block_t) + JOB_ARENA_ALIGN - 1) & ~(size_t)(JOB_ARENA_ALIGN - 1))
+
+static JOB_THREAD_LOCAL job_arena_t* job__current_arena;
+
+static unsigned char*
+job__block_data(job_arena_block_t* block)
+{
+    return (unsigned char*)block + JOB_ARENA_BLOCK_DATA_OFFSET;
+}
+
+static job_arena_block_t*
+job__block_new(size_t capacity, job_arena_block_t* prev)
+{
+    job_arena_block_t* block = (job_arena_block_t*)malloc(JOB_ARENA_BLOCK_DATA_OFFSET + capacity);
+    if (!block)
+        return NULL;
+
+    block->prev = prev;
+    block->capacity = capacity;
+    block->used = 0;
+    block->last = (size_t)-1;
+
+    return block;
+}
+
+// the arena block holding ptr, or NULL if the system allocator owns it
+static job_arena_block_t*
+job__owning_block(job_arena_t* arena, const void* ptr)
+{
+    job_arena_block_t* block;
+
+    for (block = arena ? arena->block : NULL; block; block = block->prev) {
+        const unsigned char* data = job__block_data(block);
+        if ((const unsigned char*)ptr >= data && (const unsigned char*)ptr < data + block->used)
+            return block;
+    }
+
+    return NULL;
+}
+
+static job_arena_header_t*
+job__header(void* ptr)
+{
+    return (job_arena_header_t*)ptr - 1;
+}
+
+static int
+job_arena_init(job_arena_t* arena, size_t capacity)
+{
+    arena->block = job__block_new(capacity, NULL);
+    return arena->block != NULL;
+}
+
+// allocations on this thread come from arena, or the system allocator
+// if NULL
+static void
+job_arena_make_current(job_arena_t* arena)
+{
+    job__current_arena = arena;
+}
+
+// release every allocation made from arena.  blocks chained on during
+// the job are merged into one, so the next job of the same size
+// allocates nothing.  the merged block is capped at
+// JOB_ARENA_MAX_RETAINED_SIZE; bigger jobs chain blocks again.
+static void
+job_arena_reset(job_arena_t* arena)
+{
+    job_arena_block_t* block = arena->block;
+    size_t             capacity = 0;
+
+    if (block && !block->prev) {
+        block->used = 0;
+        block->last = (size_t)-1;
+        return;
+    }
+
+    while (block) {
+        job_arena_block_t* prev = block->prev;
+        capacity += block->capacity;
+        free(block);
+        block = prev;
+    }
+
+    if (capacity > JOB_ARENA_MAX_RETAINED_SIZE)
+        capacity = JOB_ARENA_MAX_RETAINED_SIZE;
+    arena->block = job__block_new(capacity, NULL);
+}
+
+static void
+job_arena_release(job_arena_t* arena)
+{
+    while (arena->block) {
+        job_arena_block_t* prev = arena->block->prev;
+        free(arena->block);
+        arena->block = prev;
+    }
+
+    if (job__current_arena == arena)
+        job__current_arena = NULL;
+}
+
+static void*
+job_malloc(size_t size)
+{
+    job_arena_t*       arena = job__current_arena;
+    job_arena_block_t* block;
+    size_t             needed;
+
+    if (!arena || !arena->block)
+        return malloc(size);
+
+    if (size > SIZE_MAX / 2)
+        return NULL;
+    needed = sizeof(job_arena_header_t) +
+             ((size + JOB_ARENA_ALIGN - 1) & ~(size_t)(JOB_ARENA_ALIGN - 1));
+
+    block = arena->block;
+    if (block->capacity - block->used < needed) {
+        size_t capacity = block->capacity * 2;
+        if (capacity < needed)
+            capacity = needed;
+
+        block = job__block_new(capacity, arena->block);
+        if (!block)
+            return NULL;
+        arena->block = block;
+    }
+
+    job_arena_header_t* header = (job_arena_header_t*)(job__block_data(block) + block->used);
+    header->size = size;
+    block->last = block->used;
+    block->used += needed;
+
+    return header + 1;
+}
+
+// FTG_MALLOC-style element count, with overflow checking
+static void*
+job_malloc_n(size_t size, size_t num)
+{
+    if (num != 0 && size > SIZE_MAX / num)
+        return NULL;
+
+    return job_malloc(size * num);
+}
+
+static void
+job_free(void* ptr)
+{
+    job_arena_block_t* block;
+
+    if (!ptr)
+        return;
+
+    block = job__owning_block(job__current_arena, ptr);
+    if (!block) {
+        free(ptr);
+        return;
+    }
+
+    // only the newest allocation can be popped
+    if (block == job__current_arena->block &&
+        (unsigned char*)job__header(ptr) == job__block_data(block) + block->last) {
+        block->used = block->last;
+        block->last = (size_t)-1;
+    }
+}
+
+// FTG_FREE zeroes the caller's pointer
+static void
+job_free_and_null(void** ptr)
+{
+    job_free(*ptr);
+    *ptr = NULL;
+}
+
+static void*
+job_realloc(void* ptr, size_t size)
+{
+    job_arena_block_t* block;
+    void*              grown;
+
+    if (!ptr)
+        return job_malloc(size);
+
+    block = job__owning_block(job__current_arena, ptr);
+    if (!block)
+        return realloc(ptr, size);
+
+    job_arena_header_t* header = job__header(ptr);
+
+    // the newest allocation grows or shrinks in place when it fits
+    if (block == job__current_arena->block &&
+        (unsigned char*)header == job__block_data(block) + block->last) {
+        size_t needed = sizeof(job_arena_header_t) +
+                        ((size + JOB_ARENA_ALIGN - 1) & ~(size_t)(JOB_ARENA_ALIGN - 1));
+
+        if (size <= SIZE_MAX / 2 && block->capacity - block->last >= needed) {
+            header->size = size;
+            block->used = block->last + needed;
+            return ptr;
+        }
+    }
+
+    grown = job_malloc(size);
+    if (!grown)
+        return NULL;
+
+    memcpy(grown, ptr, header->size < size ? header->size : size);
+    job_free(ptr);
+
+    return grown;
+}
+
+static void*
+job_realloc_n(void* ptr, size_t size, size_t num)
+{
+    if (num != 0 && size > SIZE_MAX / num)
+        return NULL;
+
+    return job_realloc(ptr, size * num);
+}
+
+//
+// Test suite
+//
+// To run tests:  include ftg_test.h and define FTGT_TESTS_ENABLED.
+// Call job_arena_decl_suite(), then ftgt_run_all_tests(NULL).
+//
+#ifdef FTGT_TESTS_ENABLED
+
+static int
+job__test_setup(void)
+{
+    return 0; /* setup success */
+}
+
+static int
+job__test_teardown(void)
+{
+    job_arena_make_current(NULL);
+    return 0;
+}
+
+static int
+job__test_frees_only_the_newest_allocation(void)
+{
+    job_arena_t arena;
+    FTGT_ASSERT(job_arena_init(&arena, 1024));
+    job_arena_make_current(&arena);
+
+    unsigned char* a = (unsigned char*)job_malloc(100);
+    unsigned char* b = (unsigned char*)job_malloc(100);
+    size_t         used = arena.block->used;
+    FTGT_ASSERT(a && b && b > a);
+    FTGT_ASSERT(((size_t)a & (JOB_ARENA_ALIGN - 1)) == 0);
+    FTGT_ASSERT(((size_t)b & (JOB_ARENA_ALIGN - 1)) == 0);
+
+    // an older allocation stays put until reset
+    job_free(a);
+    FTGT_ASSERT(arena.block->used == used);
+
+    // the newest pops, and its space is handed out again
+    job_free(b);
+    FTGT_ASSERT(arena.block->used < used);
+    FTGT_ASSERT(job_malloc(100) == b);
+
+    // only once: after a pop, a is not the newest
+    job_free(b);
+    used = arena.block->used;
+    job_free(a);
+    FTGT_ASSERT(arena.block->used == used);
+
+    job_arena_release(&arena);
+    FTGT_ASSERT(arena.block == NULL);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+job__test_realloc_grows_the_newest_in_place(void)
+{
+    job_arena_t arena;
+    FTGT_ASSERT(job_arena_init(&arena, 4096));
+    job_arena_make_current(&arena);
+
+    unsigned char* a = (unsigned char*)job_malloc(16);
+    unsigned char* b = (unsigned char*)job_malloc(16);
+    memset(b, 0xab, 16);
+
+    // the newest grows and shrinks where it is while the block has room
+    FTGT_ASSERT(job_realloc(b, 1000) == b);
+    FTGT_ASSERT(b[15] == 0xab);
+    FTGT_ASSERT(job_realloc(b, 8) == b);
+    FTGT_ASSERT(arena.block->used < 1000);
+
+    // an older one moves, keeping its contents
+    memset(a, 0xcd, 16);
+    unsigned char* moved = (unsigned char*)job_realloc(a, 64);
+    FTGT_ASSERT(moved && moved != a && moved > b);
+    FTGT_ASSERT(moved[0] == 0xcd && moved[15] == 0xcd);
+
+    // past the block, the newest moves to a new block
+    unsigned char* big = (unsigned char*)job_realloc(moved, 8192);
+    FTGT_ASSERT(big && big != moved && big[15] == 0xcd);
+    FTGT_ASSERT(arena.block->prev != NULL);
+
+    job_arena_release(&arena);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+job__test_reset_reuses_and_caps_blocks(void)
+{
+    job_arena_t arena;
+    FTGT_ASSERT(job_arena_init(&arena, 1024));
+    job_arena_make_current(&arena);
+
+    // a job that outgrows the block chains more on
+    for (int i = 0; i < 8; i++) FTGT_ASSERT(job_malloc(1000) != NULL);
+    FTGT_ASSERT(arena.block->prev != NULL);
+
+    // reset merges them, so the same job again fits in one block
+    job_arena_reset(&arena);
+    FTGT_ASSERT(arena.block && arena.block->prev == NULL && arena.block->used == 0);
+    job_arena_block_t* merged = arena.block;
+    unsigned char*     first = (unsigned char*)job_malloc(1000);
+    FTGT_ASSERT(first == job__block_data(merged) + sizeof(job_arena_header_t));
+    for (int i = 1; i < 8; i++) FTGT_ASSERT(job_malloc(1000) != NULL);
+    FTGT_ASSERT(arena.block == merged);
+
+    // a single block is reused as is
+    job_arena_reset(&arena);
+    FTGT_ASSERT(arena.block == merged && arena.block->used == 0);
+    FTGT_ASSERT(job_malloc(1000) == first);
+
+    // but no more than the cap is kept after a huge job
+    FTGT_ASSERT(job_malloc(JOB_ARENA_MAX_RETAINED_SIZE * 2) != NULL);
+    job_arena_reset(&arena);
+    FTGT_ASSERT(arena.block && arena.block->prev == NULL);
+    FTGT_ASSERT(arena.block->capacity == JOB_ARENA_MAX_RETAINED_SIZE);
+
+    job_arena_release(&arena);
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+job__test_system_pointers_pass_through(void)
+{
+    job_arena_t arena;
+    FTGT_ASSERT(job_arena_init(&arena, 1024));
+
+    // no current arena: the system allocator
+    job_arena_make_current(NULL);
+    unsigned char* sys = (unsigned char*)job_malloc(32);
+    FTGT_ASSERT(sys && !job__owning_block(&arena, sys));
+    memset(sys, 0x5a, 32);
+
+    // with one, system pointers are still realloced and freed by the
+    // system allocator, and arena pointers stay in the arena
+    job_arena_make_current(&arena);
+    unsigned char* in_arena = (unsigned char*)job_malloc(32);
+    FTGT_ASSERT(job__owning_block(&arena, in_arena) == arena.block);
+
+    sys = (unsigned char*)job_realloc(sys, 4096);
+    FTGT_ASSERT(sys && !job__owning_block(&arena, sys) && sys[31] == 0x5a);
+    size_t used = arena.block->used;
+    job_free(sys);
+    FTGT_ASSERT(arena.block->used == used);
+
+    job_free(NULL);
+    FTGT_ASSERT(job_realloc_n(NULL, SIZE_MAX / 2, 4) == NULL);
+    FTGT_ASSERT(job_malloc_n(SIZE_MAX / 2, 4) == NULL);
+
+    job_arena_release(&arena);
+    FTGT_ASSERT(job__current_arena == NULL);
+
+    return ftgt_test_errorlevel();
+}
+
+static void
+job_arena_decl_suite(void)
+{
+    ftgt_suite_s* suite =
+        ftgt_create_suite(NULL, "job_arena", job__test_setup, job__test_teardown);
+    FTGT_ADD_TEST(suite, job__test_frees_only_the_newest_allocation);
+    FTGT_ADD_TEST(suite, job__test_realloc_grows_the_newest_in_place);
+    FTGT_ADD_TEST(suite, job__test_reset_reuses_and_caps_blocks);
+    FTGT_ADD_TEST(suite, job__test_system_pointers_pass_through);
+}
+
+#endif /* FTGT_TESTS_ENABLED */
+
+#if defined(_MSC_VER)
+#    pragma warning(pop)
+#elif defined(__GNUC__) || defined(__clang__)
+#    pragma GCC diagnostic pop
+#endif
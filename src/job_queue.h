@@ -0,0 +1,414 @@
+/* palettetool Copyright (C) 2024-2026 Frogtoss Games, Inc. */
+
+/*
+   Work-stealing job queue and worker threads.
+
+   job_queue_init() deals items 0..num_items-1 round-robin onto one
+   deque per worker, so when items are numbered largest first every
+   worker starts on one of the biggest.  A worker takes from the front
+   of its own deque.  Once that runs dry it steals from the back of
+   another worker's, where the smallest of that worker's items wait,
+   so the last few jobs are spread evenly instead of one worker
+   finishing a long tail alone.
+
+   No items are added after init, so a worker is done when its own
+   deque and every other are empty.
+
+   job_run_workers() runs a function on num_workers threads, the
+   calling thread being worker 0.
+*/
+
+#pragma once
+
+// not every program uses every function
+#if defined(_MSC_VER)
+#    pragma warning(push)
+#    pragma warning(disable : 4505)  // unreferenced local function
+#elif defined(__GNUC__) || defined(__clang__)
+#    pragma GCC diagnostic push
+#    pragma GCC diagnostic ignored "-Wunused-function"
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#if defined(_WIN32)
+#    include <windows.h>
+#else
+#    include <pthread.h>
+#    include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+typedef CRITICAL_SECTION job_mutex_t;
+typedef HANDLE           job_thread_t;
+#else
+typedef pthread_mutex_t job_mutex_t;
+typedef pthread_t       job_thread_t;
+#endif
+
+typedef struct {
+    int*        items;
+    int         head;  // the owner takes items[head++]
+    int         tail;  // thieves take items[--tail]
+    job_mutex_t lock;
+} job_deque_t;
+
+typedef struct {
+    job_deque_t* deques;
+    int*         items;  // backs every deque
+    int          num_workers;
+} job_queue_t;
+
+static void
+job__mutex_init(job_mutex_t* mutex)
+{
+#if defined(_WIN32)
+    InitializeCriticalSection(mutex);
+#else
+    pthread_mutex_init(mutex, NULL);
+#endif
+}
+
+static void
+job__mutex_destroy(job_mutex_t* mutex)
+{
+#if defined(_WIN32)
+    DeleteCriticalSection(mutex);
+#else
+    pthread_mutex_destroy(mutex);
+#endif
+}
+
+static void
+job__mutex_lock(job_mutex_t* mutex)
+{
+#if defined(_WIN32)
+    EnterCriticalSection(mutex);
+#else
+    pthread_mutex_lock(mutex);
+#endif
+}
+
+static void
+job__mutex_unlock(job_mutex_t* mutex)
+{
+#if defined(_WIN32)
+    LeaveCriticalSection(mutex);
+#else
+    pthread_mutex_unlock(mutex);
+#endif
+}
+
+static int
+job_num_cpus(void)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+// returns false if out of memory
+static bool
+job_queue_init(job_queue_t* queue, int num_items, int num_workers)
+{
+    int w, i;
+
+    queue->num_workers = num_workers;
+    queue->deques = (job_deque_t*)malloc(sizeof(job_deque_t) * (size_t)num_workers);
+    queue->items = (int*)malloc(sizeof(int) * (size_t)(num_items ? num_items : 1));
+    if (!queue->deques || !queue->items) {
+        free(queue->deques);
+        free(queue->items);
+        return false;
+    }
+
+    // worker w gets items w, w + num_workers, ... contiguously
+    int* items = queue->items;
+    for (w = 0; w < num_workers; w++) {
+        job_deque_t* deque = &queue->deques[w];
+
+        deque->items = items;
+        deque->head = 0;
+        deque->tail = 0;
+        for (i = w; i < num_items; i += num_workers) deque->items[deque->tail++] = i;
+        items += deque->tail;
+
+        job__mutex_init(&deque->lock);
+    }
+
+    return true;
+}
+
+static void
+job_queue_release(job_queue_t* queue)
+{
+    int w;
+
+    for (w = 0; w < queue->num_workers; w++) job__mutex_destroy(&queue->deques[w].lock);
+
+    free(queue->deques);
+    free(queue->items);
+    queue->deques = NULL;
+    queue->items = NULL;
+    queue->num_workers = 0;
+}
+
+// the next item for worker, from its own deque or stolen from another.
+// returns false once every deque is empty.
+static bool
+job_queue_take(job_queue_t* queue, int worker, int* out_item)
+{
+    job_deque_t* own = &queue->deques[worker];
+    bool         found = false;
+    int          i;
+
+    job__mutex_lock(&own->lock);
+    if (own->head < own->tail) {
+        *out_item = own->items[own->head++];
+        found = true;
+    }
+    job__mutex_unlock(&own->lock);
+
+    for (i = 1; i < queue->num_workers && !found; i++) {
+        job_deque_t* victim = &queue->deques[(worker + i) % queue->num_workers];
+
+        job__mutex_lock(&victim->lock);
+        if (victim->head < victim->tail) {
+            *out_item = victim->items[--victim->tail];
+            found = true;
+        }
+        job__mutex_unlock(&victim->lock);
+    }
+
+    return found;
+}
+
+typedef void (*job_worker_func_t)(int worker, void* data);
+
+typedef struct {
+    job_worker_func_t func;
+    void*             data;
+    int               worker;
+} job__worker_start_t;
+
+#if defined(_WIN32)
+static DWORD WINAPI
+job__worker_thread(LPVOID param)
+{
+    job__worker_start_t* start = (job__worker_start_t*)param;
+    start->func(start->worker, start->data);
+    return 0;
+}
+
+static bool
+job__thread_start(job_thread_t* thread, job__worker_start_t* start)
+{
+    *thread = CreateThread(NULL, 0, job__worker_thread, start, 0, NULL);
+    return *thread != NULL;
+}
+
+static void
+job__thread_join(job_thread_t thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+#else
+static void*
+job__worker_thread(void* param)
+{
+    job__worker_start_t* start = (job__worker_start_t*)param;
+    start->func(start->worker, start->data);
+    return NULL;
+}
+
+static bool
+job__thread_start(job_thread_t* thread, job__worker_start_t* start)
+{
+    return pthread_create(thread, NULL, job__worker_thread, start) == 0;
+}
+
+static void
+job__thread_join(job_thread_t thread)
+{
+    pthread_join(thread, NULL);
+}
+#endif
+
+// run func(worker, data) for each worker 0..num_workers-1 and wait for
+// them all.  a worker whose thread can't be started runs on the calling
+// thread after worker 0; with a work-stealing queue the others will
+// have taken its share by then.
+static void
+job_run_workers(int num_workers, job_worker_func_t func, void* data)
+{
+    job__worker_start_t* starts;
+    job_thread_t*        threads;
+    bool*                started;
+    int                  w;
+
+    if (num_workers <= 1) {
+        func(0, data);
+        return;
+    }
+
+    starts = (job__worker_start_t*)malloc(sizeof(job__worker_start_t) * (size_t)num_workers);
+    threads = (job_thread_t*)malloc(sizeof(job_thread_t) * (size_t)num_workers);
+    started = (bool*)malloc(sizeof(bool) * (size_t)num_workers);
+    if (!starts || !threads || !started) {
+        free(starts);
+        free(threads);
+        free(started);
+        for (w = 0; w < num_workers; w++) func(w, data);
+        return;
+    }
+
+    for (w = 0; w < num_workers; w++) {
+        starts[w].func = func;
+        starts[w].data = data;
+        starts[w].worker = w;
+        started[w] = w > 0 && job__thread_start(&threads[w], &starts[w]);
+    }
+
+    func(0, data);
+    for (w = 1; w < num_workers; w++) {
+        if (started[w])
+            job__thread_join(threads[w]);
+        else
+            func(w, data);
+    }
+
+    free(starts);
+    free(threads);
+    free(started);
+}
+
+//
+// Test suite
+//
+// To run tests:  include ftg_test.h and define FTGT_TESTS_ENABLED.
+// Call job_queue_decl_suite(), then ftgt_run_all_tests(NULL).
+//
+#ifdef FTGT_TESTS_ENABLED
+
+#    include <string.h>
+
+static int
+job__test_queue_setup(void)
+{
+    return 0; /* setup success */
+}
+
+static int
+job__test_queue_teardown(void)
+{
+    return 0;
+}
+
+static int
+job__test_queue_takes_own_then_steals(void)
+{
+    job_queue_t queue;
+    int         item, i;
+
+    FTGT_ASSERT(job_queue_init(&queue, 10, 3));
+
+    // dealt round-robin: 0 3 6 9 / 1 4 7 / 2 5 8, owners from the front
+    FTGT_ASSERT(job_queue_take(&queue, 0, &item) && item == 0);
+    FTGT_ASSERT(job_queue_take(&queue, 0, &item) && item == 3);
+    FTGT_ASSERT(job_queue_take(&queue, 1, &item) && item == 1);
+    FTGT_ASSERT(job_queue_take(&queue, 1, &item) && item == 4);
+    FTGT_ASSERT(job_queue_take(&queue, 1, &item) && item == 7);
+
+    // worker 1 is dry: steal from the back of the next worker's deque,
+    // the smallest of its items when they are numbered largest first
+    FTGT_ASSERT(job_queue_take(&queue, 1, &item) && item == 8);
+    FTGT_ASSERT(job_queue_take(&queue, 1, &item) && item == 5);
+
+    // the owner still starts from its front
+    FTGT_ASSERT(job_queue_take(&queue, 2, &item) && item == 2);
+
+    // then worker 0's, from the back
+    FTGT_ASSERT(job_queue_take(&queue, 2, &item) && item == 9);
+    FTGT_ASSERT(job_queue_take(&queue, 0, &item) && item == 6);
+
+    for (i = 0; i < 3; i++) FTGT_ASSERT(!job_queue_take(&queue, i, &item));
+
+    job_queue_release(&queue);
+
+    // more workers than items leaves some deques empty from the start
+    FTGT_ASSERT(job_queue_init(&queue, 2, 4));
+    FTGT_ASSERT(job_queue_take(&queue, 3, &item) && item == 0);
+    FTGT_ASSERT(job_queue_take(&queue, 3, &item) && item == 1);
+    FTGT_ASSERT(!job_queue_take(&queue, 2, &item));
+    job_queue_release(&queue);
+
+    FTGT_ASSERT(job_queue_init(&queue, 0, 2));
+    FTGT_ASSERT(!job_queue_take(&queue, 0, &item));
+    job_queue_release(&queue);
+
+    return ftgt_test_errorlevel();
+}
+
+#    define JOB__TEST_NUM_ITEMS 1000
+
+typedef struct {
+    job_queue_t queue;
+    int         taken_by[JOB__TEST_NUM_ITEMS];  // worker + 1, each written once
+    int         num_taken[8];
+} job__test_run_t;
+
+static void
+job__test_take_all(int worker, void* data)
+{
+    job__test_run_t* run = (job__test_run_t*)data;
+    int              item;
+
+    while (job_queue_take(&run->queue, worker, &item)) {
+        run->taken_by[item] = worker + 1;
+        run->num_taken[worker]++;
+    }
+}
+
+static int
+job__test_workers_take_every_item_once(void)
+{
+    static job__test_run_t run;
+    int                    total = 0, i;
+
+    memset(&run, 0, sizeof(run));
+    FTGT_ASSERT(job_queue_init(&run.queue, JOB__TEST_NUM_ITEMS, 8));
+
+    job_run_workers(8, job__test_take_all, &run);
+
+    for (i = 0; i < 8; i++) total += run.num_taken[i];
+    FTGT_ASSERT(total == JOB__TEST_NUM_ITEMS);
+    for (i = 0; i < JOB__TEST_NUM_ITEMS; i++) FTGT_ASSERT(run.taken_by[i] != 0);
+
+    job_queue_release(&run.queue);
+
+    return ftgt_test_errorlevel();
+}
+
+static void
+job_queue_decl_suite(void)
+{
+    ftgt_suite_s* suite =
+        ftgt_create_suite(NULL, "job_queue", job__test_queue_setup, job__test_queue_teardown);
+    FTGT_ADD_TEST(suite, job__test_queue_takes_own_then_steals);
+    FTGT_ADD_TEST(suite, job__test_workers_take_every_item_once);
+}
+
+#endif /* FTGT_TESTS_ENABLED */
+
+#if defined(_MSC_VER)
+#    pragma warning(pop)
+#elif defined(__GNUC__) || defined(__clang__)
+#    pragma GCC diagnostic pop
+#endif
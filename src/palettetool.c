@@ -10,9 +10,34 @@
 #define STBI_ONLY_PNG
 #define STBI_SUPPORT_ZLIB
 
+#include <limits.h>
+#include <setjmp.h>
 #include <stdio.h>
 #include <stdlib.h>
-
+#include <sys/stat.h>
+
+#if defined(_WIN32)
+#    include <process.h>
+#    define getpid _getpid
+#else
+#    include <unistd.h>
+#endif
+
+#include "job_arena.h"
+#include "job_queue.h"
+
+// every library allocates through the current thread's job arena
+#define FTG_MALLOC(size, num) job_malloc_n((size), (num))
+#define FTG_FREE(ptr) job_free_and_null((void**)&(ptr))
+#define FTG_REALLOC(ptr, size, num) job_realloc_n((ptr), (size), (num))
+#define STBI_MALLOC(sz) job_malloc(sz)
+#define STBI_REALLOC(p, newsz) job_realloc((p), (newsz))
+#define STBI_FREE(p) job_free(p)
+#define STBIW_MALLOC(sz) job_malloc(sz)
+#define STBIW_REALLOC(p, newsz) job_realloc((p), (newsz))
+#define STBIW_FREE(p) job_free(p)
+#define PAL_REALLOC(p, n) job_realloc((p), (n))
+#define PAL_FREE(p) job_free(p)
 
 #include "3rdparty/ftg_core.h"
 #include "3rdparty/ftg_palette.h"
@@ -22,16 +47,27 @@
 
 #include "parse_json.h"
 
+// options shared by every conversion.  what differs between them is
+// in the current thread's job_t.
 struct args_s {
-    const char* in_file;
-    const char* out_file;
     bool        verbose;
     bool        help_supported;
 
     const char* png_sort_kind;
     int         png_scale;
 
-    int json_palette_index;
+    int         json_palette_index;
+    const char* json_palette_title;
+    bool        json_index;
+    bool        json_compact;
+    bool        json_ndjson;
+    bool        json_all_palettes;
+
+    kgflags_string_array_t in_files;  // paired with out_files by position
+    kgflags_string_array_t out_files;
+    const char*            batch_manifest;
+    int                    threads;
+    const char*            cache_dir;
 } args;
 
 #define LOG_WARNING 1
@@ -44,12 +80,25 @@ typedef enum {
     FILE_KIND_JSON_PALETTE,
     FILE_KIND_GIMP_GPL,
     FILE_KIND_JASC,
+    FILE_KIND_PALB,
+    FILE_KIND_PALA,
 } file_kind_t;
 
 const file_kind_t SUPPORTED_INPUT_FORMATS[] = {
-    FILE_KIND_ACO, FILE_KIND_JSON_PALETTE, FILE_KIND_PNG, FILE_KIND_GIMP_GPL, FILE_KIND_JASC, 0};
-const file_kind_t SUPPORTED_OUTPUT_FORMATS[] = {
-    FILE_KIND_JSON_PALETTE, FILE_KIND_PNG, FILE_KIND_GIMP_GPL, 0};
+    FILE_KIND_ACO,
+    FILE_KIND_JSON_PALETTE,
+    FILE_KIND_PNG,
+    FILE_KIND_GIMP_GPL,
+    FILE_KIND_JASC,
+    FILE_KIND_PALB,
+    FILE_KIND_PALA,
+    0};
+const file_kind_t SUPPORTED_OUTPUT_FORMATS[] = {FILE_KIND_JSON_PALETTE,
+                                                FILE_KIND_PNG,
+                                                FILE_KIND_GIMP_GPL,
+                                                FILE_KIND_PALB,
+                                                FILE_KIND_PALA,
+                                                0};
 
 const char*
 kind_to_string(file_kind_t kind)
@@ -65,19 +114,83 @@ kind_to_string(file_kind_t kind)
         return "gimp gpl";
     case FILE_KIND_JASC:
         return "jasc";
+    case FILE_KIND_PALB:
+        return "palb (binary palette)";
+    case FILE_KIND_PALA:
+        return "pala (palette archive)";
     default:
         return "unknown";
     }
 }
 
+#define JOB_MAX_OPEN_FILES 4
+
+// a conversion, owned by the thread running it
+typedef struct {
+    const char* in_file;
+    const char* out_file;
+    int         emit_threads;  // json emitter threads, 0 for one per cpu
+    jmp_buf*    failed;        // if set, fatal() fails just this job
+
+    // files opened with job_fopen.  memory is in the job arena, but a
+    // failed job has to close these itself
+    FILE* open_files[JOB_MAX_OPEN_FILES];
+} job_t;
+
+static JOB_THREAD_LOCAL job_t* current_job;
+
 void
 fatal(const char* msg)
 {
+    if (current_job && current_job->failed) {
+        fprintf(stderr, "error: %s: %s\n", current_job->in_file, msg);
+        longjmp(*current_job->failed, 1);
+    }
+
     fprintf(stderr, "fatal: %s\n", msg);
 
     exit(1);
 }
 
+// fopen, registering the file with the current job so that failing
+// the job closes it
+static FILE*
+job_fopen(const char* path, const char* mode)
+{
+    int slot = 0;
+    while (slot < JOB_MAX_OPEN_FILES && current_job->open_files[slot])
+        slot++;
+    FTG_ASSERT(slot < JOB_MAX_OPEN_FILES);
+
+    FILE* fp = fopen(path, mode);
+    current_job->open_files[slot] = fp;
+
+    return fp;
+}
+
+static int
+job_fclose(FILE* fp)
+{
+    for (int i = 0; i < JOB_MAX_OPEN_FILES; i++) {
+        if (current_job->open_files[i] == fp)
+            current_job->open_files[i] = NULL;
+    }
+
+    return fclose(fp);
+}
+
+// close whatever a failed job left open
+static void
+job_close_files(job_t* job)
+{
+    for (int i = 0; i < JOB_MAX_OPEN_FILES; i++) {
+        if (job->open_files[i]) {
+            fclose(job->open_files[i]);
+            job->open_files[i] = NULL;
+        }
+    }
+}
+
 void
 print(int level, const char* msg)
 {
@@ -117,54 +230,448 @@ file_kind_for_extension(const char* path)
 
     if (ftg_stricmp(ext, "pal") == 0)
         return FILE_KIND_JASC;
+
+    if (ftg_stricmp(ext, "palb") == 0)
+        return FILE_KIND_PALB;
+
+    if (ftg_stricmp(ext, "pala") == 0)
+        return FILE_KIND_PALA;
     ;
 
     return FILE_KIND_UNKNOWN;
 }
 
+// gradient names in pal_sort_kind_t order
+const char* FULL_PALETTE_GRADIENT_NAMES[PAL_SORT_MAX] = {
+    "sort by red channel",
+    "sort by green channel",
+    "sort by blue channel",
+    "sort by hue",
+    "sort by saturation",
+    "sort by value",
+    "sort by lightness",
+    "sort by redness",
+    "sort by yellowness",
+    "sort by greenness",
+    "sort by cyanness",
+    "sort by blueness",
+    "sort by magentaness",
+};
+
 int
 add_full_palette_gradients(pal_palette_t* palette)
 {
-    int result =
-        pal_create_sorted_gradient(palette, "sort by red channel", pal_red_cb, NULL);
+    // convert every color once, then derive all builtin sorts from it
+    pal_color_features_t features = {0};
+    if (pal_compute_color_features(palette, &features) != 0)
+        fatal("out of memory");
+
+    int result = 0;
+    for (int i = 0; i < PAL_SORT_MAX; i++) {
+        result |= pal_create_feature_sorted_gradient(
+            palette, FULL_PALETTE_GRADIENT_NAMES[i], &features, (pal_sort_kind_t)i);
+    }
+    pal_color_features_free(&features);
 
-    result |= pal_create_sorted_gradient(
-        palette, "sort by green channel", pal_green_cb, NULL);
+    FTG_ASSERT(result == 0);
 
-    result |=
-        pal_create_sorted_gradient(palette, "sort by blue channel", pal_blue_cb, NULL);
+    return result;
+}
 
-    result |= pal_create_sorted_gradient(palette, "sort by hue", pal_hue_cb, NULL);
+// json_read_func_t for reading json palettes from a FILE* in chunks
+static int
+read_file_chunk(void* read_data, char* buf, int buf_len)
+{
+    FILE*  fp = (FILE*)read_data;
+    size_t read = fread(buf, 1, (size_t)buf_len, fp);
 
-    result |= pal_create_sorted_gradient(
-        palette, "sort by saturation", pal_saturation_cb, NULL);
+    if (read == 0 && ferror(fp))
+        return -1;
 
-    result |= pal_create_sorted_gradient(palette, "sort by value", pal_value_cb, NULL);
+    return (int)read;
+}
 
-    result |= pal_create_sorted_gradient(
-        palette, "sort by lightness", pal_lightness_cb, NULL);
+// json_read_func_t for parsing json already held in memory
+typedef struct {
+    const char* bytes;
+    size_t      len;
+    size_t      pos;
+} mem_reader_t;
 
-    result |=
-        pal_create_sorted_gradient(palette, "sort by redness", pal_redness_cb, NULL);
+static int
+read_mem_chunk(void* read_data, char* buf, int buf_len)
+{
+    mem_reader_t* reader = (mem_reader_t*)read_data;
+    size_t        remaining = reader->len - reader->pos;
+    size_t        n = remaining < (size_t)buf_len ? remaining : (size_t)buf_len;
 
-    result |= pal_create_sorted_gradient(
-        palette, "sort by yellowness", pal_yellowness_cb, NULL);
+    memcpy(buf, reader->bytes + reader->pos, n);
+    reader->pos += n;
 
-    result |= pal_create_sorted_gradient(
-        palette, "sort by greenness", pal_greenness_cb, NULL);
+    return (int)n;
+}
 
-    result |=
-        pal_create_sorted_gradient(palette, "sort by cyanness", pal_cyanness_cb, NULL);
+// titles are compared as stored, truncated to PAL_MAX_STRLEN - 1
+static bool
+palette_title_matches(const char* palette_title, const char* title)
+{
+    return strncmp(palette_title, title, PAL_MAX_STRLEN - 1) == 0;
+}
 
-    result |=
-        pal_create_sorted_gradient(palette, "sort by blueness", pal_blueness_cb, NULL);
+// write path under a name of its own and rename it into place, so
+// that jobs writing the same path at once, here or in another
+// palettetool, never leave or read a mix of their bytes
+static bool
+write_file_replacing(const char* path, const u8* bytes, size_t len)
+{
+    char temp_path[FTG_STRLEN_LONG];
+    snprintf(temp_path,
+             sizeof(temp_path),
+             "%s.%ld.%p.tmp",
+             path,
+             (long)getpid(),
+             (void*)current_job);
+
+    if (!ftg_file_write(temp_path, bytes, len)) {
+        remove(temp_path);
+        return false;
+    }
 
-    result |= pal_create_sorted_gradient(
-        palette, "sort by magentaness", pal_magentaness_cb, NULL);
+#if defined(_WIN32)
+    // rename won't replace an existing file on windows
+    bool renamed = MoveFileExA(temp_path, path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool renamed = rename(temp_path, path) == 0;
+#endif
+    if (!renamed)
+        remove(temp_path);
 
-    FTG_ASSERT(result == 0);
+    return renamed;
+}
 
-    return result;
+//
+// json sidecar index
+//
+// --json-index keeps <in_file>.idx next to a json document, recording
+// the byte range, title and color hash of each palette so a single
+// palette can be parsed without reading the rest of the document.
+//
+// the index is rebuilt when the document's size or mtime differ from
+// the recorded ones, or when the palette being read no longer checks
+// out: its range must lie in the document, span one object, hash to
+// the recorded range hash and parse.  it's a local cache, written in
+// native byte order.
+
+#define JSON_INDEX_MAGIC 0x58444950u  // 'PIDX'
+#define JSON_INDEX_VERSION 2
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u64 file_size;
+    u64 file_mtime;
+    u32 num_palettes;
+    u32 reserved;
+} json_index_header_t;
+
+typedef struct {
+    u64  byte_start;  // palette object, from its '{' to one past its '}'
+    u64  byte_end;
+    u64  color_hash;  // pal_hash_color_values64()
+    u32  range_hash;  // ftg_hash_fast() of the bytes in the range
+    u32  reserved;
+    char title[PAL_MAX_STRLEN];
+} json_index_entry_t;
+
+typedef struct {
+    json_index_header_t header;
+    json_index_entry_t* entries;
+    int                 capacity;
+} json_index_t;
+
+static bool
+stat_file(const char* path, u64* out_size, u64* out_mtime)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return false;
+
+    *out_size = (u64)st.st_size;
+    *out_mtime = (u64)st.st_mtime;
+    return true;
+}
+
+// json_palette_func_t that appends an entry for each palette
+static int
+index_palette(const pal_palette_t* pal,
+              int                  palette_index,
+              int64_t              byte_start,
+              int64_t              byte_end,
+              void*                palette_data)
+{
+    json_index_t* index = (json_index_t*)palette_data;
+    FTG_UNUSED(palette_index);
+
+    if ((int)index->header.num_palettes == index->capacity) {
+        index->capacity = index->capacity ? index->capacity * 2 : 64;
+        index->entries = (json_index_entry_t*)FTG_REALLOC(
+            index->entries, sizeof(json_index_entry_t), (size_t)index->capacity);
+    }
+
+    json_index_entry_t* entry = &index->entries[index->header.num_palettes++];
+    memset(entry, 0, sizeof(*entry));
+    entry->byte_start = (u64)byte_start;
+    entry->byte_end = (u64)byte_end;
+    entry->color_hash = pal_hash_color_values64(pal);
+    memcpy(entry->title, pal->title, PAL_MAX_STRLEN);
+
+    return 0;
+}
+
+static void
+free_json_index(json_index_t* index)
+{
+    if (index->entries)
+        FTG_FREE(index->entries);
+    memset(index, 0, sizeof(*index));
+}
+
+// parse the whole document, recording every palette, and write the index
+static void
+build_json_index(const char* json_path, const char* index_path, json_index_t* out_index)
+{
+    memset(out_index, 0, sizeof(*out_index));
+
+    if (!stat_file(json_path, &out_index->header.file_size, &out_index->header.file_mtime))
+        fatal(ftg_va("could not read '%s'", json_path));
+
+    ftg_off_t json_len;
+    u8*       json_bytes = ftg_file_read(json_path, false, &json_len);
+    if (json_bytes == NULL)
+        fatal(ftg_va("could not read '%s'", json_path));
+
+    pal_palette_t  scratch = {0};
+    mem_reader_t   reader = {(const char*)json_bytes, (size_t)json_len, 0};
+    char           error_message[PAL_MAX_STRLEN] = {0};
+    int64_t        error_location;
+
+    int result = parse_json_stream_palettes(
+        read_mem_chunk, &reader, &scratch, index_palette, out_index, error_message, &error_location);
+    pal_free(&scratch);
+    if (result != 0) {
+        fatal(ftg_va("Failed to parse json: '%s' at char offset %lld",
+                     error_message,
+                     (long long)error_location));
+    }
+
+    for (u32 i = 0; i < out_index->header.num_palettes; i++) {
+        json_index_entry_t* entry = &out_index->entries[i];
+        if (entry->byte_end - entry->byte_start > UINT32_MAX)
+            fatal(ftg_va("palette %u of '%s' is too large to index", i, json_path));
+
+        entry->range_hash = ftg_hash_fast(json_bytes + entry->byte_start,
+                                          (uint32_t)(entry->byte_end - entry->byte_start));
+    }
+    FTG_FREE(json_bytes);
+
+    out_index->header.magic = JSON_INDEX_MAGIC;
+    out_index->header.version = JSON_INDEX_VERSION;
+
+    size_t entries_bytes = sizeof(json_index_entry_t) * out_index->header.num_palettes;
+    size_t index_bytes = sizeof(json_index_header_t) + entries_bytes;
+    u8*    buf = (u8*)FTG_MALLOC(index_bytes, 1);
+    memcpy(buf, &out_index->header, sizeof(json_index_header_t));
+    if (entries_bytes)
+        memcpy(buf + sizeof(json_index_header_t), out_index->entries, entries_bytes);
+
+    // failing to write the cache is not fatal: the index is still used for this run
+    if (!write_file_replacing(index_path, buf, index_bytes))
+        print(LOG_WARNING, ftg_va("warning: could not write index '%s'", index_path));
+    else
+        print(LOG_MSG, ftg_va("wrote index '%s'", index_path));
+
+    FTG_FREE(buf);
+}
+
+// returns false if there is no index for the current document
+static bool
+load_json_index(const char* json_path, const char* index_path, json_index_t* out_index)
+{
+    memset(out_index, 0, sizeof(*out_index));
+
+    u64 file_size, file_mtime;
+    if (!stat_file(json_path, &file_size, &file_mtime))
+        return false;
+
+    ftg_off_t index_len;
+    u8*       index_bytes = ftg_file_read(index_path, false, &index_len);
+    if (index_bytes == NULL)
+        return false;
+
+    json_index_header_t header;
+    bool                valid = (size_t)index_len >= sizeof(json_index_header_t);
+    if (valid) {
+        memcpy(&header, index_bytes, sizeof(header));
+
+        valid = header.magic == JSON_INDEX_MAGIC && header.version == JSON_INDEX_VERSION &&
+                header.file_size == file_size && header.file_mtime == file_mtime &&
+                (size_t)index_len == sizeof(json_index_header_t) +
+                                         sizeof(json_index_entry_t) * header.num_palettes;
+    }
+
+    if (valid) {
+        out_index->header = header;
+        out_index->capacity = (int)header.num_palettes;
+        if (header.num_palettes) {
+            out_index->entries = (json_index_entry_t*)FTG_MALLOC(sizeof(json_index_entry_t),
+                                                                 header.num_palettes);
+            memcpy(out_index->entries,
+                   index_bytes + sizeof(json_index_header_t),
+                   sizeof(json_index_entry_t) * header.num_palettes);
+        }
+    }
+
+    FTG_FREE(index_bytes);
+    return valid;
+}
+
+// returns the entry selected by title if non-NULL, or by palette_index
+static const json_index_entry_t*
+find_json_index_entry(const json_index_t* index, int palette_index, const char* title)
+{
+    if (title) {
+        for (u32 i = 0; i < index->header.num_palettes; i++) {
+            if (palette_title_matches(index->entries[i].title, title))
+                return &index->entries[i];
+        }
+        return NULL;
+    }
+
+    if (palette_index < 0 || (u32)palette_index >= index->header.num_palettes)
+        return NULL;
+
+    return &index->entries[palette_index];
+}
+
+// parse the palette at entry's byte range on its own.  returns false
+// if the bytes no longer match the index: the range isn't in the
+// document, doesn't hold an object, doesn't hash to the recorded hash
+// or doesn't parse.
+static bool
+parse_indexed_palette(const char*               json_path,
+                      u64                       file_size,
+                      const json_index_entry_t* entry,
+                      pal_palette_t*            out_palette)
+{
+    static const char prefix[] = "{\"palettes\":[";
+    static const char suffix[] = "]}";
+    const size_t      prefix_len = sizeof(prefix) - 1;
+    const size_t      suffix_len = sizeof(suffix) - 1;
+
+    // build_json_index never records a range hash_fast can't cover
+    if (entry->byte_start >= entry->byte_end || entry->byte_end > file_size ||
+        entry->byte_end - entry->byte_start > UINT32_MAX)
+        return false;
+
+    size_t range_len = (size_t)(entry->byte_end - entry->byte_start);
+    char*  doc = (char*)FTG_MALLOC(prefix_len + range_len + suffix_len, 1);
+    if (doc == NULL)
+        fatal("out of memory");
+
+    FILE* fp = job_fopen(json_path, "rb");
+    if (fp == NULL)
+        fatal(ftg_va("could not read '%s'", json_path));
+
+    bool read_ok = ftg_fseek64(fp, (ftg_off_t)entry->byte_start, SEEK_SET) == 0 &&
+                   fread(doc + prefix_len, 1, range_len, fp) == range_len;
+    job_fclose(fp);
+
+    if (!read_ok || doc[prefix_len] != '{' || doc[prefix_len + range_len - 1] != '}' ||
+        ftg_hash_fast(doc + prefix_len, (uint32_t)range_len) != entry->range_hash) {
+        FTG_FREE(doc);
+        return false;
+    }
+
+    // wrap the palette object so it parses as a one-palette document
+    memcpy(doc, prefix, prefix_len);
+    memcpy(doc + prefix_len + range_len, suffix, suffix_len);
+
+    mem_reader_t reader = {doc, prefix_len + range_len + suffix_len, 0};
+    char         error_message[PAL_MAX_STRLEN] = {0};
+    int64_t      error_location;
+
+    int result = parse_json_stream_into_palettes(
+        read_mem_chunk, &reader, out_palette, 0, 1, error_message, &error_location);
+    FTG_FREE(doc);
+    if (result != 0) {
+        // the whole document parsed when it was indexed
+        pal_free(out_palette);
+        return false;
+    }
+
+    return true;
+}
+
+// select a palette through the sidecar index, creating or rebuilding
+// the index as needed
+static void
+read_json_palette_indexed(const char* json_path, pal_palette_t* out_palette)
+{
+    char index_path[FTG_STRLEN_LONG];
+    snprintf(index_path, sizeof(index_path), "%s.idx", json_path);
+
+    json_index_t index;
+    bool         fresh = false;
+    if (!load_json_index(json_path, index_path, &index)) {
+        build_json_index(json_path, index_path, &index);
+        fresh = true;
+    }
+
+    for (;;) {
+        const json_index_entry_t* entry =
+            find_json_index_entry(&index, args.json_palette_index, args.json_palette_title);
+        if (entry == NULL) {
+            if (args.json_palette_title)
+                fatal(ftg_va("no palette titled '%s' in '%s'", args.json_palette_title, json_path));
+            fatal(ftg_va("palette index %d out of range: '%s' has %u palettes",
+                         args.json_palette_index,
+                         json_path,
+                         index.header.num_palettes));
+        }
+
+        if (parse_indexed_palette(json_path, index.header.file_size, entry, out_palette))
+            break;
+
+        // document changed without changing size or mtime, or the index
+        // was damaged
+        if (fresh)
+            fatal(ftg_va("'%s' changed while it was being indexed", json_path));
+
+        free_json_index(&index);
+        build_json_index(json_path, index_path, &index);
+        fresh = true;
+    }
+
+    free_json_index(&index);
+}
+
+// json_palette_func_t that stops at the palette titled
+// args.json_palette_title, leaving it in the scratch palette
+static int
+stop_at_titled_palette(const pal_palette_t* pal,
+                       int                  palette_index,
+                       int64_t              byte_start,
+                       int64_t              byte_end,
+                       void*                palette_data)
+{
+    FTG_UNUSED(palette_index);
+    FTG_UNUSED(byte_start);
+    FTG_UNUSED(byte_end);
+
+    bool* found = (bool*)palette_data;
+    *found = palette_title_matches(pal->title, args.json_palette_title);
+
+    return *found;
 }
 
 void
@@ -196,17 +703,237 @@ name_empty_color_names(pal_palette_t* pal)
             continue;
 
         int trunc =
-            ftg_strncpy(pal->color_names[i], ftg_va("unnamed %d", i), PAL_MAX_COLORS);
+            ftg_strncpy(pal->color_names[i], ftg_va("unnamed %d", i), PAL_MAX_STRLEN);
         FTG_UNUSED(trunc);
     }
 }
 
-#define SORT_BASED_ON_NAME_IF_MATCH(n)                                              \
-    if (ftg_stricmp(sort_kind, #n) == 0) {                                          \
-        match_found = true;                                                         \
-        result |= pal_create_sorted_gradient(pal, "export_me", pal_##n##_cb, NULL); \
+// open the job's out_file, streaming writes to it through writer; no
+// upper bound on document size
+static FILE*
+open_output(pal_writer_t* writer)
+{
+    FILE* fp = job_fopen(current_job->out_file, "wb");
+    if (fp == NULL)
+        fatal(ftg_va("failed to open '%s' for writing", current_job->out_file));
+
+    pal_writer_init(writer, pal_write_to_file, fp);
+
+    return fp;
+}
+
+// close an output from open_output, failing on the emitter's result as
+// pal_write_palette_json returns it.  what names the format.
+static void
+close_output(FILE* fp, const pal_writer_t* writer, int result, const char* what)
+{
+    if (job_fclose(fp) != 0 && result == 0)
+        result = 1;
+
+    if (result == 2)
+        fatal(ftg_va("failed to generate %s", what));
+    else if (result != 0)
+        fatal(ftg_va("failed to write %s to '%s'", what, current_job->out_file));
+
+    print(LOG_MSG, ftg_va("wrote %llu bytes", writer->bytes_written));
+}
+
+static pal_json_layout_t
+json_layout(void)
+{
+    if (args.json_compact)
+        return PAL_JSON_LAYOUT_COMPACT;
+    else if (args.json_ndjson)
+        return PAL_JSON_LAYOUT_NDJSON;
+
+    return PAL_JSON_LAYOUT_PRETTY;
+}
+
+// write palettes to the job's out_file as one json document, rendering the
+// palettes in parallel when there are several
+static void
+write_json_palettes(const pal_compact_palette_t* const* palettes, int num_palettes)
+{
+    pal_writer_t writer;
+    FILE*        fp = open_output(&writer);
+
+    int result = pal_write_compact_palette_json(
+        &writer, palettes, num_palettes, json_layout(), current_job->emit_threads);
+    close_output(fp, &writer, result, "json palette");
+}
+
+// write a single palette to the job's out_file as a json document
+static void
+write_json_palette(const pal_palette_t* palette)
+{
+    pal_writer_t writer;
+    FILE*        fp = open_output(&writer);
+
+    int result = pal_write_palette_json_parallel(
+        &writer, palette, 1, json_layout(), current_job->emit_threads);
+    close_output(fp, &writer, result, "json palette");
+}
+
+// write palettes to the job's out_file as one .pala archive
+static void
+write_pala_palettes(const pal_compact_palette_t* const* palettes, int num_palettes)
+{
+    pal_writer_t writer;
+    FILE*        fp = open_output(&writer);
+
+    int result = pal_write_compact_pala(&writer, palettes, num_palettes);
+    close_output(fp, &writer, result, "palette archive");
+}
+
+// write a single palette to the job's out_file as a .pala archive
+static void
+write_pala_palette(const pal_palette_t* palette)
+{
+    pal_writer_t writer;
+    FILE*        fp = open_output(&writer);
+
+    int result = pal_write_pala(&writer, palette, 1);
+    close_output(fp, &writer, result, "palette archive");
+}
+
+// read a whole .pala into memory and open it; FTG_FREE the returned
+// bytes when done with the archive
+static u8*
+open_pala(const char* path, pal_pala_t* out_archive)
+{
+    ftg_off_t pala_len;
+    u8*       pala_bytes = ftg_file_read(path, false, &pala_len);
+    if (pala_bytes == NULL)
+        fatal(ftg_va("could not read '%s'", path));
+
+    if (pal_pala_open(pala_bytes, (pal_u64_t)pala_len, out_archive) != 0)
+        fatal(ftg_va("failed to parse '%s'", path));
+
+    return pala_bytes;
+}
+
+// pool may be NULL to keep the names inline
+static pal_compact_palette_t*
+create_compact_palette(const pal_palette_t* pal, pal_string_pool_t* pool)
+{
+    pal_compact_palette_t* compact = pal_compact_palette_create(pal, pool);
+    if (compact == NULL)
+        fatal("out of memory");
+
+    return compact;
+}
+
+// palettes held compact, each sized to its contents and with its
+// names interned into one pool for the document, so whole libraries
+// fit in memory
+typedef struct {
+    pal_compact_palette_t** palettes;
+    int                     num_palettes;
+    int                     capacity;
+    pal_string_pool_t       names;
+
+    pal_palette_t* scratch;  // each palette is read into this first
+    file_kind_t    out_kind;
+} palette_list_t;
+
+// prepare list->scratch for export and append a compact copy of it
+static void
+append_scratch_palette(palette_list_t* list)
+{
+    pal_palette_t* pal = list->scratch;
+
+    if (pal->num_colors == 0)
+        fatal(ftg_va("palette %d has 0 colors", list->num_palettes));
+
+    name_empty_color_names(pal);
+    if (list->out_kind == FILE_KIND_JSON_PALETTE)
+        add_full_palette_gradients(pal);
+
+    if (list->num_palettes == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 16;
+        list->palettes = (pal_compact_palette_t**)FTG_REALLOC(
+            list->palettes, sizeof(pal_compact_palette_t*), (size_t)list->capacity);
+    }
+
+    list->palettes[list->num_palettes++] = create_compact_palette(pal, &list->names);
+}
+
+// json_palette_func_t that appends each palette to a palette_list_t
+static int
+collect_palette(const pal_palette_t* pal,
+                int                  palette_index,
+                int64_t              byte_start,
+                int64_t              byte_end,
+                void*                palette_data)
+{
+    palette_list_t* list = (palette_list_t*)palette_data;
+    FTG_UNUSED(palette_index);
+    FTG_UNUSED(byte_start);
+    FTG_UNUSED(byte_end);
+
+    // the parser fills list->scratch, so it can be fixed up in place
+    FTG_ASSERT(pal == list->scratch);
+    FTG_UNUSED(pal);
+    append_scratch_palette(list);
+
+    return 0;
+}
+
+// --json-all-palettes: convert every palette in a json document or
+// palette archive into another json document or archive
+static void
+convert_all_palettes(file_kind_t in_kind, file_kind_t out_kind)
+{
+    pal_palette_t  scratch = {0};
+    palette_list_t list = {0};
+
+    list.scratch = &scratch;
+    list.out_kind = out_kind;
+
+    if (in_kind == FILE_KIND_PALA) {
+        pal_pala_t archive;
+        u8*        pala_bytes = open_pala(current_job->in_file, &archive);
+
+        for (u32 i = 0; i < archive.num_palettes; i++) {
+            if (pal_pala_load(&archive, i, &scratch) != 0)
+                fatal(ftg_va("failed to parse palette %u of '%s'", i, current_job->in_file));
+
+            append_scratch_palette(&list);
+        }
+        FTG_FREE(pala_bytes);
+    } else {
+        FILE* fp = job_fopen(current_job->in_file, "rb");
+        if (fp == NULL)
+            fatal(ftg_va("could not read '%s'", current_job->in_file));
+
+        char    error_message[PAL_MAX_STRLEN] = {0};
+        int64_t error_location;
+
+        int result = parse_json_stream_palettes(
+            read_file_chunk, fp, &scratch, collect_palette, &list, error_message, &error_location);
+        job_fclose(fp);
+        if (result != 0) {
+            fatal(ftg_va("Failed to parse json: '%s' at char offset %lld",
+                         error_message,
+                         (long long)error_location));
+        }
     }
 
+    const pal_compact_palette_t* const* palettes = (const pal_compact_palette_t* const*)list.palettes;
+
+    print(LOG_MSG, ftg_va("converting %d palettes", list.num_palettes));
+    if (out_kind == FILE_KIND_PALA)
+        write_pala_palettes(palettes, list.num_palettes);
+    else
+        write_json_palettes(palettes, list.num_palettes);
+
+    for (int i = 0; i < list.num_palettes; i++) pal_compact_palette_free(list.palettes[i]);
+    if (list.palettes)
+        FTG_FREE(list.palettes);
+    pal_string_pool_free(&list.names);
+    pal_free(&scratch);
+}
+
 pal_gradient_t*
 get_export_gradient_from_sort_kind(pal_palette_t* pal, const char* sort_kind)
 {
@@ -222,86 +949,36 @@ get_export_gradient_from_sort_kind(pal_palette_t* pal, const char* sort_kind)
         goto end;
     }
 
-    // this adds a gradient called "export me" in-place
-    int  result = 0;
-    bool match_found = false;
-    SORT_BASED_ON_NAME_IF_MATCH(red);
-    SORT_BASED_ON_NAME_IF_MATCH(green);
-    SORT_BASED_ON_NAME_IF_MATCH(blue);
-    SORT_BASED_ON_NAME_IF_MATCH(hue);
-    SORT_BASED_ON_NAME_IF_MATCH(saturation);
-    SORT_BASED_ON_NAME_IF_MATCH(value);
-    SORT_BASED_ON_NAME_IF_MATCH(lightness);
-    SORT_BASED_ON_NAME_IF_MATCH(redness);
-    SORT_BASED_ON_NAME_IF_MATCH(yellowness);
-    SORT_BASED_ON_NAME_IF_MATCH(greenness);
-    SORT_BASED_ON_NAME_IF_MATCH(cyanness);
-    SORT_BASED_ON_NAME_IF_MATCH(blueness);
-    SORT_BASED_ON_NAME_IF_MATCH(magentaness);
-    FTG_ASSERT(result == 0);
-    FTG_UNUSED(result);
+    // sort kinds are matched case-insensitively on the command line
+    pal_sort_kind_t kind = PAL_SORT_MAX;
+    for (int i = 0; i < PAL_SORT_MAX; i++) {
+        if (ftg_stricmp(sort_kind, pal_string_for_sort_kind((pal_sort_kind_t)i)) == 0)
+            kind = (pal_sort_kind_t)i;
+    }
 
-    if (match_found != true) {
+    if (kind == PAL_SORT_MAX) {
         fatal(ftg_va(
             "invalid sort kind '%s'.  Use --help to see all sort kinds", sort_kind));
     }
 
+    // this adds a gradient called "export me" in-place
+    pal_color_features_t features = {0};
+    if (pal_compute_color_features(pal, &features) != 0)
+        fatal("out of memory");
+
+    int result = pal_create_feature_sorted_gradient(pal, "export_me", &features, kind);
+    pal_color_features_free(&features);
+    FTG_ASSERT(result == 0);
+    FTG_UNUSED(result);
+
 end:
     return &pal->gradients[grad_idx];
 }
 
-int
-main(int argc, char* argv[])
+// convert the palette selected in the job's in_file to its out_file
+static void
+convert_palette(file_kind_t in_kind, file_kind_t out_kind)
 {
-    kgflags_string("in", NULL, "file to convert", true, &args.in_file);
-    kgflags_string("out", NULL, "file to export to (will overwrite)", true, &args.out_file);
-    kgflags_bool("verbose", false, "log verbosity", false, &args.verbose);
-    kgflags_string(
-        "sort-png",
-        NULL,
-        "when exporting as png, use a sort\n\t\t(supported: red, green, "
-        "blue, hue, saturation, value, lightness, redness, "
-        "yellowness, greenness, cyanness, blueness, magentaness)",
-        false,
-        &args.png_sort_kind);
-    kgflags_int(
-        "png-scale",
-        1,
-        "scale of the output png image (used for both width and height)",
-        false,
-        &args.png_scale);
-
-    kgflags_int("json-palette-index",
-                0,
-                "palette to parse in the json doc (starting from 0)",
-                false,
-                &args.json_palette_index);
-
-
-    if (!kgflags_parse(argc, argv)) {
-        print_header();
-        kgflags_print_errors();
-        kgflags_print_usage();
-        print_supported_kinds();
-        return 1;
-    }
-
-    if (args.help_supported) {
-        print_header();
-        print_supported_kinds();
-        return 0;
-    }
-
-    // validate args
-    if (args.png_scale < 1 || args.png_scale > 128) {
-        fatal("png-scale must be in range 1-128");
-    }
-
-    print(LOG_MSG, ftg_va("converting '%s' to '%s'\n", args.in_file, args.out_file));
-
-    file_kind_t in_kind = file_kind_for_extension(args.in_file);
-    file_kind_t out_kind = file_kind_for_extension(args.out_file);
-
     //
     // read palette
     pal_palette_t palette = {0};
@@ -309,42 +986,64 @@ main(int argc, char* argv[])
     switch (in_kind) {
     case FILE_KIND_ACO: {
         ftg_off_t aco_len;
-        u8*       aco_bytes = ftg_file_read(args.in_file, false, &aco_len);
+        u8*       aco_bytes = ftg_file_read(current_job->in_file, false, &aco_len);
         if (aco_bytes == NULL)
-            fatal(ftg_va("failed to read '%s'", args.in_file));
+            fatal(ftg_va("failed to read '%s'", current_job->in_file));
 
         int result = pal_parse_aco(aco_bytes, (unsigned int)aco_len, &palette, NULL);
         FTG_FREE(aco_bytes);
         if (result != 0) {
-            fatal(ftg_va("failed to parse '%s'", args.in_file));
+            fatal(ftg_va("failed to parse '%s'", current_job->in_file));
         }
     } break;
 
     case FILE_KIND_JSON_PALETTE: {
-        ftg_off_t json_strlen;
-        u8*       json_string = ftg_file_read(args.in_file, true, &json_strlen);
-        if (json_string == NULL)
-            fatal(ftg_va("could not read '%s'", args.in_file));
-
-        char error_message[PAL_MAX_STRLEN] = {0};
-        int  error_location;
-
-        int result = parse_json_into_palettes((char*)json_string,
-                                              json_strlen,
-                                              &palette,
-
-                                              args.json_palette_index,
-                                              1,
+        if (args.json_index) {
+            read_json_palette_indexed(current_job->in_file, &palette);
+        } else {
+            // stream the document so only the selected palette is parsed
+            FILE* fp = job_fopen(current_job->in_file, "rb");
+            if (fp == NULL)
+                fatal(ftg_va("could not read '%s'", current_job->in_file));
+
+            char    error_message[PAL_MAX_STRLEN] = {0};
+            int64_t error_location;
+            int     result;
+            bool    found = false;
+
+            if (args.json_palette_title) {
+                result = parse_json_stream_palettes(read_file_chunk,
+                                                    fp,
+                                                    &palette,
+                                                    stop_at_titled_palette,
+                                                    &found,
+
+                                                    error_message,
+                                                    &error_location);
+            } else {
+                result = parse_json_stream_into_palettes(read_file_chunk,
+                                                         fp,
+                                                         &palette,
+
+                                                         args.json_palette_index,
+                                                         1,
+
+                                                         error_message,
+                                                         &error_location);
+            }
+            job_fclose(fp);
+            if (result != 0) {
+                fatal(ftg_va("Failed to parse json: '%s' at char offset %lld",
+                             error_message,
+                             (long long)error_location));
+            }
 
-                                              error_message,
-                                              &error_location);
-        if (result != 0) {
-            fatal(ftg_va("Failed to parse json: '%s' at char offset %d",
-                         error_message,
-                         error_location));
+            if (args.json_palette_title && !found) {
+                fatal(ftg_va(
+                    "no palette titled '%s' in '%s'", args.json_palette_title, current_job->in_file));
+            }
         }
 
-        FTG_FREE(json_string);
         if (palette.num_colors == 0) {
             fatal("parsed palette has 0 colors");
         }
@@ -352,10 +1051,10 @@ main(int argc, char* argv[])
 
     case FILE_KIND_PNG: {
         int x, y, channels;
-        u8* png_bytes = stbi_load(args.in_file, &x, &y, &channels, 0);
+        u8* png_bytes = stbi_load(current_job->in_file, &x, &y, &channels, 0);
 
         if (!png_bytes) {
-            fatal(ftg_va("error loading '%s'", args.in_file));
+            fatal(ftg_va("error loading '%s'", current_job->in_file));
         }
         if (y != 1) {
             fatal(ftg_va("Expected to find a 1px-high png file, where every "
@@ -382,33 +1081,77 @@ main(int argc, char* argv[])
 
     case FILE_KIND_GIMP_GPL: {
         ftg_off_t gpl_strlen;
-        u8*       gpl_string = ftg_file_read(args.in_file, true, &gpl_strlen);
+        u8*       gpl_string = ftg_file_read(current_job->in_file, true, &gpl_strlen);
         if (gpl_string == NULL || gpl_strlen <= 1)
-            fatal(ftg_va("could not read '%s'", args.in_file));
+            fatal(ftg_va("could not read '%s'", current_job->in_file));
 
         int result =
             pal_parse_gpl(gpl_string, (unsigned int)gpl_strlen, &palette, NULL);
         FTG_FREE(gpl_string);
         if (result != 0) {
-            fatal(ftg_va("failed to parse '%s'", args.in_file));
+            fatal(ftg_va("failed to parse '%s'", current_job->in_file));
         }
 
     } break;
 
     case FILE_KIND_JASC: {
         ftg_off_t jasc_strlen;
-        u8*       jasc_string = ftg_file_read(args.in_file, true, &jasc_strlen);
+        u8*       jasc_string = ftg_file_read(current_job->in_file, true, &jasc_strlen);
         if (jasc_string == NULL || jasc_strlen <= 1)
-            fatal(ftg_va("could not read '%s", args.in_file));
+            fatal(ftg_va("could not read '%s", current_job->in_file));
 
         int result =
             pal_parse_jasc(jasc_string, (unsigned int)jasc_strlen, &palette, NULL);
         FTG_FREE(jasc_string);
         if (result != 0) {
-            fatal(ftg_va("failed to parse '%s'", args.in_file));
+            fatal(ftg_va("failed to parse '%s'", current_job->in_file));
+        }
+
+
+    } break;
+
+    case FILE_KIND_PALB: {
+        ftg_off_t palb_len;
+        u8*       palb_bytes = ftg_file_read(current_job->in_file, false, &palb_len);
+        if (palb_bytes == NULL)
+            fatal(ftg_va("could not read '%s'", current_job->in_file));
+
+        int result = pal_parse_palb(palb_bytes, (unsigned int)palb_len, &palette);
+        FTG_FREE(palb_bytes);
+        if (result != 0) {
+            fatal(ftg_va("failed to parse '%s'", current_job->in_file));
+        }
+    } break;
+
+    case FILE_KIND_PALA: {
+        // selected the same way as a palette in a json doc, through the
+        // archive's table of contents
+        pal_pala_t archive;
+        u8*        pala_bytes = open_pala(current_job->in_file, &archive);
+
+        int index = args.json_palette_index;
+        if (args.json_palette_title) {
+            index = pal_pala_find_title(&archive, args.json_palette_title);
+            if (index < 0) {
+                fatal(ftg_va(
+                    "no palette titled '%s' in '%s'", args.json_palette_title, current_job->in_file));
+            }
+        } else if (index < 0 || (u32)index >= archive.num_palettes) {
+            fatal(ftg_va("palette index %d out of range: '%s' has %u palettes",
+                         index,
+                         current_job->in_file,
+                         archive.num_palettes));
         }
 
+        int result = pal_pala_load(&archive, (u32)index, &palette);
+        FTG_FREE(pala_bytes);
+        if (result != 0) {
+            fatal(ftg_va("failed to parse '%s'", current_job->in_file));
+        }
 
+        if (palette.num_colors == 0) {
+            fatal("parsed palette has 0 colors");
+        }
     } break;
 
     default:
@@ -421,29 +1164,28 @@ main(int argc, char* argv[])
     // write file
     switch (out_kind) {
     case FILE_KIND_JSON_PALETTE: {
-        int result = add_full_palette_gradients(&palette);
-
-        usize output_buf_bytes = (1 << 19);
-        char* buf = FTG_MALLOC(sizeof(u8), output_buf_bytes);
-
-        result = pal_emit_palette_json(&palette, 1, buf, (int)output_buf_bytes);
-        if (result != 0)
-            fatal("failed to generate json palette");
-
-        result = ftg_file_write(args.out_file, (u8*)buf, strlen(buf));
-        if (result == 0)
-            fatal(ftg_va("failed to write json palette to '%s'", args.out_file));
-
-        FTG_FREE(buf);
-    } break;
+        add_full_palette_gradients(&palette);
+        write_json_palette(&palette);
+    } break;
 
     case FILE_KIND_PNG: {
+        // stb_image_write sizes its filter buffer, (stride + 1) * height,
+        // in an int
+        u64 image_width = (u64)palette.num_colors * (u64)args.png_scale;
+        u64 image_height = (u64)args.png_scale;
+        if ((image_width * 4 + 1) * image_height > (u64)INT_MAX)
+            fatal(ftg_va("a %llux%llu png is too large to write; lower png-scale",
+                         (unsigned long long)image_width,
+                         (unsigned long long)image_height));
+
         // create rgba color row from palette
-        int width = palette.num_colors * args.png_scale;
-        int height = args.png_scale;
+        int width = (int)image_width;
+        int height = (int)image_height;
         int stride = width * 4;
 
-        u8* image_data = FTG_MALLOC(sizeof(u8), stride * height);
+        u8* image_data = FTG_MALLOC(sizeof(u8), (size_t)stride * (size_t)height);
+        if (image_data == NULL)
+            fatal("out of memory");
         u8* p = image_data;
 
         pal_gradient_t* gradient =
@@ -461,40 +1203,1202 @@ main(int argc, char* argv[])
         }
 
         for (int y = 1; y < height; y++) {
-            memcpy(image_data + (stride * y), image_data, stride);
+            memcpy(image_data + (size_t)stride * (size_t)y, image_data, (size_t)stride);
         }
 
         int result =
-            stbi_write_png(args.out_file, width, height, 4, image_data, stride);
+            stbi_write_png(current_job->out_file, width, height, 4, image_data, stride);
         if (result == 0) {
-            fatal(ftg_va("failed to write png file to '%s'", args.out_file));
+            fatal(ftg_va("failed to write png file to '%s'", current_job->out_file));
         }
 
         FTG_FREE(image_data);
     } break;
 
     case FILE_KIND_GIMP_GPL: {
-        usize output_buf_bytes = (1 << 15);
-        char* buf = FTG_MALLOC(sizeof(u8), output_buf_bytes);
+        FILE* fp = job_fopen(current_job->out_file, "wb");
+        if (fp == NULL)
+            fatal(ftg_va("failed to open '%s' for writing", current_job->out_file));
+
+        pal_writer_t writer;
+        pal_writer_init(&writer, pal_write_to_file, fp);
+
+        int result = pal_write_gimp_gpl(&writer, &palette);
+        if (job_fclose(fp) != 0 && result == 0)
+            result = 1;
 
-        int result = pal_emit_gimp_gpl(&palette, buf, (int)output_buf_bytes);
         if (result != 0)
-            fatal("failed to generate gimp gpl palette");
+            fatal(ftg_va("failed to write gimp gpl palette to '%s'", current_job->out_file));
 
-        result = ftg_file_write(args.out_file, (u8*)buf, strlen(buf));
-        if (result == 0)
-            fatal(ftg_va("failed to write gimp gpl palette to '%s'", args.out_file));
+        print(LOG_MSG, ftg_va("wrote %llu bytes", writer.bytes_written));
+    } break;
+
+    case FILE_KIND_PALB: {
+        FILE* fp = job_fopen(current_job->out_file, "wb");
+        if (fp == NULL)
+            fatal(ftg_va("failed to open '%s' for writing", current_job->out_file));
+
+        pal_writer_t writer;
+        pal_writer_init(&writer, pal_write_to_file, fp);
 
+        int result = pal_write_palb(&writer, &palette);
+        if (job_fclose(fp) != 0 && result == 0)
+            result = 1;
 
-        FTG_FREE(buf);
+        if (result == 2)
+            fatal("failed to generate palb palette");
+        else if (result != 0)
+            fatal(ftg_va("failed to write palb palette to '%s'", current_job->out_file));
+
+        print(LOG_MSG, ftg_va("wrote %llu bytes", writer.bytes_written));
     } break;
 
+    case FILE_KIND_PALA:
+        write_pala_palette(&palette);
+        break;
+
     default:
         fatal("Unsupported output kind. Only json palette is currently "
               "supported");
     }
 
-    print(LOG_MSG, "success.");
+    pal_free(&palette);
+}
+
+//
+// build cache
+//
+// --cache-dir keeps a copy of every output, named by a hash of the
+// input's bytes, the input and output kinds and each option that can
+// change the output.  converting the same bytes the same way again
+// copies the cached output instead.  an output already holding those
+// bytes isn't rewritten, so its timestamp doesn't set off whatever
+// depends on it.
+//
+// outputs are copied rather than hard linked: the writers overwrite an
+// existing output in place, which would rewrite a linked entry too.
+
+// bump when any output changes for the same input and options
+#define BUILD_CACHE_VERSION 1
+
+// fnv-1a
+static u64
+cache_hash_bytes(u64 hash, const void* bytes, size_t len)
+{
+    const u8* p = (const u8*)bytes;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static u64
+cache_hash_int(u64 hash, int n)
+{
+    return cache_hash_bytes(hash, &n, sizeof(n));
+}
+
+static u64
+cache_hash_string(u64 hash, const char* str)
+{
+    // an unset option hashes differently from an empty one
+    hash = cache_hash_int(hash, str != NULL);
+    return str ? cache_hash_bytes(hash, str, strlen(str)) : hash;
+}
+
+// the cache entry for converting in_bytes with the current options
+static void
+build_cache_path(const u8*   in_bytes,
+                 size_t      in_len,
+                 file_kind_t in_kind,
+                 file_kind_t out_kind,
+                 char*       out_path,
+                 size_t      out_path_len)
+{
+    u64 key = 0xcbf29ce484222325ULL;
+
+    key = cache_hash_int(key, BUILD_CACHE_VERSION);
+    key = cache_hash_int(key, in_kind);
+    key = cache_hash_int(key, out_kind);
+    key = cache_hash_string(key, args.png_sort_kind);
+    key = cache_hash_int(key, args.png_scale);
+    key = cache_hash_int(key, args.json_palette_index);
+    key = cache_hash_string(key, args.json_palette_title);
+    key = cache_hash_int(key, args.json_compact);
+    key = cache_hash_int(key, args.json_ndjson);
+    key = cache_hash_int(key, args.json_all_palettes);
+    key = cache_hash_bytes(key, in_bytes, in_len);
+
+    snprintf(out_path,
+             out_path_len,
+             "%s/%016llx.%s",
+             args.cache_dir,
+             (unsigned long long)key,
+             ftg_get_filename_ext(current_job->out_file));
+}
+
+// the cache entry for the job's input as it is on disk now, or false
+// if it can't be read
+static bool
+input_cache_path(file_kind_t in_kind, file_kind_t out_kind, char* out_path, size_t out_path_len)
+{
+    ftg_off_t in_len;
+    u8*       in_bytes = ftg_file_read(current_job->in_file, false, &in_len);
+    if (in_bytes == NULL)
+        return false;
+
+    build_cache_path(in_bytes, (size_t)in_len, in_kind, out_kind, out_path, out_path_len);
+    FTG_FREE(in_bytes);
+
+    return true;
+}
+
+// copy the cached output for the job's input to its out_file.  on a
+// miss, returns false with the entry to store the output as in
+// cache_path, or an empty cache_path if the input can't be read.
+static bool
+fetch_cached_output(file_kind_t in_kind,
+                    file_kind_t out_kind,
+                    char*       cache_path,
+                    size_t      cache_path_len)
+{
+    cache_path[0] = '\0';
+
+    // failing to read the input is reported by the conversion
+    if (!input_cache_path(in_kind, out_kind, cache_path, cache_path_len))
+        return false;
+
+    ftg_off_t cached_len;
+    u8*       cached_bytes = ftg_file_read(cache_path, false, &cached_len);
+    if (cached_bytes == NULL)
+        return false;
+
+    ftg_off_t out_len;
+    u8*       out_bytes = ftg_file_read(current_job->out_file, false, &out_len);
+    bool      up_to_date = out_bytes != NULL && out_len == cached_len &&
+                           memcmp(out_bytes, cached_bytes, (size_t)cached_len) == 0;
+    if (out_bytes)
+        FTG_FREE(out_bytes);
+
+    if (!up_to_date &&
+        !ftg_file_write(current_job->out_file, cached_bytes, (size_t)cached_len))
+        fatal(ftg_va("failed to write '%s'", current_job->out_file));
+
+    FTG_FREE(cached_bytes);
+
+    if (up_to_date)
+        print(LOG_MSG, ftg_va("'%s' is up to date in the cache", current_job->out_file));
+    else
+        print(LOG_MSG, ftg_va("copied '%s' from the cache", current_job->out_file));
+
+    return true;
+}
+
+// add the job's freshly written out_file to the cache.  the entry is
+// written with write_file_replacing, so a palettetool converting the
+// same input never reads half an entry.
+//
+// the conversion reads the input again after cache_path was hashed
+// from it, so the input is hashed once more here: if it changed in
+// between, the output may be of either version and isn't stored.
+static void
+store_cached_output(file_kind_t in_kind, file_kind_t out_kind, const char* cache_path)
+{
+    char converted_path[FTG_STRLEN_LONG];
+    if (!input_cache_path(in_kind, out_kind, converted_path, sizeof(converted_path)) ||
+        strcmp(converted_path, cache_path) != 0) {
+        print(LOG_WARNING,
+              ftg_va("warning: '%s' changed while converting; not caching it",
+                     current_job->in_file));
+        return;
+    }
+
+    ftg_off_t out_len;
+    u8*       out_bytes = ftg_file_read(current_job->out_file, false, &out_len);
+    if (out_bytes == NULL)
+        return;
+
+    // failing to write the cache is not fatal: the output is written
+    bool stored = write_file_replacing(cache_path, out_bytes, (size_t)out_len);
+    FTG_FREE(out_bytes);
+
+    if (!stored)
+        print(LOG_WARNING, ftg_va("warning: could not write cache entry '%s'", cache_path));
+}
+
+// convert the current job's in_file to its out_file
+static void
+convert_file(void)
+{
+    print(LOG_MSG, ftg_va("converting '%s' to '%s'\n", current_job->in_file, current_job->out_file));
+
+    file_kind_t in_kind = file_kind_for_extension(current_job->in_file);
+    file_kind_t out_kind = file_kind_for_extension(current_job->out_file);
+
+    if (args.json_all_palettes) {
+        if ((in_kind != FILE_KIND_JSON_PALETTE && in_kind != FILE_KIND_PALA) ||
+            (out_kind != FILE_KIND_JSON_PALETTE && out_kind != FILE_KIND_PALA))
+            fatal("json-all-palettes converts between json docs and palette archives");
+        if (args.json_index || args.json_palette_title)
+            fatal("json-all-palettes can't be combined with a palette selection");
+    }
+
+    char cache_path[FTG_STRLEN_LONG] = {0};
+    if (args.cache_dir &&
+        fetch_cached_output(in_kind, out_kind, cache_path, sizeof(cache_path)))
+        return;
+
+    if (args.json_all_palettes)
+        convert_all_palettes(in_kind, out_kind);
+    else
+        convert_palette(in_kind, out_kind);
+
+    if (cache_path[0])
+        store_cached_output(in_kind, out_kind, cache_path);
+}
+
+//
+// batch conversion
+//
+// every --in is paired with the --out in the same position, and
+// --batch reads more pairs from a manifest.  an input that is a
+// directory converts each supported file in it, with {name} in its
+// output replaced by the file's name without its extension.
+//
+// entries convert on worker threads taking from a work-stealing
+// queue.  each worker resets its job arena between entries so each
+// reuses the last one's memory.  a failed entry is reported and the
+// batch moves on.
+
+typedef struct {
+    char* in_file;
+    char* out_file;
+} batch_entry_t;
+
+typedef struct {
+    batch_entry_t* entries;
+    int            num_entries;
+    int            capacity;
+} batch_t;
+
+static void
+add_batch_file(batch_t* batch, const char* in_file, const char* out_file)
+{
+    if (batch->num_entries == batch->capacity) {
+        batch->capacity = batch->capacity ? batch->capacity * 2 : 16;
+        batch->entries = (batch_entry_t*)FTG_REALLOC(
+            batch->entries, sizeof(batch_entry_t), (size_t)batch->capacity);
+    }
+
+    batch_entry_t* entry = &batch->entries[batch->num_entries++];
+    entry->in_file = ftg_strcatall(1, in_file);
+    entry->out_file = ftg_strcatall(1, out_file);
+}
+
+static bool
+is_supported_input(file_kind_t kind)
+{
+    for (const file_kind_t* k = SUPPORTED_INPUT_FORMATS; *k; k++) {
+        if (*k == kind)
+            return true;
+    }
+
+    return false;
+}
+
+static int
+compare_batch_entries(const void* a, const void* b)
+{
+    return strcmp(((const batch_entry_t*)a)->in_file, ((const batch_entry_t*)b)->in_file);
+}
+
+// copy out_pattern to out, replacing each {name} with name
+static void
+expand_out_pattern(const char* out_pattern, const char* name, size_t name_len, char* out, size_t out_len)
+{
+    static const char placeholder[] = "{name}";
+    const size_t      placeholder_len = sizeof(placeholder) - 1;
+    size_t            len = 0;
+
+    for (const char* p = out_pattern; *p;) {
+        const char* src = p;
+        size_t      n = 1;
+        if (strncmp(p, placeholder, placeholder_len) == 0) {
+            src = name;
+            n = name_len;
+        }
+
+        if (len + n >= out_len)
+            fatal(ftg_va("output path for '%.*s' is too long", (int)name_len, name));
+        memcpy(out + len, src, n);
+        len += n;
+        p += src == name ? placeholder_len : 1;
+    }
+
+    out[len] = '\0';
+}
+
+static void
+add_batch_directory(batch_t* batch, const char* dir, const char* out_pattern)
+{
+    if (strstr(out_pattern, "{name}") == NULL)
+        fatal(ftg_va("'%s' is a directory, so its output '%s' needs a {name}", dir, out_pattern));
+
+    int             first = batch->num_entries;
+    ftg_dirhandle_t handle;
+    char            name[FTG_STRLEN];
+    char            in_file[FTG_STRLEN_LONG];
+    char            out_file[FTG_STRLEN_LONG];
+
+    for (ftg_opendir(&handle, dir, name, sizeof(name)); name[0];
+         ftg_readdir(&handle, name, sizeof(name))) {
+        if (!is_supported_input(file_kind_for_extension(name)))
+            continue;
+
+        snprintf(in_file, sizeof(in_file), "%s/%s", dir, name);
+        if (ftg_is_dir(in_file))
+            continue;
+
+        const char* ext = ftg_get_filename_ext(name);
+        expand_out_pattern(out_pattern, name, (size_t)(ext - 1 - name), out_file, sizeof(out_file));
+        add_batch_file(batch, in_file, out_file);
+    }
+    ftg_closedir(&handle);
+
+    // directory order is arbitrary
+    qsort(batch->entries + first,
+          (size_t)(batch->num_entries - first),
+          sizeof(batch_entry_t),
+          compare_batch_entries);
+}
+
+static void
+add_batch_entry(batch_t* batch, const char* in_file, const char* out_file)
+{
+    if (ftg_is_dir(in_file))
+        add_batch_directory(batch, in_file, out_file);
+    else
+        add_batch_file(batch, in_file, out_file);
+}
+
+// one manifest field: a path in double quotes, or up to the next
+// whitespace.  returns the number of chars written to out, or -1.
+static int
+read_manifest_field(const char** p, char* out, size_t out_len)
+{
+    const char* start = *p;
+    const char* end;
+
+    if (*start == '"') {
+        start++;
+        end = strchr(start, '"');
+        if (end == NULL || memchr(start, '\n', (size_t)(end - start)))
+            return -1;
+        *p = end + 1;
+    } else {
+        end = start;
+        while (*end && *end != ' ' && *end != '\t' && *end != '\r' && *end != '\n') end++;
+        *p = end;
+    }
+
+    if (end == start || (size_t)(end - start) >= out_len)
+        return -1;
+
+    memcpy(out, start, (size_t)(end - start));
+    out[end - start] = '\0';
+
+    return (int)(end - start);
+}
+
+// a manifest holds an input and an output path per line, separated by
+// whitespace.  blank lines and lines starting with '#' are skipped.
+static void
+add_batch_manifest(batch_t* batch, const char* manifest_path)
+{
+    ftg_off_t manifest_len;
+    char*     manifest = (char*)ftg_file_read(manifest_path, true, &manifest_len);
+    if (manifest == NULL)
+        fatal(ftg_va("could not read '%s'", manifest_path));
+
+    char in_file[FTG_STRLEN_LONG];
+    char out_file[FTG_STRLEN_LONG];
+    int  line = 1;
+
+    for (const char* p = manifest; *p; line++) {
+        while (*p == ' ' || *p == '\t') p++;
+
+        if (*p != '#' && *p != '\r' && *p != '\n' && *p) {
+            bool ok = read_manifest_field(&p, in_file, sizeof(in_file)) > 0;
+            while (ok && (*p == ' ' || *p == '\t')) p++;
+            ok = ok && read_manifest_field(&p, out_file, sizeof(out_file)) > 0;
+            while (ok && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+
+            if (!ok || (*p && *p != '\n'))
+                fatal(ftg_va("%s:%d: expected an input and an output path", manifest_path, line));
+
+            add_batch_entry(batch, in_file, out_file);
+        }
+
+        while (*p && *p != '\n') p++;
+        if (*p)
+            p++;
+    }
+
+    FTG_FREE(manifest);
+}
+
+static int
+compare_out_files(const void* a, const void* b)
+{
+    return strcmp((*(const batch_entry_t* const*)a)->out_file,
+                  (*(const batch_entry_t* const*)b)->out_file);
+}
+
+// two entries writing the same file would silently lose one of them
+static void
+check_batch_outputs(const batch_t* batch)
+{
+    const batch_entry_t** sorted =
+        (const batch_entry_t**)FTG_MALLOC(sizeof(batch_entry_t*), (size_t)batch->num_entries);
+
+    for (int i = 0; i < batch->num_entries; i++) sorted[i] = &batch->entries[i];
+    qsort(sorted, (size_t)batch->num_entries, sizeof(batch_entry_t*), compare_out_files);
+
+    for (int i = 1; i < batch->num_entries; i++) {
+        if (strcmp(sorted[i - 1]->out_file, sorted[i]->out_file) == 0) {
+            fatal(ftg_va("'%s' and '%s' both convert to '%s'",
+                         sorted[i - 1]->in_file,
+                         sorted[i]->in_file,
+                         sorted[i]->out_file));
+        }
+    }
+
+    FTG_FREE(sorted);
+}
+
+static void
+free_batch(batch_t* batch)
+{
+    for (int i = 0; i < batch->num_entries; i++) {
+        FTG_FREE(batch->entries[i].in_file);
+        FTG_FREE(batch->entries[i].out_file);
+    }
+    if (batch->entries)
+        FTG_FREE(batch->entries);
+    memset(batch, 0, sizeof(*batch));
+}
+
+// returns false if the entry failed, having reported why
+static bool
+convert_batch_entry(const batch_entry_t* entry, int emit_threads)
+{
+    jmp_buf failed;
+    job_t   job = {entry->in_file, entry->out_file, emit_threads, &failed, {0}};
+
+    current_job = &job;
+    if (setjmp(failed) != 0) {
+        job_close_files(current_job);
+        current_job = NULL;
+        return false;
+    }
+
+    convert_file();
+    current_job = NULL;
+
+    return true;
+}
+
+typedef struct {
+    const batch_t* batch;
+    int*           order;  // entries by input size, largest first
+    job_queue_t    queue;
+    int            emit_threads;
+    int*           num_failed;  // per worker
+} batch_run_t;
+
+typedef struct {
+    int index;
+    u64 size;
+} batch_size_t;
+
+static int
+compare_batch_sizes(const void* a, const void* b)
+{
+    const batch_size_t* sa = (const batch_size_t*)a;
+    const batch_size_t* sb = (const batch_size_t*)b;
+
+    if (sa->size != sb->size)
+        return sa->size < sb->size ? 1 : -1;
+    return sa->index - sb->index;
+}
+
+// order the batch largest input first, so the longest conversions
+// start first and the smallest are left to even out the finish
+static int*
+order_batch_by_size(const batch_t* batch)
+{
+    batch_size_t* sizes = (batch_size_t*)FTG_MALLOC(sizeof(batch_size_t), batch->num_entries);
+    int*          order = (int*)FTG_MALLOC(sizeof(int), batch->num_entries);
+
+    for (int i = 0; i < batch->num_entries; i++) {
+        u64 mtime;
+        sizes[i].index = i;
+        if (!stat_file(batch->entries[i].in_file, &sizes[i].size, &mtime))
+            sizes[i].size = 0;
+    }
+    qsort(sizes, (size_t)batch->num_entries, sizeof(batch_size_t), compare_batch_sizes);
+
+    for (int i = 0; i < batch->num_entries; i++) order[i] = sizes[i].index;
+    FTG_FREE(sizes);
+
+    return order;
+}
+
+// job_worker_func_t converting batch entries until the queue is empty
+static void
+run_batch_worker(int worker, void* data)
+{
+    batch_run_t* run = (batch_run_t*)data;
+    job_arena_t  job_arena;
+    int          item;
+
+    if (!job_arena_init(&job_arena, JOB_ARENA_INITIAL_SIZE))
+        fatal("out of memory");
+
+    while (job_queue_take(&run->queue, worker, &item)) {
+        job_arena_make_current(&job_arena);
+        if (!convert_batch_entry(&run->batch->entries[run->order[item]], run->emit_threads))
+            run->num_failed[worker]++;
+
+        job_arena_make_current(NULL);
+        job_arena_reset(&job_arena);
+    }
+
+    job_arena_release(&job_arena);
+}
+
+// returns the number of entries that failed
+static int
+run_batch(const batch_t* batch)
+{
+    int num_workers = args.threads > 0 ? args.threads : job_num_cpus();
+    if (num_workers > batch->num_entries)
+        num_workers = batch->num_entries;
+
+    batch_run_t run = {0};
+    run.batch = batch;
+    run.order = order_batch_by_size(batch);
+    run.num_failed = (int*)FTG_MALLOC(sizeof(int), num_workers);
+    memset(run.num_failed, 0, sizeof(int) * (size_t)num_workers);
+
+    // with every core converting files, a document's palettes render
+    // on its own worker rather than fanning out again
+    run.emit_threads = num_workers > 1 ? 1 : 0;
+
+    if (!job_queue_init(&run.queue, batch->num_entries, num_workers))
+        fatal("out of memory");
+
+    job_run_workers(num_workers, run_batch_worker, &run);
+
+    int num_failed = 0;
+    for (int w = 0; w < num_workers; w++) num_failed += run.num_failed[w];
+
+    job_queue_release(&run.queue);
+    FTG_FREE(run.num_failed);
+    FTG_FREE(run.order);
+
+    return num_failed;
+}
+
+//
+// Test suite
+//
+// To run tests:  include ftg_test.h and define FTGT_TESTS_ENABLED, then
+// include this file with main renamed (#define main palettetool_main).
+// Call palettetool_decl_suite(), then ftgt_run_all_tests(NULL).  Tests
+// write their files under PALETTETOOL_TEST_DIR.
+//
+#ifdef FTGT_TESTS_ENABLED
+
+#    ifndef PALETTETOOL_TEST_DIR
+#        define PALETTETOOL_TEST_DIR "test/scratch"
+#    endif
+
+static int
+tool__test_setup(void)
+{
+    memset(&args, 0, sizeof(args));
+    ftg_mkalldirs(PALETTETOOL_TEST_DIR);
+
+    return ftg_is_dir(PALETTETOOL_TEST_DIR) ? 0 : 1; /* setup success */
+}
 
+static int
+tool__test_teardown(void)
+{
+    current_job = NULL;
     return 0;
 }
+
+static void
+tool__test_path(const char* name, char* out_path, size_t out_path_len)
+{
+    snprintf(out_path, out_path_len, "%s/%s", PALETTETOOL_TEST_DIR, name);
+}
+
+// write index as build_json_index does, so a test can damage it
+static bool
+tool__test_write_index(const char* index_path, const json_index_t* index)
+{
+    FILE* fp = fopen(index_path, "wb");
+    if (fp == NULL)
+        return false;
+
+    bool ok = fwrite(&index->header, sizeof(index->header), 1, fp) == 1 &&
+              fwrite(index->entries, sizeof(json_index_entry_t), index->header.num_palettes, fp) ==
+                  index->header.num_palettes;
+
+    return fclose(fp) == 0 && ok;
+}
+
+static int
+tool__test_json_index_rebuilds_stale_entries(void)
+{
+    static const char doc[] =
+        "{\"palettes\":["
+        "{\"title\":\"one\",\"colors\":["
+        "{\"name\":\"r\",\"red\":1.0,\"green\":0.0,\"blue\":0.0,\"alpha\":1.0}]},"
+        "{\"title\":\"two\",\"colors\":["
+        "{\"name\":\"g\",\"red\":0.0,\"green\":1.0,\"blue\":0.0,\"alpha\":1.0},"
+        "{\"name\":\"b\",\"red\":0.0,\"green\":0.0,\"blue\":1.0,\"alpha\":1.0}]}]}";
+    static const char edited_doc[] =
+        "{\"palettes\":["
+        "{\"title\":\"first\",\"colors\":["
+        "{\"name\":\"r\",\"red\":1.0,\"green\":0.0,\"blue\":0.0,\"alpha\":1.0},"
+        "{\"name\":\"k\",\"red\":0.0,\"green\":0.0,\"blue\":0.0,\"alpha\":1.0}]},"
+        "{\"title\":\"TWO\",\"colors\":["
+        "{\"name\":\"w\",\"red\":1.0,\"green\":1.0,\"blue\":1.0,\"alpha\":1.0}]}]}";
+
+    char json_path[FTG_STRLEN];
+    char index_path[FTG_STRLEN_LONG];
+    tool__test_path("index.json", json_path, sizeof(json_path));
+    snprintf(index_path, sizeof(index_path), "%s.idx", json_path);
+    remove(index_path);
+
+    job_t job = {json_path, NULL, 1, NULL, {0}};
+    current_job = &job;
+
+    pal_palette_t pal;
+    json_index_t  index;
+    args.json_palette_index = 1;
+
+    // no index yet: one is built and written
+    FTGT_ASSERT(ftg_file_write_string(json_path, doc));
+    pal_init(&pal);
+    read_json_palette_indexed(json_path, &pal);
+    FTGT_ASSERT(strcmp(pal.title, "two") == 0 && pal.num_colors == 2);
+    pal_free(&pal);
+
+    FTGT_ASSERT(load_json_index(json_path, index_path, &index));
+    FTGT_ASSERT(index.header.num_palettes == 2);
+    free_json_index(&index);
+
+    // a document of another size makes the whole index stale
+    FTGT_ASSERT(ftg_file_write_string(json_path, edited_doc));
+    FTGT_ASSERT(!load_json_index(json_path, index_path, &index));
+    pal_init(&pal);
+    read_json_palette_indexed(json_path, &pal);
+    FTGT_ASSERT(strcmp(pal.title, "TWO") == 0 && pal.num_colors == 1);
+    pal_free(&pal);
+
+    // a damaged entry is caught by its range hash and the index rebuilt
+    FTGT_ASSERT(load_json_index(json_path, index_path, &index));
+    u32 range_hash = index.entries[1].range_hash;
+    index.entries[1].range_hash ^= 1;
+    FTGT_ASSERT(tool__test_write_index(index_path, &index));
+    free_json_index(&index);
+
+    pal_init(&pal);
+    read_json_palette_indexed(json_path, &pal);
+    FTGT_ASSERT(strcmp(pal.title, "TWO") == 0);
+    pal_free(&pal);
+
+    FTGT_ASSERT(load_json_index(json_path, index_path, &index));
+    FTGT_ASSERT(index.entries[1].range_hash == range_hash);
+
+    // as is an entry reaching past the end of the document
+    index.entries[1].byte_end = index.header.file_size + 1;
+    FTGT_ASSERT(tool__test_write_index(index_path, &index));
+    free_json_index(&index);
+
+    pal_init(&pal);
+    read_json_palette_indexed(json_path, &pal);
+    FTGT_ASSERT(strcmp(pal.title, "TWO") == 0);
+    pal_free(&pal);
+
+    // the document changed without its size or mtime changing: the
+    // header checks out, but the entries point into the old bytes
+    FTGT_ASSERT(load_json_index(json_path, index_path, &index));
+    FTGT_ASSERT(ftg_file_write_string(json_path, doc));
+    FTGT_ASSERT(stat_file(json_path, &index.header.file_size, &index.header.file_mtime));
+    FTGT_ASSERT(tool__test_write_index(index_path, &index));
+    free_json_index(&index);
+
+    pal_init(&pal);
+    read_json_palette_indexed(json_path, &pal);
+    FTGT_ASSERT(strcmp(pal.title, "two") == 0 && pal.num_colors == 2);
+    pal_free(&pal);
+
+    FTGT_ASSERT(load_json_index(json_path, index_path, &index));
+    FTGT_ASSERT(strcmp(index.entries[1].title, "two") == 0);
+    free_json_index(&index);
+
+    remove(index_path);
+    remove(json_path);
+
+    return ftgt_test_errorlevel();
+}
+
+// read a manifest, or an --in and --out pair, into a batch as main()
+// does.  returns true if that failed, with fatal() failing a job
+// rather than exiting; everything read is freed with the job arena.
+static bool
+tool__test_batch_fails(const char* manifest_path, const char* in_file, const char* out_file)
+{
+    jmp_buf       failed;
+    job_t         job = {manifest_path ? manifest_path : in_file, NULL, 1, &failed, {0}};
+    job_arena_t   job_arena;
+    batch_t       batch = {0};
+    volatile bool did_fail = true;
+
+    if (!job_arena_init(&job_arena, JOB_ARENA_INITIAL_SIZE))
+        return false;
+
+    job_arena_make_current(&job_arena);
+    current_job = &job;
+    if (setjmp(failed) == 0) {
+        if (manifest_path)
+            add_batch_manifest(&batch, manifest_path);
+        else
+            add_batch_entry(&batch, in_file, out_file);
+        check_batch_outputs(&batch);
+        did_fail = false;
+    }
+    current_job = NULL;
+
+    job_arena_make_current(NULL);
+    job_arena_release(&job_arena);
+
+    return did_fail;
+}
+
+static bool
+tool__test_batch_entry_is(const batch_t* batch, int i, const char* in_file, const char* out_file)
+{
+    return i < batch->num_entries && strcmp(batch->entries[i].in_file, in_file) == 0 &&
+           strcmp(batch->entries[i].out_file, out_file) == 0;
+}
+
+static int
+tool__test_batch_manifest_parses_lines(void)
+{
+    static const char manifest[] = "# palettes to convert\n"
+                                   "\n"
+                                   "   a.json   out/a.png\n"
+                                   "\t\"with space.gpl\"\t\"out dir/b.json\"\r\n"
+                                   "  # indented comment\n"
+                                   "c.pal out/c.gpl   \n"
+                                   "\r\n"
+                                   "d.aco out/d.gpl";
+
+    char manifest_path[FTG_STRLEN_LONG];
+    tool__test_path("manifest.txt", manifest_path, sizeof(manifest_path));
+
+    FTGT_ASSERT(ftg_file_write_string(manifest_path, manifest));
+
+    batch_t batch = {0};
+    add_batch_manifest(&batch, manifest_path);
+    FTGT_ASSERT(batch.num_entries == 4);
+    FTGT_ASSERT(tool__test_batch_entry_is(&batch, 0, "a.json", "out/a.png"));
+    FTGT_ASSERT(tool__test_batch_entry_is(&batch, 1, "with space.gpl", "out dir/b.json"));
+    FTGT_ASSERT(tool__test_batch_entry_is(&batch, 2, "c.pal", "out/c.gpl"));
+    FTGT_ASSERT(tool__test_batch_entry_is(&batch, 3, "d.aco", "out/d.gpl"));
+    free_batch(&batch);
+
+    // every line needs exactly an input and an output
+    static const char* bad_manifests[] = {
+        "a.json\n",
+        "a.json out/a.png extra\n",
+        "\"a.json out/a.png\n",
+        "\"a.json\n\" out/a.png\n",
+        "\"\" out/a.png\n",
+        "a.json out/a.png\nb.json\n",
+        "a.json out/same.png\nb.json out/same.png\n",
+    };
+    for (size_t i = 0; i < sizeof(bad_manifests) / sizeof(bad_manifests[0]); i++) {
+        FTGT_ASSERT(ftg_file_write_string(manifest_path, bad_manifests[i]));
+        FTGT_ASSERT(tool__test_batch_fails(manifest_path, NULL, NULL));
+    }
+
+    remove(manifest_path);
+    FTGT_ASSERT(tool__test_batch_fails(manifest_path, NULL, NULL));
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+tool__test_batch_directory_expands_names(void)
+{
+    static const char* names[] = {"b.gpl", "a.json", "notes.txt", "README"};
+    const int          num_names = (int)(sizeof(names) / sizeof(names[0]));
+
+    char dir[FTG_STRLEN];
+    char path[FTG_STRLEN_LONG];
+    char expected_in[FTG_STRLEN_LONG];
+    tool__test_path("batch_dir", dir, sizeof(dir));
+
+    // a directory named like a supported file is not an input
+    snprintf(path, sizeof(path), "%s/sub.json", dir);
+    ftg_mkalldirs(path);
+    for (int i = 0; i < num_names; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        FTGT_ASSERT(ftg_file_write_string(path, "x"));
+    }
+
+    // supported files only, in name order, with every {name} replaced
+    batch_t batch = {0};
+    add_batch_entry(&batch, dir, "out/{name}/{name}.png");
+    FTGT_ASSERT(batch.num_entries == 2);
+    snprintf(expected_in, sizeof(expected_in), "%s/a.json", dir);
+    FTGT_ASSERT(tool__test_batch_entry_is(&batch, 0, expected_in, "out/a/a.png"));
+    snprintf(expected_in, sizeof(expected_in), "%s/b.gpl", dir);
+    FTGT_ASSERT(tool__test_batch_entry_is(&batch, 1, expected_in, "out/b/b.png"));
+
+    // a manifest line naming the directory expands the same way
+    char manifest_path[FTG_STRLEN_LONG];
+    tool__test_path("dir_manifest.txt", manifest_path, sizeof(manifest_path));
+    FTGT_ASSERT(ftg_file_write_string(manifest_path, ftg_va("c.pal c.gpl\n%s {name}.gpl\n", dir)));
+
+    add_batch_manifest(&batch, manifest_path);
+    FTGT_ASSERT(batch.num_entries == 5);
+    FTGT_ASSERT(tool__test_batch_entry_is(&batch, 2, "c.pal", "c.gpl"));
+    snprintf(expected_in, sizeof(expected_in), "%s/a.json", dir);
+    FTGT_ASSERT(tool__test_batch_entry_is(&batch, 3, expected_in, "a.gpl"));
+    snprintf(expected_in, sizeof(expected_in), "%s/b.gpl", dir);
+    FTGT_ASSERT(tool__test_batch_entry_is(&batch, 4, expected_in, "b.gpl"));
+    free_batch(&batch);
+
+    // without a {name} every file would convert to the same output
+    FTGT_ASSERT(tool__test_batch_fails(NULL, dir, "out/all.png"));
+    FTGT_ASSERT(!tool__test_batch_fails(NULL, dir, "out/{name}.png"));
+
+    remove(manifest_path);
+    for (int i = 0; i < num_names; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+        remove(path);
+    }
+
+    return ftgt_test_errorlevel();
+}
+
+// whether path holds exactly str
+static bool
+tool__test_file_is(const char* path, const char* str)
+{
+    ftg_off_t len;
+    u8*       bytes = ftg_file_read(path, false, &len);
+    if (bytes == NULL)
+        return false;
+
+    bool same = (size_t)len == strlen(str) && memcmp(bytes, str, (size_t)len) == 0;
+    FTG_FREE(bytes);
+
+    return same;
+}
+
+static int
+tool__test_cache_hits_misses_and_invalidates(void)
+{
+    static const char jasc[] = "JASC-PAL\n0100\n2\n255 0 0\n0 255 0\n";
+    static const char changed_jasc[] = "JASC-PAL\n0100\n2\n255 0 0\n0 0 255\n";
+    static const char marked[] = "served from the cache\n";
+
+    char in_path[FTG_STRLEN_LONG];
+    char out_path[FTG_STRLEN_LONG];
+    char cache_dir[FTG_STRLEN];
+    char entry_path[FTG_STRLEN_LONG];
+    char changed_entry_path[FTG_STRLEN_LONG];
+    char option_entry_path[FTG_STRLEN_LONG];
+    tool__test_path("cache_in.pal", in_path, sizeof(in_path));
+    tool__test_path("cache_out.gpl", out_path, sizeof(out_path));
+    tool__test_path("cache", cache_dir, sizeof(cache_dir));
+
+    ftg_mkalldirs(cache_dir);
+    args.cache_dir = cache_dir;
+
+    job_t job = {in_path, out_path, 1, NULL, {0}};
+    current_job = &job;
+
+    FTGT_ASSERT(ftg_file_write_string(in_path, jasc));
+    FTGT_ASSERT(input_cache_path(FILE_KIND_JASC, FILE_KIND_GIMP_GPL, entry_path, sizeof(entry_path)));
+    remove(entry_path);
+    remove(out_path);
+
+    // a miss converts, and stores what it wrote
+    convert_file();
+    ftg_off_t out_len;
+    char*     converted = (char*)ftg_file_read(out_path, true, &out_len);
+    FTGT_ASSERT(converted != NULL);
+    if (!converted)
+        return ftgt_test_errorlevel();
+    FTGT_ASSERT(strstr(converted, "0 255 0") != NULL);
+    FTGT_ASSERT(tool__test_file_is(entry_path, converted));
+    FTG_FREE(converted);
+
+    // a hit copies the entry instead of converting
+    FTGT_ASSERT(ftg_file_write_string(entry_path, marked));
+    convert_file();
+    FTGT_ASSERT(tool__test_file_is(out_path, marked));
+
+    // an output already matching the entry is left as it is
+    char fetched_path[FTG_STRLEN_LONG];
+    FTGT_ASSERT(fetch_cached_output(
+        FILE_KIND_JASC, FILE_KIND_GIMP_GPL, fetched_path, sizeof(fetched_path)));
+    FTGT_ASSERT(strcmp(fetched_path, entry_path) == 0);
+    FTGT_ASSERT(tool__test_file_is(out_path, marked));
+
+    // changed input bytes are a new entry, so the old one isn't served
+    FTGT_ASSERT(ftg_file_write_string(in_path, changed_jasc));
+    FTGT_ASSERT(input_cache_path(
+        FILE_KIND_JASC, FILE_KIND_GIMP_GPL, changed_entry_path, sizeof(changed_entry_path)));
+    FTGT_ASSERT(strcmp(changed_entry_path, entry_path) != 0);
+    remove(changed_entry_path);
+
+    convert_file();
+    FTGT_ASSERT(!tool__test_file_is(out_path, marked));
+    converted = (char*)ftg_file_read(out_path, true, &out_len);
+    FTGT_ASSERT(converted && strstr(converted, "0 0 255") != NULL);
+    FTGT_ASSERT(converted && tool__test_file_is(changed_entry_path, converted));
+    if (converted)
+        FTG_FREE(converted);
+
+    // so are changed options, for the same input
+    FTGT_ASSERT(ftg_file_write_string(in_path, jasc));
+    args.json_compact = true;
+    FTGT_ASSERT(input_cache_path(
+        FILE_KIND_JASC, FILE_KIND_GIMP_GPL, option_entry_path, sizeof(option_entry_path)));
+    FTGT_ASSERT(strcmp(option_entry_path, entry_path) != 0);
+    remove(option_entry_path);
+
+    convert_file();
+    FTGT_ASSERT(!tool__test_file_is(out_path, marked));
+
+    // and going back to the original input and options hits again
+    args.json_compact = false;
+    convert_file();
+    FTGT_ASSERT(tool__test_file_is(out_path, marked));
+
+    remove(entry_path);
+    remove(changed_entry_path);
+    remove(option_entry_path);
+    remove(out_path);
+    remove(in_path);
+
+    return ftgt_test_errorlevel();
+}
+
+static void
+palettetool_decl_suite(void)
+{
+    ftgt_suite_s* suite =
+        ftgt_create_suite(NULL, "palettetool", tool__test_setup, tool__test_teardown);
+    FTGT_ADD_TEST(suite, tool__test_json_index_rebuilds_stale_entries);
+    FTGT_ADD_TEST(suite, tool__test_batch_manifest_parses_lines);
+    FTGT_ADD_TEST(suite, tool__test_batch_directory_expands_names);
+    FTGT_ADD_TEST(suite, tool__test_cache_hits_misses_and_invalidates);
+}
+
+#endif /* FTGT_TESTS_ENABLED */
+
+int
+main(int argc, char* argv[])
+{
+    kgflags_string_array("in",
+                         "file to convert.  several, or a directory, convert as a batch",
+                         false,
+                         &args.in_files);
+    kgflags_string_array("out",
+                         "file to export to (will overwrite), one per --in.  for a\n\t\t"
+                         "directory, {name} is replaced by each input's name",
+                         false,
+                         &args.out_files);
+    kgflags_bool("verbose", false, "log verbosity", false, &args.verbose);
+    kgflags_string(
+        "sort-png",
+        NULL,
+        "when exporting as png, use a sort\n\t\t(supported: red, green, "
+        "blue, hue, saturation, value, lightness, redness, "
+        "yellowness, greenness, cyanness, blueness, magentaness)",
+        false,
+        &args.png_sort_kind);
+    kgflags_int(
+        "png-scale",
+        1,
+        "scale of the output png image (used for both width and height)",
+        false,
+        &args.png_scale);
+
+    kgflags_int("json-palette-index",
+                0,
+                "palette to parse in the json doc or archive (starting from 0)",
+                false,
+                &args.json_palette_index);
+    kgflags_string("json-palette-title",
+                   NULL,
+                   "palette to parse in the json doc or archive, by title\n\t\t"
+                   "(overrides json-palette-index)",
+                   false,
+                   &args.json_palette_title);
+    kgflags_bool("json-index",
+                 false,
+                 "select the json palette through a sidecar index (<in>.idx),\n\t\t"
+                 "creating or rebuilding it as needed",
+                 false,
+                 &args.json_index);
+    kgflags_bool("json-compact",
+                 false,
+                 "when exporting json, write a minified document",
+                 false,
+                 &args.json_compact);
+    kgflags_bool("json-ndjson",
+                 false,
+                 "when exporting json, write each palette as a minified object on "
+                 "its own line\n\t\t(newline-delimited json, which --in reads back)",
+                 false,
+                 &args.json_ndjson);
+    kgflags_bool("json-all-palettes",
+                 false,
+                 "convert every palette in a json doc or archive to a json doc\n\t\t"
+                 "or archive, rather than one",
+                 false,
+                 &args.json_all_palettes);
+    kgflags_string("batch",
+                   NULL,
+                   "convert every input and output path pair listed in this file,\n\t\t"
+                   "one pair per line",
+                   false,
+                   &args.batch_manifest);
+    kgflags_int("threads",
+                0,
+                "files converted at once in a batch (0 for one per cpu)",
+                false,
+                &args.threads);
+    kgflags_string("cache-dir",
+                   NULL,
+                   "keep every output in this directory, and copy it from there\n\t\t"
+                   "when the same input is converted with the same options",
+                   false,
+                   &args.cache_dir);
+
+
+    if (!kgflags_parse(argc, argv)) {
+        print_header();
+        kgflags_print_errors();
+        kgflags_print_usage();
+        print_supported_kinds();
+        return 1;
+    }
+
+    if (args.help_supported) {
+        print_header();
+        print_supported_kinds();
+        return 0;
+    }
+
+    // validate args
+    if (args.png_scale < 1 || args.png_scale > 128) {
+        fatal("png-scale must be in range 1-128");
+    }
+
+    if (args.threads < 0) {
+        fatal("threads must not be negative");
+    }
+
+    if (args.json_compact && args.json_ndjson) {
+        fatal("json-compact and json-ndjson are mutually exclusive");
+    }
+
+    int num_in = kgflags_string_array_get_count(&args.in_files);
+    int num_out = kgflags_string_array_get_count(&args.out_files);
+
+    if (!args.batch_manifest && (num_in == 0 || num_out == 0)) {
+        print_header();
+        fprintf(stderr, "--in and --out are required, unless --batch is given\n");
+        kgflags_print_usage();
+        print_supported_kinds();
+        return 1;
+    }
+
+    if (num_in != num_out)
+        fatal(ftg_va("%d --in files but %d --out files", num_in, num_out));
+
+    if (args.cache_dir) {
+        ftg_mkalldirs(args.cache_dir);
+        if (!ftg_is_dir(args.cache_dir))
+            fatal(ftg_va("could not create cache directory '%s'", args.cache_dir));
+    }
+
+    // a single file keeps failing through fatal()
+    if (!args.batch_manifest && num_in == 1 &&
+        !ftg_is_dir(kgflags_string_array_get_item(&args.in_files, 0))) {
+        job_t job = {kgflags_string_array_get_item(&args.in_files, 0),
+                     kgflags_string_array_get_item(&args.out_files, 0),
+                     0,
+                     NULL,
+                     {0}};
+        current_job = &job;
+
+        // every allocation the conversion makes comes from the job arena
+        job_arena_t job_arena;
+        if (!job_arena_init(&job_arena, JOB_ARENA_INITIAL_SIZE))
+            fatal("out of memory");
+        job_arena_make_current(&job_arena);
+
+        convert_file();
+
+        job_arena_release(&job_arena);
+
+        print(LOG_MSG, "success.");
+
+        return 0;
+    }
+
+    // the batch outlives every job, so it's built before an arena is current
+    batch_t batch = {0};
+    for (int i = 0; i < num_in; i++) {
+        add_batch_entry(&batch,
+                        kgflags_string_array_get_item(&args.in_files, i),
+                        kgflags_string_array_get_item(&args.out_files, i));
+    }
+    if (args.batch_manifest)
+        add_batch_manifest(&batch, args.batch_manifest);
+
+    if (batch.num_entries == 0)
+        fatal("nothing to convert");
+    check_batch_outputs(&batch);
+
+    int num_failed = run_batch(&batch);
+
+    if (num_failed) {
+        print(LOG_WARNING,
+              ftg_va("%d of %d conversions failed", num_failed, batch.num_entries));
+    } else {
+        print(LOG_MSG, ftg_va("converted %d files", batch.num_entries));
+        print(LOG_MSG, "success.");
+    }
+
+    free_batch(&batch);
+
+    return num_failed ? 1 : 0;
+}
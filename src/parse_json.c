@@ -5,8 +5,10 @@
   file so it can be ripped out, and palette parsing can be added to
   another program without too much trouble.
 
-  It is a fast, malloc-less parse of a json document which should
-  compile warnings-free on Visual C++, GCC and Clang.  To add it:
+  It is a fast parse of a json document which should compile
+  warnings-free on Visual C++, GCC and Clang.  It allocates only through
+  PAL_REALLOC, realloc by default: its tokens, sized to the document,
+  a color name index and the palettes' own storage.  To add it:
 
    1. copy parse_json.c and parse_json.h to your project
 
@@ -14,10 +16,14 @@
 
    3. fix up the 3rdparty include paths below
 
-   4. call parse_json_into_palettes(), returning 0 on success
+   4. call parse_json_into_palettes(), returning 0 on success, or
+      parse_json_stream_into_palettes() to read the document in
+      chunks with constant memory use
 
-  This parser depends on jsmn for tokenization.  The resulting parse
-  has the following properties:
+  This parser depends on jsmn for tokenization.  A SIMD structural
+  scanner produces the same tokens faster and defers to jsmn for
+  anything unusual, including all errors.  The resulting parse has the
+  following properties:
 
    - silent truncation of strings to fit in PAL_MAX_STRLEN
 
@@ -28,14 +34,19 @@
    - fails on first error with semi-vague error message, but also
      the char start of the error tokne
 
-   - uses libc routines for string to number conversion, which
-     conflate 0 and error, so silent errors to 0 can occur
+   - channel values are decoded with dedicated routines that reject
+     malformed numbers.  other numbers use libc routines, which
+     conflate 0 and error, so silent errors to 0 can occur there
 
    - single-pass parsing: colors array must appear and name all
      colors before any subsequent fields reference those names
 
    - it's fast
 
+  The streaming parser does its own tokenization and shares these
+  properties.  It stops reading once the requested palettes have been
+  parsed, and also reads ndjson, a palette object per line.
+
  */
 
 #include <stdio.h>
@@ -47,16 +58,43 @@
 #include "3rdparty/ftg_palette.h"
 #include "3rdparty/jsmn.h"
 
+#include "parse_json.h"
+
 #define JSON_ASSERT(expr) assert(expr)
 #define JSON_UNUSED(x) ((void)x)
 
+// the same allocator hooks as ftg_palette.h
+#ifndef PAL_REALLOC
+#    define PAL_REALLOC(p, n) realloc((p), (n))
+#    define PAL_FREE(p) free(p)
+#endif
+
 // increase this for multiple palettes in a json doc
 #define MAX_JSMN_TOKENS (1 << 17)
 
+// open-addressing hash index of pal->color_names, built while the
+// colors array is parsed so hint, gradient and dither pair references
+// resolve in O(1).  num_slots is a power of two kept at most half
+// full; it doubles as colors arrive, so clearing the index for a small
+// palette stays cheap.  the slots are allocated as it grows and kept
+// across clears, up to max_slots.
+#define JSON_NAME_INDEX_MIN_SLOTS 512
+#define JSON_NAME_INDEX_MAX_SLOTS (1 << 17)  // over PAL_MAX_COLORS * 2
+
+typedef struct {
+    pal_u16_t* slot;       // [num_slots], color index + 1, 0 is empty
+    int        num_slots;  // 0 until the first name is added
+    int        num_names;
+    int        max_slots;  // slots allocated
+} json_name_index_t;
+
 typedef struct {
-    jsmntok_t   tok[MAX_JSMN_TOKENS];
-    int         num_tokens;
-    const char* str;
+    jsmntok_t*        tok;   // [max_tokens]
+    int*              next;  // [max_tokens], token after tok[i] and its subtree
+    int               max_tokens;
+    int               num_tokens;
+    const char*       str;
+    json_name_index_t names;
 
     // set these to values that are returned to the caller
     // so functions up the stack can set errors
@@ -75,13 +113,224 @@ typedef struct {
     }
 
 
-static float
-hex_to_f32(const char* hex)
+//
+// Channel decoding
+//
+// Channels are hex strings holding the bits of an ieee 754 float
+// (preferred) or decimal numbers.  Both decoders take the token's
+// length rather than relying on a terminator, and report malformed
+// input instead of silently producing 0.
+//
+
+// decode 1-8 hex digits, optionally prefixed with 0x, into *out_bits.
+// eight digits, the form palettetool writes, are decoded with swar.
+static int
+json_decode_hex32(const char* hex, int len, uint32_t* out_bits)
+{
+    if (len >= 2 && hex[0] == '0' && (hex[1] == 'x' || hex[1] == 'X')) {
+        hex += 2;
+        len -= 2;
+    }
+
+    if (len == 8) {
+        const unsigned char* p = (const unsigned char*)hex;
+
+        // first digit in the lowest byte regardless of endianness
+        uint64_t v = (uint64_t)p[0] | (uint64_t)p[1] << 8 | (uint64_t)p[2] << 16 |
+                     (uint64_t)p[3] << 24 | (uint64_t)p[4] << 32 | (uint64_t)p[5] << 40 |
+                     (uint64_t)p[6] << 48 | (uint64_t)p[7] << 56;
+
+        const uint64_t ones = 0x0101010101010101ULL;
+        const uint64_t high = 0x8080808080808080ULL;
+
+        // with every byte below 0x80, adding (0x80 - c) sets a byte's high
+        // bit exactly when it is >= c, without carrying into the next byte
+        uint64_t lower = v | 0x20 * ones;
+        uint64_t is_digit = (v + (0x80 - '0') * ones) & ~(v + (0x80 - '9' - 1) * ones);
+        uint64_t is_alpha =
+            (lower + (0x80 - 'a') * ones) & ~(lower + (0x80 - 'f' - 1) * ones);
+
+        if ((v & high) != 0 || ((is_digit | is_alpha) & high) != high)
+            return 1;
+
+        // 'a'-'f' and 'A'-'F' have low nibbles 1-6
+        uint64_t nibbles = (v & 0x0f * ones) + ((is_alpha & high) >> 7) * 9;
+
+        // pair digits into bytes: high digit first
+        uint64_t pairs = ((nibbles & 0x000f000f000f000fULL) << 4) |
+                         ((nibbles & 0x0f000f000f000f00ULL) >> 8);
+
+        *out_bits = (uint32_t)(pairs & 0xff) << 24 | (uint32_t)((pairs >> 16) & 0xff) << 16 |
+                    (uint32_t)((pairs >> 32) & 0xff) << 8 | (uint32_t)((pairs >> 48) & 0xff);
+        return 0;
+    }
+
+    if (len < 1 || len > 8)
+        return 1;
+
+    uint32_t bits = 0;
+    for (int j = 0; j < len; j++) {
+        char c = hex[j];
+        if (c >= '0' && c <= '9')
+            bits = bits << 4 | (uint32_t)(c - '0');
+        else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+            bits = bits << 4 | (uint32_t)((c | 0x20) - 'a' + 10);
+        else
+            return 1;
+    }
+
+    *out_bits = bits;
+    return 0;
+}
+
+// Clinger's fast path: a decimal with at most 19 significant digits
+// whose value is at most 2^53 times a power of ten no larger than 1e22
+// is exactly m * 10^e, and one correctly rounded multiply or divide of
+// two exact doubles gives the correctly rounded result, as strtod does.
+// Needs double arithmetic without excess precision.
+#include <float.h>
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#    define JSON_CLINGER_FAST_PATH 1
+#else
+#    define JSON_CLINGER_FAST_PATH 0
+#endif
+
+#if JSON_CLINGER_FAST_PATH
+static const double JSON_EXACT_POWERS_OF_TEN[23] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+// returns nonzero if str isn't a plain decimal the fast path can
+// convert exactly
+static int
+json_decode_decimal_fast(const char* str, int len, double* out_value)
+{
+    int      j = 0;
+    int      negative = 0;
+    uint64_t mantissa = 0;
+    int      num_digits = 0;  // significant digits in mantissa
+    int      exponent = 0;
+    int      any_digits = 0;
+
+    if (j < len && str[j] == '-') {
+        negative = 1;
+        j++;
+    }
+
+    for (; j < len && str[j] >= '0' && str[j] <= '9'; j++) {
+        any_digits = 1;
+        if (mantissa == 0 && str[j] == '0')
+            continue;  // leading zero
+        if (++num_digits > 19)
+            return 1;
+        mantissa = mantissa * 10 + (uint64_t)(str[j] - '0');
+    }
+
+    if (j < len && str[j] == '.') {
+        j++;
+        for (; j < len && str[j] >= '0' && str[j] <= '9'; j++) {
+            any_digits = 1;
+            exponent--;
+            if (mantissa == 0 && str[j] == '0')
+                continue;
+            if (++num_digits > 19)
+                return 1;
+            mantissa = mantissa * 10 + (uint64_t)(str[j] - '0');
+        }
+    }
+
+    if (!any_digits)
+        return 1;
+
+    if (j < len && (str[j] == 'e' || str[j] == 'E')) {
+        int exp_negative = 0;
+        int exp_value = 0;
+        int exp_digits = 0;
+
+        j++;
+        if (j < len && (str[j] == '-' || str[j] == '+')) {
+            exp_negative = str[j] == '-';
+            j++;
+        }
+        for (; j < len && str[j] >= '0' && str[j] <= '9'; j++) {
+            if (++exp_digits > 4)
+                return 1;
+            exp_value = exp_value * 10 + (str[j] - '0');
+        }
+        if (exp_digits == 0)
+            return 1;
+
+        exponent += exp_negative ? -exp_value : exp_value;
+    }
+
+    if (j != len)
+        return 1;
+
+    if (mantissa == 0) {
+        *out_value = negative ? -0.0 : 0.0;
+        return 0;
+    }
+
+    if (mantissa > ((uint64_t)1 << 53) || exponent < -22 || exponent > 22)
+        return 1;
+
+    double value = (double)mantissa;
+    if (exponent < 0)
+        value /= JSON_EXACT_POWERS_OF_TEN[-exponent];
+    else
+        value *= JSON_EXACT_POWERS_OF_TEN[exponent];
+
+    *out_value = negative ? -value : value;
+    return 0;
+}
+#endif /* JSON_CLINGER_FAST_PATH */
+
+// decode a decimal channel exactly as (float)strtod() would, failing if
+// strtod wouldn't consume the whole token
+static int
+json_decode_decimal(const char* str, int len, float* out_float)
+{
+    double value;
+
+#if JSON_CLINGER_FAST_PATH
+    if (json_decode_decimal_fast(str, len, &value) == 0) {
+        *out_float = (float)value;
+        return 0;
+    }
+#endif
+
+    // strtod needs a terminator; anything long enough to need copying
+    // can't be a sensible channel value
+    char buf[64];
+    if (len < 1 || len >= (int)sizeof(buf))
+        return 1;
+    memcpy(buf, str, (size_t)len);
+    buf[len] = 0;
+
+    char* end;
+    value = strtod(buf, &end);
+    if (end != buf + len)
+        return 1;
+
+    *out_float = (float)value;
+    return 0;
+}
+
+// str is a channel token of len bytes.  string tokens hold hex float
+// bits, primitives hold decimals.
+static int
+json_decode_channel(const char* str, int len, int is_string, float* out_float)
 {
-    uint32_t bits = (uint32_t)strtoul(hex, NULL, 16);
-    float    f;
-    memcpy(&f, &bits, sizeof(float));
-    return f;
+    if (is_string) {
+        uint32_t bits;
+        if (json_decode_hex32(str, len, &bits) != 0)
+            return 1;
+        memcpy(out_float, &bits, sizeof(float));
+        return 0;
+    }
+
+    return json_decode_decimal(str, len, out_float);
 }
 
 
@@ -130,12 +379,29 @@ jsoneq(json_context_t* ctx, int i, const char* s)
     return -1;
 }
 
+// fill ctx->next so json_skip is constant time.  next[i] is the first
+// token that starts at or after the end of tok[i].
+//
+// walking backwards, next[i] hops over whole subtrees whose next[] is
+// already known, so each token is hopped over at most once: O(n).
+static void
+json_build_skip_table(json_context_t* ctx)
+{
+    for (int i = ctx->num_tokens - 1; i >= 0; i--) {
+        int next = i + 1;
+        while (next < ctx->num_tokens && ctx->tok[next].start < ctx->tok[i].end)
+            next = ctx->next[next];
+        ctx->next[i] = next;
+    }
+}
+
+// *i will point to the next token after the value at *i, skipping all
+// tokens of nested objects and arrays
 static void
 json_skip(const json_context_t* ctx, int* i)
 {
-    for (int char_end = ctx->tok[*i].end;
-         *i < ctx->num_tokens && ctx->tok[*i].start < char_end;
-         (*i)++);  // pass
+    if (*i < ctx->num_tokens)
+        *i = ctx->next[*i];
 }
 
 
@@ -156,7 +422,8 @@ json_strcpy_token(json_context_t* ctx, char dst[PAL_MAX_STRLEN], int i)
 
 #if 0
 // keeping this around as a good example of how to recurse tokens, but
-// it's not necessary after I figured out the json_skip trick
+// it's not necessary after I figured out the json_skip trick, now a
+// precomputed table lookup
 
 // *i will point to the next token after a dict or array, recursively skipping
 // all tokens including nested dictionaries and arrays
@@ -258,6 +525,139 @@ json_write_value_str_on_match_key(
 }
 
 
+static uint32_t
+json_name_hash(const char* name, int name_len)
+{
+    // fnv-1a
+    uint32_t hash = 2166136261u;
+    for (int j = 0; j < name_len; j++) {
+        hash ^= (unsigned char)name[j];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void
+json_name_index_init(json_name_index_t* index)
+{
+    memset(index, 0, sizeof(*index));
+}
+
+static void
+json_name_index_free(json_name_index_t* index)
+{
+    PAL_FREE(index->slot);
+    memset(index, 0, sizeof(*index));
+}
+
+// only the slots in use can be set
+static void
+json_name_index_clear(json_name_index_t* index)
+{
+    if (index->num_slots > 0)
+        memset(index->slot, 0, sizeof(pal_u16_t) * (size_t)index->num_slots);
+    index->num_slots = 0;
+    index->num_names = 0;
+}
+
+// returns the slot holding name, or the empty slot where it belongs.
+// name_len is clamped the way stored names are truncated, so a
+// reference matches exactly the name that was stored.
+static int
+json_name_index_find(const json_name_index_t* index,
+                     const pal_palette_t*     pal,
+                     const char*              name,
+                     int                      name_len)
+{
+    if (name_len > PAL_MAX_STRLEN - 1)
+        name_len = PAL_MAX_STRLEN - 1;
+
+    int mask = index->num_slots - 1;
+    int slot = (int)(json_name_hash(name, name_len) & (uint32_t)mask);
+    for (;;) {
+        int entry = index->slot[slot];
+        if (entry == 0)
+            return slot;
+
+        const char* stored = pal->color_names[entry - 1];
+        if (memcmp(stored, name, name_len) == 0 && stored[name_len] == 0)
+            return slot;
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+static void
+json_name_index_insert(json_name_index_t* index, const pal_palette_t* pal, int color_index)
+{
+    const char* name = pal->color_names[color_index];
+    int         slot = json_name_index_find(index, pal, name, (int)strlen(name));
+
+    if (index->slot[slot] == 0) {
+        index->slot[slot] = (pal_u16_t)(color_index + 1);
+        index->num_names++;
+    }
+}
+
+// add pal->color_names[color_index], after every color before it.  on
+// duplicate names the first color keeps the name.  returns 1 if out of
+// memory.
+static int
+json_name_index_add(json_name_index_t* index, const pal_palette_t* pal, int color_index)
+{
+    if ((index->num_names + 1) * 2 > index->num_slots &&
+        index->num_slots < JSON_NAME_INDEX_MAX_SLOTS) {
+        int num_slots = index->num_slots ? index->num_slots * 2 : JSON_NAME_INDEX_MIN_SLOTS;
+
+        if (num_slots > index->max_slots) {
+            pal_u16_t* slot =
+                (pal_u16_t*)PAL_REALLOC(index->slot, sizeof(pal_u16_t) * (size_t)num_slots);
+            if (!slot)
+                return 1;
+            index->slot = slot;
+            index->max_slots = num_slots;
+        }
+
+        // double and rehash, in color order so first names still win
+        memset(index->slot, 0, sizeof(pal_u16_t) * (size_t)num_slots);
+        index->num_slots = num_slots;
+        index->num_names = 0;
+        for (int j = 0; j < color_index; j++) json_name_index_insert(index, pal, j);
+    }
+
+    json_name_index_insert(index, pal, color_index);
+    return 0;
+}
+
+// grow pal to hold element number count of an array with per_color
+// elements per color of capacity: 1 for colors and hints, 2 for
+// gradient indices and dither pairs.  the caller checks the limits.
+static int
+json_reserve(pal_palette_t* pal, int count, int per_color)
+{
+    return pal_reserve(pal, count / per_color + 1);
+}
+
+// name (name_len bytes, not null terminated) is the name of a color in
+// pal->color_names. return the index to it.
+static int
+json_palette_color_index(const json_name_index_t* index,
+                         const pal_palette_t*     pal,
+                         const char*              name,
+                         int                      name_len,
+                         int*                     out_index)
+{
+    if (index->num_slots == 0)
+        return 1;
+
+    int slot = json_name_index_find(index, pal, name, name_len);
+    if (index->slot[slot] == 0)
+        return 1;
+
+    *out_index = index->slot[slot] - 1;
+    return 0;
+}
+
 // token pointed to by *i is a string that is the name of a color in
 // pal->color_names. return the index to it.
 static int
@@ -270,15 +670,8 @@ json_token_to_palette_color_index(json_context_t*      ctx,
     if (json_expect(ctx, JSMN_STRING, i) != 0)
         return 1;
 
-    for (int j = 0; j < pal->num_colors; j++) {
-        if (strncmp(ctx->str + tok->start, pal->color_names[j], tok->end - tok->start) ==
-            0) {
-            *out_index = j;
-            return 0;
-        }
-    }
-
-    return 1;
+    return json_palette_color_index(
+        &ctx->names, pal, ctx->str + tok->start, tok->end - tok->start, out_index);
 }
 
 
@@ -295,21 +688,20 @@ json_write_value_float_on_match_key(json_context_t* ctx,
         json_skip(ctx, i);
 
         (*out_inc_on_match)++;
-        if (ctx->tok[*i].type == JSMN_PRIMITIVE) {
-            // handle decimal float parsing (discouraged)
-            *out_float = (float)strtod(ctx->str + ctx->tok[*i].start, NULL);
-
-        } else if (ctx->tok[*i].type == JSMN_STRING) {
-            // handle hex float in string parsing (preferred)
-
-            // note: if *out_float is 0.0, it would be possible to check
-            // if the string is actually "00000000", and if it isn't, it's
-            // a bad parse
-            *out_float = hex_to_f32(ctx->str + ctx->tok[*i].start);
-        } else {
+        const jsmntok_t* tok = &ctx->tok[*i];
+        if (tok->type != JSMN_PRIMITIVE && tok->type != JSMN_STRING) {
             json_error(ctx, "expected string or primitive token type", *i);
             return 1;
         }
+
+        // hex float in string (preferred) or decimal float (discouraged)
+        if (json_decode_channel(ctx->str + tok->start,
+                                tok->end - tok->start,
+                                tok->type == JSMN_STRING,
+                                out_float) != 0) {
+            json_error(ctx, "invalid channel value", *i);
+            return 1;
+        }
     }
 
     return 0;
@@ -429,10 +821,10 @@ parse_palette_color_subobject(json_context_t* ctx, int* i, pal_palette_t* pal)
         return 1;
 
 
+    // the colors array reserved a color per element
+    JSON_ASSERT(pal->num_colors < (int)pal->capacity);
     pal_color_t* col = &pal->colors[pal->num_colors];
 
-    JSON_ASSERT(pal->num_colors < PAL_MAX_COLORS);
-
     int channel_set_count = 0;
     for (; !JSON_EOF && ctx->tok[*i].start < obj_end_index; (*i)++) {
         const int iter_start = *i;
@@ -488,6 +880,10 @@ parse_palette_color_subobject(json_context_t* ctx, int* i, pal_palette_t* pal)
         return 1;
     }
 
+    if (json_name_index_add(&ctx->names, pal, pal->num_colors) != 0) {
+        json_error(ctx, "out of memory", *i);
+        return 1;
+    }
     pal->num_colors++;
 
     (*i)--;
@@ -509,8 +905,16 @@ parse_palette_colors_subarray(json_context_t* ctx, int* i, pal_palette_t* pal)
     }
 
     pal->num_colors = 0;
+    if (pal_reserve(pal, colors_array_tokens) != 0) {
+        json_error(ctx, "out of memory", *i);
+        return 1;
+    }
+    json_name_index_clear(&ctx->names);
 
-    while (!JSON_EOF && ctx->tok[*i].type == JSMN_OBJECT) {
+    // bounded by the array's end: when colors is a palette's last member,
+    // the next token is the following palette's object
+    while (!JSON_EOF && ctx->tok[*i].start < array_end_index &&
+           ctx->tok[*i].type == JSMN_OBJECT) {
         if (parse_palette_color_subobject(ctx, i, pal) != 0)
             return 1;
         (*i)++;
@@ -542,6 +946,10 @@ parse_palette_hints_subarray(json_context_t* ctx, int* i, pal_palette_t* pal, pa
             json_error(ctx, "PAL_MAX_COLORS exceeded for hint", *i);
             return 1;
         }
+        if (json_reserve(pal, pal->num_hints[hint_kind], 1) != 0) {
+            json_error(ctx, "out of memory", *i);
+            return 1;
+        }
 
         int palette_color_index;
         int result =
@@ -607,6 +1015,16 @@ parse_palette_gradients_subarray(json_context_t* ctx, int* i, pal_palette_t* pal
 
     while (!JSON_EOF && ctx->tok[*i].start < gradients_array_end) {
         int palette_color_index;
+        int num_indices = pal->gradients[gradient_index].num_indices;
+
+        if (num_indices >= PAL_MAX_GRADIENT_INDICES) {
+            json_error(ctx, "PAL_MAX_GRADIENT_INDICES exceeded", *i);
+            return 1;
+        }
+        if (json_reserve(pal, num_indices, 2) != 0) {
+            json_error(ctx, "out of memory", *i);
+            return 1;
+        }
 
         int result =
             json_token_to_palette_color_index(ctx, *i, pal, &palette_color_index);
@@ -709,6 +1127,15 @@ parse_palette_dither_pairs_subobject(json_context_t* ctx, int* i, pal_palette_t*
         if (json_expect(ctx, JSMN_STRING, *i) != 0)
             return 1;
 
+        if (pal->num_dither_pairs >= PAL_MAX_DITHER_PAIRS) {
+            json_error(ctx, "PAL_MAX_DITHER_PAIRS exceeded", *i);
+            return 1;
+        }
+        if (json_reserve(pal, pal->num_dither_pairs, 2) != 0) {
+            json_error(ctx, "out of memory", *i);
+            return 1;
+        }
+
         json_strcpy_token(ctx, pal->dither_pair_names[pal->num_dither_pairs], *i);
 
         json_match(ctx, JSMN_STRING, i);
@@ -740,7 +1167,8 @@ parse_palette_object(json_context_t* ctx, int* i, pal_palette_t* pal)
                                     ctx, "title", i, pal->title, PAL_MAX_STRLEN) != 0)
             return 1;
 
-        if (*i == iter_start && jsoneq(ctx, *i, "color_hash") == 0)
+        if (*i == iter_start && (jsoneq(ctx, *i, "color_hash") == 0 ||
+                                 jsoneq(ctx, *i, "color_hash64") == 0))
             (*i)++;  // acceptable key/value, but has no analog field
 
         if (*i == iter_start && jsoneq(ctx, *i, "source") == 0) {
@@ -807,71 +1235,2434 @@ parse_palette_object(json_context_t* ctx, int* i, pal_palette_t* pal)
     return 0;
 }
 
-int
-parse_json_into_palettes(const char*    json_str,
-                         size_t         json_strlen,
-                         pal_palette_t* out_palettes,
-                         int            first_palette,
-                         int            num_palettes,
+//
+// Structural scanner
+//
+// A faster replacement for jsmn_parse() that produces the same tokens.
+// Input is classified 64 bytes at a time into bitmasks of quotes,
+// backslashes, structural characters and whitespace, with SSE2 or AVX2
+// where available.  String contents are masked out with a prefix xor of
+// the unescaped quotes, and tokens are built by visiting only the
+// structural characters, quotes and primitive starts that remain,
+// following jsmn's state machine step for step.
+//
+// Anything the fast path doesn't expect reruns jsmn over the whole
+// document, so results -- errors included -- always match jsmn.  That
+// covers every parse error, invalid escapes, quotes or brackets inside
+// primitives and nesting deeper than JSON_SCAN_MAX_DEPTH.
+//
+// Define JSON_USE_JSMN_TOKENIZER to tokenize with jsmn alone, and
+// JSON_NO_SIMD to classify bytes with scalar code only.
+//
 
-                         char out_error_message[PAL_MAX_STRLEN],
-                         int* out_error_start)
-{
-    jsmn_parser    parser;
-    json_context_t ctx;
+#define JSON_SCAN_MAX_DEPTH 64
 
-    jsmn_init(&parser);
-    ctx.num_tokens =
-        jsmn_parse(&parser, json_str, json_strlen, ctx.tok, MAX_JSMN_TOKENS);
-    if (ctx.num_tokens < 0) {
-        // JSON_ASSERT(!"jsmn_parse failed with error");
-        return 1;
-    }
-    ctx.str = json_str;
-    ctx.parse_error = out_error_message;
-    ctx.error_start = out_error_start;
+// define JSON_NO_SIMD to build only the scalar classifier
+#if !defined(JSON_NO_SIMD) &&                                                  \
+    (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#    define JSON__SSE2 1
+#    include <emmintrin.h>
+#else
+#    define JSON__SSE2 0
+#endif
 
-    // expect outer object
-    int i = 0;
-    if (json_match(&ctx, JSMN_OBJECT, &i) != 0)
-        return 1;
+// the avx2 classifier is compiled on x64 regardless of compiler flags and
+// only runs when the cpu reports support
+#if JSON__SSE2 && (defined(__x86_64__) || defined(_M_X64)) &&                  \
+    (defined(_MSC_VER) || defined(__clang__) ||                                \
+     (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#    define JSON__AVX2 1
+#    include <immintrin.h>
+#    if defined(_MSC_VER)
+#        include <intrin.h>
+#        define JSON__TARGET_AVX2
+#    else
+#        define JSON__TARGET_AVX2 __attribute__((target("avx2")))
+#    endif
+#else
+#    define JSON__AVX2 0
+#endif
 
-    // scan for 'palettes: [', setting i to the beginning of the palettes array
-    for (; i < ctx.num_tokens; i++) {
-        switch (ctx.tok[i].type) {
-        case JSMN_STRING:
-            if (jsoneq(&ctx, i, "palettes") == 0) {
-                if (i < ctx.num_tokens - 1 && ctx.tok[i + 1].type == JSMN_ARRAY) {
-                    // found the palettes array
-                    // jump i ahead to the first palette object
-                    i += 2;
-                }
-            }
-            goto end_search;
+// the classifier is selected on first use.  racing threads all select
+// the same one, so the cached pointer only has to be read and written
+// whole; msvc's aligned pointer accesses already are
+#if defined(__GNUC__) || defined(__clang__)
+#    define JSON__LOAD_RELAXED(var) __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#    define JSON__STORE_RELAXED(var, val) __atomic_store_n(&(var), (val), __ATOMIC_RELAXED)
+#else
+#    define JSON__LOAD_RELAXED(var) (var)
+#    define JSON__STORE_RELAXED(var, val) ((var) = (val))
+#endif
+
+#if defined(_MSC_VER)
+#    include <intrin.h>
+#endif
+
+// one bit per byte of a 64-byte block
+typedef struct {
+    uint64_t quote;
+    uint64_t backslash;
+    uint64_t structural;  // { } [ ] : ,
+    uint64_t whitespace;  // the four characters jsmn skips
+} json_block_masks_t;
+
+typedef void (*json_classify_func_t)(const unsigned char* block, json_block_masks_t* out_masks);
+
+#if !JSON__SSE2 || defined(FTGT_TESTS_ENABLED)
+static void
+json_classify_scalar(const unsigned char* block, json_block_masks_t* out_masks)
+{
+    memset(out_masks, 0, sizeof(*out_masks));
+
+    for (int j = 0; j < 64; j++) {
+        uint64_t bit = (uint64_t)1 << j;
+        switch (block[j]) {
+        case '"':
+            out_masks->quote |= bit;
+            break;
+        case '\\':
+            out_masks->backslash |= bit;
+            break;
+        case '{':
+        case '}':
+        case '[':
+        case ']':
+        case ':':
+        case ',':
+            out_masks->structural |= bit;
+            break;
+        case ' ':
+        case '\t':
+        case '\r':
+        case '\n':
+            out_masks->whitespace |= bit;
+            break;
         default:;
         }
     }
-end_search:
-    if (i == ctx.num_tokens) {
-        JSON_ASSERT(!"json document didn't have any palettes");
-        return 1;
-    }
+}
+#endif
 
-    // FTG_ASSERT(tok[i].type == JSMN_OBJECT);
-    for (int current_palette = 0; current_palette != first_palette; current_palette++) {
-        json_skip(&ctx, &i);
+#if JSON__SSE2
+static void
+json_classify_sse2(const unsigned char* block, json_block_masks_t* out_masks)
+{
+    memset(out_masks, 0, sizeof(*out_masks));
+
+    for (int j = 0; j < 64; j += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(block + j));
+
+        // {} and [] differ only in bit 5
+        __m128i folded = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i structural = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')),
+                         _mm_cmpeq_epi8(folded, _mm_set1_epi8('}'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8(','))));
+        __m128i whitespace = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\r')),
+                         _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+
+        out_masks->quote |=
+            (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('"'))) << j;
+        out_masks->backslash |=
+            (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))) << j;
+        out_masks->structural |= (uint64_t)(uint16_t)_mm_movemask_epi8(structural) << j;
+        out_masks->whitespace |= (uint64_t)(uint16_t)_mm_movemask_epi8(whitespace) << j;
     }
+}
+#endif /* JSON__SSE2 */
 
-    if (i == ctx.num_tokens) {
-        json_error(&ctx, "out of tokens while parsing palette", i);
-        return 1;
+#if JSON__AVX2
+JSON__TARGET_AVX2 static void
+json_classify_avx2(const unsigned char* block, json_block_masks_t* out_masks)
+{
+    memset(out_masks, 0, sizeof(*out_masks));
+
+    for (int j = 0; j < 64; j += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(block + j));
+
+        __m256i folded = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i structural = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(folded, _mm256_set1_epi8('{')),
+                            _mm256_cmpeq_epi8(folded, _mm256_set1_epi8('}'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(','))));
+        __m256i whitespace = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'))),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r')),
+                            _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+
+        out_masks->quote |=
+            (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')))
+            << j;
+        out_masks->backslash |=
+            (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')))
+            << j;
+        out_masks->structural |= (uint64_t)(uint32_t)_mm256_movemask_epi8(structural) << j;
+        out_masks->whitespace |= (uint64_t)(uint32_t)_mm256_movemask_epi8(whitespace) << j;
     }
+}
 
-    for (int pal_index = 0; pal_index < num_palettes; pal_index++) {
-        pal_init(&out_palettes[pal_index]);
-        if (parse_palette_object(&ctx, &i, &out_palettes[pal_index]) != 0)
-            return 1;
-    }
+static int
+json_cpu_has_avx2(void)
+{
+#    if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return 0;
 
-    return 0;
+    // the os must also save ymm registers: OSXSAVE, AVX and XCR0 bits
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0)
+        return 0;
+    if ((_xgetbv(0) & 6) != 6)
+        return 0;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#    else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#    endif
+}
+#endif /* JSON__AVX2 */
+
+static json_classify_func_t
+json_select_classifier(void)
+{
+#if JSON__AVX2
+    if (json_cpu_has_avx2())
+        return json_classify_avx2;
+#endif
+#if JSON__SSE2
+    return json_classify_sse2;
+#else
+    return json_classify_scalar;
+#endif
+}
+
+static int
+json_ctz64(uint64_t x)
+{
+    JSON_ASSERT(x != 0);
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, (unsigned long)x))
+        return (int)index;
+    _BitScanForward(&index, (unsigned long)(x >> 32));
+    return (int)index + 32;
+#else
+    return __builtin_ctzll(x);
+#endif
 }
+
+// bit i is set if an odd number of bits at or below i are set.  with
+// quotes, this marks each opening quote and the string it opens.
+static uint64_t
+json_prefix_xor(uint64_t x)
+{
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+// characters preceded by an odd run of backslashes.  *carry is set
+// when the block's last backslash escapes the next block's first byte.
+static uint64_t
+json_find_escaped(uint64_t backslash, uint64_t* carry)
+{
+    const uint64_t even_bits = 0x5555555555555555ULL;
+
+    backslash &= ~*carry;  // an escaped backslash starts no run
+    uint64_t follows_escape = backslash << 1 | *carry;
+
+    // runs starting on odd bits, added to all backslashes, carry through
+    // to the bit after the run, which tells odd runs from even ones
+    uint64_t odd_starts = backslash & ~even_bits & ~follows_escape;
+    uint64_t sequences_on_even = odd_starts + backslash;
+    *carry = sequences_on_even < odd_starts;
+
+    uint64_t invert_mask = sequences_on_even << 1;
+    return (even_bits ^ invert_mask) & follows_escape;
+}
+
+typedef struct {
+    const char* js;
+    int         len;
+
+    jsmntok_t* tok;
+    int        max_tokens;
+    int        num_tokens;
+    int        toksuper;  // as jsmn's parser->toksuper
+
+    int open[JSON_SCAN_MAX_DEPTH];  // open containers, innermost last
+    int depth;
+
+    int string_start;  // position of the open quote, -1 outside strings
+} json_scan_t;
+
+// check escapes in the string whose contents are js[start, end) the way
+// jsmn_parse_string does.  returns nonzero where jsmn would fail.
+static int
+json_scan_check_escapes(const json_scan_t* scan, int start, int end)
+{
+    for (int j = start; j < end; j++) {
+        if (scan->js[j] != '\\')
+            continue;
+
+        j++;
+        switch (scan->js[j]) {
+        case '\"':
+        case '/':
+        case '\\':
+        case 'b':
+        case 'f':
+        case 'r':
+        case 'n':
+        case 't':
+            break;
+        case 'u':
+            for (int k = 0; k < 4; k++) {
+                char c = scan->js[++j];
+                if (j >= end || !((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F') ||
+                                  (c >= 'a' && c <= 'f')))
+                    return 1;
+            }
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static jsmntok_t*
+json_scan_alloc_token(json_scan_t* scan, jsmntype_t type, int start, int end)
+{
+    if (scan->num_tokens == scan->max_tokens)
+        return NULL;
+
+    jsmntok_t* t = &scan->tok[scan->num_tokens++];
+    t->type = type;
+    t->start = start;
+    t->end = end;
+    t->size = 0;
+    return t;
+}
+
+// handle the structural character, quote or primitive start at pos.
+// returns nonzero to hand the document to jsmn.
+static int
+json_scan_event(json_scan_t* scan, int pos, int opens_string)
+{
+    const char* js = scan->js;
+
+    switch (js[pos]) {
+    case '{':
+    case '[':
+        if (scan->depth == JSON_SCAN_MAX_DEPTH)
+            return 1;
+        if (json_scan_alloc_token(
+                scan, js[pos] == '{' ? JSMN_OBJECT : JSMN_ARRAY, pos, -1) == NULL)
+            return 1;
+
+        if (scan->toksuper != -1)
+            scan->tok[scan->toksuper].size++;
+        scan->toksuper = scan->num_tokens - 1;
+        scan->open[scan->depth++] = scan->num_tokens - 1;
+        break;
+
+    case '}':
+    case ']': {
+        if (scan->depth == 0)
+            return 1;
+
+        jsmntok_t* t = &scan->tok[scan->open[scan->depth - 1]];
+        if (t->type != (js[pos] == '}' ? JSMN_OBJECT : JSMN_ARRAY))
+            return 1;
+
+        t->end = pos + 1;
+        scan->depth--;
+        scan->toksuper = scan->depth ? scan->open[scan->depth - 1] : -1;
+    } break;
+
+    case ':':
+        scan->toksuper = scan->num_tokens - 1;
+        break;
+
+    case ',':
+        if (scan->toksuper != -1 && scan->tok[scan->toksuper].type != JSMN_ARRAY &&
+            scan->tok[scan->toksuper].type != JSMN_OBJECT && scan->depth)
+            scan->toksuper = scan->open[scan->depth - 1];
+        break;
+
+    case '"':
+        if (opens_string) {
+            scan->string_start = pos;
+            break;
+        }
+
+        if (memchr(js + scan->string_start + 1, '\\', pos - scan->string_start - 1) &&
+            json_scan_check_escapes(scan, scan->string_start + 1, pos) != 0)
+            return 1;
+
+        if (json_scan_alloc_token(scan, JSMN_STRING, scan->string_start + 1, pos) == NULL)
+            return 1;
+        if (scan->toksuper != -1)
+            scan->tok[scan->toksuper].size++;
+        scan->string_start = -1;
+        break;
+
+    default: {
+        // primitive: ends where jsmn_parse_primitive ends it.  the masks
+        // took a quote or bracket inside it as structure, so leave those
+        // to jsmn along with the characters it rejects.
+        int end = pos;
+        for (; end < scan->len; end++) {
+            char c = js[end];
+            if (c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',' || c == ']' ||
+                c == '}' || c == ':')
+                break;
+            if (c == '"' || c == '{' || c == '[' || c < 32 || c >= 127)
+                return 1;
+        }
+
+        if (json_scan_alloc_token(scan, JSMN_PRIMITIVE, pos, end) == NULL)
+            return 1;
+        if (scan->toksuper != -1)
+            scan->tok[scan->toksuper].size++;
+    } break;
+    }
+
+    return 0;
+}
+
+static json_classify_func_t
+json_classifier(void)
+{
+    // selecting twice from racing threads is harmless
+    static json_classify_func_t selected = NULL;
+    json_classify_func_t        classify = JSON__LOAD_RELAXED(selected);
+    if (!classify) {
+        classify = json_select_classifier();
+        JSON__STORE_RELAXED(selected, classify);
+    }
+
+    return classify;
+}
+
+// the fast path: returns the token count, or -1 to hand the document
+// to jsmn
+static int
+json_scan_with(json_classify_func_t classify,
+               const char*          js,
+               size_t               len,
+               jsmntok_t*           tokens,
+               unsigned int         num_tokens)
+{
+    json_scan_t        scan;
+    json_block_masks_t masks;
+    unsigned char      tail[64];
+    uint64_t           escape_carry = 0, in_string_carry = 0, other_carry = 0;
+
+    // jsmn stops at the first null byte
+    const char* nul = (const char*)memchr(js, 0, len);
+    if (nul)
+        len = (size_t)(nul - js);
+    if (len > 0x7fffffff || num_tokens > 0x7fffffff)
+        return -1;
+
+    scan.js = js;
+    scan.len = (int)len;
+    scan.tok = tokens;
+    scan.max_tokens = (int)num_tokens;
+    scan.num_tokens = 0;
+    scan.toksuper = -1;
+    scan.depth = 0;
+    scan.string_start = -1;
+
+    for (int base = 0; base < scan.len; base += 64) {
+        const unsigned char* block = (const unsigned char*)js + base;
+        if (scan.len - base < 64) {
+            // pad with whitespace, which produces no events
+            memset(tail, ' ', sizeof(tail));
+            memcpy(tail, block, (size_t)(scan.len - base));
+            block = tail;
+        }
+
+        classify(block, &masks);
+
+        uint64_t quote = masks.quote & ~json_find_escaped(masks.backslash, &escape_carry);
+        uint64_t in_string = json_prefix_xor(quote) ^ in_string_carry;
+        in_string_carry = (uint64_t)((int64_t)in_string >> 63);
+
+        // bytes belonging to primitives, and the first byte of each run
+        uint64_t other = ~(masks.structural | masks.whitespace | quote | in_string);
+        uint64_t primitive_start = other & ~(other << 1 | other_carry);
+        other_carry = other >> 63;
+
+        uint64_t events = (masks.structural & ~in_string) | quote | primitive_start;
+        while (events) {
+            int bit = json_ctz64(events);
+            events &= events - 1;
+
+            if (json_scan_event(&scan, base + bit, (int)((in_string >> bit) & 1)) != 0)
+                return -1;
+        }
+    }
+
+    // unterminated string or unclosed object or array
+    if (scan.string_start != -1 || scan.depth != 0)
+        return -1;
+
+    return scan.num_tokens;
+}
+
+// drop-in replacement for jsmn_parse() on a fresh parser
+static int
+json_tokenize(const char* js, size_t len, jsmntok_t* tokens, unsigned int num_tokens)
+{
+    int result = -1;
+
+#ifndef JSON_USE_JSMN_TOKENIZER
+    result = json_scan_with(json_classifier(), js, len, tokens, num_tokens);
+#endif
+
+    if (result < 0) {
+        jsmn_parser parser;
+        jsmn_init(&parser);
+        result = jsmn_parse(&parser, js, len, tokens, num_tokens);
+    }
+
+    return result;
+}
+
+
+// parse num_palettes palettes starting at first_palette from ctx's tokens
+static int
+json_parse_document(json_context_t* ctx,
+                    pal_palette_t*  out_palettes,
+                    int             first_palette,
+                    int             num_palettes)
+{
+    // expect outer object
+    int i = 0;
+    if (json_match(ctx, JSMN_OBJECT, &i) != 0)
+        return 1;
+
+    // scan for 'palettes: [', setting i to the beginning of the palettes array
+    for (; i < ctx->num_tokens; i++) {
+        switch (ctx->tok[i].type) {
+        case JSMN_STRING:
+            if (jsoneq(ctx, i, "palettes") == 0) {
+                if (i < ctx->num_tokens - 1 && ctx->tok[i + 1].type == JSMN_ARRAY) {
+                    // found the palettes array
+                    // jump i ahead to the first palette object
+                    i += 2;
+                }
+            }
+            goto end_search;
+        default:;
+        }
+    }
+end_search:
+    if (i == ctx->num_tokens) {
+        JSON_ASSERT(!"json document didn't have any palettes");
+        return 1;
+    }
+
+    // FTG_ASSERT(tok[i].type == JSMN_OBJECT);
+    for (int current_palette = 0; current_palette != first_palette; current_palette++) {
+        json_skip(ctx, &i);
+    }
+
+    if (i == ctx->num_tokens) {
+        json_error(ctx, "out of tokens while parsing palette", i);
+        return 1;
+    }
+
+    for (int pal_index = 0; pal_index < num_palettes; pal_index++) {
+        pal_clear(&out_palettes[pal_index]);
+        json_name_index_clear(&ctx->names);
+        if (parse_palette_object(ctx, &i, &out_palettes[pal_index]) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+int
+parse_json_into_palettes(const char*    json_str,
+                         size_t         json_strlen,
+                         pal_palette_t* out_palettes,
+                         int            first_palette,
+                         int            num_palettes,
+
+                         char out_error_message[PAL_MAX_STRLEN],
+                         int* out_error_start)
+{
+    json_context_t ctx;
+    int            result;
+
+    // every token starts at a different byte, so the document bounds
+    // the token count
+    ctx.max_tokens = json_strlen < MAX_JSMN_TOKENS ? (int)json_strlen + 1 : MAX_JSMN_TOKENS;
+    ctx.tok = (jsmntok_t*)PAL_REALLOC(
+        NULL, (sizeof(jsmntok_t) + sizeof(int)) * (size_t)ctx.max_tokens);
+    if (!ctx.tok) {
+        json_strncpy(out_error_message, "out of memory", PAL_MAX_STRLEN);
+        *out_error_start = 0;
+        return 1;
+    }
+    ctx.next = (int*)(ctx.tok + ctx.max_tokens);
+
+    ctx.num_tokens = json_tokenize(json_str, json_strlen, ctx.tok, (unsigned int)ctx.max_tokens);
+    if (ctx.num_tokens < 0) {
+        // JSON_ASSERT(!"jsmn_parse failed with error");
+        PAL_FREE(ctx.tok);
+        return 1;
+    }
+    ctx.str = json_str;
+    json_build_skip_table(&ctx);
+    ctx.parse_error = out_error_message;
+    ctx.error_start = out_error_start;
+    json_name_index_init(&ctx.names);
+
+    result = json_parse_document(&ctx, out_palettes, first_palette, num_palettes);
+
+    json_name_index_free(&ctx.names);
+    PAL_FREE(ctx.tok);
+    return result;
+}
+
+
+//
+// Streaming parser
+//
+// Fills palettes straight from a byte stream that arrives in chunks
+// from a json_read_func_t.  Memory use is one JSON_STREAM_BUF_LEN read
+// buffer and the current token, regardless of document size or the
+// number of palettes, and palettes are parsed as soon as their bytes
+// arrive instead of after the whole document is tokenized.
+//
+// It accepts the same palette objects as the token parser above, with
+// the same truncation rules and error messages.  Unlike the token
+// parser, reading stops as soon as the requested palettes are parsed,
+// so anything after them is not validated.  Palettes before the first
+// one requested, and other members of the document, are skipped by
+// matching brackets outside strings rather than tokenizing them, so
+// they are only checked for balance.  The skip runs on the same block
+// classifier as the scanner; the palettes that are parsed are read a
+// token at a time.
+//
+
+#define JSON_STREAM_BUF_LEN 4096
+
+// longest string or primitive text kept from a token; longer strings
+// are truncated like any other string, longer primitives are an error
+#define JSON_STREAM_MAX_TOKEN 64
+
+typedef enum {
+    JSON_TOK_EOF,
+    JSON_TOK_OBJECT_START,
+    JSON_TOK_OBJECT_END,
+    JSON_TOK_ARRAY_START,
+    JSON_TOK_ARRAY_END,
+    JSON_TOK_COLON,
+    JSON_TOK_COMMA,
+    JSON_TOK_STRING,
+    JSON_TOK_PRIMITIVE,
+} json_tok_kind_t;
+
+typedef struct {
+    json_read_func_t read_func;
+    void*            read_data;
+
+    char    buf[JSON_STREAM_BUF_LEN];
+    int     buf_len;
+    int     buf_pos;
+    int64_t buf_offset;  // stream offset of buf[0]
+    int     at_eof;
+
+    // current token
+    json_tok_kind_t kind;
+    int64_t         start;                      // stream offset
+    int64_t         prev_end;                   // stream offset just past the previous token
+    int             len;                        // full length, excluding quotes
+    char            text[JSON_STREAM_MAX_TOKEN];  // null terminated, truncated
+
+    json_name_index_t    names;
+    json_classify_func_t classify;  // for skipping values
+
+    char*    parse_error;  // must point to string of PAL_MAX_STRLEN bytes
+    int64_t* error_start;
+} json_stream_t;
+
+static int
+jstream_error_at(json_stream_t* s, const char* error, int64_t start)
+{
+    json_strncpy(s->parse_error, error, PAL_MAX_STRLEN);
+    *s->error_start = start;
+    return 1;
+}
+
+static int
+jstream_error(json_stream_t* s, const char* error)
+{
+    return jstream_error_at(s, error, s->start);
+}
+
+// returns the next byte without consuming it, or -1 at end of input
+static int
+jstream_peek(json_stream_t* s)
+{
+    if (s->buf_pos == s->buf_len) {
+        if (s->at_eof)
+            return -1;
+
+        s->buf_offset += s->buf_len;
+        s->buf_pos = 0;
+        s->buf_len = s->read_func(s->read_data, s->buf, JSON_STREAM_BUF_LEN);
+        if (s->buf_len <= 0) {
+            // a read error is reported as a truncated document
+            s->buf_len = 0;
+            s->at_eof = 1;
+            return -1;
+        }
+    }
+
+    return (unsigned char)s->buf[s->buf_pos];
+}
+
+static int
+jstream_getc(json_stream_t* s)
+{
+    int c = jstream_peek(s);
+    if (c != -1)
+        s->buf_pos++;
+    return c;
+}
+
+static int64_t
+jstream_offset(const json_stream_t* s)
+{
+    return s->buf_offset + s->buf_pos;
+}
+
+static void
+jstream_append_text(json_stream_t* s, int c)
+{
+    if (s->len < JSON_STREAM_MAX_TOKEN - 1)
+        s->text[s->len] = (char)c;
+    s->len++;
+}
+
+// advance to the next token, returning nonzero on a lexical error
+static int
+jstream_next(json_stream_t* s)
+{
+    int c;
+
+    s->prev_end = jstream_offset(s);
+    do {
+        s->start = jstream_offset(s);
+        c = jstream_getc(s);
+    } while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+
+    s->len = 0;
+    s->text[0] = 0;
+
+    switch (c) {
+    case -1:
+        s->kind = JSON_TOK_EOF;
+        return 0;
+    case '{':
+        s->kind = JSON_TOK_OBJECT_START;
+        return 0;
+    case '}':
+        s->kind = JSON_TOK_OBJECT_END;
+        return 0;
+    case '[':
+        s->kind = JSON_TOK_ARRAY_START;
+        return 0;
+    case ']':
+        s->kind = JSON_TOK_ARRAY_END;
+        return 0;
+    case ':':
+        s->kind = JSON_TOK_COLON;
+        return 0;
+    case ',':
+        s->kind = JSON_TOK_COMMA;
+        return 0;
+
+    case '"':
+        // raw string contents, escapes are kept verbatim as jsmn does
+        s->kind = JSON_TOK_STRING;
+        s->start++;  // like jsmn, strings start after the quote
+        for (;;) {
+            c = jstream_getc(s);
+            if (c == -1)
+                return jstream_error(s, "unterminated string");
+            if (c == '"')
+                break;
+
+            jstream_append_text(s, c);
+            if (c == '\\') {
+                c = jstream_getc(s);
+                // strchr() would match the terminator, taking "\<nul>" as an escape
+                if (c <= 0 || strchr("\"/\\bfnrtu", c) == NULL)
+                    return jstream_error(s, "invalid escape in string");
+                jstream_append_text(s, c);
+            }
+        }
+        break;
+
+    default:
+        // primitive: number, boolean or null, ending at a delimiter
+        s->kind = JSON_TOK_PRIMITIVE;
+        for (;;) {
+            if (c < 32 || c >= 127)
+                return jstream_error(s, "invalid character in primitive");
+            jstream_append_text(s, c);
+
+            c = jstream_peek(s);
+            if (c == -1 || c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == ',' ||
+                c == ']' || c == '}' || c == ':')
+                break;
+            jstream_getc(s);
+        }
+
+        if (s->len >= JSON_STREAM_MAX_TOKEN)
+            return jstream_error(s, "primitive too long");
+        break;
+    }
+
+    s->text[s->len < JSON_STREAM_MAX_TOKEN ? s->len : JSON_STREAM_MAX_TOKEN - 1] = 0;
+    return 0;
+}
+
+static int
+jstream_expect(json_stream_t* s, json_tok_kind_t kind)
+{
+    if (s->kind == kind)
+        return 0;
+
+    return jstream_error(s, "token did not match expected type");
+}
+
+// consume the current token if it's of kind, otherwise set error
+static int
+jstream_match(json_stream_t* s, json_tok_kind_t kind)
+{
+    if (jstream_expect(s, kind) != 0)
+        return 1;
+    return jstream_next(s);
+}
+
+// step into the object or array at the current token.  *out_more is 0
+// if it was empty and has already been consumed.
+static int
+jstream_enter(json_stream_t* s, json_tok_kind_t open_kind, int* out_more)
+{
+    json_tok_kind_t close_kind =
+        open_kind == JSON_TOK_OBJECT_START ? JSON_TOK_OBJECT_END : JSON_TOK_ARRAY_END;
+
+    if (jstream_match(s, open_kind) != 0)
+        return 1;
+
+    *out_more = s->kind != close_kind;
+    if (!*out_more)
+        return jstream_next(s);
+
+    return 0;
+}
+
+// after a member or element, step past the separating comma, or past
+// the closing token, setting *out_more to 0
+static int
+jstream_continue(json_stream_t* s, json_tok_kind_t close_kind, int* out_more)
+{
+    if (s->kind == JSON_TOK_COMMA) {
+        *out_more = 1;
+        return jstream_next(s);
+    }
+
+    if (s->kind == close_kind) {
+        *out_more = 0;
+        return jstream_next(s);
+    }
+
+    return jstream_error(s, close_kind == JSON_TOK_OBJECT_END ? "expected ',' or '}'"
+                                                              : "expected ',' or ']'");
+}
+
+// copy the member key at the current token into key and step to its
+// value, recording where the key started for error reporting
+static int
+jstream_member(json_stream_t* s, char key[JSON_STREAM_MAX_TOKEN], int64_t* out_key_start)
+{
+    if (jstream_expect(s, JSON_TOK_STRING) != 0)
+        return 1;
+
+    memcpy(key, s->text, JSON_STREAM_MAX_TOKEN);
+    *out_key_start = s->start;
+
+    if (jstream_next(s) != 0)
+        return 1;
+    return jstream_match(s, JSON_TOK_COLON);
+}
+
+// bytes jstream_skip_container() stops at
+enum {
+    JSON_SKIP_BACKSLASH = 1,
+    JSON_SKIP_QUOTE,
+    JSON_SKIP_OPEN,
+    JSON_SKIP_CLOSE,
+};
+
+static const unsigned char JSON_SKIP_CLASS[256] = {
+    ['\\'] = JSON_SKIP_BACKSLASH,
+    ['"'] = JSON_SKIP_QUOTE,
+    ['{'] = JSON_SKIP_OPEN,
+    ['['] = JSON_SKIP_OPEN,
+    ['}'] = JSON_SKIP_CLOSE,
+    [']'] = JSON_SKIP_CLOSE,
+};
+
+// skip through a 64-byte block with the structural classifier, the
+// way json_scan_with() masks out strings.  returns the bytes consumed:
+// 64, or up to and including the bracket that closes the container.
+static int
+jstream_skip_block(json_classify_func_t classify,
+                   const unsigned char* block,
+                   int*                 depth,
+                   int*                 in_string,
+                   int*                 escaped)
+{
+    json_block_masks_t masks;
+    uint64_t           escape_carry = (uint64_t)*escaped;
+    uint64_t           in_string_carry = *in_string ? ~0ULL : 0;
+
+    classify(block, &masks);
+
+    uint64_t quote = masks.quote & ~json_find_escaped(masks.backslash, &escape_carry);
+    uint64_t string_mask = json_prefix_xor(quote) ^ in_string_carry;
+    uint64_t structural = masks.structural & ~string_mask;
+
+    // commas and colons are visited too, but are a few per block
+    while (structural) {
+        int bit = json_ctz64(structural);
+        structural &= structural - 1;
+
+        switch (block[bit]) {
+        case '{':
+        case '[':
+            (*depth)++;
+            break;
+        case '}':
+        case ']':
+            if (--*depth == 0)
+                return bit + 1;
+            break;
+        default:;
+        }
+    }
+
+    *escaped = (int)escape_carry;
+    *in_string = (int)(string_mask >> 63);
+    return 64;
+}
+
+// step past the rest of the object or array whose opening token was
+// just read, ending just past its closing bracket.  the bytes are not
+// tokenized: only quotes, backslashes and brackets are looked at, so
+// a skipped value is checked for balance and termination but not for
+// valid escapes or primitives.  whole blocks of the buffer go through
+// the classifier, and the bytes left over through a class table.
+static int
+jstream_skip_container(json_stream_t* s)
+{
+    int depth = 1, in_string = 0, escaped = 0;
+
+    while (depth > 0) {
+        if (jstream_peek(s) == -1) {
+            s->start = jstream_offset(s);
+            return jstream_error(s, "unexpected end of document");
+        }
+
+        const unsigned char* p = (const unsigned char*)s->buf + s->buf_pos;
+        const unsigned char* end = (const unsigned char*)s->buf + s->buf_len;
+
+        // a backslash ending the last buffer escapes this one's first byte
+        if (escaped) {
+            p++;
+            escaped = 0;
+        }
+
+        while (end - p >= 64 && depth > 0)
+            p += jstream_skip_block(s->classify, p, &depth, &in_string, &escaped);
+
+        // as does one ending the last block, if there are bytes left
+        if (escaped && p < end) {
+            p++;
+            escaped = 0;
+        }
+
+        for (; p < end && depth > 0; p++) {
+            switch (JSON_SKIP_CLASS[*p]) {
+            case 0:
+                continue;
+            case JSON_SKIP_BACKSLASH:
+                if (p + 1 == end)
+                    escaped = 1;
+                else
+                    p++;
+                continue;
+            case JSON_SKIP_QUOTE:
+                in_string = !in_string;
+                continue;
+            case JSON_SKIP_OPEN:
+                depth += !in_string;
+                continue;
+            case JSON_SKIP_CLOSE:
+                depth -= !in_string;
+                break;
+            }
+
+            if (depth == 0) {
+                p++;
+                break;
+            }
+        }
+        s->buf_pos = (int)(p - (const unsigned char*)s->buf);
+    }
+
+    return 0;
+}
+
+// consume any value, including nested objects and arrays
+static int
+jstream_skip_value(json_stream_t* s)
+{
+    switch (s->kind) {
+    case JSON_TOK_OBJECT_START:
+    case JSON_TOK_ARRAY_START:
+        if (jstream_skip_container(s) != 0)
+            return 1;
+        break;
+    case JSON_TOK_OBJECT_END:
+    case JSON_TOK_ARRAY_END:
+        return jstream_error(s, "unbalanced object or array");
+    case JSON_TOK_EOF:
+        return jstream_error(s, "unexpected end of document");
+    default:;
+    }
+
+    return jstream_next(s);
+}
+
+// copy a string value, silently truncating to max_value_len
+static int
+jstream_string_value(json_stream_t* s, char* out_value, int max_value_len)
+{
+    JSON_ASSERT(max_value_len <= JSON_STREAM_MAX_TOKEN);
+
+    if (s->kind != JSON_TOK_STRING)
+        return jstream_error(s, "expected string token type");
+
+    json_strncpy(out_value, s->text, max_value_len);
+    return jstream_next(s);
+}
+
+static int
+jstream_float_value(json_stream_t* s, float* out_float)
+{
+    if (s->kind != JSON_TOK_PRIMITIVE && s->kind != JSON_TOK_STRING)
+        return jstream_error(s, "expected string or primitive token type");
+
+    // hex float in string (preferred) or decimal float (discouraged).
+    // text is truncated past JSON_STREAM_MAX_TOKEN - 1, len is not.
+    if (s->len >= JSON_STREAM_MAX_TOKEN ||
+        json_decode_channel(s->text, s->len, s->kind == JSON_TOK_STRING, out_float) != 0)
+        return jstream_error(s, "invalid channel value");
+
+    return jstream_next(s);
+}
+
+// current token is a string naming a color in pal->color_names
+static int
+jstream_color_index_value(json_stream_t* s, const pal_palette_t* pal, int* out_index, const char* error)
+{
+    if (jstream_expect(s, JSON_TOK_STRING) != 0)
+        return 1;
+
+    if (json_palette_color_index(&s->names, pal, s->text, s->len, out_index) != 0)
+        return jstream_error(s, error);
+
+    return jstream_next(s);
+}
+
+static int
+jstream_parse_source(json_stream_t* s, pal_palette_t* pal)
+{
+    char    key[JSON_STREAM_MAX_TOKEN];
+    int64_t key_start;
+    int     more;
+
+    if (jstream_enter(s, JSON_TOK_OBJECT_START, &more) != 0)
+        return 1;
+
+    while (more) {
+        if (jstream_member(s, key, &key_start) != 0)
+            return 1;
+
+        int result;
+        if (strcmp(key, "conversion_tool") == 0) {
+            result = jstream_string_value(s, pal->source.conversion_tool, PAL_MAX_STRLEN);
+        } else if (strcmp(key, "url") == 0) {
+            result = jstream_string_value(s, pal->source.url, PAL_MAX_STRLEN);
+        } else if (strcmp(key, "conversion_date") == 0) {
+            // the one ull we have in this document is intentionally stored inside a string
+            if (s->kind != JSON_TOK_STRING)
+                return jstream_error(s, "expected primitive token type");
+            pal->source.conversion_timestamp = strtoull(s->text, NULL, 10);
+            result = jstream_next(s);
+        } else {
+            return jstream_error_at(s, "unexpected token", key_start);
+        }
+
+        if (result != 0 || jstream_continue(s, JSON_TOK_OBJECT_END, &more) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+jstream_parse_color_space(json_stream_t* s, pal_palette_t* pal)
+{
+    char    key[JSON_STREAM_MAX_TOKEN];
+    int64_t key_start;
+    int     more;
+
+    if (jstream_enter(s, JSON_TOK_OBJECT_START, &more) != 0)
+        return 1;
+
+    while (more) {
+        if (jstream_member(s, key, &key_start) != 0)
+            return 1;
+
+        int result;
+        if (strcmp(key, "name") == 0) {
+            result = jstream_string_value(s, pal->color_space.name, PAL_MAX_STRLEN);
+        } else if (strcmp(key, "icc_filename") == 0) {
+            result = jstream_string_value(s, pal->color_space.icc_filename, PAL_MAX_STRLEN);
+        } else if (strcmp(key, "is_linear") == 0) {
+            if (s->kind != JSON_TOK_PRIMITIVE)
+                return jstream_error(s, "expected boolean (primitive) type");
+
+            // only boolean in this whole parse
+            if (strcmp(s->text, "true") == 0) {
+                pal->color_space.is_linear = 1;
+            } else if (strcmp(s->text, "false") == 0) {
+                pal->color_space.is_linear = 0;
+            } else {
+                return jstream_error(s, "failed to parse is_linear as a boolean");
+            }
+            result = jstream_next(s);
+        } else {
+            return jstream_error_at(s, "unexpected token", key_start);
+        }
+
+        if (result != 0 || jstream_continue(s, JSON_TOK_OBJECT_END, &more) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+jstream_parse_color(json_stream_t* s, pal_palette_t* pal)
+{
+    char    key[JSON_STREAM_MAX_TOKEN];
+    int64_t key_start;
+    int     more;
+
+    if (pal->num_colors >= PAL_MAX_COLORS)
+        return jstream_error(s, "PAL_MAX_COLORS exceeded");
+    if (json_reserve(pal, pal->num_colors, 1) != 0)
+        return jstream_error(s, "out of memory");
+
+    pal_color_t* col = &pal->colors[pal->num_colors];
+    int64_t      color_start = s->start;
+    int          channel_set_count = 0;
+
+    pal->color_names[pal->num_colors][0] = 0;
+
+    if (jstream_enter(s, JSON_TOK_OBJECT_START, &more) != 0)
+        return 1;
+
+    while (more) {
+        if (jstream_member(s, key, &key_start) != 0)
+            return 1;
+
+        int result;
+        if (strcmp(key, "name") == 0) {
+            result = jstream_string_value(s, pal->color_names[pal->num_colors], PAL_MAX_STRLEN);
+        } else if (strcmp(key, "red") == 0) {
+            channel_set_count++;
+            result = jstream_float_value(s, &col->rgba.r);
+        } else if (strcmp(key, "green") == 0) {
+            channel_set_count++;
+            result = jstream_float_value(s, &col->rgba.g);
+        } else if (strcmp(key, "blue") == 0) {
+            channel_set_count++;
+            result = jstream_float_value(s, &col->rgba.b);
+        } else if (strcmp(key, "alpha") == 0) {
+            channel_set_count++;
+            result = jstream_float_value(s, &col->rgba.a);
+        } else {
+            return jstream_error_at(s, "unexpected token", key_start);
+        }
+
+        if (result != 0 || jstream_continue(s, JSON_TOK_OBJECT_END, &more) != 0)
+            return 1;
+    }
+
+    if (channel_set_count != 4)
+        return jstream_error_at(s, "color does not have 4 channels", color_start);
+
+    if (pal->color_names[pal->num_colors][0] == 0)
+        return jstream_error_at(s, "empty or no color name for color", color_start);
+
+    if (json_name_index_add(&s->names, pal, pal->num_colors) != 0)
+        return jstream_error_at(s, "out of memory", color_start);
+    pal->num_colors++;
+    return 0;
+}
+
+static int
+jstream_parse_colors(json_stream_t* s, pal_palette_t* pal)
+{
+    int more;
+
+    pal->num_colors = 0;
+    json_name_index_clear(&s->names);
+
+    if (jstream_enter(s, JSON_TOK_ARRAY_START, &more) != 0)
+        return 1;
+
+    while (more) {
+        if (s->kind != JSON_TOK_OBJECT_START)
+            return jstream_error(s, "invalid token type found in colors array");
+
+        if (jstream_parse_color(s, pal) != 0 ||
+            jstream_continue(s, JSON_TOK_ARRAY_END, &more) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+jstream_parse_hints(json_stream_t* s, pal_palette_t* pal)
+{
+    char    key[JSON_STREAM_MAX_TOKEN];
+    int64_t key_start;
+    int     more;
+
+    // initialize all hint kinds to zero colors
+    for (int j = 0; j < PAL_MAX_HINTS; j++) pal->num_hints[j] = 0;
+
+    if (jstream_enter(s, JSON_TOK_OBJECT_START, &more) != 0)
+        return 1;
+
+    while (more) {
+        if (jstream_member(s, key, &key_start) != 0)
+            return 1;
+
+        pal_hint_kind_t hint_kind;
+        if (pal_hint_for_string(key, (int)strlen(key), &hint_kind) != 0)
+            return jstream_error_at(s, "invalid hint kind in hints object", key_start);
+
+        // expect an array of color name strings
+        int more_colors;
+        if (jstream_enter(s, JSON_TOK_ARRAY_START, &more_colors) != 0)
+            return 1;
+
+        while (more_colors) {
+            if (pal->num_hints[hint_kind] >= PAL_MAX_COLORS)
+                return jstream_error(s, "PAL_MAX_COLORS exceeded for hint");
+            if (json_reserve(pal, pal->num_hints[hint_kind], 1) != 0)
+                return jstream_error(s, "out of memory");
+
+            int palette_color_index;
+            if (jstream_color_index_value(
+                    s, pal, &palette_color_index, "hint names a color not in colors array") != 0)
+                return 1;
+
+            pal->hint_colors[hint_kind][pal->num_hints[hint_kind]++] =
+                (pal_u16_t)palette_color_index;
+
+            if (jstream_continue(s, JSON_TOK_ARRAY_END, &more_colors) != 0)
+                return 1;
+        }
+
+        if (jstream_continue(s, JSON_TOK_OBJECT_END, &more) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+jstream_parse_gradients(json_stream_t* s, pal_palette_t* pal)
+{
+    char    key[JSON_STREAM_MAX_TOKEN];
+    int64_t key_start;
+    int     more;
+
+    pal->num_gradients = 0;
+
+    if (jstream_enter(s, JSON_TOK_OBJECT_START, &more) != 0)
+        return 1;
+
+    while (more) {
+        if (pal->num_gradients >= PAL_MAX_GRADIENTS)
+            return jstream_error(s, "PAL_MAX_GRADIENTS exceeded");
+
+        if (jstream_member(s, key, &key_start) != 0)
+            return 1;
+
+        pal_gradient_t* gradient = &pal->gradients[pal->num_gradients];
+        json_strncpy(pal->gradient_names[pal->num_gradients], key, PAL_MAX_STRLEN);
+        gradient->num_indices = 0;
+
+        int more_colors;
+        if (jstream_enter(s, JSON_TOK_ARRAY_START, &more_colors) != 0)
+            return 1;
+
+        while (more_colors) {
+            if (gradient->num_indices >= PAL_MAX_GRADIENT_INDICES)
+                return jstream_error(s, "PAL_MAX_GRADIENT_INDICES exceeded");
+            if (json_reserve(pal, gradient->num_indices, 2) != 0)
+                return jstream_error(s, "out of memory");
+
+            int palette_color_index;
+            if (jstream_color_index_value(s,
+                                          pal,
+                                          &palette_color_index,
+                                          "gradient names a color name not in colors array") != 0)
+                return 1;
+
+            gradient->indices[gradient->num_indices++] = (pal_u16_t)palette_color_index;
+
+            if (jstream_continue(s, JSON_TOK_ARRAY_END, &more_colors) != 0)
+                return 1;
+        }
+
+        pal->num_gradients++;
+
+        if (jstream_continue(s, JSON_TOK_OBJECT_END, &more) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+jstream_parse_dither_pairs(json_stream_t* s, pal_palette_t* pal)
+{
+    char    key[JSON_STREAM_MAX_TOKEN];
+    int64_t key_start;
+    int     more;
+
+    pal->num_dither_pairs = 0;
+
+    if (jstream_enter(s, JSON_TOK_OBJECT_START, &more) != 0)
+        return 1;
+
+    while (more) {
+        if (pal->num_dither_pairs >= PAL_MAX_DITHER_PAIRS)
+            return jstream_error(s, "PAL_MAX_DITHER_PAIRS exceeded");
+        if (json_reserve(pal, pal->num_dither_pairs, 2) != 0)
+            return jstream_error(s, "out of memory");
+
+        if (jstream_member(s, key, &key_start) != 0)
+            return 1;
+
+        json_strncpy(pal->dither_pair_names[pal->num_dither_pairs], key, PAL_MAX_STRLEN);
+
+        int64_t pair_start = s->start;
+        int pair[2];
+        int num_names = 0;
+        int more_colors;
+        if (jstream_enter(s, JSON_TOK_ARRAY_START, &more_colors) != 0)
+            return 1;
+
+        while (more_colors) {
+            if (num_names == 2)
+                break;
+
+            if (jstream_color_index_value(
+                    s, pal, &pair[num_names++], "dither pair unknown color name") != 0)
+                return 1;
+
+            if (jstream_continue(s, JSON_TOK_ARRAY_END, &more_colors) != 0)
+                return 1;
+        }
+
+        if (num_names != 2 || more_colors)
+            return jstream_error_at(
+                s, "dither pairs array expects exactly 2 color names", pair_start);
+
+        pal->dither_pairs[pal->num_dither_pairs].index0 = (pal_u16_t)pair[0];
+        pal->dither_pairs[pal->num_dither_pairs].index1 = (pal_u16_t)pair[1];
+        pal->num_dither_pairs++;
+
+        if (jstream_continue(s, JSON_TOK_OBJECT_END, &more) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+// parse the members of a palette object that has been entered, as
+// jstream_enter() left it
+static int
+jstream_parse_palette_members(json_stream_t* s, pal_palette_t* pal, int more)
+{
+    char    key[JSON_STREAM_MAX_TOKEN];
+    int64_t key_start;
+
+    while (more) {
+        if (jstream_member(s, key, &key_start) != 0)
+            return 1;
+
+        int result;
+        if (strcmp(key, "title") == 0) {
+            result = jstream_string_value(s, pal->title, PAL_MAX_STRLEN);
+        } else if (strcmp(key, "color_hash") == 0 || strcmp(key, "color_hash64") == 0) {
+            // acceptable key/value, but has no analog field
+            if (s->kind != JSON_TOK_STRING && s->kind != JSON_TOK_PRIMITIVE)
+                return jstream_error(s, "token did not match expected type");
+            result = jstream_next(s);
+        } else if (strcmp(key, "source") == 0) {
+            result = jstream_parse_source(s, pal);
+        } else if (strcmp(key, "color_space") == 0) {
+            result = jstream_parse_color_space(s, pal);
+        } else if (strcmp(key, "colors") == 0) {
+            result = jstream_parse_colors(s, pal);
+        } else if (strcmp(key, "hints") == 0) {
+            result = jstream_parse_hints(s, pal);
+        } else if (strcmp(key, "gradients") == 0) {
+            result = jstream_parse_gradients(s, pal);
+        } else if (strcmp(key, "dither_pairs") == 0) {
+            result = jstream_parse_dither_pairs(s, pal);
+        } else {
+            return jstream_error_at(s, "unexpected token", key_start);
+        }
+
+        if (result != 0 || jstream_continue(s, JSON_TOK_OBJECT_END, &more) != 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+jstream_parse_palette(json_stream_t* s, pal_palette_t* pal)
+{
+    int more;
+
+    if (jstream_enter(s, JSON_TOK_OBJECT_START, &more) != 0)
+        return 1;
+    return jstream_parse_palette_members(s, pal, more);
+}
+
+// skip the members of an object that has been entered, as
+// jstream_enter() left it
+static int
+jstream_skip_members(json_stream_t* s, int more)
+{
+    char    key[JSON_STREAM_MAX_TOKEN];
+    int64_t key_start;
+
+    while (more) {
+        if (jstream_member(s, key, &key_start) != 0 || jstream_skip_value(s) != 0 ||
+            jstream_continue(s, JSON_TOK_OBJECT_END, &more) != 0)
+            return 1;
+    }
+    return 0;
+}
+
+// which palettes jstream_parse_document() parses, and how far it got.
+// palette n is parsed into out_palettes[n] if advance_out is set, and
+// into out_palettes[0] otherwise, then handed to palette_func if set.
+typedef struct {
+    int                 first_palette;
+    int                 num_palettes;  // < 0 parses to the end
+    pal_palette_t*      out_palettes;
+    int                 advance_out;
+    json_palette_func_t palette_func;
+    void*               palette_data;
+
+    int palette_index;  // of the next palette object in the document
+    int num_parsed;
+    int stopped;  // palette_func returned nonzero
+} jstream_selection_t;
+
+static int
+jstream_selection_full(const jstream_selection_t* sel)
+{
+    return sel->num_palettes >= 0 && sel->num_parsed == sel->num_palettes;
+}
+
+// parse or skip the palette object starting at palette_start.  if
+// entered, jstream_enter() has already stepped into it, and more is
+// what it returned.
+static int
+jstream_select_palette(
+    json_stream_t* s, jstream_selection_t* sel, int64_t palette_start, int entered, int more)
+{
+    int index = sel->palette_index++;
+
+    if (index < sel->first_palette)
+        return entered ? jstream_skip_members(s, more) : jstream_skip_value(s);
+
+    pal_palette_t* pal = &sel->out_palettes[sel->advance_out ? sel->num_parsed : 0];
+
+    pal_clear(pal);
+    json_name_index_clear(&s->names);
+    int result = entered ? jstream_parse_palette_members(s, pal, more) : jstream_parse_palette(s, pal);
+    if (result != 0)
+        return 1;
+
+    if (sel->palette_func &&
+        sel->palette_func(pal, index, palette_start, s->prev_end, sel->palette_data) != 0)
+        sel->stopped = 1;
+    else
+        sel->num_parsed++;
+    return 0;
+}
+
+// palette keys that can't start a document, so an object that opens
+// with one is the first line of ndjson
+static int
+jstream_is_palette_key(const char* key)
+{
+    static const char* const keys[] = {"title",
+                                       "color_hash",
+                                       "color_hash64",
+                                       "source",
+                                       "color_space",
+                                       "colors",
+                                       "hints",
+                                       "gradients",
+                                       "dither_pairs"};
+
+    for (int i = 0; i < (int)(sizeof(keys) / sizeof(keys[0])); i++) {
+        if (strcmp(key, keys[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// ndjson: palette objects one after another, as the json writer's
+// PAL_JSON_LAYOUT_NDJSON emits them.  the first one has been entered.
+static int
+jstream_parse_ndjson(json_stream_t* s, jstream_selection_t* sel, int64_t first_start)
+{
+    int64_t palette_start = first_start;
+    int     entered = 1;
+
+    while (entered || s->kind != JSON_TOK_EOF) {
+        if (jstream_selection_full(sel))
+            return 0;  // done: don't read the rest of the stream
+
+        if (!entered && jstream_expect(s, JSON_TOK_OBJECT_START) != 0)
+            return 1;
+        if (jstream_select_palette(s, sel, palette_start, entered, 1) != 0)
+            return 1;
+        if (sel->stopped)
+            return 0;
+
+        entered = 0;
+        palette_start = s->start;
+    }
+
+    if (sel->num_palettes >= 0 && sel->num_parsed < sel->num_palettes)
+        return jstream_error(s, "out of palettes while parsing document");
+    return 0;
+}
+
+// parse palettes [first_palette, first_palette + num_palettes) from
+// the stream, which is a document with a "palettes" array or ndjson.
+// num_palettes < 0 parses to the end of the palettes.  see
+// jstream_selection_t for where they go.
+static int
+jstream_parse_document(json_stream_t*      s,
+                       int                 first_palette,
+                       int                 num_palettes,
+                       pal_palette_t*      out_palettes,
+                       int                 advance_out,
+                       json_palette_func_t palette_func,
+                       void*               palette_data)
+{
+    jstream_selection_t sel = {
+        first_palette, num_palettes, out_palettes, advance_out, palette_func, palette_data, 0, 0, 0};
+    char    key[JSON_STREAM_MAX_TOKEN];
+    int64_t key_start, document_start;
+    int     more;
+    int     found_palettes = 0;
+
+    if (jstream_next(s) != 0)
+        return 1;
+
+    // expect outer object
+    document_start = s->start;
+    if (jstream_enter(s, JSON_TOK_OBJECT_START, &more) != 0)
+        return 1;
+
+    if (more && s->kind == JSON_TOK_STRING && jstream_is_palette_key(s->text))
+        return jstream_parse_ndjson(s, &sel, document_start);
+
+    while (more) {
+        if (jstream_member(s, key, &key_start) != 0)
+            return 1;
+
+        if (strcmp(key, "palettes") != 0) {
+            if (jstream_skip_value(s) != 0)
+                return 1;
+        } else {
+            int more_palettes;
+
+            found_palettes = 1;
+
+            if (jstream_enter(s, JSON_TOK_ARRAY_START, &more_palettes) != 0)
+                return 1;
+
+            while (more_palettes) {
+                if (jstream_selection_full(&sel))
+                    return 0;  // done: don't read the rest of the stream
+
+                if (jstream_select_palette(s, &sel, s->start, 0, 0) != 0)
+                    return 1;
+                if (sel.stopped)
+                    return 0;
+
+                if (jstream_continue(s, JSON_TOK_ARRAY_END, &more_palettes) != 0)
+                    return 1;
+            }
+
+            if (num_palettes >= 0 && sel.num_parsed < num_palettes)
+                return jstream_error(s, "out of palettes while parsing document");
+        }
+
+        if (jstream_continue(s, JSON_TOK_OBJECT_END, &more) != 0)
+            return 1;
+    }
+
+    if (!found_palettes)
+        return jstream_error(s, "json document didn't have any palettes");
+
+    if (s->kind != JSON_TOK_EOF)
+        return jstream_error(s, "unexpected token after document");
+
+    return 0;
+}
+
+static void
+jstream_init(json_stream_t*   s,
+             json_read_func_t read_func,
+             void*            read_data,
+             char*            out_error_message,
+             int64_t*         out_error_start)
+{
+    s->read_func = read_func;
+    s->read_data = read_data;
+    s->buf_len = 0;
+    s->buf_pos = 0;
+    s->buf_offset = 0;
+    s->at_eof = 0;
+    s->parse_error = out_error_message;
+    s->error_start = out_error_start;
+    json_name_index_init(&s->names);
+    s->classify = json_classifier();
+}
+
+int
+parse_json_stream_into_palettes(json_read_func_t read_func,
+                                void*            read_data,
+                                pal_palette_t*   out_palettes,
+                                int              first_palette,
+                                int              num_palettes,
+
+                                char out_error_message[PAL_MAX_STRLEN],
+                                int64_t* out_error_start)
+{
+    json_stream_t s;
+    jstream_init(&s, read_func, read_data, out_error_message, out_error_start);
+
+    JSON_ASSERT(num_palettes >= 0);
+
+    int result = jstream_parse_document(
+        &s, first_palette, num_palettes, out_palettes, 1, NULL, NULL);
+    json_name_index_free(&s.names);
+    return result;
+}
+
+int
+parse_json_stream_palettes(json_read_func_t    read_func,
+                           void*               read_data,
+                           pal_palette_t*      scratch_palette,
+                           json_palette_func_t palette_func,
+                           void*               palette_data,
+
+                           char out_error_message[PAL_MAX_STRLEN],
+                           int64_t* out_error_start)
+{
+    json_stream_t s;
+    jstream_init(&s, read_func, read_data, out_error_message, out_error_start);
+
+    int result =
+        jstream_parse_document(&s, 0, -1, scratch_palette, 0, palette_func, palette_data);
+    json_name_index_free(&s.names);
+    return result;
+}
+
+
+//
+// Test suite
+//
+// To run tests:  include ftg_test.h and define FTGT_TESTS_ENABLED.
+// parse_json_decl_suite() should be called somewhere in the declaring
+// C file.  Then ftgt_run_all_tests(NULL).  Test documents are read from
+// PARSE_JSON_TEST_DATA_DIR.
+//
+#ifdef FTGT_TESTS_ENABLED
+
+#    ifndef PARSE_JSON_TEST_DATA_DIR
+#        define PARSE_JSON_TEST_DATA_DIR "test/data/"
+#    endif
+
+static jsmntok_t json__test_tok_jsmn[MAX_JSMN_TOKENS];
+static jsmntok_t json__test_tok_scan[MAX_JSMN_TOKENS];
+
+static int
+json__test_setup(void)
+{
+    return 0; /* setup success */
+}
+
+static int
+json__test_teardown(void)
+{
+    return 0;
+}
+
+// returns malloc'd document, or NULL
+static char*
+json__test_read_doc(const char* filename, size_t* out_len)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s%s", PARSE_JSON_TEST_DATA_DIR, filename);
+
+    FILE* fp = fopen(path, "rb");
+    if (!fp)
+        return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    char* doc = (char*)malloc((size_t)len + 1);
+    *out_len = fread(doc, 1, (size_t)len, fp);
+    doc[*out_len] = 0;
+    fclose(fp);
+
+    return doc;
+}
+
+// json_read_func_t over a document in memory, handing out at most
+// chunk_len bytes per read so tokens straddle reads
+typedef struct {
+    const char* bytes;
+    size_t      len;
+    size_t      pos;
+    int         chunk_len;
+} json__test_reader_t;
+
+static int
+json__test_read_chunk(void* read_data, char* buf, int buf_len)
+{
+    json__test_reader_t* reader = (json__test_reader_t*)read_data;
+    size_t               n = reader->len - reader->pos;
+
+    if (n > (size_t)buf_len)
+        n = (size_t)buf_len;
+    if (n > (size_t)reader->chunk_len)
+        n = (size_t)reader->chunk_len;
+
+    memcpy(buf, reader->bytes + reader->pos, n);
+    reader->pos += n;
+
+    return (int)n;
+}
+
+// the scanner must either defer to jsmn or agree with it exactly.
+// returns the scanner's result.
+static int
+json__test_scan_matches_jsmn(json_classify_func_t classify, const char* js, size_t len)
+{
+    jsmn_parser parser;
+    jsmn_init(&parser);
+    int expected = jsmn_parse(&parser, js, len, json__test_tok_jsmn, MAX_JSMN_TOKENS);
+
+    int result = json_scan_with(classify, js, len, json__test_tok_scan, MAX_JSMN_TOKENS);
+    if (result >= 0) {
+        FTGT_ASSERT(result == expected);
+        if (result == expected) {
+            for (int j = 0; j < result; j++) {
+                FTGT_ASSERT(json__test_tok_scan[j].type == json__test_tok_jsmn[j].type);
+                FTGT_ASSERT(json__test_tok_scan[j].start == json__test_tok_jsmn[j].start);
+                FTGT_ASSERT(json__test_tok_scan[j].end == json__test_tok_jsmn[j].end);
+                FTGT_ASSERT(json__test_tok_scan[j].size == json__test_tok_jsmn[j].size);
+            }
+        }
+    }
+
+    return result;
+}
+
+static int
+json__test_classifiers(json_classify_func_t out_classifiers[3])
+{
+    int n = 0;
+    out_classifiers[n++] = json_classify_scalar;
+#    if JSON__SSE2
+    out_classifiers[n++] = json_classify_sse2;
+#    endif
+#    if JSON__AVX2
+    if (json_cpu_has_avx2())
+        out_classifiers[n++] = json_classify_avx2;
+#    endif
+    return n;
+}
+
+static int
+json__test_scanner_matches_jsmn_on_test_data(void)
+{
+    const char* filenames[] = {
+        "copper-theme.json",
+        "doom.pal.json",
+        "stress-test-gradients.pal.json",
+        "sweet_sweet_canyon.json",
+    };
+
+    json_classify_func_t classifiers[3];
+    int                  num_classifiers = json__test_classifiers(classifiers);
+
+    for (int f = 0; f < (int)(sizeof(filenames) / sizeof(filenames[0])); f++) {
+        size_t len;
+        char*  doc = json__test_read_doc(filenames[f], &len);
+        FTGT_ASSERT(doc != NULL);
+        if (!doc)
+            continue;
+
+        for (int c = 0; c < num_classifiers; c++) {
+            // whole documents take the fast path
+            FTGT_ASSERT(json__test_scan_matches_jsmn(classifiers[c], doc, len) >= 0);
+
+            // truncated documents, every cut through the first kilobyte
+            for (size_t cut = 0; cut < len; cut += cut < 1024 ? 1 : 251)
+                json__test_scan_matches_jsmn(classifiers[c], doc, cut);
+        }
+
+        free(doc);
+    }
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+json__test_scanner_matches_jsmn_on_edge_cases(void)
+{
+    const char* docs[] = {
+        "{}",
+        "[]",
+        "  {\"a\" : [1, 2, {\"b\": null}], \"c\": true}  ",
+        "{\"escaped \\\" quote\": \"\\\\\", \"u\": \"\\u00e9\\uABCD\"}",
+        "{\"bad escape\": \"\\x\"}",
+        "{\"short unicode\": \"\\u12\"}",
+        "{\"backslashes\\\\\\\\\": \"\\\\\\\"\"}",
+        "{\"a\":1:2}",
+        "{\"a\"::}",
+        "[1,,2]",
+        "{\"a\":[1,2]:3}",
+        "[1}",
+        "]",
+        "{\"a\": tru\"e\"}",
+        "{\"a\": ab{}",
+        "\"top level string\" 12 -3.5e7",
+        "[\"unterminated",
+        "[\x01]",
+        "[\"\xc3\xa9\", \xc3\xa9]",
+        "{\"nul\":\"a\0b\"}",
+        "[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[[]]]]]]]]]]]"
+        "]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]]",
+    };
+
+    json_classify_func_t classifiers[3];
+    int                  num_classifiers = json__test_classifiers(classifiers);
+
+    for (int d = 0; d < (int)(sizeof(docs) / sizeof(docs[0])); d++) {
+        size_t len = strlen(docs[d]) + (d == 19 ? 4 : 0);  // keep the embedded nul
+
+        for (int c = 0; c < num_classifiers; c++) {
+            // every alignment against the 64-byte blocks
+            char buf[256];
+            for (int shift = 0; shift < 64; shift++) {
+                memset(buf, ' ', (size_t)shift);
+                memcpy(buf + shift, docs[d], len);
+                json__test_scan_matches_jsmn(classifiers[c], buf, len + (size_t)shift);
+            }
+        }
+    }
+
+    // random single-byte mutations of a real document
+    size_t len;
+    char*  doc = json__test_read_doc("sweet_sweet_canyon.json", &len);
+    FTGT_ASSERT(doc != NULL);
+    if (doc) {
+        const char replacements[] = "{}[]:,\"\\ \tax0-";
+        uint32_t   rng = 12345;
+
+        for (int trial = 0; trial < 2000; trial++) {
+            rng = rng * 1664525u + 1013904223u;
+            size_t pos = (rng >> 8) % len;
+            char   saved = doc[pos];
+
+            doc[pos] = replacements[(rng >> 4) % (sizeof(replacements) - 1)];
+            json__test_scan_matches_jsmn(
+                classifiers[trial % num_classifiers], doc, len);
+            doc[pos] = saved;
+        }
+        free(doc);
+    }
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+json__test_stream_rejects_nul_escape(void)
+{
+    // a backslash followed by a nul byte inside a title
+    const char doc[] = "{\"palettes\":[{\"title\":\"a\\\0b\",\"colors\":[]}]}";
+
+    json__test_reader_t reader = {doc, sizeof(doc) - 1, 0, 7};
+    pal_palette_t       pal = {0};
+    char                error_message[PAL_MAX_STRLEN] = {0};
+    int64_t             error_start = -1;
+
+    int result = parse_json_stream_into_palettes(
+        json__test_read_chunk, &reader, &pal, 0, 1, error_message, &error_start);
+    FTGT_ASSERT(result != 0);
+    FTGT_ASSERT(strcmp(error_message, "invalid escape in string") == 0);
+    FTGT_ASSERT(error_start == 23);  // just past the title's opening quote
+
+    pal_free(&pal);
+
+    return ftgt_test_errorlevel();
+}
+
+// the palette objects of a test document, without the
+// {"palettes":[ ]} around them
+static char*
+json__test_read_palette_objects(const char* filename, size_t* out_len)
+{
+    size_t len;
+    char*  doc = json__test_read_doc(filename, &len);
+    if (!doc)
+        return NULL;
+
+    char* open = strchr(doc, '[');
+    char* close = strrchr(doc, ']');
+    if (!open || !close || close < open) {
+        free(doc);
+        return NULL;
+    }
+
+    *out_len = (size_t)(close - open - 1);
+    memmove(doc, open + 1, *out_len);
+    doc[*out_len] = 0;
+
+    return doc;
+}
+
+static void
+json__test_check_palettes_match(const pal_palette_t* a, const pal_palette_t* b)
+{
+    FTGT_ASSERT(strcmp(a->title, b->title) == 0);
+    FTGT_ASSERT(a->num_colors == b->num_colors);
+    if (a->num_colors != b->num_colors)
+        return;
+
+    for (int j = 0; j < a->num_colors; j++) {
+        FTGT_ASSERT(memcmp(&a->colors[j], &b->colors[j], sizeof(pal_color_t)) == 0);
+        FTGT_ASSERT(strcmp(a->color_names[j], b->color_names[j]) == 0);
+    }
+    for (int h = 0; h < PAL_MAX_HINTS; h++) FTGT_ASSERT(a->num_hints[h] == b->num_hints[h]);
+    FTGT_ASSERT(a->num_gradients == b->num_gradients);
+    FTGT_ASSERT(a->num_dither_pairs == b->num_dither_pairs);
+}
+
+// selecting palette n from the stream, which skips the ones before
+// it, must give what the token parser gives
+static int
+json__test_stream_selects_palettes_like_token_parser(void)
+{
+    const char* filenames[] = {
+        "doom.pal.json",
+        "sweet_sweet_canyon.json",
+        "stress-test-gradients.pal.json",
+    };
+    // strings holding brackets, quotes and backslash runs to skip over,
+    // then colors named densely with escapes for blocks to end on
+    char tricky[2048];
+    int  tricky_len = sprintf(tricky,
+                             "{\"title\": \"} ] \\\" { [ \\\\\", \"colors\": [{\"name\": "
+                             "\"\\\\\\\"]\", \"red\": 0, \"green\": 0, \"blue\": 0, "
+                             "\"alpha\": 1}");
+    for (int c = 0; c < 8; c++) {
+        tricky_len += sprintf(tricky + tricky_len, ", {\"name\": \"");
+        for (int i = 0; i < 20; i++)
+            tricky_len +=
+                sprintf(tricky + tricky_len, "%s", (c + i) % 3 ? "\\\\\\\"" : "\\\\]");
+        tricky_len += sprintf(
+            tricky + tricky_len, "\", \"red\": 0, \"green\": 0, \"blue\": 0, \"alpha\": 1}");
+    }
+    sprintf(tricky + tricky_len, "]}");
+    const int  num_files = (int)(sizeof(filenames) / sizeof(filenames[0]));
+
+    // tricky, then each document's palettes, then tricky at every
+    // alignment to a block, then tricky again
+    const int num_padded = 64;
+    size_t    cap = 64 + (num_padded + 2) * (sizeof(tricky) + num_padded), len = 0;
+    char*     library = (char*)malloc(cap);
+    len += (size_t)sprintf(library, "{\"palettes\": [%s", tricky);
+    for (int f = 0; f < num_files; f++) {
+        size_t obj_len;
+        char*  obj = json__test_read_palette_objects(filenames[f], &obj_len);
+        FTGT_ASSERT(obj != NULL);
+        if (!obj)
+            continue;
+
+        cap += obj_len + 2;
+        library = (char*)realloc(library, cap);
+        library[len++] = ',';
+        memcpy(library + len, obj, obj_len);
+        len += obj_len;
+        free(obj);
+    }
+    for (int pad = 0; pad < num_padded; pad++)
+        len += (size_t)sprintf(library + len, ",%*s%s", pad, "", tricky);
+    len += (size_t)sprintf(library + len, ",%s]}", tricky);
+
+    const int num_palettes = num_files + num_padded + 2;
+    const int chunk_lens[] = {1, 61, 100, JSON_STREAM_BUF_LEN};
+
+    json_classify_func_t classifiers[3];
+    int                  num_classifiers = json__test_classifiers(classifiers);
+
+    for (int n = 0; n < num_palettes; n++) {
+        pal_palette_t expected = {0};
+        char          error_message[PAL_MAX_STRLEN] = {0};
+        int           error_start;
+
+        // the padded copies are covered by skipping them to the last
+        if (n > num_files + 1 && n < num_palettes - 1)
+            continue;
+
+        FTGT_ASSERT(parse_json_into_palettes(
+                        library, len, &expected, n, 1, error_message, &error_start) == 0);
+
+        for (int k = 0; k < num_classifiers; k++) {
+            for (int c = 0; c < (int)(sizeof(chunk_lens) / sizeof(chunk_lens[0])); c++) {
+                json__test_reader_t reader = {library, len, 0, chunk_lens[c]};
+                pal_palette_t       pal = {0};
+                int64_t             stream_error_start;
+                json_stream_t       stream;
+
+                jstream_init(&stream,
+                             json__test_read_chunk,
+                             &reader,
+                             error_message,
+                             &stream_error_start);
+                stream.classify = classifiers[k];
+
+                FTGT_ASSERT(jstream_parse_document(&stream, n, 1, &pal, 1, NULL, NULL) ==
+                            0);
+                json__test_check_palettes_match(&pal, &expected);
+                json_name_index_free(&stream.names);
+                pal_free(&pal);
+            }
+        }
+
+        pal_free(&expected);
+    }
+
+    // a cut anywhere in the skipped palettes runs out of document
+    for (size_t cut = 20; cut < len / 2; cut += 997) {
+        json__test_reader_t reader = {library, cut, 0, 61};
+        pal_palette_t       pal = {0};
+        char                error_message[PAL_MAX_STRLEN] = {0};
+        int64_t             error_start;
+
+        FTGT_ASSERT(parse_json_stream_into_palettes(json__test_read_chunk,
+                                                    &reader,
+                                                    &pal,
+                                                    num_palettes - 1,
+                                                    1,
+                                                    error_message,
+                                                    &error_start) != 0);
+        pal_free(&pal);
+    }
+
+    free(library);
+
+    return ftgt_test_errorlevel();
+}
+
+typedef struct {
+    const pal_palette_t* expected;
+    const char*          data;
+    int                  num_seen;
+} json__test_ndjson_t;
+
+static int
+json__test_check_ndjson_palette(const pal_palette_t* pal,
+                                int                  palette_index,
+                                int64_t              byte_start,
+                                int64_t              byte_end,
+                                void*                palette_data)
+{
+    json__test_ndjson_t* check = (json__test_ndjson_t*)palette_data;
+
+    FTGT_ASSERT(palette_index == check->num_seen);
+    json__test_check_palettes_match(pal, &check->expected[palette_index]);
+
+    // each palette is one line
+    FTGT_ASSERT(byte_start == 0 || check->data[byte_start - 1] == '\n');
+    FTGT_ASSERT(check->data[byte_start] == '{' && check->data[byte_end - 1] == '}');
+    FTGT_ASSERT(check->data[byte_end] == '\n');
+
+    check->num_seen++;
+    return 0;
+}
+
+// what the json writer emits as ndjson reads back through the stream
+// parser
+static int
+json__test_stream_reads_ndjson(void)
+{
+    const char* filenames[] = {
+        "doom.pal.json",
+        "sweet_sweet_canyon.json",
+        "stress-test-gradients.pal.json",
+    };
+    const int     num_files = (int)(sizeof(filenames) / sizeof(filenames[0]));
+    pal_palette_t expected[3];
+    pal_membuf_t  ndjson = {0};
+    pal_writer_t  writer;
+    char          error_message[PAL_MAX_STRLEN] = {0};
+    int64_t       error_start;
+
+    for (int f = 0; f < num_files; f++) {
+        size_t len;
+        char*  doc = json__test_read_doc(filenames[f], &len);
+        int    doc_error_start;
+        pal_init(&expected[f]);
+        FTGT_ASSERT(doc != NULL);
+        if (!doc)
+            return ftgt_test_errorlevel();
+
+        FTGT_ASSERT(parse_json_into_palettes(
+                        doc, len, &expected[f], 0, 1, error_message, &doc_error_start) == 0);
+        free(doc);
+    }
+
+    pal_writer_init(&writer, pal_write_to_membuf, &ndjson);
+    FTGT_ASSERT(pal_write_palette_json(&writer, expected, num_files, PAL_JSON_LAYOUT_NDJSON) == 0);
+
+    json__test_reader_t reader = {ndjson.data, (size_t)ndjson.len, 0, 61};
+    json__test_ndjson_t check = {expected, ndjson.data, 0};
+    pal_palette_t       pal = {0};
+
+    FTGT_ASSERT(parse_json_stream_palettes(json__test_read_chunk,
+                                           &reader,
+                                           &pal,
+                                           json__test_check_ndjson_palette,
+                                           &check,
+                                           error_message,
+                                           &error_start) == 0);
+    FTGT_ASSERT(check.num_seen == num_files);
+
+    // selecting skips the lines before, including the first
+    for (int n = 0; n < num_files; n++) {
+        reader.pos = 0;
+        FTGT_ASSERT(parse_json_stream_into_palettes(
+                        json__test_read_chunk, &reader, &pal, n, 1, error_message, &error_start) ==
+                    0);
+        json__test_check_palettes_match(&pal, &expected[n]);
+    }
+
+    // asking for more lines than there are runs out of document
+    reader.pos = 0;
+    FTGT_ASSERT(parse_json_stream_into_palettes(
+                    json__test_read_chunk, &reader, &pal, num_files, 1, error_message, &error_start) !=
+                0);
+    FTGT_ASSERT(strcmp(error_message, "out of palettes while parsing document") == 0);
+
+    // a line that isn't a palette object is an error
+    const char not_palette[] = "{\"title\": \"a\", \"colors\": []}\n[1]\n";
+    json__test_reader_t bad = {not_palette, sizeof(not_palette) - 1, 0, 7};
+    FTGT_ASSERT(parse_json_stream_palettes(json__test_read_chunk,
+                                           &bad,
+                                           &pal,
+                                           NULL,
+                                           NULL,
+                                           error_message,
+                                           &error_start) != 0);
+
+    pal_free(&pal);
+    pal_membuf_free(&ndjson);
+    for (int f = 0; f < num_files; f++) pal_free(&expected[f]);
+
+    return ftgt_test_errorlevel();
+}
+
+static uint32_t
+json__test_rand(uint32_t* state)
+{
+    // xorshift32
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static int
+json__test_hex_decoding_matches_libc(void)
+{
+    uint32_t rng = 0x9e3779b9u;
+    char     buf[16];
+    uint32_t bits;
+
+    for (int trial = 0; trial < 200000; trial++) {
+        uint32_t expected_bits = json__test_rand(&rng);
+        if (trial < 256)
+            expected_bits = (uint32_t)trial * 0x01010101u;  // repeated digits
+
+        int len = snprintf(buf, sizeof(buf), (trial & 1) ? "%08x" : "%08X", expected_bits);
+        FTGT_ASSERT(json_decode_hex32(buf, len, &bits) == 0);
+        FTGT_ASSERT(bits == (uint32_t)strtoul(buf, NULL, 16));
+
+        // shorter and 0x prefixed forms are accepted too
+        len = snprintf(buf, sizeof(buf), "0x%x", expected_bits >> (trial % 32));
+        FTGT_ASSERT(json_decode_hex32(buf, len, &bits) == 0);
+        FTGT_ASSERT(bits == (uint32_t)strtoul(buf, NULL, 16));
+    }
+
+    // any single bad character in an otherwise valid string is an error
+    const char bad_chars[] = "gG/:@`xX -.\x80\xff";
+    for (int pos = 0; pos < 8; pos++) {
+        for (int c = 0; c < (int)sizeof(bad_chars) - 1; c++) {
+            memcpy(buf, "3f800000", 9);
+            buf[pos] = bad_chars[c];
+            FTGT_ASSERT(json_decode_hex32(buf, 8, &bits) != 0);
+        }
+    }
+
+    FTGT_ASSERT(json_decode_hex32("", 0, &bits) != 0);
+    FTGT_ASSERT(json_decode_hex32("0x", 2, &bits) != 0);
+    FTGT_ASSERT(json_decode_hex32("3f8000000", 9, &bits) != 0);
+    FTGT_ASSERT(json_decode_hex32("-1", 2, &bits) != 0);
+
+    return ftgt_test_errorlevel();
+}
+
+// expect the same float bits as (float)strtod
+static void
+json__test_check_decimal(const char* str)
+{
+    float value, expected = (float)strtod(str, NULL);
+
+    FTGT_ASSERT(json_decode_decimal(str, (int)strlen(str), &value) == 0);
+    FTGT_ASSERT(memcmp(&value, &expected, sizeof(float)) == 0);
+}
+
+static int
+json__test_decimal_decoding_matches_libc(void)
+{
+    uint32_t rng = 0x2545f491u;
+    char     buf[64];
+
+    // values as they appear in palettes: n/256 and n/255 in every
+    // precision, plus random floats in and out of 0-1
+    for (int n = 0; n <= 256; n++) {
+        for (int precision = 1; precision <= 17; precision++) {
+            snprintf(buf, sizeof(buf), "%.*f", precision, n / 256.0);
+            json__test_check_decimal(buf);
+            snprintf(buf, sizeof(buf), "%.*f", precision, n / 255.0);
+            json__test_check_decimal(buf);
+        }
+    }
+
+    for (int trial = 0; trial < 200000; trial++) {
+        uint32_t r = json__test_rand(&rng);
+        float    f;
+
+        switch (trial % 4) {
+        case 0:
+            f = (float)r / 4294967296.0f;
+            snprintf(buf, sizeof(buf), "%.*g", 1 + (int)(r % 12), f);
+            break;
+        case 1:
+            // arbitrary float bits, skipping inf and nan
+            if ((r & 0x7f800000u) == 0x7f800000u)
+                r &= ~0x00800000u;
+            memcpy(&f, &r, sizeof(float));
+            snprintf(buf, sizeof(buf), "%.9g", f);
+            break;
+        case 2:
+            // long digit strings, often past the fast path's 19 digits
+            snprintf(buf,
+                     sizeof(buf),
+                     "%s0.%09u%09u%u",
+                     (r & 1) ? "-" : "",
+                     json__test_rand(&rng) % 1000000000u,
+                     json__test_rand(&rng) % 1000000000u,
+                     r % 1000u);
+            break;
+        default:
+            snprintf(buf,
+                     sizeof(buf),
+                     "%u.%ue%d",
+                     r % 100000u,
+                     json__test_rand(&rng) % 1000u,
+                     (int)(json__test_rand(&rng) % 61) - 30);
+            break;
+        }
+
+        json__test_check_decimal(buf);
+    }
+
+    const char* exact[] = {"0", "-0", "-0.0", "1", "1.0", "1e0", "1E+0", "0.5e1", "5e-1",
+                           "9007199254740993", "123456789012345678901234", "1e22", "1e23",
+                           "1e-22", "1e-23", "00001.5000", "3.4028235e38", "1e-50"};
+    for (int j = 0; j < (int)(sizeof(exact) / sizeof(exact[0])); j++)
+        json__test_check_decimal(exact[j]);
+
+    // strtod would stop early on all of these
+    const char* malformed[] = {"", "-", ".", "1.0abc", "true", "1e", "1e+", "--1", "0x"};
+    for (int j = 0; j < (int)(sizeof(malformed) / sizeof(malformed[0])); j++) {
+        float value;
+        FTGT_ASSERT(json_decode_decimal(malformed[j], (int)strlen(malformed[j]), &value) != 0);
+    }
+
+    return ftgt_test_errorlevel();
+}
+
+static int
+json__test_name_index_matches_whole_names(void)
+{
+    pal_palette_t     pal = {0};
+    json_name_index_t names;
+    char              long_name[PAL_MAX_STRLEN + 8];
+    int               index;
+
+    FTGT_ASSERT(pal_reserve(&pal, 2000) == 0);
+    json_name_index_init(&names);
+
+    // nothing to find before the first color
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "red", 3, &index) != 0);
+
+    snprintf(pal.color_names[0], PAL_MAX_STRLEN, "red");
+    snprintf(pal.color_names[1], PAL_MAX_STRLEN, "redder");
+    snprintf(pal.color_names[2], PAL_MAX_STRLEN, "red");  // duplicate, first one wins
+    memset(pal.color_names[3], 'x', PAL_MAX_STRLEN - 1);
+    pal.color_names[3][PAL_MAX_STRLEN - 1] = 0;
+    for (pal.num_colors = 0; pal.num_colors < 4; pal.num_colors++)
+        FTGT_ASSERT(json_name_index_add(&names, &pal, pal.num_colors) == 0);
+
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "red", 3, &index) == 0 && index == 0);
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "redder", 6, &index) == 0 && index == 1);
+
+    // a prefix or extension of a stored name is not that name
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "re", 2, &index) != 0);
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "redd", 4, &index) != 0);
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "reddest", 7, &index) != 0);
+
+    // references are truncated the way stored names are
+    memset(long_name, 'x', sizeof(long_name));
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, long_name, (int)sizeof(long_name), &index) ==
+                    0 &&
+                index == 3);
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, long_name, PAL_MAX_STRLEN - 2, &index) != 0);
+
+    // growing past the first allocation keeps every name findable
+    for (; pal.num_colors < 2000; pal.num_colors++) {
+        snprintf(pal.color_names[pal.num_colors], PAL_MAX_STRLEN, "%d", pal.num_colors);
+        FTGT_ASSERT(json_name_index_add(&names, &pal, pal.num_colors) == 0);
+    }
+    FTGT_ASSERT(names.num_slots >= 4000 && names.max_slots == names.num_slots);
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "1999", 4, &index) == 0 && index == 1999);
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "199", 3, &index) == 0 && index == 199);
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "red", 3, &index) == 0 && index == 0);
+
+    // clearing keeps the slots for the next palette
+    json_name_index_clear(&names);
+    FTGT_ASSERT(names.num_slots == 0 && names.slot != NULL && names.max_slots >= 4000);
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "red", 3, &index) != 0);
+    FTGT_ASSERT(json_name_index_add(&names, &pal, 0) == 0);
+    FTGT_ASSERT(names.num_slots == JSON_NAME_INDEX_MIN_SLOTS);
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "red", 3, &index) == 0 && index == 0);
+    FTGT_ASSERT(json_palette_color_index(&names, &pal, "redder", 6, &index) != 0);
+
+    json_name_index_free(&names);
+    pal_free(&pal);
+
+    return ftgt_test_errorlevel();
+}
+
+void
+parse_json_decl_suite(void)
+{
+    ftgt_suite_s* suite =
+        ftgt_create_suite(NULL, "parse_json", json__test_setup, json__test_teardown);
+    FTGT_ADD_TEST(suite, json__test_scanner_matches_jsmn_on_test_data);
+    FTGT_ADD_TEST(suite, json__test_scanner_matches_jsmn_on_edge_cases);
+    FTGT_ADD_TEST(suite, json__test_hex_decoding_matches_libc);
+    FTGT_ADD_TEST(suite, json__test_decimal_decoding_matches_libc);
+    FTGT_ADD_TEST(suite, json__test_stream_rejects_nul_escape);
+    FTGT_ADD_TEST(suite, json__test_stream_selects_palettes_like_token_parser);
+    FTGT_ADD_TEST(suite, json__test_stream_reads_ndjson);
+    FTGT_ADD_TEST(suite, json__test_name_index_matches_whole_names);
+}
+
+#endif /* FTGT_TESTS_ENABLED */
@@ -1,6 +1,9 @@
 #ifndef PARSE_JSON_H
 #define PARSE_JSON_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 #ifndef PAL__INCLUDE_PALETTE_H
 typedef struct pal_palette_s pal_palette_t;
 #endif
@@ -8,7 +11,8 @@ typedef struct pal_palette_s pal_palette_t;
 int parse_json_into_palettes(
     const char*    json_str,      // json input as null terminated string
     size_t         json_strlen,   // strlen(json_str)
-    pal_palette_t* out_palettes,  // pointer to pal_palette_t array
+    pal_palette_t* out_palettes,  // pointer to pal_palette_t array, each
+                                  // initialized; their storage is reused
 
     int first_palette,  // first palette in json_str to parse
     int num_palettes,   // how many to parse into out_palettes
@@ -17,4 +21,53 @@ int parse_json_into_palettes(
     int* out_error_start         // index into json_str where the error started
 );
 
+// streaming parse
+//
+// reads json in chunks through read_func instead of holding the whole
+// document and its tokens in memory.  besides a document with a
+// "palettes" array, it reads ndjson: one palette object per line, as
+// PAL_JSON_LAYOUT_NDJSON writes it.  error start is the byte offset
+// into the stream, 64 bits so documents past 2 GB report it exactly.
+
+// fill buf with up to buf_len bytes, returning how many were read.
+// return 0 at end of input, or <0 on a read error.
+typedef int (*json_read_func_t)(void* read_data, char* buf, int buf_len);
+
+// called for each palette as soon as it is parsed. byte_start and
+// byte_end are the stream offsets of the palette object's opening and
+// one past its closing brace. return nonzero to stop parsing without
+// error.
+typedef int (*json_palette_func_t)(const pal_palette_t* pal,
+                                   int                  palette_index,
+                                   int64_t              byte_start,
+                                   int64_t              byte_end,
+                                   void*                palette_data);
+
+int parse_json_stream_into_palettes(
+    json_read_func_t read_func,  // returns successive chunks of json input
+    void*            read_data,  // passed to read_func
+    pal_palette_t*   out_palettes,
+
+    int first_palette,  // first palette in the stream to parse
+    int num_palettes,   // how many to parse into out_palettes
+
+    char     out_error_message[48],  // if return !=0, this will contain the parse error
+    int64_t* out_error_start         // offset into the stream where the error started
+);
+
+// parse every palette in the stream into scratch_palette, calling
+// palette_func after each one
+int parse_json_stream_palettes(json_read_func_t    read_func,
+                               void*               read_data,
+                               pal_palette_t*      scratch_palette,
+                               json_palette_func_t palette_func,
+                               void*               palette_data,
+
+                               char     out_error_message[48],
+                               int64_t* out_error_start);
+
+#ifdef FTGT_TESTS_ENABLED
+void parse_json_decl_suite(void);
+#endif
+
 #endif
@@ -0,0 +1,118 @@
+/* palettetool Copyright (C) 2024-2025 Frogtoss Games, Inc. */
+
+/*
+   bench_emit: micro-benchmark for the json palette emitter.
+
+   Parses a palette document once, then re-emits it many times through
+   pal_write_palette_json into a memory sink, reporting time per emit
+   and throughput.
+
+   Given a thread count, each emit is instead a library of
+   LIBRARY_COPIES copies of the palette written through
+   pal_write_palette_json_parallel (0 threads for one per cpu).
+
+   Build and run from the repository root:
+
+     cc -O2 -std=gnu99 -Isrc tools/bench_emit.c -o bin/bench_emit -lm -lpthread
+     bin/bench_emit [test/data/doom.pal.json] [iterations] [threads]
+*/
+
+#define FTG_IMPLEMENT_PALETTE
+#define FTG_IMPLEMENT_CORE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "3rdparty/ftg_core.h"
+#include "3rdparty/ftg_palette.h"
+
+// single translation unit, no library to link
+#include "parse_json.c"
+
+#define LIBRARY_COPIES 256
+
+static double
+now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int
+main(int argc, char** argv)
+{
+    const char* path = argc > 1 ? argv[1] : "test/data/doom.pal.json";
+    int         iterations = argc > 2 ? atoi(argv[2]) : 20000;
+    int         threads = argc > 3 ? atoi(argv[3]) : -1;
+
+    ftg_off_t json_len;
+    char*     json = (char*)ftg_file_read(path, true, &json_len);
+    if (!json) {
+        fprintf(stderr, "could not read '%s'\n", path);
+        return 1;
+    }
+
+    static pal_palette_t palette;
+    char                 err[48];
+    int                  err_start;
+
+    if (parse_json_into_palettes(json, (size_t)json_len, &palette, 0, 1, err, &err_start) != 0) {
+        fprintf(stderr, "%s:%d: %s\n", path, err_start, err);
+        return 1;
+    }
+
+    const pal_palette_t* palettes = &palette;
+    pal_palette_t*       library = NULL;
+    int                  num_palettes = 1;
+
+    if (threads >= 0) {
+        // shallow copies share the parsed palette's storage, which is fine
+        // for read-only emits
+        library = (pal_palette_t*)FTG_MALLOC(sizeof(pal_palette_t), LIBRARY_COPIES);
+        for (int i = 0; i < LIBRARY_COPIES; i++) memcpy(&library[i], &palette, sizeof(palette));
+
+        palettes = library;
+        num_palettes = LIBRARY_COPIES;
+        iterations = (iterations + LIBRARY_COPIES - 1) / LIBRARY_COPIES;
+    }
+
+    pal_membuf_t membuf = {0};
+    pal_writer_t writer;
+
+    // warm up the sink so the timed loop doesn't measure reallocs
+    pal_writer_init(&writer, pal_write_to_membuf, &membuf);
+    pal_write_palette_json(&writer, palettes, num_palettes, PAL_JSON_LAYOUT_PRETTY);
+
+    double start = now_seconds();
+    for (int i = 0; i < iterations; i++) {
+        membuf.len = 0;
+        pal_writer_init(&writer, pal_write_to_membuf, &membuf);
+
+        int result = threads >= 0
+                         ? pal_write_palette_json_parallel(
+                               &writer, palettes, num_palettes, PAL_JSON_LAYOUT_PRETTY, threads)
+                         : pal_write_palette_json(
+                               &writer, palettes, num_palettes, PAL_JSON_LAYOUT_PRETTY);
+        if (result != 0) {
+            fprintf(stderr, "emit failed\n");
+            return 1;
+        }
+    }
+    double elapsed = now_seconds() - start;
+
+    double bytes = (double)membuf.len * iterations;
+    printf("%s: %d emits of %llu bytes\n", path, iterations, (unsigned long long)membuf.len);
+    printf("  %.2f us/emit, %.1f MB/s\n",
+           elapsed * 1e6 / iterations,
+           bytes / elapsed / (1024.0 * 1024.0));
+
+    pal_membuf_free(&membuf);
+    if (library)
+        FTG_FREE(library);
+    pal_free(&palette);
+    FTG_FREE(json);
+
+    return 0;
+}